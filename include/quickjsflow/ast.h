@@ -2,6 +2,10 @@
 #define QUICKJSFLOW_AST_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include "quickjsflow/lexer.h"
+#include "quickjsflow/atom.h"
+#include "quickjsflow/json_writer.h"
 
 typedef enum {
     // Phase 1: Essential Features
@@ -64,40 +68,61 @@ typedef enum {
     AST_Error
 } AstNodeType;
 
-typedef struct {
-    int line;
-    int column;
-} Position;
+// Byte offset into the parsed source. Line/column are resolved on demand
+// through the Program's LineIndex (see ast_position).
+typedef uint32_t SrcOffset;
+#define SRC_OFFSET_NONE UINT32_MAX // synthesized nodes, resolves to {0, 0}
 
 typedef struct AstNode AstNode;
+typedef struct AstArena AstArena;
 
 struct AstNode {
     AstNodeType type;
-    Position start;
-    Position end;
+    SrcOffset start;
+    SrcOffset end;
     int refcount; // reference count for structural sharing
     void *data; // type-specific payload
+    AstArena *arena; // arena holding the node and its payload, NULL if heap-allocated
 };
 
 typedef struct {
     AstNode **items;
     size_t count;
     size_t capacity;
+    AstArena *arena; // grows inside this arena when set
 } AstVec;
 
+// A syntax error found while parsing. kind is the message of the Error
+// node left in the tree (a static string); positions are source offsets.
+typedef struct {
+    const char *kind;
+    SrcOffset start;
+    SrcOffset end;
+} Diagnostic;
+
 typedef struct {
     AstVec body; // statements
     // captured comments in source order
     struct Comment **comments;
     size_t comment_count;
     size_t comment_capacity;
+    // syntax errors in source order, one per recovery from a bad region
+    Diagnostic *diagnostics;
+    size_t diagnostic_count;
+    size_t diagnostic_capacity;
+    LineIndex lines; // line starts of the parsed source, empty for synthesized programs
+    AstArena *arena; // arena the tree was built in, NULL for heap trees
+    int owns_arena;  // the arena is freed with this Program
+    int lazy_bodies; // may hold function bodies skipped by a lazy parse
+    size_t parsed_bytes; // arena size right after parse_program, 0 if not parsed from the lexer
+    int tangled;     // a syntax error made some statement's parse depend on the text around it
 } Program;
 
 typedef struct Comment {
     int is_block;    // 1 for block, 0 for line
     char *text;      // raw comment text without delimiters
-    Position start;  // start position in source
-    Position end;    // end position in source
+    SrcOffset start; // start offset in source
+    SrcOffset end;   // end offset in source
 } Comment;
 
 typedef enum { VD_Var = 1, VD_Let, VD_Const } VarKind;
@@ -114,6 +139,7 @@ typedef struct {
 
 typedef struct {
     char *name;
+    Atom atom; // id in the arena's atom table (name points into it), ATOM_NONE for heap nodes
 } Identifier;
 
 typedef enum { 
@@ -127,33 +153,71 @@ typedef enum {
 
 typedef struct {
     LiteralKind kind;
-    char *raw; // raw lexeme
+    char *raw;      // raw lexeme
+    double number;  // LIT_Number: value decoded by the lexer
+    char *bigint;   // LIT_Number with `n` suffix: exact decimal digits, else NULL
+    char *cooked;   // LIT_String: escape-decoded value (may hold NUL bytes), else NULL
+    size_t cooked_length;
 } Literal;
 
 typedef struct {
     AstNode *expression;
 } ExpressionStatement;
 
+// Operators of Update/Unary/Binary/AssignmentExpression, one id per
+// spelling (OP_MINUS is both binary and unary `-`).
+typedef enum {
+    OP_NONE = 0,
+    // binary, loosest first
+    OP_NULLISH, OP_OR, OP_AND, OP_PIPE, OP_CARET, OP_AMP,
+    OP_EQ, OP_NE, OP_STRICT_EQ, OP_STRICT_NE,
+    OP_LT, OP_GT, OP_LE, OP_GE, OP_IN, OP_INSTANCEOF,
+    OP_SHL, OP_SAR, OP_SHR,
+    OP_PLUS, OP_MINUS,
+    OP_STAR, OP_SLASH, OP_PERCENT, OP_STAR_STAR,
+    // prefix only
+    OP_BANG, OP_TILDE, OP_TYPEOF, OP_VOID, OP_DELETE,
+    OP_INC, OP_DEC,
+    // assignment
+    OP_ASSIGN, OP_PLUS_ASSIGN, OP_MINUS_ASSIGN, OP_STAR_ASSIGN, OP_SLASH_ASSIGN,
+    OP_PERCENT_ASSIGN, OP_STAR_STAR_ASSIGN, OP_SHL_ASSIGN, OP_SAR_ASSIGN,
+    OP_SHR_ASSIGN, OP_AMP_ASSIGN, OP_PIPE_ASSIGN, OP_CARET_ASSIGN,
+    OP_AND_ASSIGN, OP_OR_ASSIGN, OP_NULLISH_ASSIGN,
+    OP__COUNT
+} AstOperator;
+
+// AstOperatorInfo.flags
+#define OPF_RIGHT_ASSOC 0x01 // binary operator that groups right to left (**)
+#define OPF_PREFIX      0x02 // unary or update prefix operator
+#define OPF_UPDATE      0x04 // ++ / --
+#define OPF_ASSIGN      0x08
+
+typedef struct {
+    const char *text;   // spelling
+    uint8_t precedence; // binary operators: 1 (?? and ||) to 11 (**); else 0
+    uint8_t flags;      // OPF_*
+} AstOperatorInfo;
+
 typedef struct {
     int prefix;
-    char *operator; // "++" or "--"
+    AstOperator operator; // OP_INC or OP_DEC
     AstNode *argument; // Identifier
 } UpdateExpression;
 
 typedef struct {
-    char *operator; // "+" etc (limited for MVP)
+    AstOperator operator;
     AstNode *left;
     AstNode *right;
 } BinaryExpression;
 
 typedef struct {
-    char *operator; // "=" or "+=" etc
+    AstOperator operator; // OP_ASSIGN or a compound assignment
     AstNode *left;
     AstNode *right;
 } AssignmentExpression;
 
 typedef struct {
-    char *operator; // "-", "!", "typeof", etc.
+    AstOperator operator; // OP_MINUS, OP_BANG, OP_TYPEOF, etc.
     int prefix;      // 1 if prefix, 0 if postfix (rare)
     AstNode *argument;
 } UnaryExpression;
@@ -191,6 +255,12 @@ typedef struct {
 
 typedef struct {
     AstVec body; // statements
+    // Function body skipped by a lazy parse: the source its offsets index
+    // into, which must outlive the tree. body stays empty until
+    // ast_materialize_body() parses it; NULL for parsed blocks.
+    const char *lazy_source;
+    size_t lazy_length;
+    int lazy_async; // skipped body of an async arrow: `await` is an operator
 } BlockStatement;
 
 typedef struct {
@@ -296,8 +366,10 @@ typedef struct {
 } TemplateLiteral;
 
 typedef struct {
-    char *value;        // template string content
+    char *value;        // raw template text
     int tail;           // 1 if this is the tail element
+    char *cooked;       // escape-decoded text, NULL if an escape is malformed
+    size_t cooked_length;
 } TemplateElement;
 
 typedef struct {
@@ -382,69 +454,137 @@ void astvec_push(AstVec *v, AstNode *n);
 
 // comment helpers
 void commentvec_push(Program *p, Comment *c);
+void diagnostic_push(Program *p, const char *kind, SrcOffset s, SrcOffset e);
 Comment *comment_clone(const Comment *c);
 
+// Bump-pointer arena for parsed trees. While an arena is active on the
+// calling thread, the constructors below (and ast_clone) allocate nodes,
+// payloads, strings and vectors from it; nodes record their arena and are
+// never freed one by one. A Program with owns_arena set holds the creator's
+// reference: releasing it frees the arena in one step, unless ast_retain()
+// references to nodes inside are still outstanding.
+AstArena *ast_arena_new(void);
+// Arena for trees that are built and dropped as they go (recognizer
+// parses): while it is active strings are not copied, names not interned
+// and vectors stay empty, and ast_arena_rewind() gives its memory back.
+AstArena *ast_arena_new_scratch(void);
+void *ast_arena_alloc(AstArena *a, size_t size); // zeroed; NULL on failure
+// Position in a scratch arena; rewinding to it drops every block handed
+// out since, so no pointer into them may be used afterwards.
+typedef struct { void *slab; char *cur; size_t bytes; } AstArenaMark;
+AstArenaMark ast_arena_mark(const AstArena *a);
+void ast_arena_rewind(AstArena *a, AstArenaMark m);
+size_t ast_arena_bytes(const AstArena *a);       // bytes handed out so far
+int ast_arena_refs(const AstArena *a);           // 1 while only the owning Program holds it
+// Never reused, unlike the arena's address once it is freed; 0 for NULL.
+unsigned long long ast_arena_serial(const AstArena *a);
+// The Program a parse built in the arena, which takes the syntax errors of
+// bodies materialized later; NULL once that Program is released.
+void ast_arena_set_owner(AstArena *a, Program *owner);
+Program *ast_arena_owner(const AstArena *a);
+void ast_arena_free(AstArena *a);                // drop a reference
+AstArena *ast_arena_use(AstArena *a);            // make `a` active (NULL: heap); returns the previous one
+// Zeroed block / string copy from the active arena, or the heap if none.
+// ast_unalloc() gives back a block that was never attached to a node.
+void *ast_alloc(size_t size);
+void ast_unalloc(void *p);
+char *ast_strdup_n(const char *s, size_t len);
+// Names: with an arena active, the canonical copy from its atom table (and
+// its id in *atom, if non-NULL); otherwise a heap copy and ATOM_NONE. Interned strings belong to the arena and are never freed alone.
+char *ast_intern_n(const char *s, size_t len, Atom *atom);
+// The arena's atom table, created on first use; NULL on allocation failure.
+AtomTable *ast_arena_atoms(AstArena *a);
+// Replace a string field of an existing node: copy into the node's arena
+// (or the heap) and free an old value only if it is heap-owned.
+char *ast_node_strdup(const AstNode *owner, const char *s);
+void ast_node_free_string(const AstNode *owner, char *s);
+// Rename an Identifier, keeping name and atom in step.
+void ast_identifier_set_name(AstNode *id, const char *name);
+// Parse a function body left as a source range by a lazy parse (`n` is the
+// function, arrow or its BlockStatement) into the node's arena; functions
+// nested in it stay lazy. Consumers call this before walking a body, so it
+// may modify a tree they received as const. Its syntax errors join the
+// diagnostics of the Program that owns the arena, in source order, as a
+// full parse would have reported them. Returns 1 if a body was parsed
+// now, 0 if there was nothing to parse. Defined by the parser.
+int ast_materialize_body(AstNode *n);
+
+// Operator table lookups; out-of-range ids get the OP_NONE entry ("").
+const AstOperatorInfo *ast_operator_info(AstOperator op);
+const char *ast_operator_str(AstOperator op);
+// Id of an operator spelling, OP_NONE if there is none.
+AstOperator ast_operator_from_str(const char *s);
+
 // constructors
 AstNode *ast_program(void);
-AstNode *ast_identifier(const char *name, Position s, Position e);
-AstNode *ast_literal(LiteralKind kind, const char *raw, Position s, Position e);
+AstNode *ast_identifier(const char *name, SrcOffset s, SrcOffset e);
+AstNode *ast_literal(LiteralKind kind, const char *raw, SrcOffset s, SrcOffset e);
+// length-delimited variants for names/raw text borrowed from the source buffer
+AstNode *ast_identifier_n(const char *name, size_t len, SrcOffset s, SrcOffset e);
+AstNode *ast_literal_n(LiteralKind kind, const char *raw, size_t len, SrcOffset s, SrcOffset e);
 AstNode *ast_variable_declaration(VarKind kind);
 AstNode *ast_variable_declarator(AstNode *id, AstNode *init);
-AstNode *ast_expression_statement(AstNode *expr, Position s, Position e);
-AstNode *ast_update_expression(const char *op, int prefix, AstNode *arg, Position s, Position e);
-AstNode *ast_binary_expression(const char *op, AstNode *left, AstNode *right, Position s, Position e);
-AstNode *ast_assignment_expression(const char *op, AstNode *left, AstNode *right, Position s, Position e);
-AstNode *ast_unary_expression(const char *op, int prefix, AstNode *arg, Position s, Position e);
-AstNode *ast_object_expression(Position s, Position e);
+AstNode *ast_expression_statement(AstNode *expr, SrcOffset s, SrcOffset e);
+AstNode *ast_update_expression(AstOperator op, int prefix, AstNode *arg, SrcOffset s, SrcOffset e);
+AstNode *ast_binary_expression(AstOperator op, AstNode *left, AstNode *right, SrcOffset s, SrcOffset e);
+AstNode *ast_assignment_expression(AstOperator op, AstNode *left, AstNode *right, SrcOffset s, SrcOffset e);
+AstNode *ast_unary_expression(AstOperator op, int prefix, AstNode *arg, SrcOffset s, SrcOffset e);
+AstNode *ast_object_expression(SrcOffset s, SrcOffset e);
 AstNode *ast_property(AstNode *key, AstNode *value, int computed);
-AstNode *ast_array_expression(Position s, Position e);
-AstNode *ast_member_expression(AstNode *obj, AstNode *prop, int computed, Position s, Position e);
-AstNode *ast_call_expression(AstNode *callee, Position s, Position e);
-AstNode *ast_function_declaration(const char *name, Position s, Position e);
-AstNode *ast_function_expression(const char *name, Position s, Position e);
-AstNode *ast_block_statement(Position s, Position e);
-AstNode *ast_if_statement(AstNode *test, AstNode *cons, AstNode *alt, Position s, Position e);
-AstNode *ast_while_statement(AstNode *test, AstNode *body, Position s, Position e);
-AstNode *ast_do_while_statement(AstNode *body, AstNode *test, Position s, Position e);
-AstNode *ast_for_statement(AstNode *init, AstNode *test, AstNode *update, AstNode *body, Position s, Position e);
-AstNode *ast_switch_statement(AstNode *discriminant, Position s, Position e);
+AstNode *ast_array_expression(SrcOffset s, SrcOffset e);
+AstNode *ast_member_expression(AstNode *obj, AstNode *prop, int computed, SrcOffset s, SrcOffset e);
+AstNode *ast_call_expression(AstNode *callee, SrcOffset s, SrcOffset e);
+AstNode *ast_function_declaration(const char *name, SrcOffset s, SrcOffset e);
+AstNode *ast_function_expression(const char *name, SrcOffset s, SrcOffset e);
+AstNode *ast_block_statement(SrcOffset s, SrcOffset e);
+AstNode *ast_if_statement(AstNode *test, AstNode *cons, AstNode *alt, SrcOffset s, SrcOffset e);
+AstNode *ast_while_statement(AstNode *test, AstNode *body, SrcOffset s, SrcOffset e);
+AstNode *ast_do_while_statement(AstNode *body, AstNode *test, SrcOffset s, SrcOffset e);
+AstNode *ast_for_statement(AstNode *init, AstNode *test, AstNode *update, AstNode *body, SrcOffset s, SrcOffset e);
+AstNode *ast_switch_statement(AstNode *discriminant, SrcOffset s, SrcOffset e);
 AstNode *ast_switch_case(AstNode *test);
-AstNode *ast_try_statement(AstNode *block, Position s, Position e);
+AstNode *ast_try_statement(AstNode *block, SrcOffset s, SrcOffset e);
 AstNode *ast_catch_clause(AstNode *param, AstNode *body);
-AstNode *ast_throw_statement(AstNode *argument, Position s, Position e);
-AstNode *ast_return_statement(AstNode *argument, Position s, Position e);
-AstNode *ast_break_statement(Position s, Position e);
-AstNode *ast_continue_statement(Position s, Position e);
-AstNode *ast_import_declaration(const char *source, Position s, Position e);
+AstNode *ast_throw_statement(AstNode *argument, SrcOffset s, SrcOffset e);
+AstNode *ast_return_statement(AstNode *argument, SrcOffset s, SrcOffset e);
+AstNode *ast_break_statement(SrcOffset s, SrcOffset e);
+AstNode *ast_continue_statement(SrcOffset s, SrcOffset e);
+AstNode *ast_import_declaration(const char *source, SrcOffset s, SrcOffset e);
 AstNode *ast_import_specifier(AstNode *imported, AstNode *local);
-AstNode *ast_import_default_specifier(AstNode *local, Position s, Position e);
-AstNode *ast_import_namespace_specifier(AstNode *local, Position s, Position e);
-AstNode *ast_export_named_declaration(const char *source, Position s, Position e);
-AstNode *ast_export_default_declaration(Position s, Position e);
+AstNode *ast_import_default_specifier(AstNode *local, SrcOffset s, SrcOffset e);
+AstNode *ast_import_namespace_specifier(AstNode *local, SrcOffset s, SrcOffset e);
+AstNode *ast_export_named_declaration(const char *source, SrcOffset s, SrcOffset e);
+AstNode *ast_export_default_declaration(SrcOffset s, SrcOffset e);
 
 // Phase 2 constructors
-AstNode *ast_arrow_function_expression(int is_async, Position s, Position e);
-AstNode *ast_template_literal(Position s, Position e);
-AstNode *ast_template_element(const char *value, int tail, Position s, Position e);
-AstNode *ast_spread_element(AstNode *argument, Position s, Position e);
-AstNode *ast_object_pattern(Position s, Position e);
-AstNode *ast_array_pattern(Position s, Position e);
-AstNode *ast_assignment_pattern(AstNode *left, AstNode *right, Position s, Position e);
-AstNode *ast_rest_element(AstNode *argument, Position s, Position e);
-AstNode *ast_for_of_statement(AstNode *left, AstNode *right, AstNode *body, Position s, Position e);
-AstNode *ast_for_in_statement(AstNode *left, AstNode *right, AstNode *body, Position s, Position e);
-AstNode *ast_class_declaration(AstNode *id, AstNode *superClass, Position s, Position e);
-AstNode *ast_class_expression(AstNode *id, AstNode *superClass, Position s, Position e);
-AstNode *ast_method_definition(AstNode *key, AstNode *value, const char *kind, int is_static, Position s, Position e);
-AstNode *ast_await_expression(AstNode *argument, Position s, Position e);
-AstNode *ast_yield_expression(AstNode *argument, int delegate, Position s, Position e);
-AstNode *ast_super(Position s, Position e);
-AstNode *ast_this_expression(Position s, Position e);
+AstNode *ast_arrow_function_expression(int is_async, SrcOffset s, SrcOffset e);
+AstNode *ast_template_literal(SrcOffset s, SrcOffset e);
+AstNode *ast_template_element(const char *value, int tail, SrcOffset s, SrcOffset e);
+AstNode *ast_spread_element(AstNode *argument, SrcOffset s, SrcOffset e);
+AstNode *ast_object_pattern(SrcOffset s, SrcOffset e);
+AstNode *ast_array_pattern(SrcOffset s, SrcOffset e);
+AstNode *ast_assignment_pattern(AstNode *left, AstNode *right, SrcOffset s, SrcOffset e);
+AstNode *ast_rest_element(AstNode *argument, SrcOffset s, SrcOffset e);
+AstNode *ast_for_of_statement(AstNode *left, AstNode *right, AstNode *body, SrcOffset s, SrcOffset e);
+AstNode *ast_for_in_statement(AstNode *left, AstNode *right, AstNode *body, SrcOffset s, SrcOffset e);
+AstNode *ast_class_declaration(AstNode *id, AstNode *superClass, SrcOffset s, SrcOffset e);
+AstNode *ast_class_expression(AstNode *id, AstNode *superClass, SrcOffset s, SrcOffset e);
+AstNode *ast_method_definition(AstNode *key, AstNode *value, const char *kind, int is_static, SrcOffset s, SrcOffset e);
+AstNode *ast_await_expression(AstNode *argument, SrcOffset s, SrcOffset e);
+AstNode *ast_yield_expression(AstNode *argument, int delegate, SrcOffset s, SrcOffset e);
+AstNode *ast_super(SrcOffset s, SrcOffset e);
+AstNode *ast_this_expression(SrcOffset s, SrcOffset e);
 // Error node
-AstNode *ast_error(const char *msg, Position s, Position e);
+AstNode *ast_error(const char *msg, SrcOffset s, SrcOffset e);
+
 
+// Line/column of an offset in the source `program` (a Program node) was
+// parsed from; {0, 0} for SRC_OFFSET_NONE or when no line index is known.
+Position ast_position(const AstNode *program, SrcOffset offset);
 
-// JSON printer
+// JSON printer: the tree (ESTree-like, with line/column positions) as one
+// JSON value. ast_print_json() writes it and a newline to stdout.
+void ast_write_json(JsonWriter *w, const AstNode *node);
 void ast_print_json(const AstNode *node);
 void ast_free(AstNode *node);
 void ast_retain(AstNode *node);
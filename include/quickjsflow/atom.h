@@ -0,0 +1,29 @@
+#ifndef QUICKJSFLOW_ATOM_H
+#define QUICKJSFLOW_ATOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Interned names. An AtomTable maps each distinct string to a small
+// integer id once; phases that hold the same table compare ids instead of
+// strings and share one copy of every name. Interned strings never move or
+// change until the table is freed.
+typedef uint32_t Atom;
+#define ATOM_NONE 0 // no atom / not interned
+
+typedef struct AtomTable AtomTable;
+
+AtomTable *atom_table_new(void);
+void atom_table_free(AtomTable *t);
+// Id of s[0..len), adding it if new; ATOM_NONE on allocation failure.
+Atom atom_intern(AtomTable *t, const char *s, size_t len);
+// Id of s[0..len) if already interned, else ATOM_NONE.
+Atom atom_lookup(const AtomTable *t, const char *s, size_t len);
+// NUL-terminated text of an atom; NULL for ATOM_NONE or an unknown id.
+const char *atom_name(const AtomTable *t, Atom a);
+size_t atom_length(const AtomTable *t, Atom a);
+size_t atom_count(const AtomTable *t);
+// Bytes held by the table: hash slots, entries and string storage.
+size_t atom_table_bytes(const AtomTable *t);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef QUICKJSFLOW_CACHE_H
+#define QUICKJSFLOW_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "quickjsflow/compact.h"
+
+// Content-addressed parse cache: a directory of binary AST images (see
+// compact.h), one file per distinct (source bytes, parser version, parse
+// options), named by a 128-bit hash of all three. A hit maps the file, so
+// unchanged sources skip lexing and parsing. Entries are written to a
+// uniquely named temporary file and renamed into place, so concurrent runs
+// sharing a directory never see a partial entry; ones left behind by a run
+// that died are removed once stale. Past the size bound the least
+// recently used entries (by modification time, refreshed on every hit)
+// are removed.
+
+// Bump whenever the parser produces different trees for the same input,
+// so entries written by older builds stop matching.
+#define PARSE_CACHE_VERSION 2
+
+// Parse options that change the tree, part of every key.
+#define PARSE_CACHE_LAZY 0x1 // Parser.lazy_functions
+
+typedef struct {
+    char *dir;
+    uint64_t max_bytes; // bound on the entries' total size, 0 for none
+    uint64_t bytes;     // their total size as far as this handle knows
+    size_t hits;
+    size_t misses;
+    size_t stores;
+    size_t evictions;
+} ParseCache;
+
+// Use `dir` as a cache, creating it if needed. Returns 0 on success, -1 if
+// the directory cannot be created or read.
+int parse_cache_open(ParseCache *c, const char *dir, uint64_t max_bytes);
+void parse_cache_close(ParseCache *c);
+
+// The entry for src[0, len) parsed with `options`, mapped read-only; NULL
+// on a miss (including an unreadable or stale entry). Release it with
+// compact_free().
+CompactAst *parse_cache_get(ParseCache *c, const char *src, size_t len, unsigned options);
+// Store `ca` as the entry for src[0, len) and `options`, evicting old
+// entries past the size bound. Returns 0 on success, -1 on I/O failure.
+int parse_cache_put(ParseCache *c, const char *src, size_t len, unsigned options, const CompactAst *ca);
+
+// The compact tree of src[0, len): the cached entry on a hit, otherwise a
+// fresh parse, which is stored for next time. `c` may be NULL to parse
+// uncached. NULL on allocation failure. Release it with compact_free().
+CompactAst *parse_cached(ParseCache *c, const char *src, size_t len, unsigned options);
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef QUICKJSFLOW_COMPACT_H
+#define QUICKJSFLOW_COMPACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "quickjsflow/ast.h"
+
+// Compact, index-based AST storage. Every node is a fixed 24-byte record in
+// one contiguous array, addressed by 32-bit index and stored in pre-order
+// (a parent precedes its children, siblings are in source order). Payload
+// fields live inline in the record; child lists and overflow fields are
+// ranges into a shared `extra` array, and strings are byte offsets into one
+// NUL-separated pool that holds each distinct name once.
+// Positions stay SrcOffsets.
+//
+// Per-type layout of the a/b/c words (L = list ref, S = string ref,
+// X = index of overflow words in `extra`):
+//
+//   Program                  a=L body
+//   VariableDeclaration      kind=VarKind, a=L declarations
+//   VariableDeclarator       a=id b=init
+//   Identifier               a=S name
+//   Literal                  kind=LiteralKind, a=S raw b=S bigint
+//                            c=X {number lo, number hi, S cooked, cooked length}
+//   ExpressionStatement      a=expression
+//   UpdateExpression         kind=AstOperator, a=argument (COMPACT_PREFIX)
+//   Unary/Binary/Assignment  kind=AstOperator, a=left|argument b=right
+//   Property                 a=key b=value (COMPACT_COMPUTED)
+//   Object/ArrayExpression,
+//   Object/ArrayPattern,
+//   BlockStatement           a=L properties|elements|body (holes are COMPACT_NONE)
+//   MemberExpression         a=object b=property (COMPACT_COMPUTED)
+//   CallExpression           a=callee b=L arguments
+//   FunctionDeclaration/
+//   FunctionExpression       a=S name b=L params c=body
+//   IfStatement              a=test b=consequent c=alternate
+//   WhileStatement           a=test b=body
+//   DoWhileStatement         a=body b=test
+//   ForStatement             a=init b=test c=X {update, body}
+//   ForIn/ForOfStatement     a=left b=right c=body
+//   SwitchStatement          a=discriminant b=L cases
+//   SwitchCase               a=test b=L consequent
+//   TryStatement             a=block b=L handlers c=finalizer
+//   CatchClause              a=param b=body
+//   Throw/Return/Spread/
+//   Rest/Await/Yield         a=argument (COMPACT_DELEGATE for yield*)
+//   Break/ContinueStatement  a=S label
+//   ImportDeclaration        a=L specifiers b=S source
+//   ImportSpecifier          a=imported b=local
+//   Import*Specifier         a=local
+//   ExportNamedDeclaration   a=L specifiers b=S source c=declaration
+//   ExportDefaultDeclaration a=declaration b=expression
+//   ArrowFunctionExpression  a=L params b=body (COMPACT_ASYNC)
+//   TemplateLiteral          a=L quasis b=L expressions
+//   TemplateElement          a=S value b=S cooked c=cooked length (COMPACT_TAIL)
+//   AssignmentPattern        a=left b=right
+//   Class*                   a=id b=superClass c=L body
+//   MethodDefinition         a=key b=value c=X {S kind, L params} (COMPACT_STATIC)
+//   Error                    a=S message
+
+typedef uint32_t CompactId;
+#define COMPACT_NONE UINT32_MAX // absent child or string
+
+// CompactNode.flags
+#define COMPACT_COMPUTED 0x01
+#define COMPACT_PREFIX   0x02
+#define COMPACT_TAIL     0x04
+#define COMPACT_STATIC   0x08
+#define COMPACT_ASYNC    0x10
+#define COMPACT_DELEGATE 0x20
+
+typedef struct {
+    uint8_t type;  // AstNodeType
+    uint8_t flags; // COMPACT_* bits
+    uint16_t kind; // VarKind / LiteralKind / AstOperator, else 0
+    SrcOffset start;
+    SrcOffset end;
+    uint32_t a, b, c;
+} CompactNode;
+
+typedef struct {
+    int is_block;
+    uint32_t text; // string ref
+    SrcOffset start;
+    SrcOffset end;
+} CompactComment;
+
+typedef struct {
+    uint32_t kind; // string ref
+    SrcOffset start;
+    SrcOffset end;
+} CompactDiagnostic;
+
+typedef struct {
+    CompactNode *nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+    uint32_t *extra; // list ref n points at {count, items...}; ref 0 is the empty list
+    uint32_t extra_count;
+    uint32_t extra_capacity;
+    char *strings;
+    uint32_t string_bytes;
+    uint32_t string_capacity;
+    CompactComment *comments; // Program comments in source order
+    uint32_t comment_count;
+    CompactDiagnostic *diagnostics; // Program diagnostics in source order
+    uint32_t diagnostic_count;
+    LineIndex lines;          // line starts of the source, empty if unknown
+    CompactId root;
+    // Views of a binary image (compact_view, compact_load) point their
+    // arrays into it instead of owning them; `mapping` is the file mapping
+    // compact_free() unmaps, NULL for a caller's buffer.
+    int is_view;
+    void *mapping;
+    size_t mapping_size;
+} CompactAst;
+
+// Flatten a pointer tree (any node; a Program also brings its comments,
+// diagnostics and line index). Returns NULL on allocation failure or if the tree exceeds
+// 32-bit indexing.
+CompactAst *compact_from_ast(const AstNode *root);
+void compact_free(CompactAst *ca);
+// Bytes held by the node, extra, string, comment and diagnostic arrays.
+size_t compact_bytes(const CompactAst *ca);
+
+// Rebuild the subtree at `id` as a pointer tree in a fresh AstArena, for
+// code that takes AstNode pointers (codegen, CFG); this costs the full
+// pointer tree again. Scope analysis runs on the records themselves, see
+// scope_analyze_compact(). Release the result with ast_free(); a Program
+// result owns its arena and keeps comments, diagnostics and line index.
+AstNode *compact_to_ast(const CompactAst *ca, CompactId id);
+
+// Accessors. compact_node() is NULL and compact_type() 0 for an
+// out-of-range id; compact_string() is NULL for COMPACT_NONE.
+const CompactNode *compact_node(const CompactAst *ca, CompactId id);
+AstNodeType compact_type(const CompactAst *ca, CompactId id);
+const char *compact_string(const CompactAst *ca, uint32_t s);
+// Items of list ref `l`; *count receives the length.
+const CompactId *compact_list(const CompactAst *ca, uint32_t l, uint32_t *count);
+// Decoded value of a number Literal.
+double compact_number(const CompactAst *ca, CompactId id);
+
+// Binary images: the arrays of a CompactAst one after another behind a
+// small versioned header, each section 8-byte aligned: node records, extra
+// words, the string pool (every distinct name once), comments, diagnostics
+// and line starts. Positions stay byte offsets. A reader maps the image and uses it in
+// place, so loading costs one validation pass over the records and no
+// per-node allocation. Images are in the writer's byte order and struct
+// layout; a reader on a different platform rejects them and must reparse.
+
+#define COMPACT_IMAGE_VERSION 2
+
+// Bytes of the binary image of `ca`.
+size_t compact_image_size(const CompactAst *ca);
+// Write the image to out[0, compact_image_size(ca)).
+void compact_write_image(const CompactAst *ca, void *out);
+// Write the image to `path`, or to `f` at its current position (which
+// should be 8-byte aligned for the image to be viewed in place). Return 0
+// on success, -1 on I/O failure.
+int compact_save(const CompactAst *ca, const char *path);
+int compact_write_stream(const CompactAst *ca, FILE *f);
+
+// View of the image in data[0, size), which must be 8-byte aligned and
+// outlive the view. Every reference is bounds-checked first, so a corrupt
+// or foreign image gives NULL instead of a view whose accessors or
+// expansion read out of range; what kind of node sits where is trusted.
+CompactAst *compact_view(const void *data, size_t size);
+// Map `path` read-only and view it; compact_free() unmaps it. NULL if the
+// file cannot be mapped or is not a valid image.
+CompactAst *compact_load(const char *path);
+
+// Present children of `id` in source order; writes up to `cap` of them to
+// `out` and returns the total, so a first call with cap 0 sizes the buffer.
+size_t compact_children(const CompactAst *ca, CompactId id, CompactId *out, size_t cap);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef QUICKJSFLOW_JSON_WRITER_H
+#define QUICKJSFLOW_JSON_WRITER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Buffered writer behind every JSON dump (ast_print_json, scope_dump_json,
+// `quickjsflow lex`). Output collects in one large buffer and goes to a
+// FILE*, a file descriptor or stays in memory; nothing is formatted through
+// stdio. After a failed write or allocation the writer drops further output
+// and json_writer_flush() / json_writer_close() report -1.
+
+#define JSON_WRITER_BUFFER (256u << 10) // bytes collected before a FILE*/fd write
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    FILE *file; // sink of a file writer
+    int fd;     // sink of an fd writer, -1 otherwise
+    int failed;
+} JsonWriter;
+
+// Each returns 0, or -1 if the buffer cannot be allocated (the writer is
+// then failed but still safe to use and close).
+int json_writer_init_file(JsonWriter *w, FILE *f);
+int json_writer_init_fd(JsonWriter *w, int fd);
+int json_writer_init_memory(JsonWriter *w);
+
+// Hand what is buffered to the FILE* (without fflush) or fd. A no-op for
+// memory writers. Returns -1 if any write so far failed.
+int json_writer_flush(JsonWriter *w);
+// Flush and release the buffer; the output of a memory writer is dropped.
+int json_writer_close(JsonWriter *w);
+// Output of a memory writer, NUL terminated, and its length in *len (may
+// be NULL). The caller frees it; the writer starts over empty. NULL if the
+// writer failed.
+char *json_writer_take(JsonWriter *w, size_t *len);
+
+void json_raw(JsonWriter *w, const char *s, size_t n);
+// A string literal, its length known at compile time.
+#define json_lit(w, s) json_raw((w), "" s, sizeof(s) - 1)
+void json_char(JsonWriter *w, char c);
+// s[0, n) as the inside of a JSON string: '"', '\\' and control bytes are
+// escaped, everything else (including UTF-8) is copied.
+void json_escaped(JsonWriter *w, const char *s, size_t n);
+// Quoted and escaped; null for NULL.
+void json_string(JsonWriter *w, const char *s);
+void json_int(JsonWriter *w, long long v);
+void json_uint(JsonWriter *w, unsigned long long v);
+void json_bool(JsonWriter *w, int b);
+
+#endif
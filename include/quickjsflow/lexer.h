@@ -2,40 +2,290 @@
 #define QUICKJSFLOW_LEXER_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 typedef enum {
     TOKEN_EOF = 0,
     TOKEN_IDENTIFIER,
     TOKEN_NUMBER,
     TOKEN_STRING,
-    TOKEN_TEMPLATE,
+    TOKEN_TEMPLATE,         // `text` without substitutions
+    TOKEN_TEMPLATE_HEAD,    // `text${
+    TOKEN_TEMPLATE_MIDDLE,  // }text${
+    TOKEN_TEMPLATE_TAIL,    // }text`
     TOKEN_PUNCTUATOR,
     TOKEN_COMMENT_LINE,
     TOKEN_COMMENT_BLOCK,
     TOKEN_ERROR
 } TokenType;
 
+// Identifiers that spell a keyword carry its id; the token type stays
+// TOKEN_IDENTIFIER since most of these are contextual.
+typedef enum {
+    KW_NONE = 0,
+    // reserved words
+    KW_AWAIT, KW_BREAK, KW_CASE, KW_CATCH, KW_CLASS, KW_CONST, KW_CONTINUE, KW_DEBUGGER,
+    KW_DEFAULT, KW_DELETE, KW_DO, KW_ELSE, KW_ENUM, KW_EXPORT, KW_EXTENDS, KW_FALSE,
+    KW_FINALLY, KW_FOR, KW_FUNCTION, KW_IF, KW_IMPORT, KW_IN, KW_INSTANCEOF, KW_NEW,
+    KW_NULL, KW_RETURN, KW_SUPER, KW_SWITCH, KW_THIS, KW_THROW, KW_TRUE, KW_TRY,
+    KW_TYPEOF, KW_VAR, KW_VOID, KW_WHILE, KW_WITH, KW_YIELD,
+    // contextual words the parser treats specially
+    KW_AS, KW_ASYNC, KW_FROM, KW_GET, KW_LET, KW_OF, KW_SET, KW_STATIC, KW_UNDEFINED,
+    KW__COUNT
+} KeywordId;
+
+typedef enum {
+    PUNCT_NONE = 0,
+    PUNCT_LBRACE,            // {
+    PUNCT_RBRACE,            // }
+    PUNCT_LPAREN,            // (
+    PUNCT_RPAREN,            // )
+    PUNCT_LBRACKET,          // [
+    PUNCT_RBRACKET,          // ]
+    PUNCT_DOT,               // .
+    PUNCT_ELLIPSIS,          // ...
+    PUNCT_SEMICOLON,         // ;
+    PUNCT_COMMA,             // ,
+    PUNCT_COLON,             // :
+    PUNCT_QUESTION,          // ?
+    PUNCT_OPTIONAL_CHAIN,    // ?.
+    PUNCT_ARROW,             // =>
+    PUNCT_LT,                // <
+    PUNCT_GT,                // >
+    PUNCT_LE,                // <=
+    PUNCT_GE,                // >=
+    PUNCT_EQ,                // ==
+    PUNCT_NE,                // !=
+    PUNCT_STRICT_EQ,         // ===
+    PUNCT_STRICT_NE,         // !==
+    PUNCT_PLUS,              // +
+    PUNCT_MINUS,             // -
+    PUNCT_STAR,              // *
+    PUNCT_SLASH,             // /
+    PUNCT_PERCENT,           // %
+    PUNCT_STAR_STAR,         // **
+    PUNCT_INC,               // ++
+    PUNCT_DEC,               // --
+    PUNCT_SHL,               // <<
+    PUNCT_SAR,               // >>
+    PUNCT_SHR,               // >>>
+    PUNCT_AMP,               // &
+    PUNCT_PIPE,              // |
+    PUNCT_CARET,             // ^
+    PUNCT_BANG,              // !
+    PUNCT_TILDE,             // ~
+    PUNCT_AND,               // &&
+    PUNCT_OR,                // ||
+    PUNCT_NULLISH,           // ??
+    PUNCT_ASSIGN,            // =
+    PUNCT_PLUS_ASSIGN,       // +=
+    PUNCT_MINUS_ASSIGN,      // -=
+    PUNCT_STAR_ASSIGN,       // *=
+    PUNCT_SLASH_ASSIGN,      // /=
+    PUNCT_PERCENT_ASSIGN,    // %=
+    PUNCT_STAR_STAR_ASSIGN,  // **=
+    PUNCT_SHL_ASSIGN,        // <<=
+    PUNCT_SAR_ASSIGN,        // >>=
+    PUNCT_SHR_ASSIGN,        // >>>=
+    PUNCT_AMP_ASSIGN,        // &=
+    PUNCT_PIPE_ASSIGN,       // |=
+    PUNCT_CARET_ASSIGN,      // ^=
+    PUNCT_AND_ASSIGN,        // &&=
+    PUNCT_OR_ASSIGN,         // ||=
+    PUNCT_NULLISH_ASSIGN,    // ??=
+    PUNCT__COUNT
+} PunctId;
+
 typedef struct {
     TokenType type;
-    int start_line;
-    int start_col;
-    int end_line;
-    int end_col;
-    char *lexeme;
+    size_t offset;  // byte offset of the lexeme in Lexer.input
+    size_t length;  // byte length of the lexeme
+    KeywordId kw;   // TOKEN_IDENTIFIER only, KW_NONE otherwise
+    PunctId punct;  // TOKEN_PUNCTUATOR only, PUNCT_NONE otherwise
     int error;
     const char *error_kind;
+    double number;  // TOKEN_NUMBER: decoded value (nearest double for BigInts)
+    int bigint;     // TOKEN_NUMBER: has the BigInt `n` suffix
+    int escaped;    // strings, template chunks and identifiers: has a backslash escape
 } Token;
 
+#define LEXER_MAX_TEMPLATE_DEPTH 32
+
 typedef struct {
     const char *input;
     size_t length;
     size_t pos;
-    int line;
-    int col;
+    // Open `${` substitutions, innermost last, each with the count of `{`
+    // still open inside it. Tokens lexed with a non-empty stack depend on
+    // what came before, so resumable paths only restart where it is empty.
+    int tmpl_depth;
+    unsigned tmpl_braces[LEXER_MAX_TEMPLATE_DEPTH];
 } Lexer;
 
 void lexer_init(Lexer *lx, const char *input, size_t length);
 Token lexer_next(Lexer *lx);
-void token_free(Token *tok);
+
+// Whitespace, comment and string/template bodies are skipped with vector
+// kernels picked at first use: "avx2", "sse2" or "scalar".
+const char *lexer_scan_backend(void);
+// Force a backend by name (NULL restores auto-detection). Returns -1 if the
+// CPU does not support it.
+int lexer_set_scan_backend(const char *name);
+// First index in [i, n) of a byte a JSON string must escape (below 0x20,
+// '"', '\\' or DEL), or n; runs on the backend above.
+size_t lexer_scan_json_escape(const char *s, size_t i, size_t n);
+
+// Token flags stored in TokenBuffer.flags
+enum {
+    TOKF_ERROR = 1,          // lexer error token, kind kept in TokenBuffer.errors
+    TOKF_NEWLINE_BEFORE = 2, // a line break precedes the token
+    TOKF_ESCAPED = 4,        // Token.escaped
+    TOKF_IN_TEMPLATE = 8     // lexed inside a template substitution
+};
+
+typedef struct {
+    uint32_t index;
+    const char *kind;
+} TokenError;
+
+// Structure-of-arrays token stream filled by lexer_tokenize_all(): one
+// contiguous column per field, indexed by token number. The last token is
+// always TOKEN_EOF. Offsets and lengths are 32-bit, so inputs are limited
+// to 4 GiB.
+typedef struct {
+    uint8_t *types;     // TokenType
+    uint8_t *ids;       // KeywordId or PunctId by type; 1 for BigInt numbers
+    uint8_t *flags;     // TOKF_*
+    uint32_t *offsets;
+    uint32_t *lengths;
+    size_t count;
+    size_t capacity;
+    TokenError *errors; // sparse, in token order
+    size_t error_count;
+    size_t error_capacity;
+    const char *input;  // the lexed source; numbers are decoded from it on get
+} TokenBuffer;
+
+// Lex the whole input in one pass. Returns 0 on success, -1 on allocation
+// failure or oversized input (the buffer is left empty).
+int lexer_tokenize_all(const char *input, size_t length, TokenBuffer *out);
+// Rebuild the Token view of entry i (clamped to the final EOF).
+Token token_buffer_get(const TokenBuffer *tb, size_t i);
+void token_buffer_free(TokenBuffer *tb);
+
+// Replacement of `removed` bytes at `offset` by `inserted` bytes.
+typedef struct {
+    size_t offset;
+    size_t removed;
+    size_t inserted;
+} TextEdit;
+
+// Bring `tb`, tokenized from the text before `edit`, up to date with
+// `input`, the text after it. Only tokens near the edit are re-lexed (their
+// number goes to *relexed if non-NULL); later ones are shifted. Returns -1
+// on allocation failure or an edit that does not fit `input`, leaving tb
+// unchanged.
+int lexer_relex(TokenBuffer *tb, const char *input, size_t length, TextEdit edit, size_t *relexed);
+
+// Same stream as lexer_tokenize_all(), lexed by up to `threads` workers
+// (0 = one per online CPU) over line-aligned chunks. Inputs below
+// lexer_parallel_threshold() bytes (default 1 MiB) are lexed sequentially.
+int lexer_tokenize_parallel(const char *input, size_t length, size_t threads, TokenBuffer *out);
+size_t lexer_parallel_threshold(void);
+void lexer_set_parallel_threshold(size_t bytes);
+
+// 1-based line/column of a byte offset, resolved through a LineIndex.
+// {0, 0} stands for "no position".
+typedef struct {
+    int line;
+    int column;
+} Position;
+
+// Byte offsets of every line start in a source buffer, built with the
+// vectorized newline scan. Offsets are turned into Positions by binary
+// search, so tokens and AST nodes only need to carry offsets.
+typedef struct {
+    uint32_t *starts; // starts[0] == 0
+    size_t count;
+    size_t length;    // length of the indexed source
+} LineIndex;
+
+// Returns 0 on success, -1 on allocation failure or oversized input.
+int line_index_build(LineIndex *li, const char *input, size_t length);
+void line_index_free(LineIndex *li);
+int line_index_copy(LineIndex *dst, const LineIndex *src);
+// Bring `li`, built over the text before `edit`, up to date with `input`,
+// the text after it: only the inserted bytes are scanned, later line
+// starts are moved. Returns -1 on allocation failure or an edit that does
+// not fit, leaving li unchanged.
+int line_index_edit(LineIndex *li, const char *input, size_t length, TextEdit edit);
+// Position of a byte offset; {0, 0} if li is empty or offset is SIZE_MAX
+// or UINT32_MAX (the "unknown" markers).
+Position line_index_position(const LineIndex *li, size_t offset);
+// Offset of the newline that ends the line holding `offset` (the source
+// length on the last line).
+size_t line_index_line_end(const LineIndex *li, size_t offset);
+
+// Source of a streaming lexer: fill buf with up to cap bytes and return
+// how many were read, 0 at end of input or -1 on error.
+typedef long (*LexerReadFn)(void *ctx, char *buf, size_t cap);
+
+// Lexer over input pulled through a callback or file descriptor in
+// fixed-size windows, so memory stays bounded by the window (or the
+// longest token, if larger) whatever the source size. Tokens carry stream
+// offsets; their text is valid until the next stream_lexer_next().
+typedef struct {
+    LexerReadFn read;
+    void *ctx;
+    int fd;             // for stream_lexer_init_fd
+    char *buf;
+    size_t cap;
+    size_t len;         // bytes in the window
+    size_t pos;         // lexing position in the window
+    size_t base;        // stream offset of buf[0]
+    int at_end;
+    int io_error;       // a read failed; the stream ended there
+    size_t nl_pos;      // window index up to which lines are counted
+    int line;
+    size_t line_start;  // stream offset of the current line
+    Lexer lx;           // template stack carried between tokens
+} StreamLexer;
+
+int stream_lexer_init(StreamLexer *sl, LexerReadFn read, void *ctx, size_t window);
+int stream_lexer_init_fd(StreamLexer *sl, int fd, size_t window); // fd stays owned by the caller
+Token stream_lexer_next(StreamLexer *sl);
+const char *stream_lexer_text(const StreamLexer *sl, const Token *tok); // not NUL-terminated
+// Position of a stream offset of the current token or later; offsets must
+// be queried in increasing order ({0, 0} otherwise).
+Position stream_lexer_position(StreamLexer *sl, size_t offset);
+void stream_lexer_free(StreamLexer *sl);
+
+// Tokens do not own their text: the lexeme is the `length` bytes at
+// `offset` in the lexer input and stays valid as long as that buffer does.
+const char *token_text(const Lexer *lx, const Token *tok); // not NUL-terminated
+char *token_lexeme(const Lexer *lx, const Token *tok);     // owned copy, caller frees
+int token_equals(const Lexer *lx, const Token *tok, const char *s);
+
+// Value of a valid numeric lexeme, as stored in Token.number.
+double lexer_number_value(const char *s, size_t len);
+// Exact decimal digits of a BigInt lexeme (prefix, separators and `n`
+// dropped); caller frees.
+char *lexer_bigint_decimal(const char *s, size_t len);
+
+// Decode the escapes of a string or template body (delimiters excluded)
+// into `out` (`len` bytes, may be `body` itself): cooked text is never longer than
+// raw. Returns the cooked length (the text may hold NUL bytes), or
+// LEXER_BAD_ESCAPE for a malformed \x or \u escape.
+#define LEXER_BAD_ESCAPE ((size_t)-1)
+size_t lexer_cook_string(const char *body, size_t len, char *out);
+
+// Unicode ID_Start / ID_Continue (with `$`, `_` and ZWNJ/ZWJ as ECMAScript
+// adds them) for identifiers and their \u escapes.
+int lexer_is_id_start(uint32_t cp);
+int lexer_is_id_continue(uint32_t cp);
+
+// Spelling of a keyword/punctuator id ("" for *_NONE or out of range).
+const char *keyword_str(KeywordId kw);
+const char *punct_str(PunctId punct);
 
 #endif
@@ -5,14 +5,81 @@
 #include "quickjsflow/ast.h"
 #include "quickjsflow/lexer.h"
 
+// Tokens of lookahead held inline; deeper peeks (scanning an arrow
+// function's parameter list for its `=>`) move the ring to the heap.
+#define PARSER_LOOKAHEAD 8
+
 typedef struct {
     Lexer lx;
-    Token lookahead;
-    int has_lookahead;
-    Program *comment_sink; // populated during parse_program
+    Token ahead_buf[PARSER_LOOKAHEAD]; // lookahead ring while it fits
+    Token *ahead;              // heap ring once deeper lookahead was needed, else NULL
+    size_t ahead_head;         // ring slot of the next token
+    size_t ahead_count;        // tokens buffered ahead of the parse position
+    size_t ahead_cap;          // ring capacity, a power of two
+    struct ArrowHead *arrow_heads; // `(`s passed by the last arrow head scan, by offset
+    size_t arrow_head_count;
+    size_t arrow_head_cap;
+    Program *comment_sink; // receives comments and diagnostics during parse_program
+    const TokenBuffer *tokens; // bulk mode: pre-lexed stream, NULL when pulling from lx
+    size_t tok_index;          // bulk mode: index of the next token to buffer
+    int no_in;                 // parsing a for-statement head: `in` ends the expression
+    int in_async;              // parsing an async arrow body: `await` is an operator
+    size_t in_template;        // template substitutions being parsed
+    int panic;                 // after a syntax error, until the parse resynchronises
+    size_t error_count;        // syntax errors reported (one per recovery)
+    size_t block_depth;        // enclosing blocks whose `}` ends statement recovery
+    int syntax_only;           // recognizer run (parse_check): node contents are not kept
+    AstArena *scratch;         // parse_check: its arena, rewound between the statements of a list
+    Diagnostic *diags;         // parse_check: caller's diagnostics buffer
+    size_t diag_cap;           // parse_check: its capacity
+    int lazy_functions;        // brace-match function bodies instead of parsing them
+    struct ParseFrame *frames; // work stack of the productions being parsed
+    size_t frame_count;
+    size_t frame_cap;
+    struct ExprItem *items;    // operators and brackets waiting for their operands
+    size_t item_count;
+    size_t item_cap;
+    AstNode *ret;              // result of the production that finished last
 } Parser;
 
 void parser_init(Parser *p, const char *input, size_t length);
+// Parse from a buffer produced by lexer_tokenize_all() over the same input.
+// The buffer must outlive the parser.
+void parser_init_tokens(Parser *p, const char *input, size_t length, const TokenBuffer *tokens);
+// Nesting depth is bounded by memory, not by the native stack: productions
+// run as frames on a heap work stack, and operators waiting for their
+// operands sit on a second one. If either cannot grow, the parse stops
+// there as at the end of the input, and the rest of the input is reported
+// as an OutOfMemory error.
+
+// With p->lazy_functions set (after init), function and arrow block bodies
+// are only brace-matched: they keep their source range and comments, and
+// are parsed on first use through ast_materialize_body(). The input buffer
+// must then outlive the tree.
+//
+// Syntax errors do not stop the parse: each leaves an Error node in the
+// tree, the parse resynchronises at the next list separator or statement
+// boundary, and the Program's diagnostics list the first error of every
+// bad region, so one pass reports them all.
 AstNode *parse_program(Parser *p);
 
+// Incremental reparse. `program` was parsed from the text before `edit`
+// (see TextEdit), p is initialised over the text after it. Only the
+// statements around the edit in the innermost block that keeps both its
+// braces are parsed again; the rest of the tree is kept, with offsets past
+// the edit moved, along with its comments, diagnostics and line index.
+// Takes over the caller's reference to `program` and returns the updated
+// tree: `program` itself, or a full parse of p's input if the tree is
+// shared, did not come from parse_program, has piled up too many replaced
+// statements, or does not match the edit.
+AstNode *parse_program_edit(Parser *p, AstNode *program, TextEdit edit);
+
+// Recognizer: runs the same grammar with a scratch arena (see
+// ast_arena_new_scratch), so no strings, lists or comment records are
+// kept and each statement's nodes are dropped once the next one starts.
+// Returns the number of syntax errors, 0 when the input parses; the first
+// `cap` are stored in `diags` (may be NULL). Function bodies are always
+// checked, lazy_functions or not.
+size_t parse_check(Parser *p, Diagnostic *diags, size_t cap);
+
 #endif
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include "quickjsflow/ast.h"
+#include "quickjsflow/compact.h"
 
 typedef enum {
     SCOPE_GLOBAL = 1,
@@ -27,19 +28,21 @@ typedef enum {
 typedef struct Scope Scope;
 
 typedef struct Binding {
-    char *name;
+    char *name; // interned in the manager's atom table, not owned
+    Atom atom;
     BindingKind kind;
-    Position loc;
+    SrcOffset loc;
     const AstNode *node;
     Scope *scope;
     struct Binding *shadowed; // nearest outer binding shadowed by this one
 } Binding;
 
 typedef struct Reference {
-    char *name;
+    char *name; // interned in the manager's atom table, not owned
+    Atom atom;
     int is_write;
     int in_tdz;
-    Position loc;
+    SrcOffset loc;
     const AstNode *node;
     Binding *resolved;
     Scope *scope;
@@ -72,6 +75,7 @@ struct Scope {
     BindingVec bindings;
     ReferenceVec references;
     ScopeVec children;
+    const LineIndex *lines; // root scope of compact records: their line index
 };
 
 typedef struct {
@@ -79,17 +83,30 @@ typedef struct {
     ScopeMapEntry *map;
     size_t map_count;
     size_t map_capacity;
+    AtomTable *atoms; // the analyzed tree's arena table, or a private one
+    int owns_atoms;
 } ScopeManager;
 
 void scope_manager_init(ScopeManager *sm);
 void scope_manager_free(ScopeManager *sm);
 int scope_analyze(ScopeManager *sm, AstNode *root, int is_module);
+// The same analysis over the records of `ca` from its root, without
+// rebuilding a pointer tree. Scopes, bindings and references carry NULL
+// nodes (scope_of_node() finds nothing) and names in a private atom table;
+// `ca` must outlive the manager for the JSON dump's positions.
+int scope_analyze_compact(ScopeManager *sm, const CompactAst *ca, int is_module);
 
 Binding *scope_lookup_local(Scope *scope, const char *name);
 Binding *scope_resolve(Scope *scope, const char *name);
+// Same lookups by atom of the manager's table; no string compares.
+Binding *scope_lookup_local_atom(Scope *scope, Atom atom);
+Binding *scope_resolve_atom(Scope *scope, Atom atom);
 Scope *scope_of_node(const ScopeManager *sm, const AstNode *node);
 
 void scope_dump(const Scope *scope, int indent);
+// The scope tree as one JSON value; scope_dump_json() writes it and a
+// newline to stdout.
+void scope_write_json(JsonWriter *w, const Scope *scope);
 void scope_dump_json(const Scope *scope);
 
 #endif
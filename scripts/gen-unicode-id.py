@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+# Generate src/unicode_id.h, the ID_Start / ID_Continue range tables used
+# by the lexer for non-ASCII identifiers, from Python's unicodedata.
+#
+# Usage: python3 scripts/gen-unicode-id.py > src/unicode_id.h
+
+import sys
+import unicodedata
+
+# PropList.txt properties that unicodedata does not expose.
+OTHER_ID_START = [0x1885, 0x1886, 0x2118, 0x212E, 0x309B, 0x309C]
+OTHER_ID_CONTINUE = [0x00B7, 0x0387, 0x19DA] + list(range(0x1369, 0x1372))
+PATTERN_SYNTAX = [0x2E2F]  # the only Pattern_Syntax letter (Lm)
+
+
+def ranges(pred):
+    out = []
+    for cp in range(0x80, 0x110000):
+        if not pred(cp):
+            continue
+        if out and out[-1][1] == cp - 1:
+            out[-1][1] = cp
+        else:
+            out.append([cp, cp])
+    return out
+
+
+def id_start(cp):
+    if cp in PATTERN_SYNTAX:
+        return False
+    return unicodedata.category(chr(cp)) in ("Lu", "Ll", "Lt", "Lm", "Lo", "Nl") or cp in OTHER_ID_START
+
+
+def id_continue(cp):
+    if id_start(cp) or cp in OTHER_ID_CONTINUE:
+        return True
+    return unicodedata.category(chr(cp)) in ("Mn", "Mc", "Nd", "Pc")
+
+
+def emit(name, rs):
+    print("static const uint32_t %s[][2] = {" % name)
+    line = "   "
+    for lo, hi in rs:
+        item = " {0x%X, 0x%X}," % (lo, hi)
+        if len(line) + len(item) > 100:
+            print(line)
+            line = "   "
+        line += item
+    print(line)
+    print("};")
+
+
+print("// Generated by scripts/gen-unicode-id.py from Unicode %s; do not edit." % unicodedata.unidata_version)
+print("// Sorted, disjoint [lo, hi] code point ranges above U+007F.")
+print()
+print("#ifndef QUICKJSFLOW_UNICODE_ID_H")
+print("#define QUICKJSFLOW_UNICODE_ID_H")
+print()
+print("#include <stdint.h>")
+print()
+emit("unicode_id_start", ranges(id_start))
+print()
+emit("unicode_id_continue", ranges(id_continue))
+print()
+print("#endif")
@@ -1,50 +1,326 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include "quickjsflow/ast.h"
 
-static char *dupstr(const char *s) {
-    if (!s) return NULL;
-    size_t len = strlen(s);
-    char *d = (char *)malloc(len + 1);
+// ---------------------------------------------------------------------------
+// AST arena
+//
+// Slabs double in size up to ARENA_MAX_SLAB; blocks are zeroed and
+// max_align_t aligned. While a thread has an arena active, every node,
+// payload, string and vector the ast_* functions allocate comes from it,
+// and ast_release() of the owning Program drops the whole arena at once.
+
+#define ARENA_FIRST_SLAB (16u << 10)
+#define ARENA_MAX_SLAB (1u << 20)
+#define ARENA_SCRATCH (256u << 10)
+
+typedef struct ArenaSlab {
+    struct ArenaSlab *prev;
+    size_t size;
+    max_align_t data[];
+} ArenaSlab;
+
+struct AstArena {
+    ArenaSlab *slab;
+    char *cur, *end;
+    size_t next_size;
+    size_t bytes;
+    int refs; // the owning Program plus extra ast_retain()s of its nodes
+    AtomTable *atoms; // names of the tree, created on first use
+    int scratch; // see ast_arena_new_scratch()
+    ArenaSlab *spare; // slabs given back by ast_arena_rewind(), reused first
+    unsigned long long serial; // see ast_arena_serial()
+    Program *owner; // see ast_arena_owner()
+};
+
+static _Thread_local AstArena *active_arena = NULL;
+static atomic_ullong arena_serials = 0;
+
+AstArena *ast_arena_new(void) {
+    AstArena *a = (AstArena *)calloc(1, sizeof(AstArena));
+    if (!a) return NULL;
+    a->next_size = ARENA_FIRST_SLAB;
+    a->refs = 1;
+    a->serial = atomic_fetch_add(&arena_serials, 1) + 1;
+    return a;
+}
+
+// Recognizer parses run the constructors without keeping what they
+// build: while a scratch arena is active the ast_* functions skip copying
+// strings, interning names and growing vectors, so only nodes and their
+// payloads take space. Its slabs have a fixed ARENA_SCRATCH size and are
+// handed out again after ast_arena_rewind(), so blocks are zeroed as they
+// go rather than by calloc.
+AstArena *ast_arena_new_scratch(void) {
+    AstArena *a = ast_arena_new();
+    if (!a) return NULL;
+    a->scratch = 1;
+    a->next_size = ARENA_SCRATCH;
+    return a;
+}
+
+// writable stand-in for every string of a scratch tree
+static _Thread_local char scratch_string[1];
+
+static int building_scratch(void) {
+    return active_arena && active_arena->scratch;
+}
+
+static void free_slabs(ArenaSlab *s) {
+    while (s) {
+        ArenaSlab *prev = s->prev;
+        free(s);
+        s = prev;
+    }
+}
+
+static void arena_destroy(AstArena *a) {
+    free_slabs(a->slab);
+    free_slabs(a->spare);
+    atom_table_free(a->atoms);
+    free(a);
+}
+
+void ast_arena_free(AstArena *a) {
+    if (a && --a->refs == 0) arena_destroy(a);
+}
+
+void *ast_arena_alloc(AstArena *a, size_t size) {
+    size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+    if (size == 0) size = sizeof(max_align_t);
+    if ((size_t)(a->end - a->cur) < size) {
+        ArenaSlab *s = a->spare;
+        if (s && s->size >= size) {
+            a->spare = s->prev;
+        } else {
+            size_t slab = a->next_size;
+            if (a->next_size < ARENA_MAX_SLAB && !a->scratch) a->next_size *= 2;
+            if (slab < size) slab = size;
+            // calloc'd slabs come back zeroed, so blocks need no memset
+            s = (ArenaSlab *)calloc(1, sizeof(ArenaSlab) + slab);
+            if (!s) return NULL;
+            s->size = slab;
+        }
+        s->prev = a->slab;
+        a->slab = s;
+        a->cur = (char *)s->data;
+        a->end = a->cur + s->size;
+    }
+    void *p = a->cur;
+    a->cur += size;
+    a->bytes += size;
+    if (a->scratch) memset(p, 0, size);
+    return p;
+}
+
+AstArenaMark ast_arena_mark(const AstArena *a) {
+    AstArenaMark m = {a->slab, a->cur, a->bytes};
+    return m;
+}
+
+void ast_arena_rewind(AstArena *a, AstArenaMark m) {
+    while (a->slab != (ArenaSlab *)m.slab) {
+        ArenaSlab *s = a->slab;
+        a->slab = s->prev;
+        if (s->size == ARENA_SCRATCH) {
+            s->prev = a->spare;
+            a->spare = s;
+        } else {
+            free(s); // an oversized block's slab
+        }
+    }
+    a->cur = m.cur;
+    a->end = a->slab ? (char *)a->slab->data + a->slab->size : NULL;
+    a->bytes = m.bytes;
+}
+
+size_t ast_arena_bytes(const AstArena *a) {
+    return a ? a->bytes : 0;
+}
+
+int ast_arena_refs(const AstArena *a) {
+    return a ? a->refs : 0;
+}
+
+AstArena *ast_arena_use(AstArena *a) {
+    AstArena *prev = active_arena;
+    active_arena = a;
+    return prev;
+}
+
+void *ast_alloc(size_t size) {
+    return active_arena ? ast_arena_alloc(active_arena, size) : calloc(1, size);
+}
+
+void ast_unalloc(void *p) {
+    if (!active_arena) free(p);
+}
+
+static char *dupstrn(const char *s, size_t len) {
+    if (building_scratch()) return scratch_string;
+    char *d = (char *)(active_arena ? ast_arena_alloc(active_arena, len + 1) : malloc(len + 1));
     if (!d) return NULL;
-    memcpy(d, s, len);
+    if (len) memcpy(d, s, len);
     d[len] = '\0';
     return d;
 }
 
-static void print_escaped(const char *s) {
-    if (!s) return;
-    for (const char *p = s; *p; ++p) {
-        switch (*p) {
-            case '"': printf("\\\""); break;
-            case '\\': printf("\\\\"); break;
-            case '\n': printf("\\n"); break;
-            case '\r': printf("\\r"); break;
-            case '\t': printf("\\t"); break;
-            case '\b': printf("\\b"); break;
-            case '\f': printf("\\f"); break;
-            default:
-                if (*p < 32 || *p == 127) {
-                    printf("\\u%04x", (unsigned char)*p);
-                } else {
-                    putchar(*p);
-                }
-                break;
-        }
+static char *dupstr(const char *s) {
+    return s ? dupstrn(s, strlen(s)) : NULL;
+}
+
+char *ast_strdup_n(const char *s, size_t len) {
+    return dupstrn(s, len);
+}
+
+unsigned long long ast_arena_serial(const AstArena *a) {
+    return a ? a->serial : 0;
+}
+
+void ast_arena_set_owner(AstArena *a, Program *owner) {
+    if (a) a->owner = owner;
+}
+
+Program *ast_arena_owner(const AstArena *a) {
+    return a ? a->owner : NULL;
+}
+
+AtomTable *ast_arena_atoms(AstArena *a) {
+    if (a && !a->atoms) a->atoms = atom_table_new();
+    return a ? a->atoms : NULL;
+}
+
+char *ast_intern_n(const char *s, size_t len, Atom *atom) {
+    if (atom) *atom = ATOM_NONE;
+    if (!s) return NULL;
+    if (building_scratch()) return scratch_string;
+    AtomTable *t = ast_arena_atoms(active_arena);
+    Atom a = atom_intern(t, s, len);
+    if (a == ATOM_NONE) return dupstrn(s, len);
+    if (atom) *atom = a;
+    return (char *)atom_name(t, a);
+}
+
+static char *intern(const char *s) {
+    return s ? ast_intern_n(s, strlen(s), NULL) : NULL;
+}
+
+// Indexed by AstOperator; binary precedences follow the ECMAScript grammar,
+// with ?? sharing the || level.
+static const AstOperatorInfo operator_table[OP__COUNT] = {
+    [OP_NONE] = {"", 0, 0},
+    [OP_NULLISH] = {"??", 1, 0},
+    [OP_OR] = {"||", 1, 0},
+    [OP_AND] = {"&&", 2, 0},
+    [OP_PIPE] = {"|", 3, 0},
+    [OP_CARET] = {"^", 4, 0},
+    [OP_AMP] = {"&", 5, 0},
+    [OP_EQ] = {"==", 6, 0},
+    [OP_NE] = {"!=", 6, 0},
+    [OP_STRICT_EQ] = {"===", 6, 0},
+    [OP_STRICT_NE] = {"!==", 6, 0},
+    [OP_LT] = {"<", 7, 0},
+    [OP_GT] = {">", 7, 0},
+    [OP_LE] = {"<=", 7, 0},
+    [OP_GE] = {">=", 7, 0},
+    [OP_IN] = {"in", 7, 0},
+    [OP_INSTANCEOF] = {"instanceof", 7, 0},
+    [OP_SHL] = {"<<", 8, 0},
+    [OP_SAR] = {">>", 8, 0},
+    [OP_SHR] = {">>>", 8, 0},
+    [OP_PLUS] = {"+", 9, OPF_PREFIX},
+    [OP_MINUS] = {"-", 9, OPF_PREFIX},
+    [OP_STAR] = {"*", 10, 0},
+    [OP_SLASH] = {"/", 10, 0},
+    [OP_PERCENT] = {"%", 10, 0},
+    [OP_STAR_STAR] = {"**", 11, OPF_RIGHT_ASSOC},
+    [OP_BANG] = {"!", 0, OPF_PREFIX},
+    [OP_TILDE] = {"~", 0, OPF_PREFIX},
+    [OP_TYPEOF] = {"typeof", 0, OPF_PREFIX},
+    [OP_VOID] = {"void", 0, OPF_PREFIX},
+    [OP_DELETE] = {"delete", 0, OPF_PREFIX},
+    [OP_INC] = {"++", 0, OPF_PREFIX | OPF_UPDATE},
+    [OP_DEC] = {"--", 0, OPF_PREFIX | OPF_UPDATE},
+    [OP_ASSIGN] = {"=", 0, OPF_ASSIGN},
+    [OP_PLUS_ASSIGN] = {"+=", 0, OPF_ASSIGN},
+    [OP_MINUS_ASSIGN] = {"-=", 0, OPF_ASSIGN},
+    [OP_STAR_ASSIGN] = {"*=", 0, OPF_ASSIGN},
+    [OP_SLASH_ASSIGN] = {"/=", 0, OPF_ASSIGN},
+    [OP_PERCENT_ASSIGN] = {"%=", 0, OPF_ASSIGN},
+    [OP_STAR_STAR_ASSIGN] = {"**=", 0, OPF_ASSIGN},
+    [OP_SHL_ASSIGN] = {"<<=", 0, OPF_ASSIGN},
+    [OP_SAR_ASSIGN] = {">>=", 0, OPF_ASSIGN},
+    [OP_SHR_ASSIGN] = {">>>=", 0, OPF_ASSIGN},
+    [OP_AMP_ASSIGN] = {"&=", 0, OPF_ASSIGN},
+    [OP_PIPE_ASSIGN] = {"|=", 0, OPF_ASSIGN},
+    [OP_CARET_ASSIGN] = {"^=", 0, OPF_ASSIGN},
+    [OP_AND_ASSIGN] = {"&&=", 0, OPF_ASSIGN},
+    [OP_OR_ASSIGN] = {"||=", 0, OPF_ASSIGN},
+    [OP_NULLISH_ASSIGN] = {"?\?=", 0, OPF_ASSIGN}, // escaped to avoid the ??= trigraph
+};
+
+const AstOperatorInfo *ast_operator_info(AstOperator op) {
+    return &operator_table[(unsigned)op < OP__COUNT ? op : OP_NONE];
+}
+
+const char *ast_operator_str(AstOperator op) {
+    return ast_operator_info(op)->text;
+}
+
+AstOperator ast_operator_from_str(const char *s) {
+    if (!s) return OP_NONE;
+    for (int op = OP_NONE + 1; op < OP__COUNT; ++op) {
+        if (strcmp(operator_table[op].text, s) == 0) return (AstOperator)op;
     }
+    return OP_NONE;
+}
+
+char *ast_node_strdup(const AstNode *owner, const char *s) {
+    if (!s) return NULL;
+    AstArena *saved = ast_arena_use(owner ? owner->arena : NULL);
+    char *d = dupstr(s);
+    ast_arena_use(saved);
+    return d;
+}
+
+void ast_node_free_string(const AstNode *owner, char *s) {
+    if (!owner || !owner->arena) free(s);
+}
+
+void ast_identifier_set_name(AstNode *n, const char *name) {
+    if (!n || n->type != AST_Identifier || !n->data) return;
+    Identifier *id = (Identifier *)n->data;
+    AstArena *saved = ast_arena_use(n->arena);
+    ast_node_free_string(n, id->name);
+    id->name = name ? ast_intern_n(name, strlen(name), &id->atom) : NULL;
+    if (!name) id->atom = ATOM_NONE;
+    ast_arena_use(saved);
 }
 
 void astvec_init(AstVec *v) {
     v->items = NULL;
     v->count = 0;
     v->capacity = 0;
+    v->arena = active_arena;
+}
+
+// Grow an array of pointers; arena arrays move to a fresh block, which
+// keeps the total at most twice the final size.
+static void *grow_items(AstArena *arena, void *items, size_t count, size_t cap) {
+    if (!arena) return realloc(items, cap * sizeof(void *));
+    void *next = ast_arena_alloc(arena, cap * sizeof(void *));
+    if (next && count) memcpy(next, items, count * sizeof(void *));
+    return next;
 }
 
 void astvec_push(AstVec *v, AstNode *n) {
+    if (building_scratch()) return;
     if (v->count + 1 > v->capacity) {
         size_t cap = v->capacity ? v->capacity * 2 : 4;
-        AstNode **items = (AstNode **)realloc(v->items, cap * sizeof(AstNode *));
+        AstNode **items = (AstNode **)grow_items(v->arena, v->items, v->count, cap);
         if (!items) return;
         v->items = items;
         v->capacity = cap;
@@ -56,7 +332,7 @@ void commentvec_push(Program *p, Comment *c) {
     if (!p || !c) return;
     if (p->comment_count + 1 > p->comment_capacity) {
         size_t cap = p->comment_capacity ? p->comment_capacity * 2 : 4;
-        Comment **items = (Comment **)realloc(p->comments, cap * sizeof(Comment *));
+        Comment **items = (Comment **)grow_items(p->arena, p->comments, p->comment_count, cap);
         if (!items) return;
         p->comments = items;
         p->comment_capacity = cap;
@@ -64,26 +340,46 @@ void commentvec_push(Program *p, Comment *c) {
     p->comments[p->comment_count++] = c;
 }
 
+void diagnostic_push(Program *p, const char *kind, SrcOffset s, SrcOffset e) {
+    if (!p) return;
+    if (p->diagnostic_count + 1 > p->diagnostic_capacity) {
+        size_t cap = p->diagnostic_capacity ? p->diagnostic_capacity * 2 : 4;
+        Diagnostic *items;
+        if (p->arena) {
+            items = (Diagnostic *)ast_arena_alloc(p->arena, cap * sizeof(Diagnostic));
+            if (items && p->diagnostic_count) memcpy(items, p->diagnostics, p->diagnostic_count * sizeof(Diagnostic));
+        } else {
+            items = (Diagnostic *)realloc(p->diagnostics, cap * sizeof(Diagnostic));
+        }
+        if (!items) return;
+        p->diagnostics = items;
+        p->diagnostic_capacity = cap;
+    }
+    Diagnostic *d = &p->diagnostics[p->diagnostic_count++];
+    d->kind = kind;
+    d->start = s;
+    d->end = e;
+}
+
 Comment *comment_clone(const Comment *c) {
     if (!c) return NULL;
-    Comment *nc = (Comment *)calloc(1, sizeof(Comment));
+    Comment *nc = (Comment *)ast_alloc(sizeof(Comment));
     if (!nc) return NULL;
     nc->is_block = c->is_block;
-    if (c->text) {
-        size_t len = strlen(c->text);
-        nc->text = (char *)malloc(len + 1);
-        if (nc->text) memcpy(nc->text, c->text, len + 1);
-    }
+    nc->text = dupstr(c->text);
     nc->start = c->start;
     nc->end = c->end;
     return nc;
 }
 
 static AstNode *new_node(AstNodeType t) {
-    AstNode *n = (AstNode *)calloc(1, sizeof(AstNode));
+    AstNode *n = (AstNode *)ast_alloc(sizeof(AstNode));
     if (n) {
         n->type = t;
+        n->start = SRC_OFFSET_NONE;
+        n->end = SRC_OFFSET_NONE;
         n->refcount = 1;
+        n->arena = active_arena;
     }
     return n;
 }
@@ -91,30 +387,42 @@ static AstNode *new_node(AstNodeType t) {
 AstNode *ast_program(void) {
     AstNode *n = new_node(AST_Program);
     if (!n) return NULL;
-    Program *p = (Program *)calloc(1, sizeof(Program));
+    Program *p = (Program *)ast_alloc(sizeof(Program));
     astvec_init(&p->body);
     p->comments = NULL;
     p->comment_count = 0;
     p->comment_capacity = 0;
+    p->diagnostics = NULL;
+    p->diagnostic_count = 0;
+    p->diagnostic_capacity = 0;
+    p->arena = active_arena;
     n->data = p;
     return n;
 }
 
-AstNode *ast_identifier(const char *name, Position s, Position e) {
+AstNode *ast_identifier(const char *name, SrcOffset s, SrcOffset e) {
+    return ast_identifier_n(name, name ? strlen(name) : 0, s, e);
+}
+
+AstNode *ast_identifier_n(const char *name, size_t len, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_Identifier);
     if (!n) return NULL;
-    Identifier *id = (Identifier *)calloc(1, sizeof(Identifier));
-    id->name = dupstr(name);
+    Identifier *id = (Identifier *)ast_alloc(sizeof(Identifier));
+    id->name = ast_intern_n(name, len, &id->atom);
     n->data = id;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_literal(LiteralKind kind, const char *raw, Position s, Position e) {
+AstNode *ast_literal(LiteralKind kind, const char *raw, SrcOffset s, SrcOffset e) {
+    return ast_literal_n(kind, raw, raw ? strlen(raw) : 0, s, e);
+}
+
+AstNode *ast_literal_n(LiteralKind kind, const char *raw, size_t len, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_Literal);
-    Literal *lit = (Literal *)calloc(1, sizeof(Literal));
+    Literal *lit = (Literal *)ast_alloc(sizeof(Literal));
     lit->kind = kind;
-    lit->raw = dupstr(raw);
+    lit->raw = raw ? dupstrn(raw, len) : NULL;
     n->data = lit;
     n->start = s; n->end = e;
     return n;
@@ -122,7 +430,7 @@ AstNode *ast_literal(LiteralKind kind, const char *raw, Position s, Position e)
 
 AstNode *ast_variable_declaration(VarKind kind) {
     AstNode *n = new_node(AST_VariableDeclaration);
-    VariableDeclaration *vd = (VariableDeclaration *)calloc(1, sizeof(VariableDeclaration));
+    VariableDeclaration *vd = (VariableDeclaration *)ast_alloc(sizeof(VariableDeclaration));
     vd->kind = kind;
     astvec_init(&vd->declarations);
     n->data = vd;
@@ -131,26 +439,26 @@ AstNode *ast_variable_declaration(VarKind kind) {
 
 AstNode *ast_variable_declarator(AstNode *id, AstNode *init) {
     AstNode *n = new_node(AST_VariableDeclarator);
-    VariableDeclarator *vd = (VariableDeclarator *)calloc(1, sizeof(VariableDeclarator));
+    VariableDeclarator *vd = (VariableDeclarator *)ast_alloc(sizeof(VariableDeclarator));
     vd->id = id;
     vd->init = init;
     n->data = vd;
     return n;
 }
 
-AstNode *ast_expression_statement(AstNode *expr, Position s, Position e) {
+AstNode *ast_expression_statement(AstNode *expr, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ExpressionStatement);
-    ExpressionStatement *es = (ExpressionStatement *)calloc(1, sizeof(ExpressionStatement));
+    ExpressionStatement *es = (ExpressionStatement *)ast_alloc(sizeof(ExpressionStatement));
     es->expression = expr;
     n->data = es;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_update_expression(const char *op, int prefix, AstNode *arg, Position s, Position e) {
+AstNode *ast_update_expression(AstOperator op, int prefix, AstNode *arg, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_UpdateExpression);
-    UpdateExpression *ue = (UpdateExpression *)calloc(1, sizeof(UpdateExpression));
-    ue->operator = dupstr(op);
+    UpdateExpression *ue = (UpdateExpression *)ast_alloc(sizeof(UpdateExpression));
+    ue->operator = op;
     ue->prefix = prefix;
     ue->argument = arg;
     n->data = ue;
@@ -158,20 +466,20 @@ AstNode *ast_update_expression(const char *op, int prefix, AstNode *arg, Positio
     return n;
 }
 
-AstNode *ast_binary_expression(const char *op, AstNode *left, AstNode *right, Position s, Position e) {
+AstNode *ast_binary_expression(AstOperator op, AstNode *left, AstNode *right, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_BinaryExpression);
-    BinaryExpression *be = (BinaryExpression *)calloc(1, sizeof(BinaryExpression));
-    be->operator = dupstr(op);
+    BinaryExpression *be = (BinaryExpression *)ast_alloc(sizeof(BinaryExpression));
+    be->operator = op;
     be->left = left; be->right = right;
     n->data = be;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_assignment_expression(const char *op, AstNode *left, AstNode *right, Position s, Position e) {
+AstNode *ast_assignment_expression(AstOperator op, AstNode *left, AstNode *right, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_AssignmentExpression);
-    AssignmentExpression *ae = (AssignmentExpression *)calloc(1, sizeof(AssignmentExpression));
-    ae->operator = dupstr(op);
+    AssignmentExpression *ae = (AssignmentExpression *)ast_alloc(sizeof(AssignmentExpression));
+    ae->operator = op;
     ae->left = left;
     ae->right = right;
     n->data = ae;
@@ -179,10 +487,10 @@ AstNode *ast_assignment_expression(const char *op, AstNode *left, AstNode *right
     return n;
 }
 
-AstNode *ast_unary_expression(const char *op, int prefix, AstNode *arg, Position s, Position e) {
+AstNode *ast_unary_expression(AstOperator op, int prefix, AstNode *arg, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_UnaryExpression);
-    UnaryExpression *ue = (UnaryExpression *)calloc(1, sizeof(UnaryExpression));
-    ue->operator = dupstr(op);
+    UnaryExpression *ue = (UnaryExpression *)ast_alloc(sizeof(UnaryExpression));
+    ue->operator = op;
     ue->prefix = prefix;
     ue->argument = arg;
     n->data = ue;
@@ -190,9 +498,9 @@ AstNode *ast_unary_expression(const char *op, int prefix, AstNode *arg, Position
     return n;
 }
 
-AstNode *ast_object_expression(Position s, Position e) {
+AstNode *ast_object_expression(SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ObjectExpression);
-    ObjectExpression *obj = (ObjectExpression *)calloc(1, sizeof(ObjectExpression));
+    ObjectExpression *obj = (ObjectExpression *)ast_alloc(sizeof(ObjectExpression));
     astvec_init(&obj->properties);
     n->data = obj;
     n->start = s; n->end = e;
@@ -201,7 +509,7 @@ AstNode *ast_object_expression(Position s, Position e) {
 
 AstNode *ast_property(AstNode *key, AstNode *value, int computed) {
     AstNode *n = new_node(AST_Property);
-    Property *prop = (Property *)calloc(1, sizeof(Property));
+    Property *prop = (Property *)ast_alloc(sizeof(Property));
     prop->key = key;
     prop->value = value;
     prop->computed = computed;
@@ -209,18 +517,18 @@ AstNode *ast_property(AstNode *key, AstNode *value, int computed) {
     return n;
 }
 
-AstNode *ast_array_expression(Position s, Position e) {
+AstNode *ast_array_expression(SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ArrayExpression);
-    ArrayExpression *arr = (ArrayExpression *)calloc(1, sizeof(ArrayExpression));
+    ArrayExpression *arr = (ArrayExpression *)ast_alloc(sizeof(ArrayExpression));
     astvec_init(&arr->elements);
     n->data = arr;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_member_expression(AstNode *obj, AstNode *prop, int computed, Position s, Position e) {
+AstNode *ast_member_expression(AstNode *obj, AstNode *prop, int computed, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_MemberExpression);
-    MemberExpression *me = (MemberExpression *)calloc(1, sizeof(MemberExpression));
+    MemberExpression *me = (MemberExpression *)ast_alloc(sizeof(MemberExpression));
     me->object = obj;
     me->property = prop;
     me->computed = computed;
@@ -229,9 +537,9 @@ AstNode *ast_member_expression(AstNode *obj, AstNode *prop, int computed, Positi
     return n;
 }
 
-AstNode *ast_call_expression(AstNode *callee, Position s, Position e) {
+AstNode *ast_call_expression(AstNode *callee, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_CallExpression);
-    CallExpression *ce = (CallExpression *)calloc(1, sizeof(CallExpression));
+    CallExpression *ce = (CallExpression *)ast_alloc(sizeof(CallExpression));
     ce->callee = callee;
     astvec_init(&ce->arguments);
     n->data = ce;
@@ -239,38 +547,38 @@ AstNode *ast_call_expression(AstNode *callee, Position s, Position e) {
     return n;
 }
 
-AstNode *ast_function_declaration(const char *name, Position s, Position e) {
+AstNode *ast_function_declaration(const char *name, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_FunctionDeclaration);
-    FunctionBody *fb = (FunctionBody *)calloc(1, sizeof(FunctionBody));
-    fb->name = dupstr(name);
+    FunctionBody *fb = (FunctionBody *)ast_alloc(sizeof(FunctionBody));
+    fb->name = intern(name);
     astvec_init(&fb->params);
     n->data = fb;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_function_expression(const char *name, Position s, Position e) {
+AstNode *ast_function_expression(const char *name, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_FunctionExpression);
-    FunctionBody *fb = (FunctionBody *)calloc(1, sizeof(FunctionBody));
-    fb->name = dupstr(name);
+    FunctionBody *fb = (FunctionBody *)ast_alloc(sizeof(FunctionBody));
+    fb->name = intern(name);
     astvec_init(&fb->params);
     n->data = fb;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_block_statement(Position s, Position e) {
+AstNode *ast_block_statement(SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_BlockStatement);
-    BlockStatement *bs = (BlockStatement *)calloc(1, sizeof(BlockStatement));
+    BlockStatement *bs = (BlockStatement *)ast_alloc(sizeof(BlockStatement));
     astvec_init(&bs->body);
     n->data = bs;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_if_statement(AstNode *test, AstNode *cons, AstNode *alt, Position s, Position e) {
+AstNode *ast_if_statement(AstNode *test, AstNode *cons, AstNode *alt, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_IfStatement);
-    IfStatement *is = (IfStatement *)calloc(1, sizeof(IfStatement));
+    IfStatement *is = (IfStatement *)ast_alloc(sizeof(IfStatement));
     is->test = test;
     is->consequent = cons;
     is->alternate = alt;
@@ -279,9 +587,9 @@ AstNode *ast_if_statement(AstNode *test, AstNode *cons, AstNode *alt, Position s
     return n;
 }
 
-AstNode *ast_while_statement(AstNode *test, AstNode *body, Position s, Position e) {
+AstNode *ast_while_statement(AstNode *test, AstNode *body, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_WhileStatement);
-    WhileStatement *ws = (WhileStatement *)calloc(1, sizeof(WhileStatement));
+    WhileStatement *ws = (WhileStatement *)ast_alloc(sizeof(WhileStatement));
     ws->test = test;
     ws->body = body;
     n->data = ws;
@@ -289,9 +597,9 @@ AstNode *ast_while_statement(AstNode *test, AstNode *body, Position s, Position
     return n;
 }
 
-AstNode *ast_do_while_statement(AstNode *body, AstNode *test, Position s, Position e) {
+AstNode *ast_do_while_statement(AstNode *body, AstNode *test, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_DoWhileStatement);
-    DoWhileStatement *dws = (DoWhileStatement *)calloc(1, sizeof(DoWhileStatement));
+    DoWhileStatement *dws = (DoWhileStatement *)ast_alloc(sizeof(DoWhileStatement));
     dws->body = body;
     dws->test = test;
     n->data = dws;
@@ -299,9 +607,9 @@ AstNode *ast_do_while_statement(AstNode *body, AstNode *test, Position s, Positi
     return n;
 }
 
-AstNode *ast_for_statement(AstNode *init, AstNode *test, AstNode *update, AstNode *body, Position s, Position e) {
+AstNode *ast_for_statement(AstNode *init, AstNode *test, AstNode *update, AstNode *body, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ForStatement);
-    ForStatement *fs = (ForStatement *)calloc(1, sizeof(ForStatement));
+    ForStatement *fs = (ForStatement *)ast_alloc(sizeof(ForStatement));
     fs->init = init;
     fs->test = test;
     fs->update = update;
@@ -311,9 +619,9 @@ AstNode *ast_for_statement(AstNode *init, AstNode *test, AstNode *update, AstNod
     return n;
 }
 
-AstNode *ast_switch_statement(AstNode *discriminant, Position s, Position e) {
+AstNode *ast_switch_statement(AstNode *discriminant, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_SwitchStatement);
-    SwitchStatement *ss = (SwitchStatement *)calloc(1, sizeof(SwitchStatement));
+    SwitchStatement *ss = (SwitchStatement *)ast_alloc(sizeof(SwitchStatement));
     ss->discriminant = discriminant;
     astvec_init(&ss->cases);
     n->data = ss;
@@ -323,16 +631,16 @@ AstNode *ast_switch_statement(AstNode *discriminant, Position s, Position e) {
 
 AstNode *ast_switch_case(AstNode *test) {
     AstNode *n = new_node(AST_SwitchCase);
-    SwitchCase *sc = (SwitchCase *)calloc(1, sizeof(SwitchCase));
+    SwitchCase *sc = (SwitchCase *)ast_alloc(sizeof(SwitchCase));
     sc->test = test;  // NULL for default case
     astvec_init(&sc->consequent);
     n->data = sc;
     return n;
 }
 
-AstNode *ast_try_statement(AstNode *block, Position s, Position e) {
+AstNode *ast_try_statement(AstNode *block, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_TryStatement);
-    TryStatement *ts = (TryStatement *)calloc(1, sizeof(TryStatement));
+    TryStatement *ts = (TryStatement *)ast_alloc(sizeof(TryStatement));
     ts->block = block;
     astvec_init(&ts->handlers);
     n->data = ts;
@@ -342,52 +650,52 @@ AstNode *ast_try_statement(AstNode *block, Position s, Position e) {
 
 AstNode *ast_catch_clause(AstNode *param, AstNode *body) {
     AstNode *n = new_node(AST_CatchClause);
-    CatchClause *cc = (CatchClause *)calloc(1, sizeof(CatchClause));
+    CatchClause *cc = (CatchClause *)ast_alloc(sizeof(CatchClause));
     cc->param = param;
     cc->body = body;
     n->data = cc;
     return n;
 }
 
-AstNode *ast_throw_statement(AstNode *argument, Position s, Position e) {
+AstNode *ast_throw_statement(AstNode *argument, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ThrowStatement);
-    ThrowStatement *ts = (ThrowStatement *)calloc(1, sizeof(ThrowStatement));
+    ThrowStatement *ts = (ThrowStatement *)ast_alloc(sizeof(ThrowStatement));
     ts->argument = argument;
     n->data = ts;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_return_statement(AstNode *argument, Position s, Position e) {
+AstNode *ast_return_statement(AstNode *argument, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ReturnStatement);
-    ReturnStatement *rs = (ReturnStatement *)calloc(1, sizeof(ReturnStatement));
+    ReturnStatement *rs = (ReturnStatement *)ast_alloc(sizeof(ReturnStatement));
     rs->argument = argument;
     n->data = rs;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_break_statement(Position s, Position e) {
+AstNode *ast_break_statement(SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_BreakStatement);
-    BreakStatement *bs = (BreakStatement *)calloc(1, sizeof(BreakStatement));
+    BreakStatement *bs = (BreakStatement *)ast_alloc(sizeof(BreakStatement));
     bs->label = NULL;
     n->data = bs;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_continue_statement(Position s, Position e) {
+AstNode *ast_continue_statement(SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ContinueStatement);
-    ContinueStatement *cs = (ContinueStatement *)calloc(1, sizeof(ContinueStatement));
+    ContinueStatement *cs = (ContinueStatement *)ast_alloc(sizeof(ContinueStatement));
     cs->label = NULL;
     n->data = cs;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_import_declaration(const char *source, Position s, Position e) {
+AstNode *ast_import_declaration(const char *source, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ImportDeclaration);
-    ImportDeclaration *id = (ImportDeclaration *)calloc(1, sizeof(ImportDeclaration));
+    ImportDeclaration *id = (ImportDeclaration *)ast_alloc(sizeof(ImportDeclaration));
     id->source = dupstr(source);
     astvec_init(&id->specifiers);
     n->data = id;
@@ -397,34 +705,34 @@ AstNode *ast_import_declaration(const char *source, Position s, Position e) {
 
 AstNode *ast_import_specifier(AstNode *imported, AstNode *local) {
     AstNode *n = new_node(AST_ImportSpecifier);
-    ImportSpecifier *is = (ImportSpecifier *)calloc(1, sizeof(ImportSpecifier));
+    ImportSpecifier *is = (ImportSpecifier *)ast_alloc(sizeof(ImportSpecifier));
     is->imported = imported;
     is->local = local;
     n->data = is;
     return n;
 }
 
-AstNode *ast_import_default_specifier(AstNode *local, Position s, Position e) {
+AstNode *ast_import_default_specifier(AstNode *local, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ImportDefaultSpecifier);
-    ImportDefaultSpecifier *ids = (ImportDefaultSpecifier *)calloc(1, sizeof(ImportDefaultSpecifier));
+    ImportDefaultSpecifier *ids = (ImportDefaultSpecifier *)ast_alloc(sizeof(ImportDefaultSpecifier));
     ids->local = local;
     n->data = ids;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_import_namespace_specifier(AstNode *local, Position s, Position e) {
+AstNode *ast_import_namespace_specifier(AstNode *local, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ImportNamespaceSpecifier);
-    ImportNamespaceSpecifier *ins = (ImportNamespaceSpecifier *)calloc(1, sizeof(ImportNamespaceSpecifier));
+    ImportNamespaceSpecifier *ins = (ImportNamespaceSpecifier *)ast_alloc(sizeof(ImportNamespaceSpecifier));
     ins->local = local;
     n->data = ins;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_export_named_declaration(const char *source, Position s, Position e) {
+AstNode *ast_export_named_declaration(const char *source, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ExportNamedDeclaration);
-    ExportNamedDeclaration *end = (ExportNamedDeclaration *)calloc(1, sizeof(ExportNamedDeclaration));
+    ExportNamedDeclaration *end = (ExportNamedDeclaration *)ast_alloc(sizeof(ExportNamedDeclaration));
     end->source = dupstr(source);
     astvec_init(&end->specifiers);
     n->data = end;
@@ -432,9 +740,9 @@ AstNode *ast_export_named_declaration(const char *source, Position s, Position e
     return n;
 }
 
-AstNode *ast_export_default_declaration(Position s, Position e) {
+AstNode *ast_export_default_declaration(SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ExportDefaultDeclaration);
-    ExportDefaultDeclaration *edd = (ExportDefaultDeclaration *)calloc(1, sizeof(ExportDefaultDeclaration));
+    ExportDefaultDeclaration *edd = (ExportDefaultDeclaration *)ast_alloc(sizeof(ExportDefaultDeclaration));
     n->data = edd;
     n->start = s; n->end = e;
     return n;
@@ -442,9 +750,9 @@ AstNode *ast_export_default_declaration(Position s, Position e) {
 
 // Phase 2: Modern Features (ES6+)
 
-AstNode *ast_arrow_function_expression(int is_async, Position s, Position e) {
+AstNode *ast_arrow_function_expression(int is_async, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ArrowFunctionExpression);
-    ArrowFunctionExpression *afe = (ArrowFunctionExpression *)calloc(1, sizeof(ArrowFunctionExpression));
+    ArrowFunctionExpression *afe = (ArrowFunctionExpression *)ast_alloc(sizeof(ArrowFunctionExpression));
     astvec_init(&afe->params);
     afe->body = NULL;
     afe->is_async = is_async;
@@ -453,9 +761,9 @@ AstNode *ast_arrow_function_expression(int is_async, Position s, Position e) {
     return n;
 }
 
-AstNode *ast_template_literal(Position s, Position e) {
+AstNode *ast_template_literal(SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_TemplateLiteral);
-    TemplateLiteral *tl = (TemplateLiteral *)calloc(1, sizeof(TemplateLiteral));
+    TemplateLiteral *tl = (TemplateLiteral *)ast_alloc(sizeof(TemplateLiteral));
     astvec_init(&tl->quasis);
     astvec_init(&tl->expressions);
     n->data = tl;
@@ -463,9 +771,9 @@ AstNode *ast_template_literal(Position s, Position e) {
     return n;
 }
 
-AstNode *ast_template_element(const char *value, int tail, Position s, Position e) {
+AstNode *ast_template_element(const char *value, int tail, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_TemplateElement);
-    TemplateElement *te = (TemplateElement *)calloc(1, sizeof(TemplateElement));
+    TemplateElement *te = (TemplateElement *)ast_alloc(sizeof(TemplateElement));
     te->value = dupstr(value);
     te->tail = tail;
     n->data = te;
@@ -473,36 +781,36 @@ AstNode *ast_template_element(const char *value, int tail, Position s, Position
     return n;
 }
 
-AstNode *ast_spread_element(AstNode *argument, Position s, Position e) {
+AstNode *ast_spread_element(AstNode *argument, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_SpreadElement);
-    SpreadElement *se = (SpreadElement *)calloc(1, sizeof(SpreadElement));
+    SpreadElement *se = (SpreadElement *)ast_alloc(sizeof(SpreadElement));
     se->argument = argument;
     n->data = se;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_object_pattern(Position s, Position e) {
+AstNode *ast_object_pattern(SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ObjectPattern);
-    ObjectPattern *op = (ObjectPattern *)calloc(1, sizeof(ObjectPattern));
+    ObjectPattern *op = (ObjectPattern *)ast_alloc(sizeof(ObjectPattern));
     astvec_init(&op->properties);
     n->data = op;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_array_pattern(Position s, Position e) {
+AstNode *ast_array_pattern(SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ArrayPattern);
-    ArrayPattern *ap = (ArrayPattern *)calloc(1, sizeof(ArrayPattern));
+    ArrayPattern *ap = (ArrayPattern *)ast_alloc(sizeof(ArrayPattern));
     astvec_init(&ap->elements);
     n->data = ap;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_assignment_pattern(AstNode *left, AstNode *right, Position s, Position e) {
+AstNode *ast_assignment_pattern(AstNode *left, AstNode *right, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_AssignmentPattern);
-    AssignmentPattern *ap = (AssignmentPattern *)calloc(1, sizeof(AssignmentPattern));
+    AssignmentPattern *ap = (AssignmentPattern *)ast_alloc(sizeof(AssignmentPattern));
     ap->left = left;
     ap->right = right;
     n->data = ap;
@@ -510,18 +818,18 @@ AstNode *ast_assignment_pattern(AstNode *left, AstNode *right, Position s, Posit
     return n;
 }
 
-AstNode *ast_rest_element(AstNode *argument, Position s, Position e) {
+AstNode *ast_rest_element(AstNode *argument, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_RestElement);
-    RestElement *re = (RestElement *)calloc(1, sizeof(RestElement));
+    RestElement *re = (RestElement *)ast_alloc(sizeof(RestElement));
     re->argument = argument;
     n->data = re;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_for_of_statement(AstNode *left, AstNode *right, AstNode *body, Position s, Position e) {
+AstNode *ast_for_of_statement(AstNode *left, AstNode *right, AstNode *body, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ForOfStatement);
-    ForOfStatement *fos = (ForOfStatement *)calloc(1, sizeof(ForOfStatement));
+    ForOfStatement *fos = (ForOfStatement *)ast_alloc(sizeof(ForOfStatement));
     fos->left = left;
     fos->right = right;
     fos->body = body;
@@ -530,9 +838,9 @@ AstNode *ast_for_of_statement(AstNode *left, AstNode *right, AstNode *body, Posi
     return n;
 }
 
-AstNode *ast_for_in_statement(AstNode *left, AstNode *right, AstNode *body, Position s, Position e) {
+AstNode *ast_for_in_statement(AstNode *left, AstNode *right, AstNode *body, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ForInStatement);
-    ForInStatement *fis = (ForInStatement *)calloc(1, sizeof(ForInStatement));
+    ForInStatement *fis = (ForInStatement *)ast_alloc(sizeof(ForInStatement));
     fis->left = left;
     fis->right = right;
     fis->body = body;
@@ -541,9 +849,9 @@ AstNode *ast_for_in_statement(AstNode *left, AstNode *right, AstNode *body, Posi
     return n;
 }
 
-AstNode *ast_class_declaration(AstNode *id, AstNode *superClass, Position s, Position e) {
+AstNode *ast_class_declaration(AstNode *id, AstNode *superClass, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ClassDeclaration);
-    ClassDeclaration *cd = (ClassDeclaration *)calloc(1, sizeof(ClassDeclaration));
+    ClassDeclaration *cd = (ClassDeclaration *)ast_alloc(sizeof(ClassDeclaration));
     cd->id = id;
     cd->superClass = superClass;
     astvec_init(&cd->body);
@@ -552,9 +860,9 @@ AstNode *ast_class_declaration(AstNode *id, AstNode *superClass, Position s, Pos
     return n;
 }
 
-AstNode *ast_class_expression(AstNode *id, AstNode *superClass, Position s, Position e) {
+AstNode *ast_class_expression(AstNode *id, AstNode *superClass, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ClassExpression);
-    ClassExpression *ce = (ClassExpression *)calloc(1, sizeof(ClassExpression));
+    ClassExpression *ce = (ClassExpression *)ast_alloc(sizeof(ClassExpression));
     ce->id = id;
     ce->superClass = superClass;
     astvec_init(&ce->body);
@@ -563,9 +871,9 @@ AstNode *ast_class_expression(AstNode *id, AstNode *superClass, Position s, Posi
     return n;
 }
 
-AstNode *ast_method_definition(AstNode *key, AstNode *value, const char *kind, int is_static, Position s, Position e) {
+AstNode *ast_method_definition(AstNode *key, AstNode *value, const char *kind, int is_static, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_MethodDefinition);
-    MethodDefinition *md = (MethodDefinition *)calloc(1, sizeof(MethodDefinition));
+    MethodDefinition *md = (MethodDefinition *)ast_alloc(sizeof(MethodDefinition));
     md->key = key;
     md->value = value;
     md->kind = dupstr(kind);
@@ -575,18 +883,18 @@ AstNode *ast_method_definition(AstNode *key, AstNode *value, const char *kind, i
     return n;
 }
 
-AstNode *ast_await_expression(AstNode *argument, Position s, Position e) {
+AstNode *ast_await_expression(AstNode *argument, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_AwaitExpression);
-    AwaitExpression *ae = (AwaitExpression *)calloc(1, sizeof(AwaitExpression));
+    AwaitExpression *ae = (AwaitExpression *)ast_alloc(sizeof(AwaitExpression));
     ae->argument = argument;
     n->data = ae;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_yield_expression(AstNode *argument, int delegate, Position s, Position e) {
+AstNode *ast_yield_expression(AstNode *argument, int delegate, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_YieldExpression);
-    YieldExpression *ye = (YieldExpression *)calloc(1, sizeof(YieldExpression));
+    YieldExpression *ye = (YieldExpression *)ast_alloc(sizeof(YieldExpression));
     ye->argument = argument;
     ye->delegate = delegate;
     n->data = ye;
@@ -594,500 +902,649 @@ AstNode *ast_yield_expression(AstNode *argument, int delegate, Position s, Posit
     return n;
 }
 
-AstNode *ast_super(Position s, Position e) {
+AstNode *ast_super(SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_Super);
-    Super *sup = (Super *)calloc(1, sizeof(Super));
+    Super *sup = (Super *)ast_alloc(sizeof(Super));
     n->data = sup;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_this_expression(Position s, Position e) {
+AstNode *ast_this_expression(SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_ThisExpression);
-    ThisExpression *te = (ThisExpression *)calloc(1, sizeof(ThisExpression));
+    ThisExpression *te = (ThisExpression *)ast_alloc(sizeof(ThisExpression));
     n->data = te;
     n->start = s; n->end = e;
     return n;
 }
 
-AstNode *ast_error(const char *msg, Position s, Position e) {
+AstNode *ast_error(const char *msg, SrcOffset s, SrcOffset e) {
     AstNode *n = new_node(AST_Error);
-    ErrorNode *er = (ErrorNode *)calloc(1, sizeof(ErrorNode));
+    ErrorNode *er = (ErrorNode *)ast_alloc(sizeof(ErrorNode));
     er->message = dupstr(msg);
     n->data = er;
     n->start = s; n->end = e;
     return n;
 }
 
-static void print_pos(const char *key, Position p) {
-    printf("\"%s\":{\"line\":%d,\"column\":%d}", key, p.line, p.column);
-}
-
-static void print_node(const AstNode *n);
+// line index of the Program being printed, if any
+static const LineIndex *print_lines = NULL;
+// line of the last printed position; nodes come in source order, so most
+// positions fall on it and skip the binary search
+static size_t print_line = 0;
 
-static void print_program(const Program *p) {
-    printf("\"body\":[");
-    for (size_t i = 0; i < p->body.count; ++i) {
-        if (i) printf(",");
-        print_node(p->body.items[i]);
+static void print_pos(JsonWriter *w, SrcOffset off) {
+    const LineIndex *li = print_lines;
+    Position p;
+    if (li && print_line < li->count && off >= li->starts[print_line] &&
+        (print_line + 1 < li->count ? off < li->starts[print_line + 1] : off <= li->length)) {
+        p.line = (int)print_line + 1;
+        p.column = (int)(off - li->starts[print_line]) + 1;
+    } else {
+        p = line_index_position(li, off);
+        if (p.line > 0) print_line = (size_t)p.line - 1;
+    }
+    json_lit(w, "{\"line\":");
+    json_int(w, p.line);
+    json_lit(w, ",\"column\":");
+    json_int(w, p.column);
+    json_char(w, '}');
+}
+
+static void print_escaped(JsonWriter *w, const char *s) {
+    if (s) json_escaped(w, s, strlen(s));
+}
+
+// The tree is printed from an explicit stack, so nesting depth costs heap,
+// not native stack. A node's head (type and positions) and whatever comes
+// before its first child are written when it comes off the stack; the rest
+// is queued as a sequence of pieces: text, child nodes, lists, and scalars
+// that follow a child.
+
+typedef enum {
+    PRINT_NODE,        // a node, or null
+    PRINT_TEXT,        // s[0, n)
+    PRINT_LIST,        // elements n.. of the AstVec at p, comma separated
+    PRINT_INT,         // n
+    PRINT_BOOL,        // n
+    PRINT_ESCAPED,     // string s, escaped, if not NULL
+    PRINT_DIAGNOSTICS, // diagnostics of the Program at p
+} PrintKind;
+
+typedef struct {
+    PrintKind kind;
+    const void *p;
+    size_t n;
+} PrintPiece;
+
+// Pieces a node queues after its head, in output order.
+#define PRINT_SEQ_MAX 16
+typedef struct {
+    PrintPiece items[PRINT_SEQ_MAX];
+    size_t count;
+} PrintSeq;
+
+static void seq_add(PrintSeq *q, PrintKind kind, const void *p, size_t n) {
+    PrintPiece *pc = &q->items[q->count++];
+    pc->kind = kind;
+    pc->p = p;
+    pc->n = n;
+}
+
+#define seq_lit(q, s) seq_add((q), PRINT_TEXT, "" s, sizeof(s) - 1)
+
+static void seq_node(PrintSeq *q, const AstNode *n) {
+    seq_add(q, PRINT_NODE, n, 0);
+}
+
+// `[` elements `]`
+static void seq_list(PrintSeq *q, const AstVec *v) {
+    seq_lit(q, "[");
+    seq_add(q, PRINT_LIST, v, 0);
+    seq_lit(q, "]");
+}
+
+static void print_program(JsonWriter *w, const Program *p, PrintSeq *q) {
+    json_lit(w, "\"body\":");
+    seq_list(q, &p->body);
+    // lazy bodies printed above may still add diagnostics, so the count is
+    // only looked at once the body is out
+    seq_add(q, PRINT_DIAGNOSTICS, p, 0);
+}
+
+static void print_diagnostics(JsonWriter *w, const Program *p) {
+    if (!p->diagnostic_count) return;
+    json_lit(w, ",\"diagnostics\":[");
+    for (size_t i = 0; i < p->diagnostic_count; ++i) {
+        const Diagnostic *d = &p->diagnostics[i];
+        if (i) json_char(w, ',');
+        json_lit(w, "{\"kind\":\"");
+        print_escaped(w, d->kind);
+        json_lit(w, "\",\"start\":");
+        print_pos(w, d->start);
+        json_lit(w, ",\"end\":");
+        print_pos(w, d->end);
+        json_char(w, '}');
     }
-    printf("]");
+    json_char(w, ']');
 }
 
-static void print_identifier(const Identifier *id) {
-    printf("\"name\":\"");
-    print_escaped(id->name);
-    printf("\"");
+static void print_identifier(JsonWriter *w, const Identifier *id) {
+    json_lit(w, "\"name\":\"");
+    print_escaped(w, id->name);
+    json_char(w, '"');
 }
 
-static void print_literal(const Literal *lit) {
-    printf("\"raw\":\"");
-    print_escaped(lit->raw);
-    printf("\"");
+static void print_literal(JsonWriter *w, const Literal *lit) {
+    json_lit(w, "\"raw\":\"");
+    print_escaped(w, lit->raw);
+    json_char(w, '"');
 }
 
-static void print_variable_declaration(const VariableDeclaration *vd) {
+static void print_variable_declaration(JsonWriter *w, const VariableDeclaration *vd, PrintSeq *q) {
     const char *kind = vd->kind == VD_Var ? "var" : (vd->kind == VD_Let ? "let" : "const");
-    printf("\"kind\":\"%s\",\"declarations\":[", kind);
-    for (size_t i = 0; i < vd->declarations.count; ++i) {
-        if (i) printf(",");
-        print_node(vd->declarations.items[i]);
-    }
-    printf("]");
+    json_lit(w, "\"kind\":\"");
+    json_raw(w, kind, strlen(kind));
+    json_lit(w, "\",\"declarations\":");
+    seq_list(q, &vd->declarations);
 }
 
-static void print_variable_declarator(const VariableDeclarator *vd) {
-    printf("\"id\":");
-    print_node(vd->id);
-    printf(",\"init\":");
-    if (vd->init) print_node(vd->init); else printf("null");
+static void print_variable_declarator(JsonWriter *w, const VariableDeclarator *vd, PrintSeq *q) {
+    json_lit(w, "\"id\":");
+    seq_node(q, vd->id);
+    seq_lit(q, ",\"init\":");
+    seq_node(q, vd->init);
 }
 
-static void print_expression_statement(const ExpressionStatement *es) {
-    printf("\"expression\":");
-    print_node(es->expression);
+static void print_expression_statement(JsonWriter *w, const ExpressionStatement *es, PrintSeq *q) {
+    json_lit(w, "\"expression\":");
+    seq_node(q, es->expression);
 }
 
-static void print_update_expression(const UpdateExpression *ue) {
-    printf("\"operator\":\""); print_escaped(ue->operator); printf("\",");
-    printf("\"prefix\":%d,\"argument\":", ue->prefix);
-    print_node(ue->argument);
+static void print_update_expression(JsonWriter *w, const UpdateExpression *ue, PrintSeq *q) {
+    json_lit(w, "\"operator\":\""); print_escaped(w, ast_operator_str(ue->operator)); json_lit(w, "\",");
+    json_lit(w, "\"prefix\":"); json_int(w, ue->prefix); json_lit(w, ",\"argument\":");
+    seq_node(q, ue->argument);
 }
 
-static void print_binary_expression(const BinaryExpression *be) {
-    printf("\"operator\":\""); print_escaped(be->operator); printf("\",");
-    printf("\"left\":"); print_node(be->left);
-    printf(",\"right\":"); print_node(be->right);
+static void print_binary_expression(JsonWriter *w, const BinaryExpression *be, PrintSeq *q) {
+    json_lit(w, "\"operator\":\""); print_escaped(w, ast_operator_str(be->operator)); json_lit(w, "\",");
+    json_lit(w, "\"left\":"); seq_node(q, be->left);
+    seq_lit(q, ",\"right\":"); seq_node(q, be->right);
 }
 
-static void print_assignment_expression(const AssignmentExpression *ae) {
-    printf("\"operator\":\""); print_escaped(ae->operator); printf("\",");
-    printf("\"left\":"); print_node(ae->left);
-    printf(",\"right\":"); print_node(ae->right);
+static void print_assignment_expression(JsonWriter *w, const AssignmentExpression *ae, PrintSeq *q) {
+    json_lit(w, "\"operator\":\""); print_escaped(w, ast_operator_str(ae->operator)); json_lit(w, "\",");
+    json_lit(w, "\"left\":"); seq_node(q, ae->left);
+    seq_lit(q, ",\"right\":"); seq_node(q, ae->right);
 }
 
-static void print_unary_expression(const UnaryExpression *ue) {
-    printf("\"operator\":\""); print_escaped(ue->operator); printf("\",");
-    printf("\"prefix\":%d,\"argument\":", ue->prefix);
-    print_node(ue->argument);
+static void print_unary_expression(JsonWriter *w, const UnaryExpression *ue, PrintSeq *q) {
+    json_lit(w, "\"operator\":\""); print_escaped(w, ast_operator_str(ue->operator)); json_lit(w, "\",");
+    json_lit(w, "\"prefix\":"); json_int(w, ue->prefix); json_lit(w, ",\"argument\":");
+    seq_node(q, ue->argument);
 }
 
-static void print_object_expression(const ObjectExpression *obj) {
-    printf("\"properties\":[");
-    for (size_t i = 0; i < obj->properties.count; ++i) {
-        if (i) printf(",");
-        print_node(obj->properties.items[i]);
-    }
-    printf("]");
+static void print_object_expression(JsonWriter *w, const ObjectExpression *obj, PrintSeq *q) {
+    json_lit(w, "\"properties\":");
+    seq_list(q, &obj->properties);
 }
 
-static void print_property(const Property *prop) {
-    printf("\"key\":"); print_node(prop->key);
-    printf(",\"value\":"); print_node(prop->value);
-    printf(",\"computed\":%d", prop->computed);
+static void print_property(JsonWriter *w, const Property *prop, PrintSeq *q) {
+    json_lit(w, "\"key\":"); seq_node(q, prop->key);
+    seq_lit(q, ",\"value\":"); seq_node(q, prop->value);
+    seq_lit(q, ",\"computed\":"); seq_add(q, PRINT_INT, NULL, (size_t)prop->computed);
 }
 
-static void print_array_expression(const ArrayExpression *arr) {
-    printf("\"elements\":[");
-    for (size_t i = 0; i < arr->elements.count; ++i) {
-        if (i) printf(",");
-        if (arr->elements.items[i]) print_node(arr->elements.items[i]);
-        else printf("null");
-    }
-    printf("]");
+static void print_array_expression(JsonWriter *w, const ArrayExpression *arr, PrintSeq *q) {
+    json_lit(w, "\"elements\":");
+    seq_list(q, &arr->elements);
 }
 
-static void print_member_expression(const MemberExpression *me) {
-    printf("\"object\":"); print_node(me->object);
-    printf(",\"property\":"); print_node(me->property);
-    printf(",\"computed\":%d", me->computed);
+static void print_member_expression(JsonWriter *w, const MemberExpression *me, PrintSeq *q) {
+    json_lit(w, "\"object\":"); seq_node(q, me->object);
+    seq_lit(q, ",\"property\":"); seq_node(q, me->property);
+    seq_lit(q, ",\"computed\":"); seq_add(q, PRINT_INT, NULL, (size_t)me->computed);
 }
 
-static void print_call_expression(const CallExpression *ce) {
-    printf("\"callee\":"); print_node(ce->callee);
-    printf(",\"arguments\":[");
-    for (size_t i = 0; i < ce->arguments.count; ++i) {
-        if (i) printf(",");
-        print_node(ce->arguments.items[i]);
-    }
-    printf("]");
+static void print_call_expression(JsonWriter *w, const CallExpression *ce, PrintSeq *q) {
+    json_lit(w, "\"callee\":"); seq_node(q, ce->callee);
+    seq_lit(q, ",\"arguments\":");
+    seq_list(q, &ce->arguments);
 }
 
-static void print_function_body(const FunctionBody *fb) {
-    if (fb->name) { printf("\"id\":{\"type\":\"Identifier\",\"name\":\""); print_escaped(fb->name); printf("\"},"); }
-    else { printf("\"id\":null,"); }
-    printf("\"params\":[");
-    for (size_t i = 0; i < fb->params.count; ++i) {
-        if (i) printf(",");
-        print_node(fb->params.items[i]);
-    }
-    printf("],\"body\":");
-    if (fb->body) print_node(fb->body); else printf("null");
+static void print_function_body(JsonWriter *w, const FunctionBody *fb, PrintSeq *q) {
+    if (fb->name) { json_lit(w, "\"id\":{\"type\":\"Identifier\",\"name\":\""); print_escaped(w, fb->name); json_lit(w, "\"},"); }
+    else { json_lit(w, "\"id\":null,"); }
+    json_lit(w, "\"params\":");
+    seq_list(q, &fb->params);
+    seq_lit(q, ",\"body\":");
+    seq_node(q, fb->body);
 }
 
-static void print_block_statement(const BlockStatement *bs) {
-    printf("\"body\":[");
-    for (size_t i = 0; i < bs->body.count; ++i) {
-        if (i) printf(",");
-        print_node(bs->body.items[i]);
-    }
-    printf("]");
+static void print_block_statement(JsonWriter *w, const BlockStatement *bs, PrintSeq *q) {
+    json_lit(w, "\"body\":");
+    seq_list(q, &bs->body);
 }
 
-static void print_if_statement(const IfStatement *is) {
-    printf("\"test\":"); print_node(is->test);
-    printf(",\"consequent\":"); print_node(is->consequent);
-    printf(",\"alternate\":"); if (is->alternate) print_node(is->alternate); else printf("null");
+static void print_if_statement(JsonWriter *w, const IfStatement *is, PrintSeq *q) {
+    json_lit(w, "\"test\":"); seq_node(q, is->test);
+    seq_lit(q, ",\"consequent\":"); seq_node(q, is->consequent);
+    seq_lit(q, ",\"alternate\":"); seq_node(q, is->alternate);
 }
 
-static void print_while_statement(const WhileStatement *ws) {
-    printf("\"test\":"); print_node(ws->test);
-    printf(",\"body\":"); print_node(ws->body);
+static void print_while_statement(JsonWriter *w, const WhileStatement *ws, PrintSeq *q) {
+    json_lit(w, "\"test\":"); seq_node(q, ws->test);
+    seq_lit(q, ",\"body\":"); seq_node(q, ws->body);
 }
 
-static void print_do_while_statement(const DoWhileStatement *dws) {
-    printf("\"body\":"); print_node(dws->body);
-    printf(",\"test\":"); print_node(dws->test);
+static void print_do_while_statement(JsonWriter *w, const DoWhileStatement *dws, PrintSeq *q) {
+    json_lit(w, "\"body\":"); seq_node(q, dws->body);
+    seq_lit(q, ",\"test\":"); seq_node(q, dws->test);
 }
 
-static void print_for_statement(const ForStatement *fs) {
-    printf("\"init\":"); if (fs->init) print_node(fs->init); else printf("null");
-    printf(",\"test\":"); if (fs->test) print_node(fs->test); else printf("null");
-    printf(",\"update\":"); if (fs->update) print_node(fs->update); else printf("null");
-    printf(",\"body\":"); print_node(fs->body);
+static void print_for_statement(JsonWriter *w, const ForStatement *fs, PrintSeq *q) {
+    json_lit(w, "\"init\":"); seq_node(q, fs->init);
+    seq_lit(q, ",\"test\":"); seq_node(q, fs->test);
+    seq_lit(q, ",\"update\":"); seq_node(q, fs->update);
+    seq_lit(q, ",\"body\":"); seq_node(q, fs->body);
 }
 
-static void print_switch_statement(const SwitchStatement *ss) {
-    printf("\"discriminant\":"); print_node(ss->discriminant);
-    printf(",\"cases\":[");
-    for (size_t i = 0; i < ss->cases.count; ++i) {
-        if (i) printf(",");
-        print_node(ss->cases.items[i]);
-    }
-    printf("]");
+static void print_switch_statement(JsonWriter *w, const SwitchStatement *ss, PrintSeq *q) {
+    json_lit(w, "\"discriminant\":"); seq_node(q, ss->discriminant);
+    seq_lit(q, ",\"cases\":");
+    seq_list(q, &ss->cases);
 }
 
-static void print_switch_case(const SwitchCase *sc) {
-    printf("\"test\":"); if (sc->test) print_node(sc->test); else printf("null");
-    printf(",\"consequent\":[");
-    for (size_t i = 0; i < sc->consequent.count; ++i) {
-        if (i) printf(",");
-        print_node(sc->consequent.items[i]);
-    }
-    printf("]");
+static void print_switch_case(JsonWriter *w, const SwitchCase *sc, PrintSeq *q) {
+    json_lit(w, "\"test\":"); seq_node(q, sc->test);
+    seq_lit(q, ",\"consequent\":");
+    seq_list(q, &sc->consequent);
 }
 
-static void print_try_statement(const TryStatement *ts) {
-    printf("\"block\":"); print_node(ts->block);
-    printf(",\"handlers\":[");
-    for (size_t i = 0; i < ts->handlers.count; ++i) {
-        if (i) printf(",");
-        print_node(ts->handlers.items[i]);
-    }
-    printf("],\"finalizer\":"); if (ts->finalizer) print_node(ts->finalizer); else printf("null");
+static void print_try_statement(JsonWriter *w, const TryStatement *ts, PrintSeq *q) {
+    json_lit(w, "\"block\":"); seq_node(q, ts->block);
+    seq_lit(q, ",\"handlers\":");
+    seq_list(q, &ts->handlers);
+    seq_lit(q, ",\"finalizer\":"); seq_node(q, ts->finalizer);
 }
 
-static void print_catch_clause(const CatchClause *cc) {
-    printf("\"param\":"); if (cc->param) print_node(cc->param); else printf("null");
-    printf(",\"body\":"); print_node(cc->body);
+static void print_catch_clause(JsonWriter *w, const CatchClause *cc, PrintSeq *q) {
+    json_lit(w, "\"param\":"); seq_node(q, cc->param);
+    seq_lit(q, ",\"body\":"); seq_node(q, cc->body);
 }
 
-static void print_throw_statement(const ThrowStatement *ts) {
-    printf("\"argument\":"); print_node(ts->argument);
+static void print_throw_statement(JsonWriter *w, const ThrowStatement *ts, PrintSeq *q) {
+    json_lit(w, "\"argument\":"); seq_node(q, ts->argument);
 }
 
-static void print_return_statement(const ReturnStatement *rs) {
-    printf("\"argument\":"); if (rs->argument) print_node(rs->argument); else printf("null");
+static void print_return_statement(JsonWriter *w, const ReturnStatement *rs, PrintSeq *q) {
+    json_lit(w, "\"argument\":"); seq_node(q, rs->argument);
 }
 
-static void print_break_statement(const BreakStatement *bs) {
+static void print_break_statement(JsonWriter *w, const BreakStatement *bs) {
     (void)bs;
-    printf("\"label\":null");
+    json_lit(w, "\"label\":null");
 }
 
-static void print_continue_statement(const ContinueStatement *cs) {
+static void print_continue_statement(JsonWriter *w, const ContinueStatement *cs) {
     (void)cs;
-    printf("\"label\":null");
+    json_lit(w, "\"label\":null");
 }
 
-static void print_import_declaration(const ImportDeclaration *id) {
-    printf("\"specifiers\":[");
-    for (size_t i = 0; i < id->specifiers.count; ++i) {
-        if (i) printf(",");
-        print_node(id->specifiers.items[i]);
-    }
-    printf("],\"source\":\""); print_escaped(id->source); printf("\"");
+static void print_import_declaration(JsonWriter *w, const ImportDeclaration *id, PrintSeq *q) {
+    json_lit(w, "\"specifiers\":");
+    seq_list(q, &id->specifiers);
+    seq_lit(q, ",\"source\":\""); seq_add(q, PRINT_ESCAPED, id->source, 0); seq_lit(q, "\"");
 }
 
-static void print_import_specifier(const ImportSpecifier *is) {
-    printf("\"imported\":"); print_node(is->imported);
-    printf(",\"local\":"); print_node(is->local);
+static void print_import_specifier(JsonWriter *w, const ImportSpecifier *is, PrintSeq *q) {
+    json_lit(w, "\"imported\":"); seq_node(q, is->imported);
+    seq_lit(q, ",\"local\":"); seq_node(q, is->local);
 }
 
-static void print_import_default_specifier(const ImportDefaultSpecifier *ids) {
-    printf("\"local\":"); print_node(ids->local);
+static void print_import_default_specifier(JsonWriter *w, const ImportDefaultSpecifier *ids, PrintSeq *q) {
+    json_lit(w, "\"local\":"); seq_node(q, ids->local);
 }
 
-static void print_import_namespace_specifier(const ImportNamespaceSpecifier *ins) {
-    printf("\"local\":"); print_node(ins->local);
+static void print_import_namespace_specifier(JsonWriter *w, const ImportNamespaceSpecifier *ins, PrintSeq *q) {
+    json_lit(w, "\"local\":"); seq_node(q, ins->local);
 }
 
-static void print_export_named_declaration(const ExportNamedDeclaration *end) {
-    printf("\"specifiers\":[");
-    for (size_t i = 0; i < end->specifiers.count; ++i) {
-        if (i) printf(",");
-        print_node(end->specifiers.items[i]);
-    }
-    printf("],\"source\":"); if (end->source) { printf("\""); print_escaped(end->source); printf("\""); } else printf("null");
-    printf(",\"declaration\":"); if (end->declaration) print_node(end->declaration); else printf("null");
+static void print_export_named_declaration(JsonWriter *w, const ExportNamedDeclaration *end, PrintSeq *q) {
+    json_lit(w, "\"specifiers\":");
+    seq_list(q, &end->specifiers);
+    if (end->source) { seq_lit(q, ",\"source\":\""); seq_add(q, PRINT_ESCAPED, end->source, 0); seq_lit(q, "\""); }
+    else seq_lit(q, ",\"source\":null");
+    seq_lit(q, ",\"declaration\":"); seq_node(q, end->declaration);
 }
 
-static void print_export_default_declaration(const ExportDefaultDeclaration *edd) {
-    printf("\"declaration\":"); if (edd->declaration) print_node(edd->declaration); else printf("null");
-    printf(",\"expression\":"); if (edd->expression) print_node(edd->expression); else printf("null");
+static void print_export_default_declaration(JsonWriter *w, const ExportDefaultDeclaration *edd, PrintSeq *q) {
+    json_lit(w, "\"declaration\":"); seq_node(q, edd->declaration);
+    seq_lit(q, ",\"expression\":"); seq_node(q, edd->expression);
 }
 
 // Phase 2: Modern Feature Print Functions
-static void print_arrow_function_expression(const ArrowFunctionExpression *afe) {
-    printf("\"async\":%s", afe->is_async ? "true" : "false");
-    printf(",\"params\":[");
-    for (size_t i = 0; i < afe->params.count; ++i) {
-        if (i) printf(",");
-        print_node(afe->params.items[i]);
-    }
-    printf("],\"body\":");
-    if (afe->body) print_node(afe->body); else printf("null");
+static void print_arrow_function_expression(JsonWriter *w, const ArrowFunctionExpression *afe, PrintSeq *q) {
+    json_lit(w, "\"async\":"); json_bool(w, afe->is_async);
+    json_lit(w, ",\"params\":");
+    seq_list(q, &afe->params);
+    seq_lit(q, ",\"body\":");
+    seq_node(q, afe->body);
 }
 
-static void print_template_literal(const TemplateLiteral *tl) {
-    printf("\"quasis\":[");
-    for (size_t i = 0; i < tl->quasis.count; ++i) {
-        if (i) printf(",");
-        print_node(tl->quasis.items[i]);
-    }
-    printf("],\"expressions\":[");
-    for (size_t i = 0; i < tl->expressions.count; ++i) {
-        if (i) printf(",");
-        print_node(tl->expressions.items[i]);
-    }
-    printf("]");
+static void print_template_literal(JsonWriter *w, const TemplateLiteral *tl, PrintSeq *q) {
+    json_lit(w, "\"quasis\":");
+    seq_list(q, &tl->quasis);
+    seq_lit(q, ",\"expressions\":");
+    seq_list(q, &tl->expressions);
 }
 
-static void print_template_element(const TemplateElement *te) {
-    printf("\"value\":{\"raw\":\""); print_escaped(te->value); printf("\"}");
-    printf(",\"tail\":%s", te->tail ? "true" : "false");
+static void print_template_element(JsonWriter *w, const TemplateElement *te) {
+    json_lit(w, "\"value\":{\"raw\":\""); print_escaped(w, te->value); json_char(w, '"');
+    json_lit(w, ",\"cooked\":");
+    if (te->cooked) { json_char(w, '"'); json_escaped(w, te->cooked, te->cooked_length); json_char(w, '"'); } else json_lit(w, "null");
+    json_char(w, '}');
+    json_lit(w, ",\"tail\":"); json_bool(w, te->tail);
 }
 
-static void print_spread_element(const SpreadElement *se) {
-    printf("\"argument\":"); if (se->argument) print_node(se->argument); else printf("null");
+static void print_spread_element(JsonWriter *w, const SpreadElement *se, PrintSeq *q) {
+    json_lit(w, "\"argument\":"); seq_node(q, se->argument);
 }
 
-static void print_rest_element(const RestElement *re) {
-    printf("\"argument\":"); if (re->argument) print_node(re->argument); else printf("null");
+static void print_rest_element(JsonWriter *w, const RestElement *re, PrintSeq *q) {
+    json_lit(w, "\"argument\":"); seq_node(q, re->argument);
 }
 
-static void print_for_of_statement(const ForOfStatement *fos) {
-    printf("\"left\":"); if (fos->left) print_node(fos->left); else printf("null");
-    printf(",\"right\":"); if (fos->right) print_node(fos->right); else printf("null");
-    printf(",\"body\":"); if (fos->body) print_node(fos->body); else printf("null");
-    printf(",\"await\":false"); // TODO: Add await support if needed
+static void print_object_pattern(JsonWriter *w, const ObjectPattern *op, PrintSeq *q) {
+    json_lit(w, "\"properties\":");
+    seq_list(q, &op->properties);
 }
 
-static void print_for_in_statement(const ForInStatement *fis) {
-    printf("\"left\":"); if (fis->left) print_node(fis->left); else printf("null");
-    printf(",\"right\":"); if (fis->right) print_node(fis->right); else printf("null");
-    printf(",\"body\":"); if (fis->body) print_node(fis->body); else printf("null");
+static void print_array_pattern(JsonWriter *w, const ArrayPattern *ap, PrintSeq *q) {
+    json_lit(w, "\"elements\":");
+    seq_list(q, &ap->elements);
 }
 
-static void print_class_declaration(const ClassDeclaration *cd) {
-    printf("\"id\":"); if (cd->id) print_node(cd->id); else printf("null");
-    printf(",\"superClass\":"); if (cd->superClass) print_node(cd->superClass); else printf("null");
-    printf(",\"body\":{\"type\":\"ClassBody\",\"body\":[");
-    for (size_t i = 0; i < cd->body.count; ++i) {
-        if (i) printf(",");
-        print_node(cd->body.items[i]);
-    }
-    printf("]}");
+static void print_assignment_pattern(JsonWriter *w, const AssignmentPattern *ap, PrintSeq *q) {
+    json_lit(w, "\"left\":"); seq_node(q, ap->left);
+    seq_lit(q, ",\"right\":"); seq_node(q, ap->right);
 }
 
-static void print_class_expression(const ClassExpression *ce) {
-    printf("\"id\":"); if (ce->id) print_node(ce->id); else printf("null");
-    printf(",\"superClass\":"); if (ce->superClass) print_node(ce->superClass); else printf("null");
-    printf(",\"body\":{\"type\":\"ClassBody\",\"body\":[");
-    for (size_t i = 0; i < ce->body.count; ++i) {
-        if (i) printf(",");
-        print_node(ce->body.items[i]);
-    }
-    printf("]}");
+static void print_await_expression(JsonWriter *w, const AwaitExpression *ae, PrintSeq *q) {
+    json_lit(w, "\"argument\":"); seq_node(q, ae->argument);
 }
 
-static void print_method_definition(const MethodDefinition *md) {
-    printf("\"kind\":\"");
+static void print_for_of_statement(JsonWriter *w, const ForOfStatement *fos, PrintSeq *q) {
+    json_lit(w, "\"left\":"); seq_node(q, fos->left);
+    seq_lit(q, ",\"right\":"); seq_node(q, fos->right);
+    seq_lit(q, ",\"body\":"); seq_node(q, fos->body);
+    seq_lit(q, ",\"await\":false"); // TODO: Add await support if needed
+}
+
+static void print_for_in_statement(JsonWriter *w, const ForInStatement *fis, PrintSeq *q) {
+    json_lit(w, "\"left\":"); seq_node(q, fis->left);
+    seq_lit(q, ",\"right\":"); seq_node(q, fis->right);
+    seq_lit(q, ",\"body\":"); seq_node(q, fis->body);
+}
+
+static void print_class_declaration(JsonWriter *w, const ClassDeclaration *cd, PrintSeq *q) {
+    json_lit(w, "\"id\":"); seq_node(q, cd->id);
+    seq_lit(q, ",\"superClass\":"); seq_node(q, cd->superClass);
+    seq_lit(q, ",\"body\":{\"type\":\"ClassBody\",\"body\":");
+    seq_list(q, &cd->body);
+    seq_lit(q, "}");
+}
+
+static void print_class_expression(JsonWriter *w, const ClassExpression *ce, PrintSeq *q) {
+    json_lit(w, "\"id\":"); seq_node(q, ce->id);
+    seq_lit(q, ",\"superClass\":"); seq_node(q, ce->superClass);
+    seq_lit(q, ",\"body\":{\"type\":\"ClassBody\",\"body\":");
+    seq_list(q, &ce->body);
+    seq_lit(q, "}");
+}
+
+static void print_method_definition(JsonWriter *w, const MethodDefinition *md, PrintSeq *q) {
+    json_lit(w, "\"kind\":\"");
     if (md->kind) {
-        print_escaped(md->kind);
+        print_escaped(w, md->kind);
     } else {
-        printf("method");
+        json_lit(w, "method");
     }
-    printf("\",\"key\":"); if (md->key) print_node(md->key); else printf("null");
-    printf(",\"value\":"); if (md->value) print_node(md->value); else printf("null");
-    printf(",\"static\":%s", md->is_static ? "true" : "false");
+    json_lit(w, "\",\"key\":"); seq_node(q, md->key);
+    seq_lit(q, ",\"value\":"); seq_node(q, md->value);
+    seq_lit(q, ",\"static\":"); seq_add(q, PRINT_BOOL, NULL, (size_t)md->is_static);
 }
 
-static void print_error(const ErrorNode *er) {
-    printf("\"message\":\""); print_escaped(er->message); printf("\"");
+static void print_error(JsonWriter *w, const ErrorNode *er) {
+    json_lit(w, "\"message\":\""); print_escaped(w, er->message); json_char(w, '"');
 }
 
-static void print_node(const AstNode *n) {
-    if (!n) { printf("null"); return; }
-    printf("{");
-    const char *type = "Unknown";
+// `{"type":"<name>","start":` as one fragment per node type
+#define NODE_HEAD(name) \
+    case AST_##name: json_lit(w, "{\"type\":\"" #name "\",\"start\":"); break
+
+// Write n's head and leading fields; queue the rest, with its closing
+// brace, in q.
+static void print_node(JsonWriter *w, const AstNode *n, PrintSeq *q) {
     switch (n->type) {
-        case AST_Program: type = "Program"; break;
-        case AST_VariableDeclaration: type = "VariableDeclaration"; break;
-        case AST_VariableDeclarator: type = "VariableDeclarator"; break;
-        case AST_Identifier: type = "Identifier"; break;
-        case AST_Literal: type = "Literal"; break;
-        case AST_ExpressionStatement: type = "ExpressionStatement"; break;
-        case AST_UpdateExpression: type = "UpdateExpression"; break;
-        case AST_BinaryExpression: type = "BinaryExpression"; break;
-        case AST_AssignmentExpression: type = "AssignmentExpression"; break;
-        case AST_UnaryExpression: type = "UnaryExpression"; break;
-        case AST_ObjectExpression: type = "ObjectExpression"; break;
-        case AST_Property: type = "Property"; break;
-        case AST_ArrayExpression: type = "ArrayExpression"; break;
-        case AST_MemberExpression: type = "MemberExpression"; break;
-        case AST_CallExpression: type = "CallExpression"; break;
-        case AST_FunctionDeclaration: type = "FunctionDeclaration"; break;
-        case AST_FunctionExpression: type = "FunctionExpression"; break;
-        case AST_BlockStatement: type = "BlockStatement"; break;
-        case AST_IfStatement: type = "IfStatement"; break;
-        case AST_WhileStatement: type = "WhileStatement"; break;
-        case AST_DoWhileStatement: type = "DoWhileStatement"; break;
-        case AST_ForStatement: type = "ForStatement"; break;
-        case AST_SwitchStatement: type = "SwitchStatement"; break;
-        case AST_SwitchCase: type = "SwitchCase"; break;
-        case AST_TryStatement: type = "TryStatement"; break;
-        case AST_CatchClause: type = "CatchClause"; break;
-        case AST_ThrowStatement: type = "ThrowStatement"; break;
-        case AST_ReturnStatement: type = "ReturnStatement"; break;
-        case AST_BreakStatement: type = "BreakStatement"; break;
-        case AST_ContinueStatement: type = "ContinueStatement"; break;
-        case AST_ImportDeclaration: type = "ImportDeclaration"; break;
-        case AST_ImportSpecifier: type = "ImportSpecifier"; break;
-        case AST_ImportDefaultSpecifier: type = "ImportDefaultSpecifier"; break;
-        case AST_ImportNamespaceSpecifier: type = "ImportNamespaceSpecifier"; break;
-        case AST_ExportNamedDeclaration: type = "ExportNamedDeclaration"; break;
-        case AST_ExportDefaultDeclaration: type = "ExportDefaultDeclaration"; break;
-        case AST_Error: type = "Error"; break;
+        NODE_HEAD(Program);
+        NODE_HEAD(VariableDeclaration);
+        NODE_HEAD(VariableDeclarator);
+        NODE_HEAD(Identifier);
+        NODE_HEAD(Literal);
+        NODE_HEAD(ExpressionStatement);
+        NODE_HEAD(UpdateExpression);
+        NODE_HEAD(BinaryExpression);
+        NODE_HEAD(AssignmentExpression);
+        NODE_HEAD(UnaryExpression);
+        NODE_HEAD(ObjectExpression);
+        NODE_HEAD(Property);
+        NODE_HEAD(ArrayExpression);
+        NODE_HEAD(MemberExpression);
+        NODE_HEAD(CallExpression);
+        NODE_HEAD(FunctionDeclaration);
+        NODE_HEAD(FunctionExpression);
+        NODE_HEAD(BlockStatement);
+        NODE_HEAD(IfStatement);
+        NODE_HEAD(WhileStatement);
+        NODE_HEAD(DoWhileStatement);
+        NODE_HEAD(ForStatement);
+        NODE_HEAD(SwitchStatement);
+        NODE_HEAD(SwitchCase);
+        NODE_HEAD(TryStatement);
+        NODE_HEAD(CatchClause);
+        NODE_HEAD(ThrowStatement);
+        NODE_HEAD(ReturnStatement);
+        NODE_HEAD(BreakStatement);
+        NODE_HEAD(ContinueStatement);
+        NODE_HEAD(ImportDeclaration);
+        NODE_HEAD(ImportSpecifier);
+        NODE_HEAD(ImportDefaultSpecifier);
+        NODE_HEAD(ImportNamespaceSpecifier);
+        NODE_HEAD(ExportNamedDeclaration);
+        NODE_HEAD(ExportDefaultDeclaration);
+        NODE_HEAD(Error);
         // Phase 2: Modern Features
-        case AST_ArrowFunctionExpression: type = "ArrowFunctionExpression"; break;
-        case AST_TemplateLiteral: type = "TemplateLiteral"; break;
-        case AST_TemplateElement: type = "TemplateElement"; break;
-        case AST_SpreadElement: type = "SpreadElement"; break;
-        case AST_ObjectPattern: type = "ObjectPattern"; break;
-        case AST_ArrayPattern: type = "ArrayPattern"; break;
-        case AST_AssignmentPattern: type = "AssignmentPattern"; break;
-        case AST_RestElement: type = "RestElement"; break;
-        case AST_ForOfStatement: type = "ForOfStatement"; break;
-        case AST_ForInStatement: type = "ForInStatement"; break;
-        case AST_ClassDeclaration: type = "ClassDeclaration"; break;
-        case AST_ClassExpression: type = "ClassExpression"; break;
-        case AST_MethodDefinition: type = "MethodDefinition"; break;
-        case AST_AwaitExpression: type = "AwaitExpression"; break;
-        case AST_YieldExpression: type = "YieldExpression"; break;
-        case AST_Super: type = "Super"; break;
-        case AST_ThisExpression: type = "ThisExpression"; break;
-        default: break;
+        NODE_HEAD(ArrowFunctionExpression);
+        NODE_HEAD(TemplateLiteral);
+        NODE_HEAD(TemplateElement);
+        NODE_HEAD(SpreadElement);
+        NODE_HEAD(ObjectPattern);
+        NODE_HEAD(ArrayPattern);
+        NODE_HEAD(AssignmentPattern);
+        NODE_HEAD(RestElement);
+        NODE_HEAD(ForOfStatement);
+        NODE_HEAD(ForInStatement);
+        NODE_HEAD(ClassDeclaration);
+        NODE_HEAD(ClassExpression);
+        NODE_HEAD(MethodDefinition);
+        NODE_HEAD(AwaitExpression);
+        NODE_HEAD(YieldExpression);
+        NODE_HEAD(Super);
+        NODE_HEAD(ThisExpression);
+        default: json_lit(w, "{\"type\":\"Unknown\",\"start\":"); break;
     }
-    printf("\"type\":\"%s\",", type);
-    print_pos("start", n->start);
-    printf(",");
-    print_pos("end", n->end);
-    printf(",");
+    print_pos(w, n->start);
+    json_lit(w, ",\"end\":");
+    print_pos(w, n->end);
+    json_char(w, ',');
+    q->count = 0;
     switch (n->type) {
-        case AST_Program: print_program((const Program *)n->data); break;
-        case AST_VariableDeclaration: print_variable_declaration((const VariableDeclaration *)n->data); break;
-        case AST_VariableDeclarator: print_variable_declarator((const VariableDeclarator *)n->data); break;
-        case AST_Identifier: print_identifier((const Identifier *)n->data); break;
-        case AST_Literal: print_literal((const Literal *)n->data); break;
-        case AST_ExpressionStatement: print_expression_statement((const ExpressionStatement *)n->data); break;
-        case AST_UpdateExpression: print_update_expression((const UpdateExpression *)n->data); break;
-        case AST_BinaryExpression: print_binary_expression((const BinaryExpression *)n->data); break;
-        case AST_AssignmentExpression: print_assignment_expression((const AssignmentExpression *)n->data); break;
-        case AST_UnaryExpression: print_unary_expression((const UnaryExpression *)n->data); break;
-        case AST_ObjectExpression: print_object_expression((const ObjectExpression *)n->data); break;
-        case AST_Property: print_property((const Property *)n->data); break;
-        case AST_ArrayExpression: print_array_expression((const ArrayExpression *)n->data); break;
-        case AST_MemberExpression: print_member_expression((const MemberExpression *)n->data); break;
-        case AST_CallExpression: print_call_expression((const CallExpression *)n->data); break;
-        case AST_FunctionDeclaration: print_function_body((const FunctionBody *)n->data); break;
-        case AST_FunctionExpression: print_function_body((const FunctionBody *)n->data); break;
-        case AST_BlockStatement: print_block_statement((const BlockStatement *)n->data); break;
-        case AST_IfStatement: print_if_statement((const IfStatement *)n->data); break;
-        case AST_WhileStatement: print_while_statement((const WhileStatement *)n->data); break;
-        case AST_DoWhileStatement: print_do_while_statement((const DoWhileStatement *)n->data); break;
-        case AST_ForStatement: print_for_statement((const ForStatement *)n->data); break;
-        case AST_SwitchStatement: print_switch_statement((const SwitchStatement *)n->data); break;
-        case AST_SwitchCase: print_switch_case((const SwitchCase *)n->data); break;
-        case AST_TryStatement: print_try_statement((const TryStatement *)n->data); break;
-        case AST_CatchClause: print_catch_clause((const CatchClause *)n->data); break;
-        case AST_ThrowStatement: print_throw_statement((const ThrowStatement *)n->data); break;
-        case AST_ReturnStatement: print_return_statement((const ReturnStatement *)n->data); break;
-        case AST_BreakStatement: print_break_statement((const BreakStatement *)n->data); break;
-        case AST_ContinueStatement: print_continue_statement((const ContinueStatement *)n->data); break;
-        case AST_ImportDeclaration: print_import_declaration((const ImportDeclaration *)n->data); break;
-        case AST_ImportSpecifier: print_import_specifier((const ImportSpecifier *)n->data); break;
-        case AST_ImportDefaultSpecifier: print_import_default_specifier((const ImportDefaultSpecifier *)n->data); break;
-        case AST_ImportNamespaceSpecifier: print_import_namespace_specifier((const ImportNamespaceSpecifier *)n->data); break;
-        case AST_ExportNamedDeclaration: print_export_named_declaration((const ExportNamedDeclaration *)n->data); break;
-        case AST_ExportDefaultDeclaration: print_export_default_declaration((const ExportDefaultDeclaration *)n->data); break;
-        case AST_Error: print_error((const ErrorNode *)n->data); break;
+        case AST_Program: print_program(w, (const Program *)n->data, q); break;
+        case AST_VariableDeclaration: print_variable_declaration(w, (const VariableDeclaration *)n->data, q); break;
+        case AST_VariableDeclarator: print_variable_declarator(w, (const VariableDeclarator *)n->data, q); break;
+        case AST_Identifier: print_identifier(w, (const Identifier *)n->data); break;
+        case AST_Literal: print_literal(w, (const Literal *)n->data); break;
+        case AST_ExpressionStatement: print_expression_statement(w, (const ExpressionStatement *)n->data, q); break;
+        case AST_UpdateExpression: print_update_expression(w, (const UpdateExpression *)n->data, q); break;
+        case AST_BinaryExpression: print_binary_expression(w, (const BinaryExpression *)n->data, q); break;
+        case AST_AssignmentExpression: print_assignment_expression(w, (const AssignmentExpression *)n->data, q); break;
+        case AST_UnaryExpression: print_unary_expression(w, (const UnaryExpression *)n->data, q); break;
+        case AST_ObjectExpression: print_object_expression(w, (const ObjectExpression *)n->data, q); break;
+        case AST_Property: print_property(w, (const Property *)n->data, q); break;
+        case AST_ArrayExpression: print_array_expression(w, (const ArrayExpression *)n->data, q); break;
+        case AST_MemberExpression: print_member_expression(w, (const MemberExpression *)n->data, q); break;
+        case AST_CallExpression: print_call_expression(w, (const CallExpression *)n->data, q); break;
+        case AST_FunctionDeclaration: print_function_body(w, (const FunctionBody *)n->data, q); break;
+        case AST_FunctionExpression: print_function_body(w, (const FunctionBody *)n->data, q); break;
+        case AST_BlockStatement:
+            ast_materialize_body((AstNode *)n);
+            print_block_statement(w, (const BlockStatement *)n->data, q);
+            break;
+        case AST_IfStatement: print_if_statement(w, (const IfStatement *)n->data, q); break;
+        case AST_WhileStatement: print_while_statement(w, (const WhileStatement *)n->data, q); break;
+        case AST_DoWhileStatement: print_do_while_statement(w, (const DoWhileStatement *)n->data, q); break;
+        case AST_ForStatement: print_for_statement(w, (const ForStatement *)n->data, q); break;
+        case AST_SwitchStatement: print_switch_statement(w, (const SwitchStatement *)n->data, q); break;
+        case AST_SwitchCase: print_switch_case(w, (const SwitchCase *)n->data, q); break;
+        case AST_TryStatement: print_try_statement(w, (const TryStatement *)n->data, q); break;
+        case AST_CatchClause: print_catch_clause(w, (const CatchClause *)n->data, q); break;
+        case AST_ThrowStatement: print_throw_statement(w, (const ThrowStatement *)n->data, q); break;
+        case AST_ReturnStatement: print_return_statement(w, (const ReturnStatement *)n->data, q); break;
+        case AST_BreakStatement: print_break_statement(w, (const BreakStatement *)n->data); break;
+        case AST_ContinueStatement: print_continue_statement(w, (const ContinueStatement *)n->data); break;
+        case AST_ImportDeclaration: print_import_declaration(w, (const ImportDeclaration *)n->data, q); break;
+        case AST_ImportSpecifier: print_import_specifier(w, (const ImportSpecifier *)n->data, q); break;
+        case AST_ImportDefaultSpecifier: print_import_default_specifier(w, (const ImportDefaultSpecifier *)n->data, q); break;
+        case AST_ImportNamespaceSpecifier: print_import_namespace_specifier(w, (const ImportNamespaceSpecifier *)n->data, q); break;
+        case AST_ExportNamedDeclaration: print_export_named_declaration(w, (const ExportNamedDeclaration *)n->data, q); break;
+        case AST_ExportDefaultDeclaration: print_export_default_declaration(w, (const ExportDefaultDeclaration *)n->data, q); break;
+        case AST_Error: print_error(w, (const ErrorNode *)n->data); break;
         // Phase 2: Modern Features
-        case AST_ArrowFunctionExpression: print_arrow_function_expression((const ArrowFunctionExpression *)n->data); break;
-        case AST_TemplateLiteral: print_template_literal((const TemplateLiteral *)n->data); break;
-        case AST_TemplateElement: print_template_element((const TemplateElement *)n->data); break;
-        case AST_SpreadElement: print_spread_element((const SpreadElement *)n->data); break;
-        case AST_RestElement: print_rest_element((const RestElement *)n->data); break;
-        case AST_ForOfStatement: print_for_of_statement((const ForOfStatement *)n->data); break;
-        case AST_ForInStatement: print_for_in_statement((const ForInStatement *)n->data); break;
-        case AST_ClassDeclaration: print_class_declaration((const ClassDeclaration *)n->data); break;
-        case AST_ClassExpression: print_class_expression((const ClassExpression *)n->data); break;
-        case AST_MethodDefinition: print_method_definition((const MethodDefinition *)n->data); break;
-        case AST_AwaitExpression:
-        case AST_YieldExpression: printf("\"argument\":null"); break;
+        case AST_ArrowFunctionExpression: print_arrow_function_expression(w, (const ArrowFunctionExpression *)n->data, q); break;
+        case AST_TemplateLiteral: print_template_literal(w, (const TemplateLiteral *)n->data, q); break;
+        case AST_TemplateElement: print_template_element(w, (const TemplateElement *)n->data); break;
+        case AST_SpreadElement: print_spread_element(w, (const SpreadElement *)n->data, q); break;
+        case AST_RestElement: print_rest_element(w, (const RestElement *)n->data, q); break;
+        case AST_ForOfStatement: print_for_of_statement(w, (const ForOfStatement *)n->data, q); break;
+        case AST_ForInStatement: print_for_in_statement(w, (const ForInStatement *)n->data, q); break;
+        case AST_ClassDeclaration: print_class_declaration(w, (const ClassDeclaration *)n->data, q); break;
+        case AST_ClassExpression: print_class_expression(w, (const ClassExpression *)n->data, q); break;
+        case AST_MethodDefinition: print_method_definition(w, (const MethodDefinition *)n->data, q); break;
+        case AST_AwaitExpression: print_await_expression(w, (const AwaitExpression *)n->data, q); break;
+        case AST_YieldExpression: json_lit(w, "\"argument\":null"); break;
         case AST_Super:
         case AST_ThisExpression: break; // No additional fields
-        case AST_ObjectPattern:
-        case AST_ArrayPattern:
-        case AST_AssignmentPattern: break; // TODO: Implement if needed
+        case AST_ObjectPattern: print_object_pattern(w, (const ObjectPattern *)n->data, q); break;
+        case AST_ArrayPattern: print_array_pattern(w, (const ArrayPattern *)n->data, q); break;
+        case AST_AssignmentPattern: print_assignment_pattern(w, (const AssignmentPattern *)n->data, q); break;
         default: break;
     }
-    printf("}");
+    seq_lit(q, "}");
+}
+
+typedef struct {
+    PrintPiece *items; // pieces still to print, next last
+    size_t count;
+    size_t cap;
+} PrintStack;
+
+static int print_push(PrintStack *st, const PrintPiece *pc) {
+    if (st->count == st->cap) {
+        size_t cap = st->cap ? st->cap * 2 : 256;
+        PrintPiece *grown = (PrintPiece *)realloc(st->items, cap * sizeof(PrintPiece));
+        if (!grown) return -1;
+        st->items = grown;
+        st->cap = cap;
+    }
+    st->items[st->count++] = *pc;
+    return 0;
+}
+
+// A piece that is not a node or a list.
+static void print_scalar(JsonWriter *w, const PrintPiece *pc) {
+    switch (pc->kind) {
+    case PRINT_TEXT: json_raw(w, (const char *)pc->p, pc->n); break;
+    case PRINT_INT: json_int(w, (long long)pc->n); break;
+    case PRINT_BOOL: json_bool(w, (int)pc->n); break;
+    case PRINT_ESCAPED: print_escaped(w, (const char *)pc->p); break;
+    case PRINT_DIAGNOSTICS: print_diagnostics(w, (const Program *)pc->p); break;
+    default: break;
+    }
+}
+
+// Out of memory fails the writer, dropping the rest of the output.
+static void print_tree(JsonWriter *w, const AstNode *root) {
+    PrintStack st = {NULL, 0, 0};
+    PrintSeq q;
+    PrintPiece pc = {PRINT_NODE, root, 0};
+    int rc = 0;
+    while (rc == 0) {
+        // pc is printed next; the piece it leads to, if any, replaces it
+        // without a trip through the stack
+        if (pc.kind == PRINT_NODE && pc.p) {
+            print_node(w, (const AstNode *)pc.p, &q);
+            // what precedes the first child is written now, what follows
+            // it is queued
+            size_t i = 0;
+            while (i < q.count && q.items[i].kind != PRINT_NODE && q.items[i].kind != PRINT_LIST) print_scalar(w, &q.items[i++]);
+            if (i < q.count) {
+                for (size_t k = q.count; rc == 0 && k-- > i + 1;) rc = print_push(&st, &q.items[k]);
+                pc = q.items[i];
+                continue;
+            }
+        } else if (pc.kind == PRINT_NODE) {
+            json_lit(w, "null");
+        } else if (pc.kind == PRINT_LIST) {
+            const AstVec *v = (const AstVec *)pc.p;
+            if (pc.n < v->count) {
+                if (pc.n) json_char(w, ',');
+                PrintPiece rest = {PRINT_LIST, v, pc.n + 1};
+                if (pc.n + 1 < v->count) rc = print_push(&st, &rest);
+                pc.kind = PRINT_NODE;
+                pc.p = v->items[pc.n];
+                continue;
+            }
+        } else {
+            print_scalar(w, &pc);
+        }
+        if (st.count == 0) break;
+        pc = st.items[--st.count];
+    }
+    if (rc != 0) w->failed = 1;
+    free(st.items);
+}
+
+Position ast_position(const AstNode *program, SrcOffset offset) {
+    const LineIndex *li = NULL;
+    if (program && program->type == AST_Program && program->data) li = &((const Program *)program->data)->lines;
+    return line_index_position(li, offset);
+}
+
+void ast_write_json(JsonWriter *w, const AstNode *node) {
+    const LineIndex *saved = print_lines;
+    if (node && node->type == AST_Program && node->data) print_lines = &((const Program *)node->data)->lines;
+    print_tree(w, node);
+    print_lines = saved;
 }
 
 void ast_print_json(const AstNode *node) {
-    print_node(node);
-    printf("\n");
+    JsonWriter w;
+    json_writer_init_file(&w, stdout);
+    ast_write_json(&w, node);
+    json_char(&w, '\n');
+    json_writer_close(&w);
 }
 
 static void free_node(AstNode *n);
@@ -1095,10 +1552,27 @@ static void free_node(AstNode *n);
 void ast_retain(AstNode *node) {
     if (!node) return;
     node->refcount++;
+    if (node->arena) node->arena->refs++;
 }
 
+// Arena nodes are never freed one by one. Their first reference belongs
+// to the parent (or, for the owning Program, to the arena itself); extra
+// references from ast_retain() keep the whole arena alive.
 void ast_release(AstNode *node) {
     if (!node) return;
+    AstArena *arena = node->arena;
+    if (arena) {
+        int last = --node->refcount == 0;
+        Program *p = node->type == AST_Program ? (Program *)node->data : NULL;
+        if (last && p && p->owns_arena) {
+            line_index_free(&p->lines);
+            if (arena->owner == p) arena->owner = NULL; // retained nodes may outlive it
+            ast_arena_free(arena);
+        } else if (!last) {
+            ast_arena_free(arena);
+        }
+        return;
+    }
     if (--node->refcount > 0) return;
     free_node(node);
 }
@@ -1124,7 +1598,8 @@ static AstNode *clone_node(const AstNode *n) {
     switch (n->type) {
         case AST_Program: {
             Program *orig = (Program *)n->data;
-            Program *cp = (Program *)calloc(1, sizeof(Program));
+            Program *cp = (Program *)ast_alloc(sizeof(Program));
+            cp->arena = active_arena;
             astvec_init(&cp->body);
             for (size_t i = 0; orig && i < orig->body.count; ++i) {
                 astvec_push(&cp->body, clone_node(orig->body.items[i]));
@@ -1134,13 +1609,19 @@ static AstNode *clone_node(const AstNode *n) {
                     Comment *cc = comment_clone(orig->comments[i]);
                     if (cc) commentvec_push(cp, cc);
                 }
+                for (size_t i = 0; i < orig->diagnostic_count; ++i) {
+                    const Diagnostic *d = &orig->diagnostics[i];
+                    diagnostic_push(cp, d->kind, d->start, d->end);
+                }
+                line_index_copy(&cp->lines, &orig->lines);
+                cp->lazy_bodies = orig->lazy_bodies;
             }
             c->data = cp;
             break;
         }
         case AST_VariableDeclaration: {
             VariableDeclaration *vd = (VariableDeclaration *)n->data;
-            VariableDeclaration *cvd = (VariableDeclaration *)calloc(1, sizeof(VariableDeclaration));
+            VariableDeclaration *cvd = (VariableDeclaration *)ast_alloc(sizeof(VariableDeclaration));
             if (vd) {
                 cvd->kind = vd->kind;
                 astvec_init(&cvd->declarations);
@@ -1153,7 +1634,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_VariableDeclarator: {
             VariableDeclarator *vd = (VariableDeclarator *)n->data;
-            VariableDeclarator *cvd = (VariableDeclarator *)calloc(1, sizeof(VariableDeclarator));
+            VariableDeclarator *cvd = (VariableDeclarator *)ast_alloc(sizeof(VariableDeclarator));
             if (vd) {
                 cvd->id = clone_node(vd->id);
                 cvd->init = clone_node(vd->init);
@@ -1163,34 +1644,38 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_Identifier: {
             Identifier *id = (Identifier *)n->data;
-            Identifier *cid = (Identifier *)calloc(1, sizeof(Identifier));
-            if (id && id->name) cid->name = dupstr(id->name);
+            Identifier *cid = (Identifier *)ast_alloc(sizeof(Identifier));
+            if (id && id->name) cid->name = ast_intern_n(id->name, strlen(id->name), &cid->atom);
             c->data = cid;
             break;
         }
         case AST_Literal: {
             Literal *lit = (Literal *)n->data;
-            Literal *clit = (Literal *)calloc(1, sizeof(Literal));
+            Literal *clit = (Literal *)ast_alloc(sizeof(Literal));
             if (lit) {
                 clit->kind = lit->kind;
                 clit->raw = dupstr(lit->raw);
+                clit->number = lit->number;
+                clit->bigint = lit->bigint ? dupstr(lit->bigint) : NULL;
+                clit->cooked = lit->cooked ? dupstrn(lit->cooked, lit->cooked_length) : NULL;
+                clit->cooked_length = lit->cooked_length;
             }
             c->data = clit;
             break;
         }
         case AST_ExpressionStatement: {
             ExpressionStatement *es = (ExpressionStatement *)n->data;
-            ExpressionStatement *ces = (ExpressionStatement *)calloc(1, sizeof(ExpressionStatement));
+            ExpressionStatement *ces = (ExpressionStatement *)ast_alloc(sizeof(ExpressionStatement));
             if (es) ces->expression = clone_node(es->expression);
             c->data = ces;
             break;
         }
         case AST_UpdateExpression: {
             UpdateExpression *ue = (UpdateExpression *)n->data;
-            UpdateExpression *cue = (UpdateExpression *)calloc(1, sizeof(UpdateExpression));
+            UpdateExpression *cue = (UpdateExpression *)ast_alloc(sizeof(UpdateExpression));
             if (ue) {
                 cue->prefix = ue->prefix;
-                cue->operator = dupstr(ue->operator);
+                cue->operator = ue->operator;
                 cue->argument = clone_node(ue->argument);
             }
             c->data = cue;
@@ -1198,9 +1683,9 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_BinaryExpression: {
             BinaryExpression *be = (BinaryExpression *)n->data;
-            BinaryExpression *cbe = (BinaryExpression *)calloc(1, sizeof(BinaryExpression));
+            BinaryExpression *cbe = (BinaryExpression *)ast_alloc(sizeof(BinaryExpression));
             if (be) {
-                cbe->operator = dupstr(be->operator);
+                cbe->operator = be->operator;
                 cbe->left = clone_node(be->left);
                 cbe->right = clone_node(be->right);
             }
@@ -1209,9 +1694,9 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_AssignmentExpression: {
             AssignmentExpression *ae = (AssignmentExpression *)n->data;
-            AssignmentExpression *cae = (AssignmentExpression *)calloc(1, sizeof(AssignmentExpression));
+            AssignmentExpression *cae = (AssignmentExpression *)ast_alloc(sizeof(AssignmentExpression));
             if (ae) {
-                cae->operator = dupstr(ae->operator);
+                cae->operator = ae->operator;
                 cae->left = clone_node(ae->left);
                 cae->right = clone_node(ae->right);
             }
@@ -1220,9 +1705,9 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_UnaryExpression: {
             UnaryExpression *ue = (UnaryExpression *)n->data;
-            UnaryExpression *cue = (UnaryExpression *)calloc(1, sizeof(UnaryExpression));
+            UnaryExpression *cue = (UnaryExpression *)ast_alloc(sizeof(UnaryExpression));
             if (ue) {
-                cue->operator = dupstr(ue->operator);
+                cue->operator = ue->operator;
                 cue->prefix = ue->prefix;
                 cue->argument = clone_node(ue->argument);
             }
@@ -1231,7 +1716,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ObjectExpression: {
             ObjectExpression *oe = (ObjectExpression *)n->data;
-            ObjectExpression *coe = (ObjectExpression *)calloc(1, sizeof(ObjectExpression));
+            ObjectExpression *coe = (ObjectExpression *)ast_alloc(sizeof(ObjectExpression));
             astvec_init(&coe->properties);
             if (oe) {
                 for (size_t i = 0; i < oe->properties.count; ++i) {
@@ -1243,7 +1728,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_Property: {
             Property *prop = (Property *)n->data;
-            Property *cprop = (Property *)calloc(1, sizeof(Property));
+            Property *cprop = (Property *)ast_alloc(sizeof(Property));
             if (prop) {
                 cprop->computed = prop->computed;
                 cprop->key = clone_node(prop->key);
@@ -1254,7 +1739,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ArrayExpression: {
             ArrayExpression *ae = (ArrayExpression *)n->data;
-            ArrayExpression *cae = (ArrayExpression *)calloc(1, sizeof(ArrayExpression));
+            ArrayExpression *cae = (ArrayExpression *)ast_alloc(sizeof(ArrayExpression));
             astvec_init(&cae->elements);
             if (ae) {
                 for (size_t i = 0; i < ae->elements.count; ++i) {
@@ -1266,7 +1751,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_MemberExpression: {
             MemberExpression *me = (MemberExpression *)n->data;
-            MemberExpression *cme = (MemberExpression *)calloc(1, sizeof(MemberExpression));
+            MemberExpression *cme = (MemberExpression *)ast_alloc(sizeof(MemberExpression));
             if (me) {
                 cme->computed = me->computed;
                 cme->object = clone_node(me->object);
@@ -1277,7 +1762,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_CallExpression: {
             CallExpression *ce = (CallExpression *)n->data;
-            CallExpression *cce = (CallExpression *)calloc(1, sizeof(CallExpression));
+            CallExpression *cce = (CallExpression *)ast_alloc(sizeof(CallExpression));
             astvec_init(&cce->arguments);
             if (ce) {
                 cce->callee = clone_node(ce->callee);
@@ -1291,9 +1776,9 @@ static AstNode *clone_node(const AstNode *n) {
         case AST_FunctionDeclaration:
         case AST_FunctionExpression: {
             FunctionBody *fb = (FunctionBody *)n->data;
-            FunctionBody *cfb = (FunctionBody *)calloc(1, sizeof(FunctionBody));
+            FunctionBody *cfb = (FunctionBody *)ast_alloc(sizeof(FunctionBody));
             if (fb) {
-                cfb->name = dupstr(fb->name);
+                cfb->name = intern(fb->name);
                 astvec_init(&cfb->params);
                 for (size_t i = 0; i < fb->params.count; ++i) {
                     astvec_push(&cfb->params, clone_node(fb->params.items[i]));
@@ -1305,19 +1790,23 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_BlockStatement: {
             BlockStatement *bs = (BlockStatement *)n->data;
-            BlockStatement *cbs = (BlockStatement *)calloc(1, sizeof(BlockStatement));
+            BlockStatement *cbs = (BlockStatement *)ast_alloc(sizeof(BlockStatement));
             astvec_init(&cbs->body);
             if (bs) {
                 for (size_t i = 0; i < bs->body.count; ++i) {
                     astvec_push(&cbs->body, clone_node(bs->body.items[i]));
                 }
+                // an unparsed body stays unparsed in the copy
+                cbs->lazy_source = bs->lazy_source;
+                cbs->lazy_length = bs->lazy_length;
+                cbs->lazy_async = bs->lazy_async;
             }
             c->data = cbs;
             break;
         }
         case AST_IfStatement: {
             IfStatement *is = (IfStatement *)n->data;
-            IfStatement *cis = (IfStatement *)calloc(1, sizeof(IfStatement));
+            IfStatement *cis = (IfStatement *)ast_alloc(sizeof(IfStatement));
             if (is) {
                 cis->test = clone_node(is->test);
                 cis->consequent = clone_node(is->consequent);
@@ -1328,7 +1817,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_WhileStatement: {
             WhileStatement *ws = (WhileStatement *)n->data;
-            WhileStatement *cws = (WhileStatement *)calloc(1, sizeof(WhileStatement));
+            WhileStatement *cws = (WhileStatement *)ast_alloc(sizeof(WhileStatement));
             if (ws) {
                 cws->test = clone_node(ws->test);
                 cws->body = clone_node(ws->body);
@@ -1338,7 +1827,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_DoWhileStatement: {
             DoWhileStatement *dw = (DoWhileStatement *)n->data;
-            DoWhileStatement *cdw = (DoWhileStatement *)calloc(1, sizeof(DoWhileStatement));
+            DoWhileStatement *cdw = (DoWhileStatement *)ast_alloc(sizeof(DoWhileStatement));
             if (dw) {
                 cdw->body = clone_node(dw->body);
                 cdw->test = clone_node(dw->test);
@@ -1348,7 +1837,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ForStatement: {
             ForStatement *fs = (ForStatement *)n->data;
-            ForStatement *cfs = (ForStatement *)calloc(1, sizeof(ForStatement));
+            ForStatement *cfs = (ForStatement *)ast_alloc(sizeof(ForStatement));
             if (fs) {
                 cfs->init = clone_node(fs->init);
                 cfs->test = clone_node(fs->test);
@@ -1360,7 +1849,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_SwitchStatement: {
             SwitchStatement *ss = (SwitchStatement *)n->data;
-            SwitchStatement *css = (SwitchStatement *)calloc(1, sizeof(SwitchStatement));
+            SwitchStatement *css = (SwitchStatement *)ast_alloc(sizeof(SwitchStatement));
             astvec_init(&css->cases);
             if (ss) {
                 css->discriminant = clone_node(ss->discriminant);
@@ -1373,7 +1862,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_SwitchCase: {
             SwitchCase *sc = (SwitchCase *)n->data;
-            SwitchCase *csc = (SwitchCase *)calloc(1, sizeof(SwitchCase));
+            SwitchCase *csc = (SwitchCase *)ast_alloc(sizeof(SwitchCase));
             astvec_init(&csc->consequent);
             if (sc) {
                 csc->test = clone_node(sc->test);
@@ -1386,7 +1875,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_TryStatement: {
             TryStatement *ts = (TryStatement *)n->data;
-            TryStatement *cts = (TryStatement *)calloc(1, sizeof(TryStatement));
+            TryStatement *cts = (TryStatement *)ast_alloc(sizeof(TryStatement));
             astvec_init(&cts->handlers);
             if (ts) {
                 cts->block = clone_node(ts->block);
@@ -1400,7 +1889,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_CatchClause: {
             CatchClause *cc = (CatchClause *)n->data;
-            CatchClause *ccc = (CatchClause *)calloc(1, sizeof(CatchClause));
+            CatchClause *ccc = (CatchClause *)ast_alloc(sizeof(CatchClause));
             if (cc) {
                 ccc->param = clone_node(cc->param);
                 ccc->body = clone_node(cc->body);
@@ -1410,35 +1899,35 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ThrowStatement: {
             ThrowStatement *ts = (ThrowStatement *)n->data;
-            ThrowStatement *cts = (ThrowStatement *)calloc(1, sizeof(ThrowStatement));
+            ThrowStatement *cts = (ThrowStatement *)ast_alloc(sizeof(ThrowStatement));
             if (ts) cts->argument = clone_node(ts->argument);
             c->data = cts;
             break;
         }
         case AST_ReturnStatement: {
             ReturnStatement *rs = (ReturnStatement *)n->data;
-            ReturnStatement *crs = (ReturnStatement *)calloc(1, sizeof(ReturnStatement));
+            ReturnStatement *crs = (ReturnStatement *)ast_alloc(sizeof(ReturnStatement));
             if (rs) crs->argument = clone_node(rs->argument);
             c->data = crs;
             break;
         }
         case AST_BreakStatement: {
             BreakStatement *bs = (BreakStatement *)n->data;
-            BreakStatement *cbs = (BreakStatement *)calloc(1, sizeof(BreakStatement));
+            BreakStatement *cbs = (BreakStatement *)ast_alloc(sizeof(BreakStatement));
             if (bs && bs->label) cbs->label = dupstr(bs->label);
             c->data = cbs;
             break;
         }
         case AST_ContinueStatement: {
             ContinueStatement *cs = (ContinueStatement *)n->data;
-            ContinueStatement *ccs = (ContinueStatement *)calloc(1, sizeof(ContinueStatement));
+            ContinueStatement *ccs = (ContinueStatement *)ast_alloc(sizeof(ContinueStatement));
             if (cs && cs->label) ccs->label = dupstr(cs->label);
             c->data = ccs;
             break;
         }
         case AST_ImportDeclaration: {
             ImportDeclaration *id = (ImportDeclaration *)n->data;
-            ImportDeclaration *cid = (ImportDeclaration *)calloc(1, sizeof(ImportDeclaration));
+            ImportDeclaration *cid = (ImportDeclaration *)ast_alloc(sizeof(ImportDeclaration));
             astvec_init(&cid->specifiers);
             if (id) {
                 cid->source = dupstr(id->source);
@@ -1451,7 +1940,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ImportSpecifier: {
             ImportSpecifier *is = (ImportSpecifier *)n->data;
-            ImportSpecifier *cis = (ImportSpecifier *)calloc(1, sizeof(ImportSpecifier));
+            ImportSpecifier *cis = (ImportSpecifier *)ast_alloc(sizeof(ImportSpecifier));
             if (is) {
                 cis->imported = clone_node(is->imported);
                 cis->local = clone_node(is->local);
@@ -1461,7 +1950,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ImportDefaultSpecifier: {
             ImportDefaultSpecifier *ids = (ImportDefaultSpecifier *)n->data;
-            ImportDefaultSpecifier *cids = (ImportDefaultSpecifier *)calloc(1, sizeof(ImportDefaultSpecifier));
+            ImportDefaultSpecifier *cids = (ImportDefaultSpecifier *)ast_alloc(sizeof(ImportDefaultSpecifier));
             if (ids) {
                 cids->local = clone_node(ids->local);
             }
@@ -1470,7 +1959,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ImportNamespaceSpecifier: {
             ImportNamespaceSpecifier *ins = (ImportNamespaceSpecifier *)n->data;
-            ImportNamespaceSpecifier *cins = (ImportNamespaceSpecifier *)calloc(1, sizeof(ImportNamespaceSpecifier));
+            ImportNamespaceSpecifier *cins = (ImportNamespaceSpecifier *)ast_alloc(sizeof(ImportNamespaceSpecifier));
             if (ins) {
                 cins->local = clone_node(ins->local);
             }
@@ -1479,7 +1968,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ExportNamedDeclaration: {
             ExportNamedDeclaration *en = (ExportNamedDeclaration *)n->data;
-            ExportNamedDeclaration *cen = (ExportNamedDeclaration *)calloc(1, sizeof(ExportNamedDeclaration));
+            ExportNamedDeclaration *cen = (ExportNamedDeclaration *)ast_alloc(sizeof(ExportNamedDeclaration));
             astvec_init(&cen->specifiers);
             if (en) {
                 cen->source = dupstr(en->source);
@@ -1493,7 +1982,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ExportDefaultDeclaration: {
             ExportDefaultDeclaration *ed = (ExportDefaultDeclaration *)n->data;
-            ExportDefaultDeclaration *ced = (ExportDefaultDeclaration *)calloc(1, sizeof(ExportDefaultDeclaration));
+            ExportDefaultDeclaration *ced = (ExportDefaultDeclaration *)ast_alloc(sizeof(ExportDefaultDeclaration));
             if (ed) {
                 ced->declaration = clone_node(ed->declaration);
                 ced->expression = clone_node(ed->expression);
@@ -1504,7 +1993,7 @@ static AstNode *clone_node(const AstNode *n) {
         // Phase 2: Modern Features
         case AST_ArrowFunctionExpression: {
             ArrowFunctionExpression *afe = (ArrowFunctionExpression *)n->data;
-            ArrowFunctionExpression *cafe = (ArrowFunctionExpression *)calloc(1, sizeof(ArrowFunctionExpression));
+            ArrowFunctionExpression *cafe = (ArrowFunctionExpression *)ast_alloc(sizeof(ArrowFunctionExpression));
             astvec_init(&cafe->params);
             if (afe) {
                 cafe->is_async = afe->is_async;
@@ -1518,7 +2007,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_TemplateLiteral: {
             TemplateLiteral *tl = (TemplateLiteral *)n->data;
-            TemplateLiteral *ctl = (TemplateLiteral *)calloc(1, sizeof(TemplateLiteral));
+            TemplateLiteral *ctl = (TemplateLiteral *)ast_alloc(sizeof(TemplateLiteral));
             astvec_init(&ctl->quasis);
             astvec_init(&ctl->expressions);
             if (tl) {
@@ -1534,24 +2023,26 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_TemplateElement: {
             TemplateElement *te = (TemplateElement *)n->data;
-            TemplateElement *cte = (TemplateElement *)calloc(1, sizeof(TemplateElement));
+            TemplateElement *cte = (TemplateElement *)ast_alloc(sizeof(TemplateElement));
             if (te) {
                 cte->value = dupstr(te->value);
                 cte->tail = te->tail;
+                cte->cooked = te->cooked ? dupstrn(te->cooked, te->cooked_length) : NULL;
+                cte->cooked_length = te->cooked_length;
             }
             c->data = cte;
             break;
         }
         case AST_SpreadElement: {
             SpreadElement *se = (SpreadElement *)n->data;
-            SpreadElement *cse = (SpreadElement *)calloc(1, sizeof(SpreadElement));
+            SpreadElement *cse = (SpreadElement *)ast_alloc(sizeof(SpreadElement));
             if (se) cse->argument = clone_node(se->argument);
             c->data = cse;
             break;
         }
         case AST_ObjectPattern: {
             ObjectPattern *op = (ObjectPattern *)n->data;
-            ObjectPattern *cop = (ObjectPattern *)calloc(1, sizeof(ObjectPattern));
+            ObjectPattern *cop = (ObjectPattern *)ast_alloc(sizeof(ObjectPattern));
             astvec_init(&cop->properties);
             if (op) {
                 for (size_t i = 0; i < op->properties.count; ++i) {
@@ -1563,7 +2054,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ArrayPattern: {
             ArrayPattern *ap = (ArrayPattern *)n->data;
-            ArrayPattern *cap = (ArrayPattern *)calloc(1, sizeof(ArrayPattern));
+            ArrayPattern *cap = (ArrayPattern *)ast_alloc(sizeof(ArrayPattern));
             astvec_init(&cap->elements);
             if (ap) {
                 for (size_t i = 0; i < ap->elements.count; ++i) {
@@ -1575,7 +2066,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_AssignmentPattern: {
             AssignmentPattern *ap = (AssignmentPattern *)n->data;
-            AssignmentPattern *cap = (AssignmentPattern *)calloc(1, sizeof(AssignmentPattern));
+            AssignmentPattern *cap = (AssignmentPattern *)ast_alloc(sizeof(AssignmentPattern));
             if (ap) {
                 cap->left = clone_node(ap->left);
                 cap->right = clone_node(ap->right);
@@ -1585,14 +2076,14 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_RestElement: {
             RestElement *re = (RestElement *)n->data;
-            RestElement *cre = (RestElement *)calloc(1, sizeof(RestElement));
+            RestElement *cre = (RestElement *)ast_alloc(sizeof(RestElement));
             if (re) cre->argument = clone_node(re->argument);
             c->data = cre;
             break;
         }
         case AST_ForOfStatement: {
             ForOfStatement *fos = (ForOfStatement *)n->data;
-            ForOfStatement *cfos = (ForOfStatement *)calloc(1, sizeof(ForOfStatement));
+            ForOfStatement *cfos = (ForOfStatement *)ast_alloc(sizeof(ForOfStatement));
             if (fos) {
                 cfos->left = clone_node(fos->left);
                 cfos->right = clone_node(fos->right);
@@ -1603,7 +2094,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ForInStatement: {
             ForInStatement *fis = (ForInStatement *)n->data;
-            ForInStatement *cfis = (ForInStatement *)calloc(1, sizeof(ForInStatement));
+            ForInStatement *cfis = (ForInStatement *)ast_alloc(sizeof(ForInStatement));
             if (fis) {
                 cfis->left = clone_node(fis->left);
                 cfis->right = clone_node(fis->right);
@@ -1614,7 +2105,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ClassDeclaration: {
             ClassDeclaration *cd = (ClassDeclaration *)n->data;
-            ClassDeclaration *ccd = (ClassDeclaration *)calloc(1, sizeof(ClassDeclaration));
+            ClassDeclaration *ccd = (ClassDeclaration *)ast_alloc(sizeof(ClassDeclaration));
             astvec_init(&ccd->body);
             if (cd) {
                 ccd->id = clone_node(cd->id);
@@ -1628,7 +2119,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_ClassExpression: {
             ClassExpression *ce = (ClassExpression *)n->data;
-            ClassExpression *cce = (ClassExpression *)calloc(1, sizeof(ClassExpression));
+            ClassExpression *cce = (ClassExpression *)ast_alloc(sizeof(ClassExpression));
             astvec_init(&cce->body);
             if (ce) {
                 cce->id = clone_node(ce->id);
@@ -1642,7 +2133,7 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_MethodDefinition: {
             MethodDefinition *md = (MethodDefinition *)n->data;
-            MethodDefinition *cmd = (MethodDefinition *)calloc(1, sizeof(MethodDefinition));
+            MethodDefinition *cmd = (MethodDefinition *)ast_alloc(sizeof(MethodDefinition));
             if (md) {
                 cmd->key = clone_node(md->key);
                 cmd->value = clone_node(md->value);
@@ -1654,14 +2145,14 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_AwaitExpression: {
             AwaitExpression *ae = (AwaitExpression *)n->data;
-            AwaitExpression *cae = (AwaitExpression *)calloc(1, sizeof(AwaitExpression));
+            AwaitExpression *cae = (AwaitExpression *)ast_alloc(sizeof(AwaitExpression));
             if (ae) cae->argument = clone_node(ae->argument);
             c->data = cae;
             break;
         }
         case AST_YieldExpression: {
             YieldExpression *ye = (YieldExpression *)n->data;
-            YieldExpression *cye = (YieldExpression *)calloc(1, sizeof(YieldExpression));
+            YieldExpression *cye = (YieldExpression *)ast_alloc(sizeof(YieldExpression));
             if (ye) {
                 cye->argument = clone_node(ye->argument);
                 cye->delegate = ye->delegate;
@@ -1671,21 +2162,21 @@ static AstNode *clone_node(const AstNode *n) {
         }
         case AST_Super: {
             Super *sup = (Super *)n->data;
-            Super *csup = (Super *)calloc(1, sizeof(Super));
+            Super *csup = (Super *)ast_alloc(sizeof(Super));
             if (sup) csup->unused = sup->unused;
             c->data = csup;
             break;
         }
         case AST_ThisExpression: {
             ThisExpression *te = (ThisExpression *)n->data;
-            ThisExpression *cte = (ThisExpression *)calloc(1, sizeof(ThisExpression));
+            ThisExpression *cte = (ThisExpression *)ast_alloc(sizeof(ThisExpression));
             if (te) cte->unused = te->unused;
             c->data = cte;
             break;
         }
         case AST_Error: {
             ErrorNode *er = (ErrorNode *)n->data;
-            ErrorNode *cer = (ErrorNode *)calloc(1, sizeof(ErrorNode));
+            ErrorNode *cer = (ErrorNode *)ast_alloc(sizeof(ErrorNode));
             if (er && er->message) cer->message = dupstr(er->message);
             c->data = cer;
             break;
@@ -1704,21 +2195,23 @@ static void free_program(Program *p) {
         if (c) { free(c->text); free(c); }
     }
     free(p->comments);
+    free(p->diagnostics);
+    line_index_free(&p->lines);
     free(p);
 }
 
 static void free_identifier(Identifier *id) { free(id->name); free(id); }
-static void free_literal(Literal *lit) { free(lit->raw); free(lit); }
+static void free_literal(Literal *lit) { free(lit->raw); free(lit->bigint); free(lit->cooked); free(lit); }
 static void free_vardecl(VariableDeclaration *vd) {
     for (size_t i = 0; i < vd->declarations.count; ++i) ast_release(vd->declarations.items[i]);
     free(vd->declarations.items); free(vd);
 }
 static void free_vardeclarator(VariableDeclarator *vd) { ast_release(vd->id); ast_release(vd->init); free(vd); }
 static void free_exprstmt(ExpressionStatement *es) { ast_release(es->expression); free(es); }
-static void free_update(UpdateExpression *ue) { free(ue->operator); ast_release(ue->argument); free(ue); }
-static void free_binary(BinaryExpression *be) { free(be->operator); ast_release(be->left); ast_release(be->right); free(be); }
-static void free_assignment(AssignmentExpression *ae) { free(ae->operator); ast_release(ae->left); ast_release(ae->right); free(ae); }
-static void free_unary(UnaryExpression *ue) { free(ue->operator); ast_release(ue->argument); free(ue); }
+static void free_update(UpdateExpression *ue) { ast_release(ue->argument); free(ue); }
+static void free_binary(BinaryExpression *be) { ast_release(be->left); ast_release(be->right); free(be); }
+static void free_assignment(AssignmentExpression *ae) { ast_release(ae->left); ast_release(ae->right); free(ae); }
+static void free_unary(UnaryExpression *ue) { ast_release(ue->argument); free(ue); }
 static void free_object_expr(ObjectExpression *obj) {
     for (size_t i = 0; i < obj->properties.count; ++i) ast_release(obj->properties.items[i]);
     free(obj->properties.items); free(obj);
@@ -1798,7 +2291,7 @@ static void free_template_lit(TemplateLiteral *tl) {
     free(tl->expressions.items);
     free(tl);
 }
-static void free_template_elem(TemplateElement *te) { free(te->value); free(te); }
+static void free_template_elem(TemplateElement *te) { free(te->value); free(te->cooked); free(te); }
 static void free_spread_elem(SpreadElement *se) { ast_release(se->argument); free(se); }
 static void free_object_pattern(ObjectPattern *op) {
     for (size_t i = 0; i < op->properties.count; ++i) ast_release(op->properties.items[i]);
@@ -1827,7 +2320,7 @@ static void free_await_expr(AwaitExpression *ae) { ast_release(ae->argument); fr
 static void free_yield_expr(YieldExpression *ye) { ast_release(ye->argument); free(ye); }
 static void free_super(Super *sup) { free(sup); }
 static void free_this_expr(ThisExpression *te) { free(te); }
-static void free_error(ErrorNode *er) { /*free(er->message);*/ free(er); }
+static void free_error(ErrorNode *er) { free(er->message); free(er); }
 
 static void free_node(AstNode *n) {
     if (!n) return;
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include "quickjsflow/atom.h"
+
+// Open-addressed hash of atom ids (linear probing, at most half full) over
+// an entry array indexed by atom. Strings are copied into fixed chunks that
+// are never reallocated, so atom_name() pointers stay valid.
+
+#define ATOM_CHUNK (16u << 10)
+
+typedef struct AtomChunk {
+    struct AtomChunk *prev;
+    char data[];
+} AtomChunk;
+
+typedef struct {
+    const char *name;
+    uint32_t length;
+    uint32_t hash;
+} AtomEntry;
+
+struct AtomTable {
+    Atom *slots;
+    uint32_t slot_count; // power of two
+    AtomEntry *entries;  // entries[0] is unused, so ids start at 1
+    uint32_t count;      // entries in use, including entries[0]
+    uint32_t capacity;
+    AtomChunk *chunk;
+    char *cur, *end;
+    size_t chunk_bytes;
+};
+
+static uint32_t hash_bytes(const char *s, size_t len) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+AtomTable *atom_table_new(void) {
+    AtomTable *t = (AtomTable *)calloc(1, sizeof(AtomTable));
+    if (!t) return NULL;
+    t->slot_count = 256;
+    t->slots = (Atom *)calloc(t->slot_count, sizeof(Atom));
+    t->capacity = 128;
+    t->entries = (AtomEntry *)calloc(t->capacity, sizeof(AtomEntry));
+    if (!t->slots || !t->entries) {
+        atom_table_free(t);
+        return NULL;
+    }
+    t->count = 1;
+    return t;
+}
+
+void atom_table_free(AtomTable *t) {
+    if (!t) return;
+    AtomChunk *c = t->chunk;
+    while (c) {
+        AtomChunk *prev = c->prev;
+        free(c);
+        c = prev;
+    }
+    free(t->slots);
+    free(t->entries);
+    free(t);
+}
+
+static Atom *find_slot(const AtomTable *t, const char *s, size_t len, uint32_t h) {
+    uint32_t mask = t->slot_count - 1;
+    for (uint32_t i = h & mask;; i = (i + 1) & mask) {
+        Atom a = t->slots[i];
+        if (a == ATOM_NONE) return &t->slots[i];
+        const AtomEntry *e = &t->entries[a];
+        if (e->hash == h && e->length == len && memcmp(e->name, s, len) == 0) return &t->slots[i];
+    }
+}
+
+static int rehash(AtomTable *t) {
+    uint32_t n = t->slot_count * 2;
+    Atom *slots = (Atom *)calloc(n, sizeof(Atom));
+    if (!slots) return -1;
+    for (Atom a = 1; a < t->count; ++a) {
+        uint32_t i = t->entries[a].hash & (n - 1);
+        while (slots[i] != ATOM_NONE) i = (i + 1) & (n - 1);
+        slots[i] = a;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->slot_count = n;
+    return 0;
+}
+
+static char *store(AtomTable *t, const char *s, size_t len) {
+    if ((size_t)(t->end - t->cur) < len + 1) {
+        size_t size = len + 1 > ATOM_CHUNK ? len + 1 : ATOM_CHUNK;
+        AtomChunk *c = (AtomChunk *)malloc(sizeof(AtomChunk) + size);
+        if (!c) return NULL;
+        c->prev = t->chunk;
+        t->chunk = c;
+        t->cur = c->data;
+        t->end = c->data + size;
+        t->chunk_bytes += sizeof(AtomChunk) + size;
+    }
+    char *d = t->cur;
+    memcpy(d, s, len);
+    d[len] = '\0';
+    t->cur += len + 1;
+    return d;
+}
+
+Atom atom_intern(AtomTable *t, const char *s, size_t len) {
+    if (!t || !s || len >= UINT32_MAX) return ATOM_NONE;
+    // keep the hash at most half full; if growing fails, carry on while
+    // an empty slot is left
+    if ((uint64_t)t->count * 2 > t->slot_count && rehash(t) != 0 && t->count >= t->slot_count) {
+        return ATOM_NONE;
+    }
+    uint32_t h = hash_bytes(s, len);
+    Atom *slot = find_slot(t, s, len, h);
+    if (*slot != ATOM_NONE) return *slot;
+
+    if (t->count == t->capacity) {
+        if (t->capacity > UINT32_MAX / 4) return ATOM_NONE;
+        AtomEntry *entries = (AtomEntry *)realloc(t->entries, (size_t)t->capacity * 2 * sizeof(AtomEntry));
+        if (!entries) return ATOM_NONE;
+        t->entries = entries;
+        t->capacity *= 2;
+    }
+    char *name = store(t, s, len);
+    if (!name) return ATOM_NONE;
+    Atom a = t->count++;
+    t->entries[a].name = name;
+    t->entries[a].length = (uint32_t)len;
+    t->entries[a].hash = h;
+    *slot = a;
+    return a;
+}
+
+Atom atom_lookup(const AtomTable *t, const char *s, size_t len) {
+    if (!t || !s || len >= UINT32_MAX) return ATOM_NONE;
+    return *find_slot(t, s, len, hash_bytes(s, len));
+}
+
+const char *atom_name(const AtomTable *t, Atom a) {
+    return t && a != ATOM_NONE && a < t->count ? t->entries[a].name : NULL;
+}
+
+size_t atom_length(const AtomTable *t, Atom a) {
+    return t && a != ATOM_NONE && a < t->count ? t->entries[a].length : 0;
+}
+
+size_t atom_count(const AtomTable *t) {
+    return t ? t->count - 1 : 0;
+}
+
+size_t atom_table_bytes(const AtomTable *t) {
+    if (!t) return 0;
+    return sizeof(AtomTable) + (size_t)t->slot_count * sizeof(Atom) +
+           (size_t)t->capacity * sizeof(AtomEntry) + t->chunk_bytes;
+}
@@ -0,0 +1,311 @@
+#define _POSIX_C_SOURCE 200809L // mkdir, mkstemp, directory scans, utimensat
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "quickjsflow/cache.h"
+#include "quickjsflow/parser.h"
+
+// Entry file: EntryHeader, then the image at an 8-byte aligned offset.
+#define ENTRY_MAGIC "QJFC"
+#define ENTRY_SUFFIX ".qjfc"
+// Entries are written as <key>.tmpXXXXXX (mkstemp) and renamed into place.
+// One older than this was left by a run that died before the rename; a
+// younger one may still be being written.
+#define TEMP_SUFFIX ".tmp"
+#define TEMP_STALE_SECONDS 3600
+// After an eviction the entries fill at most this share of the bound, so
+// a run that keeps storing scans the directory once per batch, not per
+// entry.
+#define EVICT_TO_PERCENT 75
+
+typedef struct {
+    char magic[4];
+    uint32_t version;     // PARSE_CACHE_VERSION
+    uint64_t key[2];
+    uint64_t source_length;
+} EntryHeader;
+
+// ---------------------------------------------------------------------------
+// Keys
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// 128-bit key: two multiply-rotate lanes over the source 8 bytes at a
+// time, seeded with the versions and options.
+static void entry_key(const char *src, size_t len, unsigned options, uint64_t key[2]) {
+    uint64_t a = 0x9e3779b97f4a7c15ULL ^ PARSE_CACHE_VERSION ^ ((uint64_t)COMPACT_IMAGE_VERSION << 16) ^
+                 ((uint64_t)options << 32);
+    uint64_t b = 0xc2b2ae3d27d4eb4fULL ^ (uint64_t)len;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, src + i, 8);
+        a = rotl64((a ^ w) * 0x87c37b91114253d5ULL, 31);
+        b = rotl64((b ^ w) * 0x4cf5ad432745937fULL, 27) + a;
+    }
+    uint64_t tail = 0;
+    if (i < len) memcpy(&tail, src + i, len - i);
+    a = rotl64((a ^ tail) * 0x87c37b91114253d5ULL, 31);
+    b = rotl64((b ^ tail) * 0x4cf5ad432745937fULL, 27) + a;
+    key[0] = fmix64(a ^ (uint64_t)len);
+    key[1] = fmix64(b ^ key[0]);
+}
+
+// dir/<32 hex digits><suffix>; NULL on allocation failure
+static char *entry_path(const ParseCache *c, const uint64_t key[2], const char *suffix) {
+    size_t n = strlen(c->dir) + 1 + 32 + strlen(suffix) + 1;
+    char *path = (char *)malloc(n);
+    if (!path) return NULL;
+    snprintf(path, n, "%s/%016llx%016llx%s", c->dir, (unsigned long long)key[0], (unsigned long long)key[1], suffix);
+    return path;
+}
+
+static int is_entry_name(const char *name) {
+    size_t n = strlen(name), ls = strlen(ENTRY_SUFFIX);
+    return n == 32 + ls && strcmp(name + 32, ENTRY_SUFFIX) == 0;
+}
+
+static int is_temp_name(const char *name) {
+    size_t n = strlen(name), ls = strlen(TEMP_SUFFIX);
+    return n > 32 + ls && strncmp(name + 32, TEMP_SUFFIX, ls) == 0;
+}
+
+// ---------------------------------------------------------------------------
+// Directory
+
+typedef struct {
+    char *name;
+    uint64_t size;
+    struct timespec used;
+} EntryInfo;
+
+// Entries of the directory; *total receives their size, plus that of
+// temporary files still being written. Stale temporary files are removed.
+// -1 if it cannot be read.
+static int scan_entries(const ParseCache *c, EntryInfo **out, size_t *count, uint64_t *total) {
+    *out = NULL;
+    *count = 0;
+    *total = 0;
+    DIR *d = opendir(c->dir);
+    if (!d) return -1;
+    size_t cap = 0;
+    size_t dir_len = strlen(c->dir);
+    int rc = 0;
+    time_t stale = time(NULL) - TEMP_STALE_SECONDS;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        int temp = is_temp_name(de->d_name);
+        if (!temp && !is_entry_name(de->d_name)) continue;
+        char path[4096];
+        if (dir_len + 1 + strlen(de->d_name) >= sizeof(path)) continue;
+        snprintf(path, sizeof(path), "%s/%s", c->dir, de->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0) continue; // evicted by another run meanwhile
+        if (temp) {
+            if (st.st_mtime < stale) unlink(path);
+            else *total += (uint64_t)st.st_size;
+            continue;
+        }
+        if (*count == cap) {
+            size_t next = cap ? cap * 2 : 64;
+            EntryInfo *grown = (EntryInfo *)realloc(*out, next * sizeof(EntryInfo));
+            if (!grown) { rc = -1; break; }
+            *out = grown;
+            cap = next;
+        }
+        EntryInfo *e = &(*out)[*count];
+        e->name = (char *)malloc(strlen(de->d_name) + 1);
+        if (!e->name) { rc = -1; break; }
+        strcpy(e->name, de->d_name);
+        e->size = (uint64_t)st.st_size;
+        e->used = st.st_mtim;
+        (*count)++;
+        *total += (uint64_t)st.st_size;
+    }
+    closedir(d);
+    return rc;
+}
+
+static void free_entries(EntryInfo *entries, size_t count) {
+    for (size_t i = 0; i < count; ++i) free(entries[i].name);
+    free(entries);
+}
+
+static int by_use(const void *x, const void *y) {
+    const EntryInfo *a = (const EntryInfo *)x, *b = (const EntryInfo *)y;
+    if (a->used.tv_sec != b->used.tv_sec) return a->used.tv_sec < b->used.tv_sec ? -1 : 1;
+    if (a->used.tv_nsec != b->used.tv_nsec) return a->used.tv_nsec < b->used.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+// Remove least recently used entries until the rest fit EVICT_TO_PERCENT
+// of the bound.
+static void evict(ParseCache *c) {
+    EntryInfo *entries;
+    size_t count;
+    uint64_t total;
+    if (scan_entries(c, &entries, &count, &total) != 0) {
+        free_entries(entries, count);
+        return;
+    }
+    qsort(entries, count, sizeof(EntryInfo), by_use);
+    uint64_t target = c->max_bytes / 100 * EVICT_TO_PERCENT;
+    size_t dir_len = strlen(c->dir);
+    for (size_t i = 0; i < count && total > target; ++i) {
+        char path[4096];
+        if (dir_len + 1 + strlen(entries[i].name) >= sizeof(path)) continue;
+        snprintf(path, sizeof(path), "%s/%s", c->dir, entries[i].name);
+        if (unlink(path) == 0 || errno == ENOENT) {
+            total -= entries[i].size;
+            c->evictions++;
+        }
+    }
+    c->bytes = total;
+    free_entries(entries, count);
+}
+
+int parse_cache_open(ParseCache *c, const char *dir, uint64_t max_bytes) {
+    memset(c, 0, sizeof(*c));
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) return -1;
+    c->dir = (char *)malloc(strlen(dir) + 1);
+    if (!c->dir) return -1;
+    strcpy(c->dir, dir);
+    c->max_bytes = max_bytes;
+    EntryInfo *entries;
+    size_t count;
+    if (scan_entries(c, &entries, &count, &c->bytes) != 0) {
+        free_entries(entries, count);
+        parse_cache_close(c);
+        return -1;
+    }
+    free_entries(entries, count);
+    return 0;
+}
+
+void parse_cache_close(ParseCache *c) {
+    free(c->dir);
+    c->dir = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Entries
+
+static CompactAst *map_entry(const char *path, const uint64_t key[2], size_t len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+    size_t size = 0;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(EntryHeader)) {
+        size = (size_t)st.st_size;
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    const EntryHeader *h = (const EntryHeader *)map;
+    CompactAst *ca = NULL;
+    if (memcmp(h->magic, ENTRY_MAGIC, 4) == 0 && h->version == PARSE_CACHE_VERSION &&
+        h->key[0] == key[0] && h->key[1] == key[1] && h->source_length == (uint64_t)len) {
+        ca = compact_view((const char *)map + sizeof(EntryHeader), size - sizeof(EntryHeader));
+    }
+    if (!ca) {
+        munmap(map, size);
+        return NULL;
+    }
+    ca->mapping = map;
+    ca->mapping_size = size;
+    return ca;
+}
+
+CompactAst *parse_cache_get(ParseCache *c, const char *src, size_t len, unsigned options) {
+    uint64_t key[2];
+    entry_key(src, len, options, key);
+    char *path = entry_path(c, key, ENTRY_SUFFIX);
+    CompactAst *ca = path ? map_entry(path, key, len) : NULL;
+    if (ca) {
+        utimensat(AT_FDCWD, path, NULL, 0); // most recently used
+        c->hits++;
+    } else {
+        c->misses++;
+    }
+    free(path);
+    return ca;
+}
+
+int parse_cache_put(ParseCache *c, const char *src, size_t len, unsigned options, const CompactAst *ca) {
+    uint64_t key[2];
+    entry_key(src, len, options, key);
+    uint64_t size = sizeof(EntryHeader) + compact_image_size(ca);
+    if (c->max_bytes && size > c->max_bytes) return -1; // would evict itself
+    // a unique name per writer, even for threads of one process
+    char *tmp = entry_path(c, key, TEMP_SUFFIX "XXXXXX");
+    char *path = entry_path(c, key, ENTRY_SUFFIX);
+    int rc = -1;
+    int fd = tmp && path ? mkstemp(tmp) : -1;
+    FILE *f = NULL;
+    if (fd >= 0) {
+        fchmod(fd, 0644); // mkstemp makes it private to the user
+        f = fdopen(fd, "wb");
+        if (!f) {
+            close(fd);
+            unlink(tmp);
+        }
+    }
+    if (f) {
+        EntryHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, ENTRY_MAGIC, 4);
+        h.version = PARSE_CACHE_VERSION;
+        h.key[0] = key[0];
+        h.key[1] = key[1];
+        h.source_length = len;
+        rc = fwrite(&h, sizeof(h), 1, f) == 1 ? compact_write_stream(ca, f) : -1;
+        if (fclose(f) != 0) rc = -1;
+        struct stat old;
+        if (rc == 0 && stat(path, &old) == 0) c->bytes -= (uint64_t)old.st_size < c->bytes ? (uint64_t)old.st_size : c->bytes;
+        // readers only ever see a complete entry under the final name
+        if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+        if (rc != 0) unlink(tmp);
+    }
+    if (rc == 0) {
+        c->stores++;
+        c->bytes += size;
+        if (c->max_bytes && c->bytes > c->max_bytes) evict(c);
+    }
+    free(tmp);
+    free(path);
+    return rc;
+}
+
+CompactAst *parse_cached(ParseCache *c, const char *src, size_t len, unsigned options) {
+    if (c) {
+        CompactAst *hit = parse_cache_get(c, src, len, options);
+        if (hit) return hit;
+    }
+    Parser p;
+    parser_init(&p, src, len);
+    p.lazy_functions = (options & PARSE_CACHE_LAZY) != 0;
+    AstNode *prog = parse_program(&p);
+    CompactAst *ca = compact_from_ast(prog);
+    ast_free(prog);
+    if (ca && c) parse_cache_put(c, src, len, options, ca);
+    return ca;
+}
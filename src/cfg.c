@@ -200,6 +200,7 @@ static BasicBlock *cfg_build_statement(CFG *cfg, const AstNode *stmt, BasicBlock
     switch (stmt->type) {
         case AST_BlockStatement: {
             // 递归处理块内语句
+            ast_materialize_body((AstNode *)stmt);
             BlockStatement *block = (BlockStatement *)stmt->data;
             if (block && block->body.count > 0) {
                 BasicBlock *block_end = current;
@@ -509,6 +510,7 @@ CFG *qjs_build_cfg(const AstNode *func_node, Scope *scope, const CFGOptions *opt
         case AST_FunctionExpression: {
             FunctionBody *func = (FunctionBody *)func_node->data;
             if (func && func->body) {
+                ast_materialize_body(func->body);
                 BlockStatement *block_stmt = (BlockStatement *)func->body->data;
                 if (block_stmt) {
                     body = &block_stmt->body;
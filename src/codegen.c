@@ -1,4 +1,3 @@
-#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -103,6 +102,7 @@ typedef struct {
     Comment **comments;
     size_t comment_count;
     size_t comment_index;
+    const LineIndex *lines; // resolves node offsets for the source map
 } CGCtx;
 
 static void cg_init(CGCtx *cg, const CodegenOptions *opts) {
@@ -124,6 +124,7 @@ static void cg_init(CGCtx *cg, const CodegenOptions *opts) {
     cg->comments = NULL;
     cg->comment_count = 0;
     cg->comment_index = 0;
+    cg->lines = NULL;
 }
 
 static int cg_indent(CGCtx *cg) {
@@ -140,15 +141,12 @@ static int cg_newline(CGCtx *cg) {
 
 // --- precedence helpers --------------------------------------------------
 
-static int precedence_for_binary(const char *op) {
-    if (!op) return 1;
-    if (strcmp(op, "||") == 0) return 1;
-    if (strcmp(op, "&&") == 0) return 2;
-    if (strcmp(op, "==") == 0 || strcmp(op, "!=") == 0) return 3;
-    if (strcmp(op, "<") == 0 || strcmp(op, ">") == 0 || strcmp(op, "<=") == 0 || strcmp(op, ">=") == 0) return 4;
-    if (strcmp(op, "+") == 0 || strcmp(op, "-") == 0) return 5;
-    if (strcmp(op, "*") == 0 || strcmp(op, "/") == 0 || strcmp(op, "%") == 0) return 6;
-    return 2;
+// Expression precedence, loosest first: assignment 0, other non-operator
+// expressions 1, binary operators 2-12 from the operator table, then
+// update, unary, member, call and primary expressions.
+static int precedence_for_binary(AstOperator op) {
+    int prec = ast_operator_info(op)->precedence;
+    return prec ? prec + 1 : 1;
 }
 
 static int precedence_of(const AstNode *n) {
@@ -157,24 +155,36 @@ static int precedence_of(const AstNode *n) {
         case AST_AssignmentExpression: return 0;
         case AST_BinaryExpression: {
             BinaryExpression *be = (BinaryExpression *)n->data;
-            return precedence_for_binary(be ? be->operator : NULL);
+            return precedence_for_binary(be ? be->operator : OP_NONE);
         }
-        case AST_UpdateExpression: return 7;
-        case AST_UnaryExpression: return 8;
-        case AST_MemberExpression: return 9;
-        case AST_CallExpression: return 10;
+        case AST_UpdateExpression: return 13;
+        case AST_UnaryExpression:
+        case AST_AwaitExpression: return 14;
+        case AST_MemberExpression: return 15;
+        case AST_CallExpression: return 16;
         case AST_ArrayExpression:
         case AST_ObjectExpression:
         case AST_Literal:
-        case AST_Identifier: return 11;
+        case AST_Identifier: return 17;
         default: return 1;
     }
 }
 
-static int pos_le(Position a, Position b) {
-    if (a.line < b.line) return 1;
-    if (a.line > b.line) return 0;
-    return a.column <= b.column;
+// ?? does not mix with || or && without parentheses.
+static int is_logical(const AstNode *n, int nullish) {
+    if (!n || n->type != AST_BinaryExpression) return 0;
+    AstOperator op = ((BinaryExpression *)n->data)->operator;
+    return nullish ? op == OP_NULLISH : (op == OP_OR || op == OP_AND);
+}
+
+// comment flush limit covering everything that is left
+#define CG_ALL_COMMENTS (SRC_OFFSET_NONE - 1)
+
+// Last offset on the line where `end` lies: comments up to it trail the
+// statement that ends there.
+static SrcOffset line_tail(const CGCtx *cg, SrcOffset end) {
+    if (end == SRC_OFFSET_NONE) return SRC_OFFSET_NONE;
+    return (SrcOffset)line_index_line_end(cg->lines, end);
 }
 
 // --- VLQ helpers for source map ----------------------------------------
@@ -269,8 +279,9 @@ static int emit_block(CGCtx *cg, const AstNode *block, int newline_after);
 
 static void add_mapping(CGCtx *cg, const AstNode *n) {
     if (!cg || !n) return;
-    int sl = n->start.line > 0 ? n->start.line - 1 : 0;
-    int sc = n->start.column > 0 ? n->start.column - 1 : 0;
+    Position p = line_index_position(cg->lines, n->start);
+    int sl = p.line > 0 ? p.line - 1 : 0;
+    int sc = p.column > 0 ? p.column - 1 : 0;
     mapvec_push(&cg->mappings, cg->buf.len, sl, sc);
 }
 
@@ -301,7 +312,8 @@ static int emit_literal(CGCtx *cg, const AstNode *n) {
 }
 
 static int emit_variable_declarator(CGCtx *cg, const AstNode *n) {
-    if (!n || n->type != AST_VariableDeclarator) return 0;
+    if (!n) return 0;
+    if (n->type != AST_VariableDeclarator) return emit_expression(cg, n, 0); // a recovered Error
     VariableDeclarator *vd = (VariableDeclarator *)n->data;
     add_mapping(cg, n);
     if (!emit_expression(cg, vd->id, precedence_of(vd->id))) return 0;
@@ -344,16 +356,37 @@ static int emit_comment(CGCtx *cg, Comment *c) {
     return cg_newline(cg);
 }
 
-static int emit_comments_up_to(CGCtx *cg, Position limit) {
+// SRC_OFFSET_NONE (a node without a source position) flushes nothing.
+static int emit_comments_up_to(CGCtx *cg, SrcOffset limit) {
+    if (limit == SRC_OFFSET_NONE) return 1;
     while (cg->comment_index < cg->comment_count) {
         Comment *c = cg->comments[cg->comment_index];
-        if (!pos_le(c->start, limit)) break;
+        if (c->start > limit) break;
         if (!emit_comment(cg, c)) return 0;
         cg->comment_index++;
     }
     return 1;
 }
 
+// An object pattern entry: `key: target`, or just the binding (with its
+// default) when it repeats the key's name.
+static int emit_pattern_property(CGCtx *cg, const AstNode *n) {
+    if (!n || n->type != AST_Property) return emit_expression(cg, n, 1);
+    Property *prop = (Property *)n->data;
+    const AstNode *target = prop->value;
+    if (target && target->type == AST_AssignmentPattern) target = ((AssignmentPattern *)target->data)->left;
+    if (!prop->computed && prop->key && prop->key->type == AST_Identifier &&
+        target && target->type == AST_Identifier &&
+        strcmp(((Identifier *)prop->key->data)->name, ((Identifier *)target->data)->name) == 0) {
+        return emit_expression(cg, prop->value, 1);
+    }
+    if (prop->computed && !sb_append_char(&cg->buf, '[')) return 0;
+    if (!emit_expression(cg, prop->key, 0)) return 0;
+    if (prop->computed && !sb_append_char(&cg->buf, ']')) return 0;
+    if (!sb_append(&cg->buf, ": ")) return 0;
+    return emit_expression(cg, prop->value, 1);
+}
+
 static int emit_expression(CGCtx *cg, const AstNode *n, int parent_prec) {
     if (!n) return sb_append(&cg->buf, "null");
     int t = n->type;
@@ -373,11 +406,11 @@ static int emit_expression(CGCtx *cg, const AstNode *n, int parent_prec) {
             int need_paren = precedence_of(n) < parent_prec;
             if (need_paren && !sb_append_char(&cg->buf, '(')) return 0;
             if (ue && ue->prefix) {
-                if (!sb_append(&cg->buf, ue->operator ? ue->operator : "")) return 0;
+                if (!sb_append(&cg->buf, ast_operator_str(ue->operator))) return 0;
                 if (!emit_paren_expr(cg, ue->argument, precedence_of(n))) return 0;
             } else {
                 if (!emit_paren_expr(cg, ue ? ue->argument : NULL, precedence_of(n))) return 0;
-                if (!sb_append(&cg->buf, ue && ue->operator ? ue->operator : "")) return 0;
+                if (!sb_append(&cg->buf, ast_operator_str(ue ? ue->operator : OP_NONE))) return 0;
             }
             if (need_paren && !sb_append_char(&cg->buf, ')')) return 0;
             return 1;
@@ -386,8 +419,8 @@ static int emit_expression(CGCtx *cg, const AstNode *n, int parent_prec) {
             UnaryExpression *ue = (UnaryExpression *)n->data;
             int need_paren = precedence_of(n) < parent_prec;
             if (need_paren && !sb_append_char(&cg->buf, '(')) return 0;
-            if (!sb_append(&cg->buf, ue && ue->operator ? ue->operator : "")) return 0;
-            if (ue && ue->prefix && strcmp(ue->operator, "typeof") != 0 && strcmp(ue->operator, "void") != 0) {
+            if (!sb_append(&cg->buf, ast_operator_str(ue ? ue->operator : OP_NONE))) return 0;
+            if (ue && ue->prefix && ue->operator != OP_TYPEOF && ue->operator != OP_VOID) {
                 if (!sb_append_char(&cg->buf, ' ')) return 0;
             }
             if (!emit_paren_expr(cg, ue ? ue->argument : NULL, precedence_of(n))) return 0;
@@ -396,14 +429,25 @@ static int emit_expression(CGCtx *cg, const AstNode *n, int parent_prec) {
         }
         case AST_BinaryExpression: {
             BinaryExpression *be = (BinaryExpression *)n->data;
+            AstOperator op = be ? be->operator : OP_NONE;
             int prec = precedence_of(n);
             int need_paren = prec < parent_prec;
+            // the operand on the non-associative side must bind tighter
+            int right_assoc = (ast_operator_info(op)->flags & OPF_RIGHT_ASSOC) != 0;
+            int left_prec = right_assoc ? prec + 1 : prec;
+            int right_prec = right_assoc ? prec : prec + 1;
+            const AstNode *left = be ? be->left : NULL;
+            const AstNode *right = be ? be->right : NULL;
+            if (is_logical(left, op != OP_NULLISH) || (right_assoc && left && (left->type == AST_UnaryExpression || left->type == AST_AwaitExpression))) {
+                left_prec = precedence_of(left) + 1;
+            }
+            if (is_logical(right, op != OP_NULLISH)) right_prec = precedence_of(right) + 1;
             if (need_paren && !sb_append_char(&cg->buf, '(')) return 0;
-            if (!emit_paren_expr(cg, be ? be->left : NULL, prec)) return 0;
+            if (!emit_paren_expr(cg, left, left_prec)) return 0;
             if (!sb_append(&cg->buf, " " )) return 0;
-            if (!sb_append(&cg->buf, be && be->operator ? be->operator : "")) return 0;
+            if (!sb_append(&cg->buf, ast_operator_str(op))) return 0;
             if (!sb_append(&cg->buf, " " )) return 0;
-            if (!emit_paren_expr(cg, be ? be->right : NULL, prec)) return 0;
+            if (!emit_paren_expr(cg, right, right_prec)) return 0;
             if (need_paren && !sb_append_char(&cg->buf, ')')) return 0;
             return 1;
         }
@@ -414,7 +458,7 @@ static int emit_expression(CGCtx *cg, const AstNode *n, int parent_prec) {
             if (need_paren && !sb_append_char(&cg->buf, '(')) return 0;
             if (!emit_paren_expr(cg, ae ? ae->left : NULL, prec)) return 0;
             if (!sb_append(&cg->buf, " " )) return 0;
-            if (!sb_append(&cg->buf, ae && ae->operator ? ae->operator : "=")) return 0;
+            if (!sb_append(&cg->buf, ae && ae->operator ? ast_operator_str(ae->operator) : "=")) return 0;
             if (!sb_append(&cg->buf, " " )) return 0;
             if (!emit_paren_expr(cg, ae ? ae->right : NULL, prec)) return 0;
             if (need_paren && !sb_append_char(&cg->buf, ')')) return 0;
@@ -527,6 +571,11 @@ static int emit_expression(CGCtx *cg, const AstNode *n, int parent_prec) {
             if (afe && afe->body) {
                 if (afe->body->type == AST_BlockStatement) {
                     if (!emit_block(cg, afe->body, 0)) return 0;
+                } else if (afe->body->type == AST_ObjectExpression) {
+                    // a bare `{` would open a block body
+                    if (!sb_append_char(&cg->buf, '(')) return 0;
+                    if (!emit_expression(cg, afe->body, 0)) return 0;
+                    if (!sb_append_char(&cg->buf, ')')) return 0;
                 } else {
                     if (!emit_expression(cg, afe->body, 0)) return 0;
                 }
@@ -572,12 +621,45 @@ static int emit_expression(CGCtx *cg, const AstNode *n, int parent_prec) {
         }
         case AST_AwaitExpression: {
             AwaitExpression *ae = (AwaitExpression *)n->data;
+            int need_paren = precedence_of(n) < parent_prec;
+            if (need_paren && !sb_append_char(&cg->buf, '(')) return 0;
             if (!sb_append(&cg->buf, "await ")) return 0;
-            if (ae && ae->argument) {
-                if (!emit_expression(cg, ae->argument, precedence_of(ae->argument))) return 0;
-            }
+            if (!emit_paren_expr(cg, ae ? ae->argument : NULL, precedence_of(n))) return 0;
+            if (need_paren && !sb_append_char(&cg->buf, ')')) return 0;
             return 1;
         }
+        case AST_ObjectPattern: {
+            ObjectPattern *op = (ObjectPattern *)n->data;
+            if (!sb_append_char(&cg->buf, '{')) return 0;
+            for (size_t i = 0; op && i < op->properties.count; ++i) {
+                if (i > 0 && !sb_append(&cg->buf, ", ")) return 0;
+                if (!emit_pattern_property(cg, op->properties.items[i])) return 0;
+            }
+            return sb_append_char(&cg->buf, '}');
+        }
+        case AST_ArrayPattern: {
+            ArrayPattern *ap = (ArrayPattern *)n->data;
+            if (!sb_append_char(&cg->buf, '[')) return 0;
+            for (size_t i = 0; ap && i < ap->elements.count; ++i) {
+                if (i > 0 && !sb_append(&cg->buf, ", ")) return 0;
+                AstNode *el = ap->elements.items[i];
+                if (el && !emit_expression(cg, el, 1)) return 0;
+                // a trailing hole needs its own comma
+                if (!el && i + 1 == ap->elements.count && !sb_append_char(&cg->buf, ',')) return 0;
+            }
+            return sb_append_char(&cg->buf, ']');
+        }
+        case AST_AssignmentPattern: {
+            AssignmentPattern *ap = (AssignmentPattern *)n->data;
+            if (!emit_expression(cg, ap ? ap->left : NULL, 1)) return 0;
+            if (!sb_append(&cg->buf, " = ")) return 0;
+            return emit_expression(cg, ap ? ap->right : NULL, 0);
+        }
+        case AST_RestElement: {
+            RestElement *re = (RestElement *)n->data;
+            if (!sb_append(&cg->buf, "...")) return 0;
+            return emit_expression(cg, re ? re->argument : NULL, 1);
+        }
         case AST_YieldExpression: {
             YieldExpression *ye = (YieldExpression *)n->data;
             if (!sb_append(&cg->buf, "yield")) return 0;
@@ -942,6 +1024,7 @@ static int emit_block(CGCtx *cg, const AstNode *block, int newline_after) {
         if (newline_after) return cg_newline(cg);
         return 1;
     }
+    ast_materialize_body((AstNode *)block);
     BlockStatement *bs = block ? (BlockStatement *)block->data : NULL;
     if (!sb_append(&cg->buf, "{\n")) return 0;
     cg->indent_level++;
@@ -951,12 +1034,11 @@ static int emit_block(CGCtx *cg, const AstNode *block, int newline_after) {
             if (stmt && !emit_comments_up_to(cg, stmt->start)) return 0;
             if (!emit_statement(cg, stmt)) return 0;
             if (stmt) {
-                Position line_tail = { stmt->end.line, INT_MAX };
-                if (!emit_comments_up_to(cg, line_tail)) return 0;
+                if (!emit_comments_up_to(cg, line_tail(cg, stmt->end))) return 0;
             }
         }
         // flush comments that belong to this block
-        Position block_end = block ? block->end : (Position){ INT_MAX, INT_MAX };
+        SrcOffset block_end = block ? block->end : CG_ALL_COMMENTS;
         if (!emit_comments_up_to(cg, block_end)) return 0;
     }
     cg->indent_level--;
@@ -980,6 +1062,7 @@ CodegenResult codegen_generate(const AstNode *root, const CodegenOptions *option
         cg.comments = pr ? pr->comments : NULL;
         cg.comment_count = pr ? pr->comment_count : 0;
         cg.comment_index = 0;
+        cg.lines = pr ? &pr->lines : NULL;
         if (pr) {
             for (size_t i = 0; i < pr->body.count; ++i) {
                 AstNode *stmt = pr->body.items[i];
@@ -994,8 +1077,7 @@ CodegenResult codegen_generate(const AstNode *root, const CodegenOptions *option
                     return res;
                 }
                 if (stmt) {
-                    Position line_tail = { stmt->end.line, INT_MAX };
-                    if (!emit_comments_up_to(&cg, line_tail)) {
+                    if (!emit_comments_up_to(&cg, line_tail(&cg, stmt->end))) {
                         sb_free(&cg.buf);
                         mapvec_free(&cg.mappings);
                         return res;
@@ -1003,8 +1085,7 @@ CodegenResult codegen_generate(const AstNode *root, const CodegenOptions *option
                 }
             }
             // flush trailing comments
-            Position tail = { INT_MAX, INT_MAX };
-            if (!emit_comments_up_to(&cg, tail)) {
+            if (!emit_comments_up_to(&cg, CG_ALL_COMMENTS)) {
                 sb_free(&cg.buf);
                 mapvec_free(&cg.mappings);
                 return res;
@@ -0,0 +1,1423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "quickjsflow/compact.h"
+#include "quickjsflow/atom.h"
+
+// ---------------------------------------------------------------------------
+// Building
+//
+// Nodes are flattened from an explicit stack, so nesting depth costs heap,
+// not native stack. A record is added when its node comes off the stack and
+// its children go on in reverse, which gives the pre-order layout; each
+// child's id is then written into the field or `extra` word reserved for
+// it, by index, since the arrays move as they grow.
+
+enum { SLOT_ROOT, SLOT_A, SLOT_B, SLOT_C, SLOT_EXTRA };
+
+typedef struct {
+    const AstNode *node;
+    uint32_t at;  // record (SLOT_A..C) or extra word (SLOT_EXTRA) to fill
+    uint8_t slot;
+} Pending;
+
+typedef struct {
+    CompactAst *ca;
+    int failed;
+    AtomTable *atoms;  // names seen so far
+    uint32_t *offsets; // atom -> pool offset + 1, 0 if not stored yet
+    uint32_t offset_capacity;
+    Pending *pending;  // nodes still to flatten, next last
+    size_t pending_count;
+    size_t pending_capacity;
+} Flattener;
+
+// Payload-less nodes read as all-zero payloads, like ast_clone treats them.
+static const uint64_t zero_payload[32];
+
+static int grow(void **items, uint32_t *cap, uint32_t need, size_t elem) {
+    if (need <= *cap) return 0;
+    if (need > UINT32_MAX / 2) return -1;
+    uint32_t next = *cap ? *cap : 64;
+    while (next < need) next *= 2;
+    void *p = realloc(*items, (size_t)next * elem);
+    if (!p) return -1;
+    *items = p;
+    *cap = next;
+    return 0;
+}
+
+static CompactId add_node(Flattener *f, const AstNode *n) {
+    CompactAst *ca = f->ca;
+    if (grow((void **)&ca->nodes, &ca->node_capacity, ca->node_count + 1, sizeof(CompactNode)) != 0) {
+        f->failed = 1;
+        return COMPACT_NONE;
+    }
+    CompactNode *r = &ca->nodes[ca->node_count];
+    memset(r, 0, sizeof(*r));
+    r->type = (uint8_t)n->type;
+    r->start = n->start;
+    r->end = n->end;
+    r->a = r->b = r->c = COMPACT_NONE;
+    return ca->node_count++;
+}
+
+static uint32_t add_extra(Flattener *f, uint32_t words) {
+    CompactAst *ca = f->ca;
+    if (grow((void **)&ca->extra, &ca->extra_capacity, ca->extra_count + words, sizeof(uint32_t)) != 0) {
+        f->failed = 1;
+        return 0;
+    }
+    uint32_t at = ca->extra_count;
+    memset(ca->extra + at, 0, words * sizeof(uint32_t));
+    ca->extra_count += words;
+    return at;
+}
+
+static uint32_t add_bytes(Flattener *f, const char *s, size_t len) {
+    CompactAst *ca = f->ca;
+    if (!s) return COMPACT_NONE;
+    if (len >= UINT32_MAX / 2 ||
+        grow((void **)&ca->strings, &ca->string_capacity, ca->string_bytes + (uint32_t)len + 1, 1) != 0) {
+        f->failed = 1;
+        return COMPACT_NONE;
+    }
+    uint32_t at = ca->string_bytes;
+    if (len) memcpy(ca->strings + at, s, len);
+    ca->strings[at + len] = '\0';
+    ca->string_bytes += (uint32_t)len + 1;
+    return at;
+}
+
+// NUL-terminated strings are stored once per distinct value.
+static uint32_t add_string(Flattener *f, const char *s) {
+    if (!s) return COMPACT_NONE;
+    size_t len = strlen(s);
+    Atom a = atom_intern(f->atoms, s, len);
+    uint32_t cap = f->offset_capacity;
+    if (a == ATOM_NONE || grow((void **)&f->offsets, &f->offset_capacity, a + 1, sizeof(uint32_t)) != 0) {
+        return add_bytes(f, s, len);
+    }
+    if (f->offset_capacity > cap) memset(f->offsets + cap, 0, (f->offset_capacity - cap) * sizeof(uint32_t));
+    if (f->offsets[a] == 0) {
+        uint32_t at = add_bytes(f, s, len);
+        if (at == COMPACT_NONE) return at;
+        f->offsets[a] = at + 1;
+    }
+    return f->offsets[a] - 1;
+}
+
+static void fill_slot(Flattener *f, uint8_t slot, uint32_t at, CompactId id) {
+    CompactAst *ca = f->ca;
+    switch (slot) {
+        case SLOT_A: ca->nodes[at].a = id; break;
+        case SLOT_B: ca->nodes[at].b = id; break;
+        case SLOT_C: ca->nodes[at].c = id; break;
+        case SLOT_EXTRA: ca->extra[at] = id; break;
+        default: ca->root = id; break;
+    }
+}
+
+// Queue n to be flattened into `slot` of record `at` (extra[at] for
+// SLOT_EXTRA); an empty slot gets COMPACT_NONE right away.
+static void defer(Flattener *f, const AstNode *n, uint8_t slot, uint32_t at) {
+    if (f->failed) return;
+    if (!n) {
+        fill_slot(f, slot, at, COMPACT_NONE);
+        return;
+    }
+    if (f->pending_count == f->pending_capacity) {
+        size_t next = f->pending_capacity ? f->pending_capacity * 2 : 256;
+        Pending *grown = (Pending *)realloc(f->pending, next * sizeof(Pending));
+        if (!grown) { f->failed = 1; return; }
+        f->pending = grown;
+        f->pending_capacity = next;
+    }
+    Pending *q = &f->pending[f->pending_count++];
+    q->node = n;
+    q->slot = slot;
+    q->at = at;
+}
+
+static uint32_t flatten_list(Flattener *f, const AstVec *v) {
+    if (v->count == 0) return 0;
+    if (v->count >= UINT32_MAX / 2) {
+        f->failed = 1;
+        return 0;
+    }
+    uint32_t l = add_extra(f, (uint32_t)v->count + 1);
+    if (f->failed) return 0;
+    f->ca->extra[l] = (uint32_t)v->count;
+    for (size_t i = 0; i < v->count; ++i) defer(f, v->items[i], SLOT_EXTRA, l + 1 + (uint32_t)i);
+    return l;
+}
+
+static void set_fields(Flattener *f, CompactId id, uint32_t a, uint32_t b, uint32_t c) {
+    if (f->failed) return;
+    CompactNode *r = &f->ca->nodes[id];
+    r->a = a;
+    r->b = b;
+    r->c = c;
+}
+
+// Add the record of n and queue its children, in field order.
+static CompactId flatten_node(Flattener *f, const AstNode *n) {
+    CompactId id = add_node(f, n);
+    if (f->failed) return COMPACT_NONE;
+    const void *d = n->data ? n->data : zero_payload;
+    uint8_t flags = 0;
+    uint16_t kind = 0;
+    uint32_t a = COMPACT_NONE, b = COMPACT_NONE, c = COMPACT_NONE;
+    switch (n->type) {
+        case AST_Program:
+            a = flatten_list(f, &((const Program *)d)->body);
+            break;
+        case AST_VariableDeclaration: {
+            const VariableDeclaration *vd = (const VariableDeclaration *)d;
+            kind = (uint16_t)vd->kind;
+            a = flatten_list(f, &vd->declarations);
+            break;
+        }
+        case AST_VariableDeclarator: {
+            const VariableDeclarator *vd = (const VariableDeclarator *)d;
+            defer(f, vd->id, SLOT_A, id);
+            defer(f, vd->init, SLOT_B, id);
+            break;
+        }
+        case AST_Identifier:
+            a = add_string(f, ((const Identifier *)d)->name);
+            break;
+        case AST_Literal: {
+            const Literal *lit = (const Literal *)d;
+            kind = (uint16_t)lit->kind;
+            a = add_string(f, lit->raw);
+            b = add_string(f, lit->bigint);
+            uint32_t cooked = lit->cooked ? add_bytes(f, lit->cooked, lit->cooked_length) : COMPACT_NONE;
+            c = add_extra(f, 4);
+            if (f->failed) break;
+            uint32_t bits[2];
+            memcpy(bits, &lit->number, sizeof(bits));
+            f->ca->extra[c] = bits[0];
+            f->ca->extra[c + 1] = bits[1];
+            f->ca->extra[c + 2] = cooked;
+            f->ca->extra[c + 3] = (uint32_t)lit->cooked_length;
+            break;
+        }
+        case AST_ExpressionStatement:
+            defer(f, ((const ExpressionStatement *)d)->expression, SLOT_A, id);
+            break;
+        case AST_UpdateExpression: {
+            const UpdateExpression *ue = (const UpdateExpression *)d;
+            if (ue->prefix) flags |= COMPACT_PREFIX;
+            kind = (uint16_t)ue->operator;
+            defer(f, ue->argument, SLOT_A, id);
+            break;
+        }
+        case AST_UnaryExpression: {
+            const UnaryExpression *ue = (const UnaryExpression *)d;
+            if (ue->prefix) flags |= COMPACT_PREFIX;
+            kind = (uint16_t)ue->operator;
+            defer(f, ue->argument, SLOT_A, id);
+            break;
+        }
+        case AST_BinaryExpression: {
+            const BinaryExpression *be = (const BinaryExpression *)d;
+            kind = (uint16_t)be->operator;
+            defer(f, be->left, SLOT_A, id);
+            defer(f, be->right, SLOT_B, id);
+            break;
+        }
+        case AST_AssignmentExpression: {
+            const AssignmentExpression *ae = (const AssignmentExpression *)d;
+            kind = (uint16_t)ae->operator;
+            defer(f, ae->left, SLOT_A, id);
+            defer(f, ae->right, SLOT_B, id);
+            break;
+        }
+        case AST_Property: {
+            const Property *prop = (const Property *)d;
+            if (prop->computed) flags |= COMPACT_COMPUTED;
+            defer(f, prop->key, SLOT_A, id);
+            defer(f, prop->value, SLOT_B, id);
+            break;
+        }
+        case AST_ObjectExpression:
+            a = flatten_list(f, &((const ObjectExpression *)d)->properties);
+            break;
+        case AST_ArrayExpression:
+            a = flatten_list(f, &((const ArrayExpression *)d)->elements);
+            break;
+        case AST_ObjectPattern:
+            a = flatten_list(f, &((const ObjectPattern *)d)->properties);
+            break;
+        case AST_ArrayPattern:
+            a = flatten_list(f, &((const ArrayPattern *)d)->elements);
+            break;
+        case AST_BlockStatement:
+            ast_materialize_body((AstNode *)n);
+            a = flatten_list(f, &((const BlockStatement *)d)->body);
+            break;
+        case AST_MemberExpression: {
+            const MemberExpression *me = (const MemberExpression *)d;
+            if (me->computed) flags |= COMPACT_COMPUTED;
+            defer(f, me->object, SLOT_A, id);
+            defer(f, me->property, SLOT_B, id);
+            break;
+        }
+        case AST_CallExpression: {
+            const CallExpression *ce = (const CallExpression *)d;
+            defer(f, ce->callee, SLOT_A, id);
+            b = flatten_list(f, &ce->arguments);
+            break;
+        }
+        case AST_FunctionDeclaration:
+        case AST_FunctionExpression: {
+            const FunctionBody *fb = (const FunctionBody *)d;
+            a = add_string(f, fb->name);
+            b = flatten_list(f, &fb->params);
+            defer(f, fb->body, SLOT_C, id);
+            break;
+        }
+        case AST_IfStatement: {
+            const IfStatement *is = (const IfStatement *)d;
+            defer(f, is->test, SLOT_A, id);
+            defer(f, is->consequent, SLOT_B, id);
+            defer(f, is->alternate, SLOT_C, id);
+            break;
+        }
+        case AST_WhileStatement: {
+            const WhileStatement *ws = (const WhileStatement *)d;
+            defer(f, ws->test, SLOT_A, id);
+            defer(f, ws->body, SLOT_B, id);
+            break;
+        }
+        case AST_DoWhileStatement: {
+            const DoWhileStatement *dw = (const DoWhileStatement *)d;
+            defer(f, dw->body, SLOT_A, id);
+            defer(f, dw->test, SLOT_B, id);
+            break;
+        }
+        case AST_ForStatement: {
+            const ForStatement *fs = (const ForStatement *)d;
+            c = add_extra(f, 2);
+            defer(f, fs->init, SLOT_A, id);
+            defer(f, fs->test, SLOT_B, id);
+            defer(f, fs->update, SLOT_EXTRA, c);
+            defer(f, fs->body, SLOT_EXTRA, c + 1);
+            break;
+        }
+        case AST_ForInStatement:
+        case AST_ForOfStatement: {
+            // ForInStatement and ForOfStatement share their layout
+            const ForOfStatement *fo = (const ForOfStatement *)d;
+            defer(f, fo->left, SLOT_A, id);
+            defer(f, fo->right, SLOT_B, id);
+            defer(f, fo->body, SLOT_C, id);
+            break;
+        }
+        case AST_SwitchStatement: {
+            const SwitchStatement *ss = (const SwitchStatement *)d;
+            defer(f, ss->discriminant, SLOT_A, id);
+            b = flatten_list(f, &ss->cases);
+            break;
+        }
+        case AST_SwitchCase: {
+            const SwitchCase *sc = (const SwitchCase *)d;
+            defer(f, sc->test, SLOT_A, id);
+            b = flatten_list(f, &sc->consequent);
+            break;
+        }
+        case AST_TryStatement: {
+            const TryStatement *ts = (const TryStatement *)d;
+            defer(f, ts->block, SLOT_A, id);
+            b = flatten_list(f, &ts->handlers);
+            defer(f, ts->finalizer, SLOT_C, id);
+            break;
+        }
+        case AST_CatchClause: {
+            const CatchClause *cc = (const CatchClause *)d;
+            defer(f, cc->param, SLOT_A, id);
+            defer(f, cc->body, SLOT_B, id);
+            break;
+        }
+        case AST_ThrowStatement:
+            defer(f, ((const ThrowStatement *)d)->argument, SLOT_A, id);
+            break;
+        case AST_ReturnStatement:
+            defer(f, ((const ReturnStatement *)d)->argument, SLOT_A, id);
+            break;
+        case AST_SpreadElement:
+            defer(f, ((const SpreadElement *)d)->argument, SLOT_A, id);
+            break;
+        case AST_RestElement:
+            defer(f, ((const RestElement *)d)->argument, SLOT_A, id);
+            break;
+        case AST_AwaitExpression:
+            defer(f, ((const AwaitExpression *)d)->argument, SLOT_A, id);
+            break;
+        case AST_YieldExpression: {
+            const YieldExpression *ye = (const YieldExpression *)d;
+            if (ye->delegate) flags |= COMPACT_DELEGATE;
+            defer(f, ye->argument, SLOT_A, id);
+            break;
+        }
+        case AST_BreakStatement:
+            a = add_string(f, ((const BreakStatement *)d)->label);
+            break;
+        case AST_ContinueStatement:
+            a = add_string(f, ((const ContinueStatement *)d)->label);
+            break;
+        case AST_ImportDeclaration: {
+            const ImportDeclaration *id = (const ImportDeclaration *)d;
+            a = flatten_list(f, &id->specifiers);
+            b = add_string(f, id->source);
+            break;
+        }
+        case AST_ImportSpecifier: {
+            const ImportSpecifier *is = (const ImportSpecifier *)d;
+            defer(f, is->imported, SLOT_A, id);
+            defer(f, is->local, SLOT_B, id);
+            break;
+        }
+        case AST_ImportDefaultSpecifier:
+            defer(f, ((const ImportDefaultSpecifier *)d)->local, SLOT_A, id);
+            break;
+        case AST_ImportNamespaceSpecifier:
+            defer(f, ((const ImportNamespaceSpecifier *)d)->local, SLOT_A, id);
+            break;
+        case AST_ExportNamedDeclaration: {
+            const ExportNamedDeclaration *en = (const ExportNamedDeclaration *)d;
+            a = flatten_list(f, &en->specifiers);
+            b = add_string(f, en->source);
+            defer(f, en->declaration, SLOT_C, id);
+            break;
+        }
+        case AST_ExportDefaultDeclaration: {
+            const ExportDefaultDeclaration *ed = (const ExportDefaultDeclaration *)d;
+            defer(f, ed->declaration, SLOT_A, id);
+            defer(f, ed->expression, SLOT_B, id);
+            break;
+        }
+        case AST_ArrowFunctionExpression: {
+            const ArrowFunctionExpression *af = (const ArrowFunctionExpression *)d;
+            if (af->is_async) flags |= COMPACT_ASYNC;
+            a = flatten_list(f, &af->params);
+            defer(f, af->body, SLOT_B, id);
+            break;
+        }
+        case AST_TemplateLiteral: {
+            // quasis and expressions interleave in the source; both lists
+            // keep their own order, quasis first
+            const TemplateLiteral *tl = (const TemplateLiteral *)d;
+            a = flatten_list(f, &tl->quasis);
+            b = flatten_list(f, &tl->expressions);
+            break;
+        }
+        case AST_TemplateElement: {
+            const TemplateElement *te = (const TemplateElement *)d;
+            if (te->tail) flags |= COMPACT_TAIL;
+            a = add_string(f, te->value);
+            b = te->cooked ? add_bytes(f, te->cooked, te->cooked_length) : COMPACT_NONE;
+            c = (uint32_t)te->cooked_length;
+            break;
+        }
+        case AST_AssignmentPattern: {
+            const AssignmentPattern *ap = (const AssignmentPattern *)d;
+            defer(f, ap->left, SLOT_A, id);
+            defer(f, ap->right, SLOT_B, id);
+            break;
+        }
+        case AST_ClassDeclaration:
+        case AST_ClassExpression: {
+            // ClassDeclaration and ClassExpression share their layout
+            const ClassDeclaration *cd = (const ClassDeclaration *)d;
+            defer(f, cd->id, SLOT_A, id);
+            defer(f, cd->superClass, SLOT_B, id);
+            c = flatten_list(f, &cd->body);
+            break;
+        }
+        case AST_MethodDefinition: {
+            const MethodDefinition *md = (const MethodDefinition *)d;
+            if (md->is_static) flags |= COMPACT_STATIC;
+            c = add_extra(f, 2);
+            defer(f, md->key, SLOT_A, id);
+            uint32_t params = flatten_list(f, &md->params);
+            defer(f, md->value, SLOT_B, id);
+            uint32_t kind_str = add_string(f, md->kind);
+            if (f->failed) break;
+            f->ca->extra[c] = kind_str;
+            f->ca->extra[c + 1] = params;
+            break;
+        }
+        case AST_Error:
+            a = add_string(f, ((const ErrorNode *)d)->message);
+            break;
+        case AST_Super:
+        case AST_ThisExpression:
+        default:
+            break;
+    }
+    if (f->failed) return COMPACT_NONE;
+    f->ca->nodes[id].flags = flags;
+    f->ca->nodes[id].kind = kind;
+    set_fields(f, id, a, b, c);
+    return id;
+}
+
+static void flatten(Flattener *f, const AstNode *root) {
+    defer(f, root, SLOT_ROOT, 0);
+    while (f->pending_count > 0 && !f->failed) {
+        Pending q = f->pending[--f->pending_count];
+        size_t first = f->pending_count;
+        CompactId id = flatten_node(f, q.node);
+        if (f->failed) break;
+        fill_slot(f, q.slot, q.at, id);
+        // the children were queued in field order; reverse them so the
+        // first comes off the stack first
+        for (size_t i = first, j = f->pending_count; i + 1 < j; ++i, --j) {
+            Pending t = f->pending[i];
+            f->pending[i] = f->pending[j - 1];
+            f->pending[j - 1] = t;
+        }
+    }
+}
+
+// Trim an array to its used length; a failed shrink keeps the old block.
+static void shrink(void **items, uint32_t *cap, uint32_t count, size_t elem) {
+    if (count == 0 || count == *cap) return;
+    void *p = realloc(*items, (size_t)count * elem);
+    if (!p) return;
+    *items = p;
+    *cap = count;
+}
+
+CompactAst *compact_from_ast(const AstNode *root) {
+    CompactAst *ca = (CompactAst *)calloc(1, sizeof(CompactAst));
+    if (!ca) return NULL;
+    Flattener f = { ca, 0, atom_table_new(), NULL, 0, NULL, 0, 0 };
+    add_extra(&f, 1); // list ref 0: the shared empty list
+    flatten(&f, root);
+    if (!f.failed && root && root->type == AST_Program && root->data) {
+        const Program *p = (const Program *)root->data;
+        if (p->comment_count) {
+            ca->comments = (CompactComment *)calloc(p->comment_count, sizeof(CompactComment));
+            if (!ca->comments) f.failed = 1;
+        }
+        for (size_t i = 0; !f.failed && i < p->comment_count; ++i) {
+            const Comment *cm = p->comments[i];
+            CompactComment *cc = &ca->comments[ca->comment_count++];
+            cc->is_block = cm->is_block;
+            cc->text = add_string(&f, cm->text);
+            cc->start = cm->start;
+            cc->end = cm->end;
+        }
+        if (!f.failed && p->diagnostic_count) {
+            ca->diagnostics = (CompactDiagnostic *)calloc(p->diagnostic_count, sizeof(CompactDiagnostic));
+            if (!ca->diagnostics) f.failed = 1;
+        }
+        for (size_t i = 0; !f.failed && i < p->diagnostic_count; ++i) {
+            const Diagnostic *d = &p->diagnostics[i];
+            CompactDiagnostic *cd = &ca->diagnostics[ca->diagnostic_count++];
+            cd->kind = add_string(&f, d->kind);
+            cd->start = d->start;
+            cd->end = d->end;
+        }
+        if (!f.failed && line_index_copy(&ca->lines, &p->lines) != 0) f.failed = 1;
+    }
+    atom_table_free(f.atoms);
+    free(f.offsets);
+    free(f.pending);
+    if (f.failed) {
+        compact_free(ca);
+        return NULL;
+    }
+    shrink((void **)&ca->nodes, &ca->node_capacity, ca->node_count, sizeof(CompactNode));
+    shrink((void **)&ca->extra, &ca->extra_capacity, ca->extra_count, sizeof(uint32_t));
+    shrink((void **)&ca->strings, &ca->string_capacity, ca->string_bytes, 1);
+    return ca;
+}
+
+void compact_free(CompactAst *ca) {
+    if (!ca) return;
+    if (ca->is_view) {
+        if (ca->mapping) munmap(ca->mapping, ca->mapping_size);
+        free(ca);
+        return;
+    }
+    free(ca->nodes);
+    free(ca->extra);
+    free(ca->strings);
+    free(ca->comments);
+    free(ca->diagnostics);
+    line_index_free(&ca->lines);
+    free(ca);
+}
+
+size_t compact_bytes(const CompactAst *ca) {
+    if (!ca) return 0;
+    return sizeof(CompactAst) +
+           (size_t)ca->node_capacity * sizeof(CompactNode) +
+           (size_t)ca->extra_capacity * sizeof(uint32_t) +
+           ca->string_capacity +
+           (size_t)ca->comment_count * sizeof(CompactComment) +
+           (size_t)ca->diagnostic_count * sizeof(CompactDiagnostic);
+}
+
+// ---------------------------------------------------------------------------
+// Accessors
+
+const CompactNode *compact_node(const CompactAst *ca, CompactId id) {
+    return ca && id < ca->node_count ? &ca->nodes[id] : NULL;
+}
+
+AstNodeType compact_type(const CompactAst *ca, CompactId id) {
+    return ca && id < ca->node_count ? (AstNodeType)ca->nodes[id].type : (AstNodeType)0;
+}
+
+const char *compact_string(const CompactAst *ca, uint32_t s) {
+    return s == COMPACT_NONE ? NULL : ca->strings + s;
+}
+
+const CompactId *compact_list(const CompactAst *ca, uint32_t l, uint32_t *count) {
+    *count = ca->extra[l];
+    return ca->extra + l + 1;
+}
+
+double compact_number(const CompactAst *ca, CompactId id) {
+    const CompactNode *r = compact_node(ca, id);
+    if (!r || r->type != AST_Literal) return 0;
+    double v;
+    memcpy(&v, ca->extra + r->c, sizeof(v));
+    return v;
+}
+
+typedef struct {
+    CompactId *out;
+    size_t cap;
+    size_t count;
+} ChildSink;
+
+static void sink_child(ChildSink *s, CompactId id) {
+    if (id == COMPACT_NONE) return;
+    if (s->count < s->cap) s->out[s->count] = id;
+    s->count++;
+}
+
+static void sink_list(ChildSink *s, const CompactAst *ca, uint32_t l) {
+    uint32_t count;
+    const CompactId *items = compact_list(ca, l, &count);
+    for (uint32_t i = 0; i < count; ++i) sink_child(s, items[i]);
+}
+
+size_t compact_children(const CompactAst *ca, CompactId id, CompactId *out, size_t cap) {
+    const CompactNode *r = compact_node(ca, id);
+    if (!r) return 0;
+    ChildSink s = { out, cap, 0 };
+    switch (r->type) {
+        case AST_Program:
+        case AST_VariableDeclaration:
+        case AST_ObjectExpression:
+        case AST_ArrayExpression:
+        case AST_ObjectPattern:
+        case AST_ArrayPattern:
+        case AST_BlockStatement:
+            sink_list(&s, ca, r->a);
+            break;
+        case AST_VariableDeclarator:
+        case AST_Property:
+        case AST_MemberExpression:
+        case AST_WhileStatement:
+        case AST_DoWhileStatement:
+        case AST_CatchClause:
+        case AST_ImportSpecifier:
+        case AST_ExportDefaultDeclaration:
+        case AST_AssignmentPattern:
+            sink_child(&s, r->a);
+            sink_child(&s, r->b);
+            break;
+        case AST_ExpressionStatement:
+        case AST_ThrowStatement:
+        case AST_ReturnStatement:
+        case AST_SpreadElement:
+        case AST_RestElement:
+        case AST_AwaitExpression:
+        case AST_YieldExpression:
+        case AST_ImportDefaultSpecifier:
+        case AST_ImportNamespaceSpecifier:
+            sink_child(&s, r->a);
+            break;
+        case AST_UpdateExpression:
+        case AST_UnaryExpression:
+            sink_child(&s, r->a);
+            break;
+        case AST_BinaryExpression:
+        case AST_AssignmentExpression:
+            sink_child(&s, r->a);
+            sink_child(&s, r->b);
+            break;
+        case AST_CallExpression:
+        case AST_SwitchStatement:
+        case AST_SwitchCase:
+            sink_child(&s, r->a);
+            sink_list(&s, ca, r->b);
+            break;
+        case AST_FunctionDeclaration:
+        case AST_FunctionExpression:
+            sink_list(&s, ca, r->b);
+            sink_child(&s, r->c);
+            break;
+        case AST_IfStatement:
+        case AST_ForInStatement:
+        case AST_ForOfStatement:
+            sink_child(&s, r->a);
+            sink_child(&s, r->b);
+            sink_child(&s, r->c);
+            break;
+        case AST_ForStatement:
+            sink_child(&s, r->a);
+            sink_child(&s, r->b);
+            sink_child(&s, ca->extra[r->c]);
+            sink_child(&s, ca->extra[r->c + 1]);
+            break;
+        case AST_TryStatement:
+            sink_child(&s, r->a);
+            sink_list(&s, ca, r->b);
+            sink_child(&s, r->c);
+            break;
+        case AST_ImportDeclaration:
+            sink_list(&s, ca, r->a);
+            break;
+        case AST_ExportNamedDeclaration:
+            sink_list(&s, ca, r->a);
+            sink_child(&s, r->c);
+            break;
+        case AST_ArrowFunctionExpression:
+            sink_list(&s, ca, r->a);
+            sink_child(&s, r->b);
+            break;
+        case AST_TemplateLiteral: {
+            // interleave quasis and expressions back into source order
+            uint32_t nq, ne;
+            const CompactId *q = compact_list(ca, r->a, &nq);
+            const CompactId *e = compact_list(ca, r->b, &ne);
+            for (uint32_t i = 0; i < nq || i < ne; ++i) {
+                if (i < nq) sink_child(&s, q[i]);
+                if (i < ne) sink_child(&s, e[i]);
+            }
+            break;
+        }
+        case AST_ClassDeclaration:
+        case AST_ClassExpression:
+            sink_child(&s, r->a);
+            sink_child(&s, r->b);
+            sink_list(&s, ca, r->c);
+            break;
+        case AST_MethodDefinition:
+            sink_child(&s, r->a);
+            sink_list(&s, ca, ca->extra[r->c + 1]);
+            sink_child(&s, r->b);
+            break;
+        default:
+            break;
+    }
+    return s.count;
+}
+
+// ---------------------------------------------------------------------------
+// Binary images
+//
+// header | nodes | extra | strings | comments | diagnostics | line starts,
+// each section starting on an 8-byte boundary. The writer's CompactNode and
+// CompactComment layouts are the file's, so a view only points into it.
+
+#define IMAGE_MAGIC "QJFA"
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;   // IMAGE_BYTE_ORDER as the writer stores it
+    uint16_t node_size;    // sizeof(CompactNode)
+    uint16_t comment_size; // sizeof(CompactComment)
+    uint32_t root;
+    uint32_t node_count;
+    uint32_t extra_count;
+    uint32_t string_bytes;
+    uint32_t comment_count;
+    uint32_t diagnostic_count;
+    uint32_t line_count;
+    uint64_t source_length;
+} ImageHeader;
+
+typedef struct {
+    size_t nodes, extra, strings, comments, diagnostics, lines, end;
+} ImageLayout;
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+static ImageLayout image_layout(const ImageHeader *h) {
+    ImageLayout l;
+    l.nodes = align8(sizeof(ImageHeader));
+    l.extra = align8(l.nodes + (size_t)h->node_count * sizeof(CompactNode));
+    l.strings = align8(l.extra + (size_t)h->extra_count * sizeof(uint32_t));
+    l.comments = align8(l.strings + h->string_bytes);
+    l.diagnostics = align8(l.comments + (size_t)h->comment_count * sizeof(CompactComment));
+    l.lines = align8(l.diagnostics + (size_t)h->diagnostic_count * sizeof(CompactDiagnostic));
+    l.end = align8(l.lines + (size_t)h->line_count * sizeof(uint32_t));
+    return l;
+}
+
+static ImageHeader image_header(const CompactAst *ca) {
+    ImageHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, IMAGE_MAGIC, 4);
+    h.version = COMPACT_IMAGE_VERSION;
+    h.byte_order = IMAGE_BYTE_ORDER;
+    h.node_size = (uint16_t)sizeof(CompactNode);
+    h.comment_size = (uint16_t)sizeof(CompactComment);
+    h.root = ca->root;
+    h.node_count = ca->node_count;
+    h.extra_count = ca->extra_count;
+    h.string_bytes = ca->string_bytes;
+    h.comment_count = ca->comment_count;
+    h.diagnostic_count = ca->diagnostic_count;
+    h.line_count = (uint32_t)ca->lines.count;
+    h.source_length = ca->lines.length;
+    return h;
+}
+
+size_t compact_image_size(const CompactAst *ca) {
+    ImageHeader h = image_header(ca);
+    return image_layout(&h).end;
+}
+
+void compact_write_image(const CompactAst *ca, void *out) {
+    ImageHeader h = image_header(ca);
+    ImageLayout l = image_layout(&h);
+    char *o = (char *)out;
+    memset(o, 0, l.end); // padding
+    memcpy(o, &h, sizeof(h));
+    if (h.node_count) memcpy(o + l.nodes, ca->nodes, (size_t)h.node_count * sizeof(CompactNode));
+    if (h.extra_count) memcpy(o + l.extra, ca->extra, (size_t)h.extra_count * sizeof(uint32_t));
+    if (h.string_bytes) memcpy(o + l.strings, ca->strings, h.string_bytes);
+    if (h.comment_count) memcpy(o + l.comments, ca->comments, (size_t)h.comment_count * sizeof(CompactComment));
+    if (h.diagnostic_count) memcpy(o + l.diagnostics, ca->diagnostics, (size_t)h.diagnostic_count * sizeof(CompactDiagnostic));
+    if (h.line_count) memcpy(o + l.lines, ca->lines.starts, (size_t)h.line_count * sizeof(uint32_t));
+}
+
+// Section at `at`, preceded by zero padding from `*written`.
+static int write_section(FILE *f, size_t *written, size_t at, const void *data, size_t bytes) {
+    static const char zeros[8];
+    if (at - *written && fwrite(zeros, 1, at - *written, f) != at - *written) return -1;
+    if (bytes && fwrite(data, 1, bytes, f) != bytes) return -1;
+    *written = at + bytes;
+    return 0;
+}
+
+int compact_write_stream(const CompactAst *ca, FILE *f) {
+    ImageHeader h = image_header(ca);
+    ImageLayout l = image_layout(&h);
+    size_t written = 0;
+    if (write_section(f, &written, 0, &h, sizeof(h)) != 0 ||
+        write_section(f, &written, l.nodes, ca->nodes, (size_t)h.node_count * sizeof(CompactNode)) != 0 ||
+        write_section(f, &written, l.extra, ca->extra, (size_t)h.extra_count * sizeof(uint32_t)) != 0 ||
+        write_section(f, &written, l.strings, ca->strings, h.string_bytes) != 0 ||
+        write_section(f, &written, l.comments, ca->comments, (size_t)h.comment_count * sizeof(CompactComment)) != 0 ||
+        write_section(f, &written, l.diagnostics, ca->diagnostics, (size_t)h.diagnostic_count * sizeof(CompactDiagnostic)) != 0 ||
+        write_section(f, &written, l.lines, ca->lines.starts, (size_t)h.line_count * sizeof(uint32_t)) != 0 ||
+        write_section(f, &written, l.end, NULL, 0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int compact_save(const CompactAst *ca, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    int rc = compact_write_stream(ca, f);
+    if (fclose(f) != 0) rc = -1;
+    return rc;
+}
+
+// What the a/b/c words of each node type refer to (see compact.h). The
+// overflow kinds name the words at extra[c].
+enum {
+    REF_RAW,     // plain value or unused
+    REF_NODE,    // child record, after its parent (pre-order)
+    REF_LIST,    // list of child records
+    REF_STRING,  // NUL-terminated pool string
+    REF_COOKED,  // pool bytes, length in c (TemplateElement)
+    REF_LITERAL, // {number lo, number hi, cooked bytes, cooked length}
+    REF_FOR,     // {update, body}
+    REF_METHOD,  // {kind string, params list}
+};
+
+static const uint8_t node_refs[AST_Error + 1][3] = {
+    [AST_Program] = {REF_LIST},
+    [AST_VariableDeclaration] = {REF_LIST},
+    [AST_VariableDeclarator] = {REF_NODE, REF_NODE},
+    [AST_Identifier] = {REF_STRING},
+    [AST_Literal] = {REF_STRING, REF_STRING, REF_LITERAL},
+    [AST_ExpressionStatement] = {REF_NODE},
+    [AST_UpdateExpression] = {REF_NODE},
+    [AST_BinaryExpression] = {REF_NODE, REF_NODE},
+    [AST_AssignmentExpression] = {REF_NODE, REF_NODE},
+    [AST_UnaryExpression] = {REF_NODE},
+    [AST_ObjectExpression] = {REF_LIST},
+    [AST_Property] = {REF_NODE, REF_NODE},
+    [AST_ArrayExpression] = {REF_LIST},
+    [AST_MemberExpression] = {REF_NODE, REF_NODE},
+    [AST_CallExpression] = {REF_NODE, REF_LIST},
+    [AST_FunctionDeclaration] = {REF_STRING, REF_LIST, REF_NODE},
+    [AST_FunctionExpression] = {REF_STRING, REF_LIST, REF_NODE},
+    [AST_BlockStatement] = {REF_LIST},
+    [AST_IfStatement] = {REF_NODE, REF_NODE, REF_NODE},
+    [AST_WhileStatement] = {REF_NODE, REF_NODE},
+    [AST_DoWhileStatement] = {REF_NODE, REF_NODE},
+    [AST_ForStatement] = {REF_NODE, REF_NODE, REF_FOR},
+    [AST_SwitchStatement] = {REF_NODE, REF_LIST},
+    [AST_SwitchCase] = {REF_NODE, REF_LIST},
+    [AST_TryStatement] = {REF_NODE, REF_LIST, REF_NODE},
+    [AST_CatchClause] = {REF_NODE, REF_NODE},
+    [AST_ThrowStatement] = {REF_NODE},
+    [AST_ReturnStatement] = {REF_NODE},
+    [AST_BreakStatement] = {REF_STRING},
+    [AST_ContinueStatement] = {REF_STRING},
+    [AST_ImportDeclaration] = {REF_LIST, REF_STRING},
+    [AST_ImportSpecifier] = {REF_NODE, REF_NODE},
+    [AST_ImportDefaultSpecifier] = {REF_NODE},
+    [AST_ImportNamespaceSpecifier] = {REF_NODE},
+    [AST_ExportNamedDeclaration] = {REF_LIST, REF_STRING, REF_NODE},
+    [AST_ExportDefaultDeclaration] = {REF_NODE, REF_NODE},
+    [AST_ArrowFunctionExpression] = {REF_LIST, REF_NODE},
+    [AST_TemplateLiteral] = {REF_LIST, REF_LIST},
+    [AST_TemplateElement] = {REF_STRING, REF_COOKED},
+    [AST_SpreadElement] = {REF_NODE},
+    [AST_ObjectPattern] = {REF_LIST},
+    [AST_ArrayPattern] = {REF_LIST},
+    [AST_AssignmentPattern] = {REF_NODE, REF_NODE},
+    [AST_RestElement] = {REF_NODE},
+    [AST_ForOfStatement] = {REF_NODE, REF_NODE, REF_NODE},
+    [AST_ForInStatement] = {REF_NODE, REF_NODE, REF_NODE},
+    [AST_ClassDeclaration] = {REF_NODE, REF_NODE, REF_LIST},
+    [AST_ClassExpression] = {REF_NODE, REF_NODE, REF_LIST},
+    [AST_MethodDefinition] = {REF_NODE, REF_NODE, REF_METHOD},
+    [AST_AwaitExpression] = {REF_NODE},
+    [AST_YieldExpression] = {REF_NODE},
+    [AST_Error] = {REF_STRING},
+};
+
+static int valid_child(const CompactAst *ca, CompactId parent, uint32_t v) {
+    return v == COMPACT_NONE || (v > parent && v < ca->node_count);
+}
+
+static int valid_string(const CompactAst *ca, uint32_t v) {
+    return v == COMPACT_NONE || v < ca->string_bytes;
+}
+
+// bytes v[0, len) plus their NUL
+static int valid_bytes(const CompactAst *ca, uint32_t v, uint32_t len) {
+    return v == COMPACT_NONE || (v < ca->string_bytes && len < ca->string_bytes - v);
+}
+
+static int valid_list(const CompactAst *ca, CompactId parent, uint32_t v) {
+    if (v >= ca->extra_count || ca->extra[v] > ca->extra_count - v - 1) return 0;
+    for (uint32_t i = 0; i < ca->extra[v]; ++i) {
+        if (!valid_child(ca, parent, ca->extra[v + 1 + i])) return 0;
+    }
+    return 1;
+}
+
+// overflow words extra[v, v + words)
+static int valid_overflow(const CompactAst *ca, uint32_t v, uint32_t words) {
+    return v < ca->extra_count && words <= ca->extra_count - v;
+}
+
+static int valid_ref(const CompactAst *ca, CompactId id, int ref, uint32_t v) {
+    const uint32_t *x = ca->extra;
+    switch (ref) {
+        case REF_NODE: return valid_child(ca, id, v);
+        case REF_LIST: return valid_list(ca, id, v);
+        case REF_STRING: return valid_string(ca, v);
+        case REF_COOKED: return valid_bytes(ca, v, ca->nodes[id].c);
+        case REF_LITERAL: return valid_overflow(ca, v, 4) && valid_bytes(ca, x[v + 2], x[v + 3]);
+        case REF_FOR: return valid_overflow(ca, v, 2) && valid_child(ca, id, x[v]) && valid_child(ca, id, x[v + 1]);
+        case REF_METHOD: return valid_overflow(ca, v, 2) && valid_string(ca, x[v]) && valid_list(ca, id, x[v + 1]);
+        default: return 1;
+    }
+}
+
+// Every reference in range, and children after their parents, so walks
+// over the view terminate.
+static int valid_image(const CompactAst *ca) {
+    if (ca->string_bytes && ca->strings[ca->string_bytes - 1] != '\0') return 0;
+    if (ca->extra_count == 0 || ca->extra[0] != 0) return 0; // the empty list
+    if (ca->root != COMPACT_NONE && ca->root >= ca->node_count) return 0;
+    for (CompactId id = 0; id < ca->node_count; ++id) {
+        const CompactNode *r = &ca->nodes[id];
+        if (r->type < AST_Program || r->type > AST_Error) return 0;
+        if ((r->type == AST_UpdateExpression || r->type == AST_UnaryExpression ||
+             r->type == AST_BinaryExpression || r->type == AST_AssignmentExpression) && r->kind >= OP__COUNT) {
+            return 0;
+        }
+        const uint8_t *refs = node_refs[r->type];
+        if (!valid_ref(ca, id, refs[0], r->a) || !valid_ref(ca, id, refs[1], r->b) ||
+            !valid_ref(ca, id, refs[2], r->c)) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < ca->comment_count; ++i) {
+        if (!valid_string(ca, ca->comments[i].text)) return 0;
+    }
+    for (uint32_t i = 0; i < ca->diagnostic_count; ++i) {
+        // the kind becomes a Diagnostic's string, which is never NULL
+        uint32_t kind = ca->diagnostics[i].kind;
+        if (kind == COMPACT_NONE || !valid_string(ca, kind)) return 0;
+    }
+    return 1;
+}
+
+CompactAst *compact_view(const void *data, size_t size) {
+    ImageHeader h;
+    if (!data || ((uintptr_t)data & 7) || size < sizeof(h)) return NULL;
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, IMAGE_MAGIC, 4) != 0 || h.version != COMPACT_IMAGE_VERSION ||
+        h.byte_order != IMAGE_BYTE_ORDER || h.node_size != sizeof(CompactNode) ||
+        h.comment_size != sizeof(CompactComment) || (size_t)h.source_length != h.source_length) {
+        return NULL;
+    }
+    ImageLayout l = image_layout(&h);
+    if (l.end != size) return NULL;
+    CompactAst *ca = (CompactAst *)calloc(1, sizeof(CompactAst));
+    if (!ca) return NULL;
+    const char *base = (const char *)data;
+    // the view never writes through these
+    ca->nodes = (CompactNode *)(base + l.nodes);
+    ca->node_count = ca->node_capacity = h.node_count;
+    ca->extra = (uint32_t *)(base + l.extra);
+    ca->extra_count = ca->extra_capacity = h.extra_count;
+    ca->strings = (char *)(base + l.strings);
+    ca->string_bytes = ca->string_capacity = h.string_bytes;
+    ca->comments = (CompactComment *)(base + l.comments);
+    ca->comment_count = h.comment_count;
+    ca->diagnostics = (CompactDiagnostic *)(base + l.diagnostics);
+    ca->diagnostic_count = h.diagnostic_count;
+    ca->lines.starts = h.line_count ? (uint32_t *)(base + l.lines) : NULL;
+    ca->lines.count = h.line_count;
+    ca->lines.length = (size_t)h.source_length;
+    ca->root = h.root;
+    ca->is_view = 1;
+    if (!valid_image(ca)) {
+        free(ca);
+        return NULL;
+    }
+    return ca;
+}
+
+CompactAst *compact_load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+    size_t size = 0;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        size = (size_t)st.st_size;
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    CompactAst *ca = compact_view(map, size);
+    if (!ca) {
+        munmap(map, size);
+        return NULL;
+    }
+    ca->mapping = map;
+    ca->mapping_size = size;
+    return ca;
+}
+
+// ---------------------------------------------------------------------------
+// Expansion back to a pointer tree
+//
+// Children come after their parents, so walking the ids of a subtree
+// backwards builds every node after its children, without recursion. Each
+// built node waits in `built` until its parent takes it.
+
+typedef struct {
+    const CompactAst *ca;
+    CompactId first; // the subtree's root
+    CompactId last;  // its highest id
+    AstNode **built; // by id - first
+} Expander;
+
+static AstNode *take(Expander *x, CompactId id) {
+    if (id == COMPACT_NONE || id <= x->first || id > x->last) return NULL;
+    AstNode *n = x->built[id - x->first];
+    x->built[id - x->first] = NULL; // a malformed image may name a node twice
+    return n;
+}
+
+static void expand_list(Expander *x, uint32_t l, AstVec *v) {
+    uint32_t count;
+    const CompactId *items = compact_list(x->ca, l, &count);
+    for (uint32_t i = 0; i < count; ++i) astvec_push(v, take(x, items[i]));
+}
+
+static char *expand_string(const CompactAst *ca, uint32_t s) {
+    const char *str = compact_string(ca, s);
+    return str ? ast_strdup_n(str, strlen(str)) : NULL;
+}
+
+// The node `id`, its children taken from x->built.
+static AstNode *expand(Expander *x, CompactId id) {
+    const CompactAst *ca = x->ca;
+    const CompactNode *r = compact_node(ca, id);
+    if (!r) return NULL;
+    const char *sa = r->a == COMPACT_NONE ? NULL : ca->strings + r->a;
+    SrcOffset s = r->start, e = r->end;
+    AstNode *n = NULL;
+    switch (r->type) {
+        case AST_Program: {
+            n = ast_program();
+            if (!n) return NULL;
+            Program *p = (Program *)n->data;
+            expand_list(x, r->a, &p->body);
+            if (id == ca->root) {
+                for (uint32_t i = 0; i < ca->comment_count; ++i) {
+                    const CompactComment *cc = &ca->comments[i];
+                    Comment *cm = (Comment *)ast_alloc(sizeof(Comment));
+                    if (!cm) break;
+                    cm->is_block = cc->is_block;
+                    cm->text = expand_string(ca, cc->text);
+                    cm->start = cc->start;
+                    cm->end = cc->end;
+                    commentvec_push(p, cm);
+                }
+                for (uint32_t i = 0; i < ca->diagnostic_count; ++i) {
+                    const CompactDiagnostic *cd = &ca->diagnostics[i];
+                    diagnostic_push(p, expand_string(ca, cd->kind), cd->start, cd->end);
+                }
+                line_index_copy(&p->lines, &ca->lines);
+            }
+            break;
+        }
+        case AST_VariableDeclaration:
+            n = ast_variable_declaration((VarKind)r->kind);
+            if (n) expand_list(x, r->a, &((VariableDeclaration *)n->data)->declarations);
+            break;
+        case AST_VariableDeclarator:
+            n = ast_variable_declarator(take(x, r->a), take(x, r->b));
+            break;
+        case AST_Identifier:
+            n = ast_identifier(sa, s, e);
+            break;
+        case AST_Literal: {
+            n = ast_literal((LiteralKind)r->kind, sa, s, e);
+            if (!n) return NULL;
+            Literal *lit = (Literal *)n->data;
+            lit->number = compact_number(ca, id);
+            lit->bigint = expand_string(ca, r->b);
+            uint32_t cooked = ca->extra[r->c + 2];
+            if (cooked != COMPACT_NONE) {
+                lit->cooked_length = ca->extra[r->c + 3];
+                lit->cooked = ast_strdup_n(ca->strings + cooked, lit->cooked_length);
+            }
+            break;
+        }
+        case AST_ExpressionStatement:
+            n = ast_expression_statement(take(x, r->a), s, e);
+            break;
+        case AST_UpdateExpression:
+            n = ast_update_expression((AstOperator)r->kind, (r->flags & COMPACT_PREFIX) != 0, take(x, r->a), s, e);
+            break;
+        case AST_UnaryExpression:
+            n = ast_unary_expression((AstOperator)r->kind, (r->flags & COMPACT_PREFIX) != 0, take(x, r->a), s, e);
+            break;
+        case AST_BinaryExpression: {
+            AstNode *left = take(x, r->a);
+            n = ast_binary_expression((AstOperator)r->kind, left, take(x, r->b), s, e);
+            break;
+        }
+        case AST_AssignmentExpression: {
+            AstNode *left = take(x, r->a);
+            n = ast_assignment_expression((AstOperator)r->kind, left, take(x, r->b), s, e);
+            break;
+        }
+        case AST_Property: {
+            AstNode *key = take(x, r->a);
+            n = ast_property(key, take(x, r->b), (r->flags & COMPACT_COMPUTED) != 0);
+            break;
+        }
+        case AST_ObjectExpression:
+            n = ast_object_expression(s, e);
+            if (n) expand_list(x, r->a, &((ObjectExpression *)n->data)->properties);
+            break;
+        case AST_ArrayExpression:
+            n = ast_array_expression(s, e);
+            if (n) expand_list(x, r->a, &((ArrayExpression *)n->data)->elements);
+            break;
+        case AST_ObjectPattern:
+            n = ast_object_pattern(s, e);
+            if (n) expand_list(x, r->a, &((ObjectPattern *)n->data)->properties);
+            break;
+        case AST_ArrayPattern:
+            n = ast_array_pattern(s, e);
+            if (n) expand_list(x, r->a, &((ArrayPattern *)n->data)->elements);
+            break;
+        case AST_BlockStatement:
+            n = ast_block_statement(s, e);
+            if (n) expand_list(x, r->a, &((BlockStatement *)n->data)->body);
+            break;
+        case AST_MemberExpression: {
+            AstNode *obj = take(x, r->a);
+            n = ast_member_expression(obj, take(x, r->b), (r->flags & COMPACT_COMPUTED) != 0, s, e);
+            break;
+        }
+        case AST_CallExpression:
+            n = ast_call_expression(take(x, r->a), s, e);
+            if (n) expand_list(x, r->b, &((CallExpression *)n->data)->arguments);
+            break;
+        case AST_FunctionDeclaration:
+        case AST_FunctionExpression: {
+            n = r->type == AST_FunctionDeclaration ? ast_function_declaration(sa, s, e)
+                                                   : ast_function_expression(sa, s, e);
+            if (!n) return NULL;
+            FunctionBody *fb = (FunctionBody *)n->data;
+            expand_list(x, r->b, &fb->params);
+            fb->body = take(x, r->c);
+            break;
+        }
+        case AST_IfStatement: {
+            AstNode *test = take(x, r->a);
+            AstNode *cons = take(x, r->b);
+            n = ast_if_statement(test, cons, take(x, r->c), s, e);
+            break;
+        }
+        case AST_WhileStatement: {
+            AstNode *test = take(x, r->a);
+            n = ast_while_statement(test, take(x, r->b), s, e);
+            break;
+        }
+        case AST_DoWhileStatement: {
+            AstNode *body = take(x, r->a);
+            n = ast_do_while_statement(body, take(x, r->b), s, e);
+            break;
+        }
+        case AST_ForStatement: {
+            AstNode *init = take(x, r->a);
+            AstNode *test = take(x, r->b);
+            AstNode *update = take(x, ca->extra[r->c]);
+            n = ast_for_statement(init, test, update, take(x, ca->extra[r->c + 1]), s, e);
+            break;
+        }
+        case AST_ForInStatement:
+        case AST_ForOfStatement: {
+            AstNode *left = take(x, r->a);
+            AstNode *right = take(x, r->b);
+            AstNode *body = take(x, r->c);
+            n = r->type == AST_ForInStatement ? ast_for_in_statement(left, right, body, s, e)
+                                              : ast_for_of_statement(left, right, body, s, e);
+            break;
+        }
+        case AST_SwitchStatement:
+            n = ast_switch_statement(take(x, r->a), s, e);
+            if (n) expand_list(x, r->b, &((SwitchStatement *)n->data)->cases);
+            break;
+        case AST_SwitchCase:
+            n = ast_switch_case(take(x, r->a));
+            if (n) expand_list(x, r->b, &((SwitchCase *)n->data)->consequent);
+            break;
+        case AST_TryStatement: {
+            n = ast_try_statement(take(x, r->a), s, e);
+            if (!n) return NULL;
+            TryStatement *ts = (TryStatement *)n->data;
+            expand_list(x, r->b, &ts->handlers);
+            ts->finalizer = take(x, r->c);
+            break;
+        }
+        case AST_CatchClause: {
+            AstNode *param = take(x, r->a);
+            n = ast_catch_clause(param, take(x, r->b));
+            break;
+        }
+        case AST_ThrowStatement:
+            n = ast_throw_statement(take(x, r->a), s, e);
+            break;
+        case AST_ReturnStatement:
+            n = ast_return_statement(take(x, r->a), s, e);
+            break;
+        case AST_SpreadElement:
+            n = ast_spread_element(take(x, r->a), s, e);
+            break;
+        case AST_RestElement:
+            n = ast_rest_element(take(x, r->a), s, e);
+            break;
+        case AST_AwaitExpression:
+            n = ast_await_expression(take(x, r->a), s, e);
+            break;
+        case AST_YieldExpression:
+            n = ast_yield_expression(take(x, r->a), (r->flags & COMPACT_DELEGATE) != 0, s, e);
+            break;
+        case AST_BreakStatement:
+            n = ast_break_statement(s, e);
+            if (n) ((BreakStatement *)n->data)->label = expand_string(ca, r->a);
+            break;
+        case AST_ContinueStatement:
+            n = ast_continue_statement(s, e);
+            if (n) ((ContinueStatement *)n->data)->label = expand_string(ca, r->a);
+            break;
+        case AST_ImportDeclaration:
+            n = ast_import_declaration(compact_string(ca, r->b), s, e);
+            if (n) expand_list(x, r->a, &((ImportDeclaration *)n->data)->specifiers);
+            break;
+        case AST_ImportSpecifier: {
+            AstNode *imported = take(x, r->a);
+            n = ast_import_specifier(imported, take(x, r->b));
+            break;
+        }
+        case AST_ImportDefaultSpecifier:
+            n = ast_import_default_specifier(take(x, r->a), s, e);
+            break;
+        case AST_ImportNamespaceSpecifier:
+            n = ast_import_namespace_specifier(take(x, r->a), s, e);
+            break;
+        case AST_ExportNamedDeclaration: {
+            n = ast_export_named_declaration(compact_string(ca, r->b), s, e);
+            if (!n) return NULL;
+            ExportNamedDeclaration *en = (ExportNamedDeclaration *)n->data;
+            expand_list(x, r->a, &en->specifiers);
+            en->declaration = take(x, r->c);
+            break;
+        }
+        case AST_ExportDefaultDeclaration: {
+            n = ast_export_default_declaration(s, e);
+            if (!n) return NULL;
+            ExportDefaultDeclaration *ed = (ExportDefaultDeclaration *)n->data;
+            ed->declaration = take(x, r->a);
+            ed->expression = take(x, r->b);
+            break;
+        }
+        case AST_ArrowFunctionExpression: {
+            n = ast_arrow_function_expression((r->flags & COMPACT_ASYNC) != 0, s, e);
+            if (!n) return NULL;
+            ArrowFunctionExpression *af = (ArrowFunctionExpression *)n->data;
+            expand_list(x, r->a, &af->params);
+            af->body = take(x, r->b);
+            break;
+        }
+        case AST_TemplateLiteral: {
+            n = ast_template_literal(s, e);
+            if (!n) return NULL;
+            TemplateLiteral *tl = (TemplateLiteral *)n->data;
+            expand_list(x, r->a, &tl->quasis);
+            expand_list(x, r->b, &tl->expressions);
+            break;
+        }
+        case AST_TemplateElement: {
+            n = ast_template_element(sa, (r->flags & COMPACT_TAIL) != 0, s, e);
+            if (n && r->b != COMPACT_NONE) {
+                TemplateElement *te = (TemplateElement *)n->data;
+                te->cooked_length = r->c;
+                te->cooked = ast_strdup_n(ca->strings + r->b, r->c);
+            }
+            break;
+        }
+        case AST_AssignmentPattern: {
+            AstNode *left = take(x, r->a);
+            n = ast_assignment_pattern(left, take(x, r->b), s, e);
+            break;
+        }
+        case AST_ClassDeclaration:
+        case AST_ClassExpression: {
+            AstNode *cid = take(x, r->a);
+            AstNode *super = take(x, r->b);
+            n = r->type == AST_ClassDeclaration ? ast_class_declaration(cid, super, s, e)
+                                                : ast_class_expression(cid, super, s, e);
+            if (n) expand_list(x, r->c, &((ClassDeclaration *)n->data)->body);
+            break;
+        }
+        case AST_MethodDefinition: {
+            AstNode *key = take(x, r->a);
+            AstNode *value = take(x, r->b);
+            n = ast_method_definition(key, value, compact_string(ca, ca->extra[r->c]),
+                                      (r->flags & COMPACT_STATIC) != 0, s, e);
+            if (n) expand_list(x, ca->extra[r->c + 1], &((MethodDefinition *)n->data)->params);
+            break;
+        }
+        case AST_Super:
+            n = ast_super(s, e);
+            break;
+        case AST_ThisExpression:
+            n = ast_this_expression(s, e);
+            break;
+        case AST_Error:
+            n = ast_error(sa, s, e);
+            break;
+        default:
+            return NULL;
+    }
+    if (n) {
+        n->start = s;
+        n->end = e;
+    }
+    return n;
+}
+
+// Highest id in the subtree at `id`; COMPACT_NONE on allocation failure.
+static CompactId subtree_last(const CompactAst *ca, CompactId id) {
+    size_t cap = 256, count = 1;
+    CompactId *stack = (CompactId *)malloc(cap * sizeof(CompactId));
+    if (!stack) return COMPACT_NONE;
+    stack[0] = id;
+    CompactId last = id;
+    while (count > 0) {
+        CompactId v = stack[--count];
+        if (v > last) last = v;
+        size_t n = compact_children(ca, v, stack + count, cap - count);
+        if (n > cap - count) {
+            while (cap - count < n) cap *= 2;
+            CompactId *grown = (CompactId *)realloc(stack, cap * sizeof(CompactId));
+            if (!grown) { free(stack); return COMPACT_NONE; }
+            stack = grown;
+            compact_children(ca, v, stack + count, cap - count);
+        }
+        count += n;
+    }
+    free(stack);
+    return last;
+}
+
+AstNode *compact_to_ast(const CompactAst *ca, CompactId id) {
+    if (!compact_node(ca, id)) return NULL;
+    AstArena *arena = ast_arena_new();
+    if (!arena) return NULL;
+    AstArena *saved = ast_arena_use(arena);
+    AstNode *n = NULL;
+    Expander x = { ca, id, subtree_last(ca, id), NULL };
+    if (x.last != COMPACT_NONE) x.built = (AstNode **)calloc((size_t)(x.last - id) + 1, sizeof(AstNode *));
+    if (x.built) {
+        for (CompactId i = x.last; i > id; --i) x.built[i - id] = expand(&x, i);
+        n = expand(&x, id);
+    }
+    free(x.built);
+    ast_arena_use(saved);
+    if (!n) {
+        ast_arena_free(arena);
+        return NULL;
+    }
+    if (n->type == AST_Program) {
+        ((Program *)n->data)->owns_arena = 1; // takes over the creator's reference
+    } else {
+        // move the creator's reference onto the root, so ast_free() of it
+        // is the arena's last release
+        ast_retain(n);
+        ast_arena_free(arena);
+    }
+    return n;
+}
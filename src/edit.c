@@ -208,6 +208,15 @@ static AstNode *rewrite_tree(const AstNode *orig, const RewriteOptions *opt) {
             if (olit) {
                 nlit->kind = olit->kind;
                 if (olit->raw) nlit->raw = dup_cstr(olit->raw);
+                nlit->number = olit->number;
+                if (olit->bigint) nlit->bigint = dup_cstr(olit->bigint);
+                if (olit->cooked) {
+                    nlit->cooked = (char *)malloc(olit->cooked_length + 1);
+                    if (nlit->cooked) {
+                        memcpy(nlit->cooked, olit->cooked, olit->cooked_length + 1);
+                        nlit->cooked_length = olit->cooked_length;
+                    }
+                }
             }
             n->data = nlit;
             break;
@@ -224,7 +233,7 @@ static AstNode *rewrite_tree(const AstNode *orig, const RewriteOptions *opt) {
             UpdateExpression *nue = (UpdateExpression *)calloc(1, sizeof(UpdateExpression));
             if (oue) {
                 nue->prefix = oue->prefix;
-                if (oue->operator) nue->operator = dup_cstr(oue->operator);
+                nue->operator = oue->operator;
                 nue->argument = rewrite_tree(oue->argument, opt);
             }
             n->data = nue;
@@ -234,7 +243,7 @@ static AstNode *rewrite_tree(const AstNode *orig, const RewriteOptions *opt) {
             BinaryExpression *obe = (BinaryExpression *)orig->data;
             BinaryExpression *nbe = (BinaryExpression *)calloc(1, sizeof(BinaryExpression));
             if (obe) {
-                if (obe->operator) nbe->operator = dup_cstr(obe->operator);
+                nbe->operator = obe->operator;
                 nbe->left = rewrite_tree(obe->left, opt);
                 nbe->right = rewrite_tree(obe->right, opt);
             }
@@ -245,7 +254,7 @@ static AstNode *rewrite_tree(const AstNode *orig, const RewriteOptions *opt) {
             AssignmentExpression *oae = (AssignmentExpression *)orig->data;
             AssignmentExpression *nae = (AssignmentExpression *)calloc(1, sizeof(AssignmentExpression));
             if (oae) {
-                if (oae->operator) nae->operator = dup_cstr(oae->operator);
+                nae->operator = oae->operator;
                 nae->left = rewrite_tree(oae->left, opt);
                 nae->right = rewrite_tree(oae->right, opt);
             }
@@ -256,7 +265,7 @@ static AstNode *rewrite_tree(const AstNode *orig, const RewriteOptions *opt) {
             UnaryExpression *oue = (UnaryExpression *)orig->data;
             UnaryExpression *nue = (UnaryExpression *)calloc(1, sizeof(UnaryExpression));
             if (oue) {
-                if (oue->operator) nue->operator = dup_cstr(oue->operator);
+                nue->operator = oue->operator;
                 nue->prefix = oue->prefix;
                 nue->argument = rewrite_tree(oue->argument, opt);
             }
@@ -350,6 +359,7 @@ static AstNode *rewrite_tree(const AstNode *orig, const RewriteOptions *opt) {
             break;
         }
         case AST_BlockStatement: {
+            ast_materialize_body((AstNode *)orig);
             BlockStatement *obs = (BlockStatement *)orig->data;
             BlockStatement *nbs = (BlockStatement *)calloc(1, sizeof(BlockStatement));
             astvec_init(&nbs->body);
@@ -602,8 +612,8 @@ static AstNode *rename_cb(const AstNode *orig, void *ctx, int *handled) {
     if (should_rename(rc, orig) && orig->type == AST_Identifier) {
         if (handled) *handled = 1;
         Identifier *oid = (Identifier *)orig->data;
-        Position s = orig->start;
-        Position e = orig->end;
+        SrcOffset s = orig->start;
+        SrcOffset e = orig->end;
         (void)oid;
         return ast_identifier(rc->new_name, s, e);
     }
@@ -859,7 +869,7 @@ EditStatus edit_move(ScopeManager *sm, AstNode *root, const AstNode *target, con
         Binding *b = r ? r->resolved : NULL;
         if (!b) continue;
         if (binding_in_subtree(target, b)) continue; // moves together
-        Binding *at_new = scope_resolve(insert_scope, b->name);
+        Binding *at_new = scope_resolve_atom(insert_scope, b->atom);
         if (at_new != b) {
             free(refs.items);
             return status_err("move would change resolution");
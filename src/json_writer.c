@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "quickjsflow/json_writer.h"
+#include "quickjsflow/lexer.h"
+
+#define MEMORY_FIRST_BUFFER 4096u
+
+// Second character of the escape of each byte a JSON string cannot hold as
+// is ('u' for \u00XX); 0 for bytes copied unchanged.
+static const char escape_char[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    ['"'] = '"', ['\\'] = '\\', [0x7f] = 'u',
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int init(JsonWriter *w, FILE *f, int fd, size_t cap) {
+    memset(w, 0, sizeof(*w));
+    w->file = f;
+    w->fd = fd;
+    w->buf = (char *)malloc(cap);
+    if (!w->buf) { w->failed = 1; return -1; }
+    w->cap = cap;
+    return 0;
+}
+
+int json_writer_init_file(JsonWriter *w, FILE *f) {
+    return init(w, f, -1, JSON_WRITER_BUFFER);
+}
+
+int json_writer_init_fd(JsonWriter *w, int fd) {
+    return init(w, NULL, fd, JSON_WRITER_BUFFER);
+}
+
+int json_writer_init_memory(JsonWriter *w) {
+    return init(w, NULL, -1, MEMORY_FIRST_BUFFER);
+}
+
+static int has_sink(const JsonWriter *w) {
+    return w->file || w->fd >= 0;
+}
+
+// Write the buffer out to the sink and empty it.
+static int drain(JsonWriter *w) {
+    if (w->failed) return -1;
+    if (w->file) {
+        if (w->len && fwrite(w->buf, 1, w->len, w->file) != w->len) w->failed = 1;
+    } else {
+        for (size_t done = 0; done < w->len;) {
+            ssize_t k = write(w->fd, w->buf + done, w->len - done);
+            if (k < 0 && errno == EINTR) continue;
+            if (k <= 0) { w->failed = 1; break; }
+            done += (size_t)k;
+        }
+    }
+    w->len = 0;
+    return w->failed ? -1 : 0;
+}
+
+// Make room for n more bytes: sinks drain first, memory writers (and
+// pieces larger than a sink's buffer) grow it.
+static int make_room(JsonWriter *w, size_t n) {
+    if (w->failed) return -1;
+    if (has_sink(w) && drain(w) != 0) return -1;
+    if (w->cap - w->len >= n) return 0;
+    size_t cap = w->cap ? w->cap : MEMORY_FIRST_BUFFER;
+    while (cap - w->len < n) cap *= 2;
+    char *grown = (char *)realloc(w->buf, cap);
+    if (!grown) { w->failed = 1; return -1; }
+    w->buf = grown;
+    w->cap = cap;
+    return 0;
+}
+
+int json_writer_flush(JsonWriter *w) {
+    if (has_sink(w)) return drain(w);
+    return w->failed ? -1 : 0;
+}
+
+int json_writer_close(JsonWriter *w) {
+    int rc = json_writer_flush(w);
+    free(w->buf);
+    w->buf = NULL;
+    w->len = w->cap = 0;
+    return rc;
+}
+
+char *json_writer_take(JsonWriter *w, size_t *len) {
+    if (has_sink(w) || w->failed || make_room(w, 1) != 0) return NULL;
+    char *out = w->buf;
+    out[w->len] = '\0';
+    if (len) *len = w->len;
+    w->buf = NULL;
+    w->len = w->cap = 0;
+    return out;
+}
+
+void json_raw(JsonWriter *w, const char *s, size_t n) {
+    if (w->cap - w->len < n && make_room(w, n) != 0) return;
+    if (w->failed) return;
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+void json_char(JsonWriter *w, char c) {
+    if (w->len == w->cap && make_room(w, 1) != 0) return;
+    if (w->failed) return;
+    w->buf[w->len++] = c;
+}
+
+void json_escaped(JsonWriter *w, const char *s, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        // short runs (names, operators) are cheaper to scan in place
+        size_t j = n - i >= 16 ? lexer_scan_json_escape(s, i, n) : i;
+        while (j < n && !escape_char[(unsigned char)s[j]]) j++;
+        json_raw(w, s + i, j - i);
+        if (j == n) break;
+        unsigned char c = (unsigned char)s[j];
+        char e = escape_char[c];
+        if (e == 'u') {
+            char u[6] = {'\\', 'u', '0', '0', hex_digits[c >> 4], hex_digits[c & 15]};
+            json_raw(w, u, sizeof(u));
+        } else {
+            char two[2] = {'\\', e};
+            json_raw(w, two, sizeof(two));
+        }
+        i = j + 1;
+    }
+}
+
+void json_string(JsonWriter *w, const char *s) {
+    if (!s) { json_lit(w, "null"); return; }
+    json_char(w, '"');
+    json_escaped(w, s, strlen(s));
+    json_char(w, '"');
+}
+
+void json_uint(JsonWriter *w, unsigned long long v) {
+    char digits[20];
+    size_t at = sizeof(digits);
+    do {
+        digits[--at] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    json_raw(w, digits + at, sizeof(digits) - at);
+}
+
+void json_int(JsonWriter *w, long long v) {
+    if (v < 0) {
+        json_char(w, '-');
+        json_uint(w, 0ull - (unsigned long long)v);
+    } else {
+        json_uint(w, (unsigned long long)v);
+    }
+}
+
+void json_bool(JsonWriter *w, int b) {
+    if (b) json_lit(w, "true"); else json_lit(w, "false");
+}
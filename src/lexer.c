@@ -1,14 +1,243 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 #include "quickjsflow/lexer.h"
+#include "unicode_id.h"
 
-static int is_ident_start(int c) {
-    return (c == '_' || c == '$' || isalpha(c));
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define QJSF_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// Scanning kernels
+//
+// Long runs of whitespace, comment text and string/template bodies are
+// skipped with block scans instead of per-byte advance(). Every kernel
+// works on [i, n) of the input and returns an index in that range (or n).
+// The vector variants fall back to the scalar code for the tail. The JSON
+// writer shares them to find the bytes a string has to escape.
+
+typedef struct {
+    const char *name;
+    // first index whose byte is one of a, b, c, d
+    size_t (*find_any)(const char *s, size_t i, size_t n, char a, char b, char c, char d);
+    // first index whose byte is not ' ', '\t', '\r' or '\n'
+    size_t (*skip_ws)(const char *s, size_t i, size_t n);
+    // number of '\n' bytes in [i, n); *last receives the index of the last one
+    size_t (*count_nl)(const char *s, size_t i, size_t n, size_t *last);
+    // first index whose byte is below 0x20, '"', '\\' or 0x7f
+    size_t (*find_json_escape)(const char *s, size_t i, size_t n);
+} ScanKernels;
+
+static size_t find_any_scalar(const char *s, size_t i, size_t n, char a, char b, char c, char d) {
+    for (; i < n; ++i) {
+        char x = s[i];
+        if (x == a || x == b || x == c || x == d) return i;
+    }
+    return n;
+}
+
+static size_t skip_ws_scalar(const char *s, size_t i, size_t n) {
+    for (; i < n; ++i) {
+        char x = s[i];
+        if (x != ' ' && x != '\t' && x != '\r' && x != '\n') return i;
+    }
+    return n;
+}
+
+static size_t count_nl_scalar(const char *s, size_t i, size_t n, size_t *last) {
+    size_t count = 0;
+    for (; i < n; ++i) {
+        if (s[i] == '\n') { count++; *last = i; }
+    }
+    return count;
+}
+
+static size_t find_json_escape_scalar(const char *s, size_t i, size_t n) {
+    for (; i < n; ++i) {
+        unsigned char x = (unsigned char)s[i];
+        if (x < 0x20 || x == '"' || x == '\\' || x == 0x7f) return i;
+    }
+    return n;
+}
+
+static const ScanKernels scan_scalar = {"scalar", find_any_scalar, skip_ws_scalar, count_nl_scalar,
+                                        find_json_escape_scalar};
+
+#ifdef QJSF_SCAN_X86
+__attribute__((target("sse2")))
+static size_t find_any_sse2(const char *s, size_t i, size_t n, char a, char b, char c, char d) {
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    const __m128i vc = _mm_set1_epi8(c), vd = _mm_set1_epi8(d);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vd)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(m);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return find_any_scalar(s, i, n, a, b, c, d);
+}
+
+__attribute__((target("sse2")))
+static size_t skip_ws_sse2(const char *s, size_t i, size_t n) {
+    const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r'), nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, nl)));
+        unsigned other = ~(unsigned)_mm_movemask_epi8(m) & 0xFFFFu;
+        if (other) return i + (size_t)__builtin_ctz(other);
+    }
+    return skip_ws_scalar(s, i, n);
+}
+
+__attribute__((target("sse2,popcnt")))
+static size_t count_nl_sse2(const char *s, size_t i, size_t n, size_t *last) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t count = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask) {
+            count += (size_t)__builtin_popcount(mask);
+            *last = i + 31 - (size_t)__builtin_clz(mask);
+        }
+    }
+    return count + count_nl_scalar(s, i, n, last);
+}
+
+__attribute__((target("avx2")))
+static size_t find_any_avx2(const char *s, size_t i, size_t n, char a, char b, char c, char d) {
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    const __m256i vc = _mm256_set1_epi8(c), vd = _mm256_set1_epi8(d);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(v, vc), _mm256_cmpeq_epi8(v, vd)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return find_any_sse2(s, i, n, a, b, c, d);
 }
 
-static int is_ident_part(int c) {
-    return (c == '_' || c == '$' || isalnum(c));
+__attribute__((target("avx2")))
+static size_t skip_ws_avx2(const char *s, size_t i, size_t n) {
+    const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r'), nl = _mm256_set1_epi8('\n');
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, nl)));
+        unsigned other = ~(unsigned)_mm256_movemask_epi8(m);
+        if (other) return i + (size_t)__builtin_ctz(other);
+    }
+    return skip_ws_sse2(s, i, n);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_nl_avx2(const char *s, size_t i, size_t n, size_t *last) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask) {
+            count += (size_t)__builtin_popcount(mask);
+            *last = i + 31 - (size_t)__builtin_clz(mask);
+        }
+    }
+    return count + count_nl_sse2(s, i, n, last);
+}
+
+// unsigned x <= 0x1f is min(x, 0x1f) == x
+__attribute__((target("sse2")))
+static size_t find_json_escape_sse2(const char *s, size_t i, size_t n) {
+    const __m128i ctl = _mm_set1_epi8(0x1f), quote = _mm_set1_epi8('"');
+    const __m128i bs = _mm_set1_epi8('\\'), del = _mm_set1_epi8(0x7f);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v), _mm_cmpeq_epi8(v, quote)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, bs), _mm_cmpeq_epi8(v, del)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(m);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return find_json_escape_scalar(s, i, n);
+}
+
+__attribute__((target("avx2")))
+static size_t find_json_escape_avx2(const char *s, size_t i, size_t n) {
+    const __m256i ctl = _mm256_set1_epi8(0x1f), quote = _mm256_set1_epi8('"');
+    const __m256i bs = _mm256_set1_epi8('\\'), del = _mm256_set1_epi8(0x7f);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v), _mm256_cmpeq_epi8(v, quote)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, bs), _mm256_cmpeq_epi8(v, del)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return find_json_escape_sse2(s, i, n);
+}
+
+static const ScanKernels scan_sse2 = {"sse2", find_any_sse2, skip_ws_sse2, count_nl_sse2, find_json_escape_sse2};
+static const ScanKernels scan_avx2 = {"avx2", find_any_avx2, skip_ws_avx2, count_nl_avx2, find_json_escape_avx2};
+#endif
+
+// Picked on first use or by lexer_set_scan_backend(); atomic because
+// parallel lexing workers read it while another thread may set it.
+static _Atomic(const ScanKernels *) scan = NULL;
+
+static const ScanKernels *scan_detect(void) {
+#ifdef QJSF_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) return &scan_avx2;
+    if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) return &scan_sse2;
+#endif
+    return &scan_scalar;
+}
+
+static const ScanKernels *scan_kernels(void) {
+    const ScanKernels *k = atomic_load_explicit(&scan, memory_order_acquire);
+    if (!k) {
+        const ScanKernels *none = NULL;
+        k = scan_detect();
+        // a backend set meanwhile wins over detection
+        if (!atomic_compare_exchange_strong(&scan, &none, k)) k = none;
+    }
+    return k;
+}
+
+const char *lexer_scan_backend(void) {
+    return scan_kernels()->name;
+}
+
+size_t lexer_scan_json_escape(const char *s, size_t i, size_t n) {
+    return scan_kernels()->find_json_escape(s, i, n);
+}
+
+int lexer_set_scan_backend(const char *name) {
+    if (!name) { atomic_store(&scan, scan_detect()); return 0; }
+    if (strcmp(name, "scalar") == 0) { atomic_store(&scan, &scan_scalar); return 0; }
+#ifdef QJSF_SCAN_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) {
+        atomic_store(&scan, &scan_sse2);
+        return 0;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        atomic_store(&scan, &scan_avx2);
+        return 0;
+    }
+#endif
+    return -1;
 }
 
 static char current_char(Lexer *lx) {
@@ -21,100 +250,283 @@ static char peek_char(Lexer *lx) {
     return lx->input[lx->pos + 1];
 }
 
+// Tokens only record byte offsets; line/column are resolved on demand
+// through a LineIndex, so moving forward is plain pointer arithmetic.
 static void advance(Lexer *lx) {
-    if (lx->pos >= lx->length) return;
-    char c = lx->input[lx->pos++];
-    if (c == '\n') {
-        lx->line += 1;
-        lx->col = 1;
-    } else {
-        lx->col += 1;
-    }
+    if (lx->pos < lx->length) lx->pos++;
+}
+
+static void advance_to(Lexer *lx, size_t to) {
+    if (to > lx->length) to = lx->length;
+    if (to > lx->pos) lx->pos = to;
 }
 
 static void skip_whitespace(Lexer *lx) {
-    for (;;) {
-        char c = current_char(lx);
-        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
-            advance(lx);
-            continue;
-        }
-        break;
-    }
+    advance_to(lx, scan_kernels()->skip_ws(lx->input, lx->pos, lx->length));
 }
 
-static char *substr_dup(const char *src, size_t start, size_t end) {
-    if (end <= start) {
-        char *s = (char *)malloc(1);
-        if (s) s[0] = '\0';
-        return s;
-    }
-    size_t len = end - start;
-    char *s = (char *)malloc(len + 1);
-    if (!s) return NULL;
-    memcpy(s, src + start, len);
-    s[len] = '\0';
-    return s;
+// ---------------------------------------------------------------------------
+// Keyword and punctuator ids
+
+// Perfect hash over the keyword set: first, second and last byte plus the
+// length select a unique slot, so a lookup costs one hash and one memcmp.
+// Regenerate the multipliers if the keyword set changes.
+#define KW_HASH_SIZE 128
+#define KW_HASH(s, n) ((((unsigned char)(s)[0] * 16u) + ((unsigned char)(s)[1] * 26u) + \
+                        ((unsigned char)(s)[(n) - 1] * 15u) + (unsigned)(n)) & (KW_HASH_SIZE - 1))
+
+typedef struct {
+    const char *name;
+    unsigned char len;
+    KeywordId id;
+} KeywordEntry;
+
+static const KeywordEntry keyword_table[KW_HASH_SIZE] = {
+    [1] = {"get", 3, KW_GET},
+    [6] = {"void", 4, KW_VOID},
+    [9] = {"do", 2, KW_DO},
+    [10] = {"typeof", 6, KW_TYPEOF},
+    [16] = {"async", 5, KW_ASYNC},
+    [17] = {"this", 4, KW_THIS},
+    [26] = {"null", 4, KW_NULL},
+    [27] = {"yield", 5, KW_YIELD},
+    [30] = {"new", 3, KW_NEW},
+    [39] = {"catch", 5, KW_CATCH},
+    [40] = {"finally", 7, KW_FINALLY},
+    [42] = {"false", 5, KW_FALSE},
+    [48] = {"in", 2, KW_IN},
+    [54] = {"with", 4, KW_WITH},
+    [55] = {"else", 4, KW_ELSE},
+    [56] = {"debugger", 8, KW_DEBUGGER},
+    [60] = {"function", 8, KW_FUNCTION},
+    [64] = {"instanceof", 10, KW_INSTANCEOF},
+    [65] = {"set", 3, KW_SET},
+    [67] = {"true", 4, KW_TRUE},
+    [68] = {"extends", 7, KW_EXTENDS},
+    [69] = {"super", 5, KW_SUPER},
+    [71] = {"const", 5, KW_CONST},
+    [72] = {"of", 2, KW_OF},
+    [75] = {"static", 6, KW_STATIC},
+    [78] = {"throw", 5, KW_THROW},
+    [81] = {"let", 3, KW_LET},
+    [82] = {"export", 6, KW_EXPORT},
+    [85] = {"default", 7, KW_DEFAULT},
+    [87] = {"for", 3, KW_FOR},
+    [90] = {"return", 6, KW_RETURN},
+    [91] = {"from", 4, KW_FROM},
+    [97] = {"undefined", 9, KW_UNDEFINED},
+    [99] = {"enum", 4, KW_ENUM},
+    [100] = {"switch", 6, KW_SWITCH},
+    [104] = {"if", 2, KW_IF},
+    [105] = {"continue", 8, KW_CONTINUE},
+    [106] = {"class", 5, KW_CLASS},
+    [107] = {"var", 3, KW_VAR},
+    [110] = {"try", 3, KW_TRY},
+    [112] = {"while", 5, KW_WHILE},
+    [115] = {"delete", 6, KW_DELETE},
+    [116] = {"import", 6, KW_IMPORT},
+    [119] = {"await", 5, KW_AWAIT},
+    [121] = {"case", 4, KW_CASE},
+    [125] = {"as", 2, KW_AS},
+    [126] = {"break", 5, KW_BREAK},
+};
+
+static const char *const keyword_names[KW__COUNT] = {
+    [KW_AWAIT] = "await",
+    [KW_BREAK] = "break",
+    [KW_CASE] = "case",
+    [KW_CATCH] = "catch",
+    [KW_CLASS] = "class",
+    [KW_CONST] = "const",
+    [KW_CONTINUE] = "continue",
+    [KW_DEBUGGER] = "debugger",
+    [KW_DEFAULT] = "default",
+    [KW_DELETE] = "delete",
+    [KW_DO] = "do",
+    [KW_ELSE] = "else",
+    [KW_ENUM] = "enum",
+    [KW_EXPORT] = "export",
+    [KW_EXTENDS] = "extends",
+    [KW_FALSE] = "false",
+    [KW_FINALLY] = "finally",
+    [KW_FOR] = "for",
+    [KW_FUNCTION] = "function",
+    [KW_IF] = "if",
+    [KW_IMPORT] = "import",
+    [KW_IN] = "in",
+    [KW_INSTANCEOF] = "instanceof",
+    [KW_NEW] = "new",
+    [KW_NULL] = "null",
+    [KW_RETURN] = "return",
+    [KW_SUPER] = "super",
+    [KW_SWITCH] = "switch",
+    [KW_THIS] = "this",
+    [KW_THROW] = "throw",
+    [KW_TRUE] = "true",
+    [KW_TRY] = "try",
+    [KW_TYPEOF] = "typeof",
+    [KW_VAR] = "var",
+    [KW_VOID] = "void",
+    [KW_WHILE] = "while",
+    [KW_WITH] = "with",
+    [KW_YIELD] = "yield",
+    [KW_AS] = "as",
+    [KW_ASYNC] = "async",
+    [KW_FROM] = "from",
+    [KW_GET] = "get",
+    [KW_LET] = "let",
+    [KW_OF] = "of",
+    [KW_SET] = "set",
+    [KW_STATIC] = "static",
+    [KW_UNDEFINED] = "undefined",
+};
+
+static const char *const punct_names[PUNCT__COUNT] = {
+    [PUNCT_LBRACE] = "{",
+    [PUNCT_RBRACE] = "}",
+    [PUNCT_LPAREN] = "(",
+    [PUNCT_RPAREN] = ")",
+    [PUNCT_LBRACKET] = "[",
+    [PUNCT_RBRACKET] = "]",
+    [PUNCT_DOT] = ".",
+    [PUNCT_ELLIPSIS] = "...",
+    [PUNCT_SEMICOLON] = ";",
+    [PUNCT_COMMA] = ",",
+    [PUNCT_COLON] = ":",
+    [PUNCT_QUESTION] = "?",
+    [PUNCT_OPTIONAL_CHAIN] = "?.",
+    [PUNCT_ARROW] = "=>",
+    [PUNCT_LT] = "<",
+    [PUNCT_GT] = ">",
+    [PUNCT_LE] = "<=",
+    [PUNCT_GE] = ">=",
+    [PUNCT_EQ] = "==",
+    [PUNCT_NE] = "!=",
+    [PUNCT_STRICT_EQ] = "===",
+    [PUNCT_STRICT_NE] = "!==",
+    [PUNCT_PLUS] = "+",
+    [PUNCT_MINUS] = "-",
+    [PUNCT_STAR] = "*",
+    [PUNCT_SLASH] = "/",
+    [PUNCT_PERCENT] = "%",
+    [PUNCT_STAR_STAR] = "**",
+    [PUNCT_INC] = "++",
+    [PUNCT_DEC] = "--",
+    [PUNCT_SHL] = "<<",
+    [PUNCT_SAR] = ">>",
+    [PUNCT_SHR] = ">>>",
+    [PUNCT_AMP] = "&",
+    [PUNCT_PIPE] = "|",
+    [PUNCT_CARET] = "^",
+    [PUNCT_BANG] = "!",
+    [PUNCT_TILDE] = "~",
+    [PUNCT_AND] = "&&",
+    [PUNCT_OR] = "||",
+    [PUNCT_NULLISH] = "??",
+    [PUNCT_ASSIGN] = "=",
+    [PUNCT_PLUS_ASSIGN] = "+=",
+    [PUNCT_MINUS_ASSIGN] = "-=",
+    [PUNCT_STAR_ASSIGN] = "*=",
+    [PUNCT_SLASH_ASSIGN] = "/=",
+    [PUNCT_PERCENT_ASSIGN] = "%=",
+    [PUNCT_STAR_STAR_ASSIGN] = "**=",
+    [PUNCT_SHL_ASSIGN] = "<<=",
+    [PUNCT_SAR_ASSIGN] = ">>=",
+    [PUNCT_SHR_ASSIGN] = ">>>=",
+    [PUNCT_AMP_ASSIGN] = "&=",
+    [PUNCT_PIPE_ASSIGN] = "|=",
+    [PUNCT_CARET_ASSIGN] = "^=",
+    [PUNCT_AND_ASSIGN] = "&&=",
+    [PUNCT_OR_ASSIGN] = "||=",
+    [PUNCT_NULLISH_ASSIGN] = "?\?=", // escaped to avoid the ??= trigraph
+};
+
+
+static KeywordId keyword_lookup(const char *s, size_t n) {
+    if (n < 2 || n > 10) return KW_NONE;
+    const KeywordEntry *e = &keyword_table[KW_HASH(s, n)];
+    if (e->len == n && memcmp(e->name, s, n) == 0) return e->id;
+    return KW_NONE;
+}
+
+const char *keyword_str(KeywordId kw) {
+    if (kw <= KW_NONE || kw >= KW__COUNT) return "";
+    return keyword_names[kw];
+}
+
+const char *punct_str(PunctId punct) {
+    if (punct <= PUNCT_NONE || punct >= PUNCT__COUNT) return "";
+    return punct_names[punct];
 }
 
-static Token make_token(Lexer *lx, TokenType type, int sl, int sc, int el, int ec, size_t s, size_t e) {
+static Token make_token(TokenType type, size_t s, size_t e) {
     Token t;
     t.type = type;
-    t.start_line = sl;
-    t.start_col = sc;
-    t.end_line = el;
-    t.end_col = ec;
-    t.lexeme = substr_dup(lx->input, s, e);
+    t.offset = s;
+    t.length = e > s ? e - s : 0;
+    t.kw = KW_NONE;
+    t.punct = PUNCT_NONE;
     t.error = 0;
     t.error_kind = NULL;
+    t.number = 0.0;
+    t.bigint = 0;
+    t.escaped = 0;
     return t;
 }
 
-static Token make_error_token(Lexer *lx, const char *kind, int sl, int sc, int el, int ec, size_t s, size_t e) {
-    Token t = make_token(lx, TOKEN_ERROR, sl, sc, el, ec, s, e);
+static Token make_error_token(const char *kind, size_t s, size_t e) {
+    Token t = make_token(TOKEN_ERROR, s, e);
     t.error = 1;
     t.error_kind = kind;
     return t;
 }
 
 static Token read_line_comment(Lexer *lx) {
-    int sl = lx->line, sc = lx->col;
     size_t start = lx->pos;
-    while (current_char(lx) != '\n' && current_char(lx) != '\0') advance(lx);
+    size_t stop = scan_kernels()->find_any(lx->input, lx->pos, lx->length, '\n', '\0', '\n', '\n');
+    lx->pos = stop;
     size_t end = lx->pos;
-    return make_token(lx, TOKEN_COMMENT_LINE, sl, sc, lx->line, lx->col, start, end);
+    return make_token(TOKEN_COMMENT_LINE, start, end);
 }
 
-static Token read_block_comment(Lexer *lx) {
-    int sl = lx->line, sc = lx->col;
-    size_t start = lx->pos;
-    int closed = 0;
-    advance(lx); // '/'
-    advance(lx); // '*'
+// The *_body scanners continue a token from inside its body, which is also
+// where a parallel chunk resumes a token left open by the previous chunk.
+// They return 1 if the closing delimiter was consumed and set *escaped if
+// a backslash was seen: bodies without one cook to their raw bytes.
+static int scan_block_comment_body(Lexer *lx) {
     while (current_char(lx) != '\0') {
+        advance_to(lx, scan_kernels()->find_any(lx->input, lx->pos, lx->length, '*', '\0', '*', '*'));
+        if (current_char(lx) == '\0') break;
         if (current_char(lx) == '*' && peek_char(lx) == '/') {
             advance(lx);
             advance(lx);
-            closed = 1;
-            break;
+            return 1;
         }
         advance(lx);
     }
+    return 0;
+}
+
+static Token read_block_comment(Lexer *lx) {
+    size_t start = lx->pos;
+    advance(lx); // '/'
+    advance(lx); // '*'
+    int closed = scan_block_comment_body(lx);
     size_t end = lx->pos;
     if (!closed) {
-        return make_error_token(lx, "UnterminatedBlockComment", sl, sc, lx->line, lx->col, start, end);
+        return make_error_token("UnterminatedBlockComment", start, end);
     }
-    return make_token(lx, TOKEN_COMMENT_BLOCK, sl, sc, lx->line, lx->col, start, end);
+    return make_token(TOKEN_COMMENT_BLOCK, start, end);
 }
 
-static Token read_string(Lexer *lx, char quote) {
-    int sl = lx->line, sc = lx->col;
-    size_t start = lx->pos;
-    advance(lx); // opening quote
-    int closed = 0;
+static int scan_string_body(Lexer *lx, char quote, int *escaped) {
     while (current_char(lx) != '\0') {
+        size_t stop = scan_kernels()->find_any(lx->input, lx->pos, lx->length, quote, '\\', '\n', '\0');
+        lx->pos = stop;
         char c = current_char(lx);
+        if (c == '\0') break;
         if (c == '\\') {
+            *escaped = 1;
             advance(lx);
             if (current_char(lx) != '\0') advance(lx);
             continue;
@@ -124,75 +536,792 @@ static Token read_string(Lexer *lx, char quote) {
         }
         if (c == quote) {
             advance(lx);
-            closed = 1;
-            break;
+            return 1;
         }
         advance(lx);
     }
+    return 0;
+}
+
+static Token read_string(Lexer *lx, char quote) {
+    size_t start = lx->pos;
+    int escaped = 0;
+    advance(lx); // opening quote
+    int closed = scan_string_body(lx, quote, &escaped);
     size_t end = lx->pos;
     if (!closed) {
-        return make_error_token(lx, "UnterminatedString", sl, sc, lx->line, lx->col, start, end);
+        return make_error_token("UnterminatedString", start, end);
     }
-    return make_token(lx, TOKEN_STRING, sl, sc, lx->line, lx->col, start, end);
+    Token t = make_token(TOKEN_STRING, start, end);
+    t.escaped = escaped;
+    return t;
 }
 
-static Token read_template(Lexer *lx) {
-    int sl = lx->line, sc = lx->col;
-    size_t start = lx->pos;
-    advance(lx); // opening backtick
-    int closed = 0;
+// Template text up to the closing backtick (returns 1) or a `${` (returns
+// 2); both delimiters are consumed. 0 means unterminated.
+static int scan_template_body(Lexer *lx, int *escaped) {
     while (current_char(lx) != '\0') {
+        advance_to(lx, scan_kernels()->find_any(lx->input, lx->pos, lx->length, '`', '\\', '$', '\0'));
         char c = current_char(lx);
+        if (c == '\0') break;
         if (c == '\\') {
+            *escaped = 1;
             advance(lx);
             if (current_char(lx) != '\0') advance(lx);
             continue;
         }
         if (c == '`') {
             advance(lx);
-            closed = 1;
-            break;
+            return 1;
+        }
+        if (c == '$' && peek_char(lx) == '{') {
+            advance(lx);
+            advance(lx);
+            return 2;
         }
         advance(lx);
     }
+    return 0;
+}
+
+// A template chunk starts at a backtick (head or whole template) or at the
+// `}` closing a substitution (middle or tail). Substitutions are tracked on
+// the lexer's template stack so a `}` only resumes template text when it
+// closes the innermost `${`.
+static Token read_template(Lexer *lx) {
+    size_t start = lx->pos;
+    int resumed = current_char(lx) == '}';
+    int escaped = 0;
+    advance(lx); // '`' or '}'
+    int r = scan_template_body(lx, &escaped);
     size_t end = lx->pos;
-    if (!closed) {
-        return make_error_token(lx, "UnterminatedTemplate", sl, sc, lx->line, lx->col, start, end);
+    if (r == 0) {
+        if (resumed) lx->tmpl_depth--;
+        return make_error_token("UnterminatedTemplate", start, end);
+    }
+    TokenType type;
+    if (r == 1) {
+        type = resumed ? TOKEN_TEMPLATE_TAIL : TOKEN_TEMPLATE;
+        if (resumed) lx->tmpl_depth--;
+    } else {
+        type = resumed ? TOKEN_TEMPLATE_MIDDLE : TOKEN_TEMPLATE_HEAD;
+        if (!resumed) {
+            if (lx->tmpl_depth == LEXER_MAX_TEMPLATE_DEPTH) {
+                return make_error_token("TemplateNestingTooDeep", start, end);
+            }
+            lx->tmpl_braces[lx->tmpl_depth++] = 0;
+        }
+    }
+    Token t = make_token(type, start, end);
+    t.escaped = escaped;
+    return t;
+}
+
+// ---------------------------------------------------------------------------
+// Cooked strings
+//
+// Tokens stay zero-copy; the scans above already flag bodies holding a
+// backslash, so unescaped ones cook to a plain copy of their bytes and
+// only flagged ones come through here.
+
+static int digit_value(int c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 99;
+}
+
+// Value of exactly n hex digits at s[*i], or -1.
+static long read_hex(const char *s, size_t len, size_t *i, int n) {
+    if (len - *i < (size_t)n) return -1;
+    long v = 0;
+    for (int k = 0; k < n; ++k) {
+        int d = digit_value(s[*i + k]);
+        if (d >= 16) return -1;
+        v = v * 16 + d;
+    }
+    *i += (size_t)n;
+    return v;
+}
+
+// \uXXXX or \u{X...} after the `u`.
+static long read_unicode_escape(const char *s, size_t len, size_t *i) {
+    if (*i < len && s[*i] == '{') {
+        size_t k = *i + 1;
+        long v = 0;
+        int digits = 0;
+        for (; k < len && s[k] != '}'; ++k, ++digits) {
+            int d = digit_value(s[k]);
+            if (d >= 16) return -1;
+            v = v * 16 + d;
+            if (v > 0x10FFFF) return -1;
+        }
+        if (k == len || digits == 0) return -1;
+        *i = k + 1;
+        return v;
+    }
+    return read_hex(s, len, i, 4);
+}
+
+// UTF-8 (lone surrogates encoded as themselves); returns the byte count.
+static size_t put_utf8(char *out, unsigned long cp) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+size_t lexer_cook_string(const char *body, size_t len, char *out) {
+    size_t i = 0, n = 0;
+    while (i < len) {
+        const char *bs = (const char *)memchr(body + i, '\\', len - i);
+        size_t run = bs ? (size_t)(bs - (body + i)) : len - i;
+        memmove(out + n, body + i, run);
+        n += run;
+        i += run;
+        if (!bs) break;
+        if (++i == len) return LEXER_BAD_ESCAPE;
+        char c = body[i++];
+        long cp;
+        switch (c) {
+            case 'n': out[n++] = '\n'; break;
+            case 't': out[n++] = '\t'; break;
+            case 'r': out[n++] = '\r'; break;
+            case 'b': out[n++] = '\b'; break;
+            case 'f': out[n++] = '\f'; break;
+            case 'v': out[n++] = '\v'; break;
+            case '\r':
+                if (i < len && body[i] == '\n') i++;
+                break; // line continuations vanish
+            case '\n':
+                break;
+            case 'x':
+                cp = read_hex(body, len, &i, 2);
+                if (cp < 0) return LEXER_BAD_ESCAPE;
+                n += put_utf8(out + n, (unsigned long)cp);
+                break;
+            case 'u':
+                cp = read_unicode_escape(body, len, &i);
+                if (cp < 0) return LEXER_BAD_ESCAPE;
+                if (cp >= 0xD800 && cp <= 0xDBFF && len - i >= 6 && body[i] == '\\' && body[i + 1] == 'u') {
+                    size_t j = i + 2;
+                    long lo = read_hex(body, len, &j, 4);
+                    if (lo >= 0xDC00 && lo <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        i = j;
+                    }
+                }
+                n += put_utf8(out + n, (unsigned long)cp);
+                break;
+            default:
+                if (c >= '0' && c <= '7') {
+                    // \0 and legacy octal escapes, up to \377
+                    cp = c - '0';
+                    int max = c <= '3' ? 2 : 1;
+                    while (max-- > 0 && i < len && body[i] >= '0' && body[i] <= '7') cp = cp * 8 + (body[i++] - '0');
+                    n += put_utf8(out + n, (unsigned long)cp);
+                } else if ((unsigned char)c == 0xE2 && len - i >= 2 && (unsigned char)body[i] == 0x80 &&
+                           ((unsigned char)body[i + 1] == 0xA8 || (unsigned char)body[i + 1] == 0xA9)) {
+                    i += 2; // LS/PS line continuation
+                } else {
+                    out[n++] = c; // \' \" \\ and identity escapes
+                }
+                break;
+        }
+    }
+    return n;
+}
+
+// ---------------------------------------------------------------------------
+// Identifiers
+//
+// ASCII identifier bytes are classified by one table lookup. Anything else
+// that may continue an identifier -- a UTF-8 sequence or a \u escape --
+// goes through the Unicode ID_Start/ID_Continue range tables.
+
+enum { CC_ID_START = 1, CC_ID_PART = 2, CC_DIGIT = 4, CC_SLOW = 8 };
+
+#define CC_L (CC_ID_START | CC_ID_PART)
+#define CC_D (CC_ID_PART | CC_DIGIT)
+#define CC_S CC_SLOW
+static const unsigned char char_class[256] = {
+    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    0,    0,    CC_L, 0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    // $
+    CC_D, CC_D, CC_D, CC_D, CC_D, CC_D, CC_D, CC_D, CC_D, CC_D, 0,    0,    0,    0,    0,    0,
+    0,    CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L,
+    CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, 0,    CC_S, 0,    0,    CC_L, // \ _
+    0,    CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L,
+    CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, CC_L, 0,    0,    0,    0,    0,
+    CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S,
+    CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S,
+    CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S,
+    CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S,
+    CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S,
+    CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S,
+    CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S,
+    CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S, CC_S,
+};
+#undef CC_L
+#undef CC_D
+#undef CC_S
+
+static int char_is(char c, int cls) {
+    return (char_class[(unsigned char)c] & cls) != 0;
+}
+
+static int in_ranges(const uint32_t (*r)[2], size_t n, uint32_t cp) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cp > r[mid][1]) lo = mid + 1;
+        else if (cp < r[mid][0]) hi = mid;
+        else return 1;
+    }
+    return 0;
+}
+
+int lexer_is_id_start(uint32_t cp) {
+    if (cp < 0x80) return char_is((char)cp, CC_ID_START);
+    return in_ranges(unicode_id_start, sizeof(unicode_id_start) / sizeof(unicode_id_start[0]), cp);
+}
+
+int lexer_is_id_continue(uint32_t cp) {
+    if (cp < 0x80) return char_is((char)cp, CC_ID_PART);
+    if (cp == 0x200C || cp == 0x200D) return 1; // ZWNJ, ZWJ
+    return in_ranges(unicode_id_continue, sizeof(unicode_id_continue) / sizeof(unicode_id_continue[0]), cp);
+}
+
+// Well-formed UTF-8 sequence at s[i..n): its length, or 0.
+static size_t decode_utf8(const char *s, size_t i, size_t n, uint32_t *cp) {
+    const unsigned char *u = (const unsigned char *)s + i;
+    size_t avail = n - i;
+    uint32_t c;
+    size_t len;
+    uint32_t min;
+    if (u[0] >= 0xC2 && u[0] <= 0xDF) { c = u[0] & 0x1F; len = 2; min = 0x80; }
+    else if (u[0] >= 0xE0 && u[0] <= 0xEF) { c = u[0] & 0x0F; len = 3; min = 0x800; }
+    else if (u[0] >= 0xF0 && u[0] <= 0xF4) { c = u[0] & 0x07; len = 4; min = 0x10000; }
+    else return 0;
+    if (avail < len) return 0;
+    for (size_t k = 1; k < len; ++k) {
+        if ((u[k] & 0xC0) != 0x80) return 0;
+        c = (c << 6) | (u[k] & 0x3F);
+    }
+    if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) return 0;
+    *cp = c;
+    return len;
+}
+
+// Bytes of the identifier character at lx->pos that the ASCII table does
+// not cover (0 if none starts there). A \u escape is always taken; *bad
+// is set if it is malformed or names a code point that cannot appear here.
+// Only the consumed bytes and the one after them are examined.
+static size_t ident_char_slow(const Lexer *lx, int first, int *escaped, int *bad) {
+    const char *s = lx->input;
+    size_t i = lx->pos, n = lx->length;
+    uint32_t cp;
+    if (s[i] != '\\') {
+        size_t len = decode_utf8(s, i, n, &cp);
+        if (len == 0 || !(first ? lexer_is_id_start(cp) : lexer_is_id_continue(cp))) return 0;
+        return len;
+    }
+    if (i + 1 >= n || s[i + 1] != 'u') return 0;
+    *escaped = 1;
+    size_t k = i + 2;
+    int ok = 1;
+    cp = 0;
+    if (k < n && s[k] == '{') {
+        size_t digits = 0;
+        for (k++; k < n && digit_value(s[k]) < 16; ++k, ++digits) {
+            if (cp <= 0x10FFFF) cp = cp * 16 + (uint32_t)digit_value(s[k]);
+        }
+        if (k < n && s[k] == '}') k++;
+        else ok = 0;
+        if (digits == 0 || cp > 0x10FFFF) ok = 0;
+    } else {
+        size_t digits = 0;
+        for (; digits < 4 && k < n && digit_value(s[k]) < 16; ++k, ++digits) cp = cp * 16 + (uint32_t)digit_value(s[k]);
+        if (digits < 4) ok = 0;
+    }
+    if (!ok || !(first ? lexer_is_id_start(cp) : lexer_is_id_continue(cp))) *bad = 1;
+    return k - i;
+}
+
+// Identifier characters from lx->pos on; `first` if none were taken yet.
+static void scan_ident_rest(Lexer *lx, int first, int *escaped, int *bad) {
+    for (;;) {
+        while (lx->pos < lx->length && char_is(lx->input[lx->pos], first ? CC_ID_START : CC_ID_PART)) {
+            lx->pos++;
+            first = 0;
+        }
+        if (lx->pos >= lx->length || !char_is(lx->input[lx->pos], CC_SLOW)) return;
+        size_t len = ident_char_slow(lx, first, escaped, bad);
+        if (len == 0) return;
+        lx->pos += len;
+        first = 0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Numeric literals
+//
+// read_number() checks the full ES2022 grammar (0x/0o/0b, legacy octal,
+// `_` separators, BigInt `n`) and decode_number() turns the lexeme into a
+// double once, so later passes never re-parse Literal.raw. Decimals go
+// through Clinger's exact fast path, then Eisel-Lemire over a 128-bit
+// power-of-ten table; the rare inputs both decline fall back to strtod.
+
+static int radix_of(char prefix) {
+    switch (prefix | 0x20) {
+        case 'x': return 16;
+        case 'o': return 8;
+        case 'b': return 2;
+        default: return 0;
+    }
+}
+
+// Digits of `radix` with single `_` separators between them. Returns the
+// digit count; a misplaced separator sets *bad.
+static size_t scan_digits(Lexer *lx, int radix, int *bad) {
+    size_t n = 0;
+    int prev_sep = 0;
+    for (;;) {
+        char c = current_char(lx);
+        if (c == '_') {
+            if (n == 0 || prev_sep) *bad = 1;
+            prev_sep = 1;
+        } else if (digit_value(c) < radix) {
+            prev_sep = 0;
+            n++;
+        } else {
+            break;
+        }
+        advance(lx);
+    }
+    if (prev_sep) *bad = 1;
+    return n;
+}
+
+// Legacy octal (017) or the decimal-looking 08/09 form: no separators,
+// no BigInt suffix.
+static int is_legacy_octal_like(const char *s, size_t n) {
+    return n >= 2 && s[0] == '0' && isdigit((unsigned char)s[1]);
+}
+
+// Round an integer accumulated as 64 significant bits, a sticky bit and a
+// binary exponent to the nearest double, ties to even.
+static double round_to_double(uint64_t m, int exp2, int sticky) {
+    int bits = 0;
+    for (uint64_t t = m; t; t >>= 1) bits++;
+    if (bits > 53) {
+        int shift = bits - 53;
+        uint64_t rem = m & ((1ull << shift) - 1);
+        uint64_t half = 1ull << (shift - 1);
+        m >>= shift;
+        exp2 += shift;
+        if (rem > half || (rem == half && (sticky || (m & 1)))) m++;
+    }
+    return ldexp((double)m, exp2);
+}
+
+// Digits in base 2^bits_per_digit, `_` and a trailing `n` skipped.
+static double decode_radix(const char *s, size_t n, int radix) {
+    uint64_t m = 0;
+    int exp2 = 0, sticky = 0;
+    int width = radix == 16 ? 4 : radix == 8 ? 3 : radix == 2 ? 1 : 0;
+    for (size_t i = 0; i < n; ++i) {
+        int d = digit_value(s[i]);
+        if (d >= radix) continue;
+        for (int b = width - 1; b >= 0; --b) {
+            int bit = (d >> b) & 1;
+            if (m < (1ull << 63)) m = m * 2 + (uint64_t)bit;
+            else { exp2++; sticky |= bit; }
+        }
+    }
+    return round_to_double(m, exp2, sticky);
+}
+
+// 128-bit truncated mantissas of 10^q for q in [POW10_MIN, POW10_MAX],
+// normalized so bit 127 is set. Built once on first use (pthread_once)
+// with exact big-integer arithmetic: 5^q by repeated multiplication, and
+// floor(2^B / 5^q) by repeated division (floor division by 5 composes
+// exactly).
+#define POW10_MIN (-348)
+#define POW10_MAX 347
+#define BIG_LIMBS 40 // 1280 bits
+
+static uint64_t pow10_hi[POW10_MAX - POW10_MIN + 1];
+static uint64_t pow10_lo[POW10_MAX - POW10_MIN + 1];
+static pthread_once_t pow10_once = PTHREAD_ONCE_INIT;
+
+static void big_top128(const uint32_t *limb, int count, uint64_t *hi, uint64_t *lo) {
+    int top = count - 1;
+    while (top > 0 && limb[top] == 0) top--;
+    int bits = top * 32;
+    for (uint32_t t = limb[top]; t; t >>= 1) bits++;
+    // bit i of the result is bit (bits - 128 + i) of the big integer
+    uint64_t h = 0, l = 0;
+    for (int i = 127; i >= 0; --i) {
+        int src = bits - 128 + i;
+        int bit = src >= 0 ? (int)((limb[src / 32] >> (src % 32)) & 1) : 0;
+        if (i >= 64) h |= (uint64_t)bit << (i - 64);
+        else l |= (uint64_t)bit << i;
+    }
+    *hi = h;
+    *lo = l;
+}
+
+static void pow10_init(void) {
+    uint32_t big[BIG_LIMBS];
+    memset(big, 0, sizeof(big));
+    big[0] = 1;
+    for (int q = 0; q <= POW10_MAX; ++q) {
+        big_top128(big, BIG_LIMBS, &pow10_hi[q - POW10_MIN], &pow10_lo[q - POW10_MIN]);
+        uint64_t carry = 0;
+        for (int k = 0; k < BIG_LIMBS; ++k) {
+            uint64_t v = (uint64_t)big[k] * 5 + carry;
+            big[k] = (uint32_t)v;
+            carry = v >> 32;
+        }
+    }
+    memset(big, 0, sizeof(big));
+    big[BIG_LIMBS - 1] = 1u << 31; // 2^1279
+    for (int q = -1; q >= POW10_MIN; --q) {
+        uint64_t rem = 0;
+        for (int k = BIG_LIMBS - 1; k >= 0; --k) {
+            uint64_t v = (rem << 32) | big[k];
+            big[k] = (uint32_t)(v / 5);
+            rem = v % 5;
+        }
+        big_top128(big, BIG_LIMBS, &pow10_hi[q - POW10_MIN], &pow10_lo[q - POW10_MIN]);
+    }
+}
+
+static void mul64(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo) {
+    uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    *lo = (mid << 32) | (uint32_t)p00;
+    *hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+
+// w * 10^q for a nonzero w; returns 0 when the result cannot be decided
+// from 128 bits of the power (the caller falls back).
+static int eisel_lemire(uint64_t w, int q, double *out) {
+    if (q < POW10_MIN || q > POW10_MAX) return 0;
+    pthread_once(&pow10_once, pow10_init);
+    int clz = 0;
+    while (!(w & (1ull << 63))) { w <<= 1; clz++; }
+    uint64_t exp2 = (uint64_t)((((int64_t)217706 * q) >> 16) + 64 + 1023) - (uint64_t)clz;
+    uint64_t x_hi, x_lo;
+    mul64(w, pow10_hi[q - POW10_MIN], &x_hi, &x_lo);
+    if ((x_hi & 0x1FF) == 0x1FF && x_lo + w < w) {
+        uint64_t y_hi, y_lo;
+        mul64(w, pow10_lo[q - POW10_MIN], &y_hi, &y_lo);
+        uint64_t m_hi = x_hi, m_lo = x_lo + y_hi;
+        if (m_lo < x_lo) m_hi++;
+        if ((m_hi & 0x1FF) == 0x1FF && m_lo + 1 == 0 && y_lo + w < w) return 0;
+        x_hi = m_hi;
+        x_lo = m_lo;
+    }
+    uint64_t msb = x_hi >> 63;
+    uint64_t mant = x_hi >> (msb + 9);
+    exp2 -= 1 ^ msb;
+    if (x_lo == 0 && (x_hi & 0x1FF) == 0 && (mant & 3) == 1) return 0;
+    mant += mant & 1;
+    mant >>= 1;
+    if (mant >> 53) {
+        mant >>= 1;
+        exp2++;
     }
-    return make_token(lx, TOKEN_TEMPLATE, sl, sc, lx->line, lx->col, start, end);
+    if (exp2 - 1 >= 0x7FF - 1) return 0; // subnormal or overflow
+    uint64_t bits = exp2 << 52 | (mant & 0x000FFFFFFFFFFFFFull);
+    memcpy(out, &bits, sizeof(bits));
+    return 1;
+}
+
+static double decode_decimal_slow(const char *s, size_t n) {
+    char small[128];
+    char *buf = n < sizeof(small) ? small : (char *)malloc(n + 1);
+    if (!buf) return 0.0;
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (s[i] != '_') buf[k++] = s[i];
+    }
+    buf[k] = '\0';
+    double v = strtod(buf, NULL);
+    if (buf != small) free(buf);
+    return v;
+}
+
+static double decode_decimal(const char *s, size_t n) {
+    static const double exact_pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    uint64_t w = 0;
+    int digits = 0, truncated = 0, seen_dot = 0;
+    long q = 0;
+    size_t i = 0;
+    for (; i < n; ++i) {
+        char c = s[i];
+        if (c == '_') continue;
+        if (c == '.') { seen_dot = 1; continue; }
+        if (!isdigit((unsigned char)c)) break;
+        if (digits == 0 && c == '0') {
+            if (seen_dot) q--;
+            continue;
+        }
+        if (digits < 19) {
+            w = w * 10 + (uint64_t)(c - '0');
+            digits++;
+            if (seen_dot) q--;
+        } else {
+            truncated = 1;
+            if (!seen_dot) q++;
+        }
+    }
+    if (i < n && (s[i] | 0x20) == 'e') {
+        int neg = 0;
+        long e = 0;
+        if (++i < n && (s[i] == '+' || s[i] == '-')) neg = s[i++] == '-';
+        for (; i < n; ++i) {
+            if (s[i] == '_') continue;
+            if (e < 100000) e = e * 10 + (s[i] - '0');
+        }
+        q += neg ? -e : e;
+    }
+    if (w == 0) return 0.0;
+    if (!truncated && w <= (1ull << 53) && q >= -22 && q <= 22) {
+        return q < 0 ? (double)w / exact_pow10[-q] : (double)w * exact_pow10[q];
+    }
+    if (q < -400) return 0.0;
+    if (q > 400) return HUGE_VAL;
+    double v, v_up;
+    if (eisel_lemire(w, (int)q, &v)) {
+        // a truncated mantissa lies in [w, w + 1): both ends must agree
+        if (!truncated || (eisel_lemire(w + 1, (int)q, &v_up) && v == v_up)) return v;
+    }
+    return decode_decimal_slow(s, n);
+}
+
+static double decode_number(const char *s, size_t n) {
+    if (n > 0 && s[n - 1] == 'n') n--; // BigInt
+    if (n >= 2 && s[0] == '0') {
+        int radix = radix_of(s[1]);
+        if (radix) return decode_radix(s + 2, n - 2, radix);
+        if (is_legacy_octal_like(s, n)) {
+            int octal = 1;
+            for (size_t i = 1; i < n; ++i) {
+                if (!isdigit((unsigned char)s[i]) || s[i] > '7') octal = 0;
+            }
+            if (octal) return decode_radix(s + 1, n - 1, 8);
+        }
+    }
+    return decode_decimal(s, n);
+}
+
+double lexer_number_value(const char *s, size_t len) {
+    return decode_number(s, len);
+}
+
+char *lexer_bigint_decimal(const char *s, size_t len) {
+    int radix = 10;
+    if (len > 0 && s[len - 1] == 'n') len--;
+    if (len >= 2 && s[0] == '0' && radix_of(s[1])) {
+        radix = radix_of(s[1]);
+        s += 2;
+        len -= 2;
+    }
+    // base-2^32 limbs, least significant first; a digit adds at most
+    // `bits` bits (4 also covers decimal's 3.33)
+    size_t bits = radix == 2 ? 1 : radix == 8 ? 3 : 4;
+    size_t cap = len * bits / 32 + 2, count = 1;
+    uint32_t *limb = (uint32_t *)calloc(cap, sizeof(uint32_t));
+    char *out = (char *)malloc(len * 2 + 16);
+    if (!limb || !out) {
+        free(limb);
+        free(out);
+        return NULL;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        int d = digit_value(s[i]);
+        if (d >= radix) continue;
+        uint64_t carry = (uint64_t)d;
+        for (size_t k = 0; k < count; ++k) {
+            uint64_t v = (uint64_t)limb[k] * (uint64_t)radix + carry;
+            limb[k] = (uint32_t)v;
+            carry = v >> 32;
+        }
+        if (carry) limb[count++] = (uint32_t)carry;
+    }
+    // peel off base-10^9 chunks, least significant first
+    size_t n = 0;
+    int zero;
+    do {
+        uint64_t rem = 0;
+        for (size_t k = count; k-- > 0;) {
+            uint64_t v = (rem << 32) | limb[k];
+            limb[k] = (uint32_t)(v / 1000000000u);
+            rem = v % 1000000000u;
+        }
+        for (int k = 0; k < 9; ++k) {
+            out[n++] = (char)('0' + rem % 10);
+            rem /= 10;
+        }
+        while (count > 1 && limb[count - 1] == 0) count--;
+        zero = count == 1 && limb[0] == 0;
+    } while (!zero);
+    while (n > 1 && out[n - 1] == '0') n--;
+    for (size_t a = 0, b = n - 1; a < b; ++a, --b) {
+        char t = out[a];
+        out[a] = out[b];
+        out[b] = t;
+    }
+    out[n] = '\0';
+    free(limb);
+    return out;
 }
 
 static Token read_number(Lexer *lx) {
-    int sl = lx->line, sc = lx->col;
     size_t start = lx->pos;
-    int seen_dot = 0;
-    while (isdigit(current_char(lx))) advance(lx);
-    if (current_char(lx) == '.') {
-        seen_dot = 1;
+    int bad = 0, is_int = 1, legacy = 0;
+    char c = current_char(lx);
+    char next = peek_char(lx);
+    int radix = c == '0' ? radix_of(next) : 0;
+    if (radix) {
+        advance(lx);
         advance(lx);
-        while (isdigit(current_char(lx))) advance(lx);
+        if (scan_digits(lx, radix, &bad) == 0) bad = 1;
+    } else {
+        if (c == '0' && isdigit((unsigned char)next)) {
+            legacy = 1;
+            while (isdigit((unsigned char)current_char(lx))) advance(lx);
+            if (current_char(lx) == '_') bad = 1;
+        } else {
+            if (c == '0' && next == '_') bad = 1;
+            scan_digits(lx, 10, &bad);
+        }
+        if (current_char(lx) == '.') {
+            is_int = 0;
+            advance(lx);
+            if (current_char(lx) == '_') bad = 1;
+            scan_digits(lx, 10, &bad);
+        }
+        c = current_char(lx);
+        if (c == 'e' || c == 'E') {
+            is_int = 0;
+            advance(lx);
+            if (current_char(lx) == '+' || current_char(lx) == '-') advance(lx);
+            if (scan_digits(lx, 10, &bad) == 0) bad = 1;
+        }
     }
-    if (current_char(lx) == 'e' || current_char(lx) == 'E') {
+    int bigint = 0;
+    if (current_char(lx) == 'n') {
+        if (!is_int || legacy) bad = 1;
+        bigint = 1;
         advance(lx);
-        if (current_char(lx) == '+' || current_char(lx) == '-') advance(lx);
-        while (isdigit(current_char(lx))) advance(lx);
     }
+    // `3in` or `0xg`: an identifier may not follow a number directly
+    size_t tail = lx->pos;
+    int escaped = 0;
+    scan_ident_rest(lx, 0, &escaped, &bad);
+    if (lx->pos > tail) bad = 1;
     size_t end = lx->pos;
-    (void)seen_dot;
-    return make_token(lx, TOKEN_NUMBER, sl, sc, lx->line, lx->col, start, end);
+    if (bad) {
+        return make_error_token("InvalidNumericLiteral", start, end);
+    }
+    Token t = make_token(TOKEN_NUMBER, start, end);
+    t.bigint = bigint;
+    t.number = decode_number(lx->input + start, end - start);
+    return t;
 }
 
 static Token read_identifier_or_keyword(Lexer *lx) {
-    int sl = lx->line, sc = lx->col;
     size_t start = lx->pos;
-    advance(lx);
-    while (is_ident_part(current_char(lx))) advance(lx);
+    int escaped = 0, bad = 0;
+    scan_ident_rest(lx, 1, &escaped, &bad);
     size_t end = lx->pos;
-    return make_token(lx, TOKEN_IDENTIFIER, sl, sc, lx->line, lx->col, start, end);
+    if (bad) {
+        return make_error_token("InvalidIdentifierEscape", start, end);
+    }
+    Token t = make_token(TOKEN_IDENTIFIER, start, end);
+    // an escaped keyword spells an identifier, never the keyword
+    t.kw = escaped ? KW_NONE : keyword_lookup(lx->input + start, end - start);
+    t.escaped = escaped;
+    return t;
+}
+
+// Maximal-munch punctuator DFA, built once on first use from punct_names
+// (pthread_once, as lexing workers may get there together): one state per
+// punctuator prefix, transitions indexed by a compact class of the
+// punctuator characters, and the id accepted in each state.
+#define PUNCT_STATES 64
+#define PUNCT_CLASSES 32
+
+static unsigned char punct_class[128];
+static unsigned char punct_next[PUNCT_STATES][PUNCT_CLASSES];
+static unsigned char punct_accept[PUNCT_STATES];
+static pthread_once_t punct_dfa_once = PTHREAD_ONCE_INIT;
+
+static void punct_dfa_init(void) {
+    int classes = 1, states = 1; // class 0 and state 0 mean "none"/root
+    for (int id = PUNCT_NONE + 1; id < PUNCT__COUNT; ++id) {
+        int state = 0;
+        for (const char *c = punct_names[id]; *c; ++c) {
+            unsigned char ch = (unsigned char)*c;
+            if (!punct_class[ch]) punct_class[ch] = (unsigned char)classes++;
+            unsigned char *next = &punct_next[state][punct_class[ch]];
+            if (!*next) *next = (unsigned char)states++;
+            state = *next;
+        }
+        punct_accept[state] = (unsigned char)id;
+    }
+}
+
+// Longest punctuator at s[i..n); *len_out is 0 if none starts there.
+static PunctId scan_punct(const char *s, size_t i, size_t n, size_t *len_out) {
+    pthread_once(&punct_dfa_once, punct_dfa_init);
+    int state = 0;
+    PunctId best = PUNCT_NONE;
+    size_t best_len = 0;
+    for (size_t k = i; k < n; ++k) {
+        unsigned char ch = (unsigned char)s[k];
+        if (ch >= 128 || !punct_class[ch]) break;
+        state = punct_next[state][punct_class[ch]];
+        if (!state) break;
+        if (punct_accept[state]) {
+            best = (PunctId)punct_accept[state];
+            best_len = k - i + 1;
+        }
+    }
+    // `a?.5:b` is a conditional, not optional chaining
+    if (best == PUNCT_OPTIONAL_CHAIN && i + 2 < n && isdigit((unsigned char)s[i + 2])) {
+        best = PUNCT_QUESTION;
+        best_len = 1;
+    }
+    *len_out = best_len;
+    return best;
 }
 
 static Token read_punctuator(Lexer *lx) {
-    int sl = lx->line, sc = lx->col;
     size_t start = lx->pos;
     char c = current_char(lx);
     char n = peek_char(lx);
@@ -202,67 +1331,826 @@ static Token read_punctuator(Lexer *lx) {
     if (c == '/' && n == '*') {
         return read_block_comment(lx);
     }
-    // handle arrow function =>
-    if (c == '=' && n == '>') {
-        advance(lx);
+    size_t len = 0;
+    PunctId id = scan_punct(lx->input, lx->pos, lx->length, &len);
+    if (len == 0) {
+        // unknown character: single-char punctuator without an id
         advance(lx);
-        size_t end2 = lx->pos;
-        return make_token(lx, TOKEN_PUNCTUATOR, sl, sc, lx->line, lx->col, start, end2);
+    } else {
+        // punctuators never span lines
+        lx->pos += len;
     }
-    // handle spread/rest ...
-    if (c == '.' && n == '.' && lx->pos + 2 < lx->length && lx->input[lx->pos + 2] == '.') {
-        advance(lx);
-        advance(lx);
-        advance(lx);
-        size_t end3 = lx->pos;
-        return make_token(lx, TOKEN_PUNCTUATOR, sl, sc, lx->line, lx->col, start, end3);
+    if (lx->tmpl_depth > 0) {
+        // braces nested inside the innermost substitution
+        if (id == PUNCT_LBRACE) lx->tmpl_braces[lx->tmpl_depth - 1]++;
+        else if (id == PUNCT_RBRACE) lx->tmpl_braces[lx->tmpl_depth - 1]--;
     }
-    // handle a few common two-char punctuators
-    if ((c == '=' && n == '=') || (c == '!' && n == '=') || (c == '<' && n == '=') || (c == '>' && n == '=') ||
-        (c == '+' && n == '+') || (c == '-' && n == '-') || (c == '&' && n == '&') || (c == '|' && n == '|')) {
-        advance(lx);
-        advance(lx);
-        size_t end2 = lx->pos;
-        return make_token(lx, TOKEN_PUNCTUATOR, sl, sc, lx->line, lx->col, start, end2);
-    }
-    advance(lx);
-    size_t end = lx->pos;
-    return make_token(lx, TOKEN_PUNCTUATOR, sl, sc, lx->line, lx->col, start, end);
+    Token t = make_token(TOKEN_PUNCTUATOR, start, lx->pos);
+    t.punct = id;
+    return t;
 }
 
 void lexer_init(Lexer *lx, const char *input, size_t length) {
     lx->input = input;
     lx->length = length;
     lx->pos = 0;
-    lx->line = 1;
-    lx->col = 1;
+    lx->tmpl_depth = 0;
 }
 
 Token lexer_next(Lexer *lx) {
     skip_whitespace(lx);
-    int sl = lx->line, sc = lx->col;
     char c = current_char(lx);
     if (c == '\0') {
-        return make_token(lx, TOKEN_EOF, sl, sc, lx->line, lx->col, lx->pos, lx->pos);
+        return make_token(TOKEN_EOF, lx->pos, lx->pos);
     }
     if (c == '\'' || c == '"') {
         return read_string(lx, c);
     }
-    if (c == '`') {
+    if (c == '`' || (c == '}' && lx->tmpl_depth > 0 && lx->tmpl_braces[lx->tmpl_depth - 1] == 0)) {
         return read_template(lx);
     }
-    if (is_ident_start(c)) {
+    if (char_is(c, CC_ID_START)) {
         return read_identifier_or_keyword(lx);
     }
-    if (isdigit(c)) {
+    if (char_is(c, CC_SLOW)) {
+        int escaped = 0, bad = 0;
+        if (ident_char_slow(lx, 1, &escaped, &bad) > 0) return read_identifier_or_keyword(lx);
+    }
+    if (char_is(c, CC_DIGIT) || (c == '.' && char_is(peek_char(lx), CC_DIGIT))) {
         return read_number(lx);
     }
     return read_punctuator(lx);
 }
 
-void token_free(Token *tok) {
-    if (tok && tok->lexeme) {
-        free(tok->lexeme);
-        tok->lexeme = NULL;
+static int token_buffer_reserve(TokenBuffer *tb, size_t need) {
+    if (need <= tb->capacity) return 0;
+    size_t cap = tb->capacity ? tb->capacity * 2 : 256;
+    if (cap < need) cap = need;
+#define GROW_COLUMN(col) do { \
+        void *np = realloc(tb->col, cap * sizeof(*tb->col)); \
+        if (!np) return -1; \
+        tb->col = np; \
+    } while (0)
+    GROW_COLUMN(types);
+    GROW_COLUMN(ids);
+    GROW_COLUMN(flags);
+    GROW_COLUMN(offsets);
+    GROW_COLUMN(lengths);
+#undef GROW_COLUMN
+    tb->capacity = cap;
+    return 0;
+}
+
+static int token_buffer_add_error(TokenBuffer *tb, size_t index, const char *kind) {
+    if (tb->error_count == tb->error_capacity) {
+        size_t cap = tb->error_capacity ? tb->error_capacity * 2 : 8;
+        TokenError *np = (TokenError *)realloc(tb->errors, cap * sizeof(TokenError));
+        if (!np) return -1;
+        tb->errors = np;
+        tb->error_capacity = cap;
+    }
+    tb->errors[tb->error_count].index = (uint32_t)index;
+    tb->errors[tb->error_count].kind = kind;
+    tb->error_count++;
+    return 0;
+}
+
+// Append t; `prev_end` is where the previous token ended and decides
+// TOKF_NEWLINE_BEFORE (ignored for the first token of the buffer).
+// `in_template` says the lexer's template stack was not empty before t.
+static int token_buffer_push(TokenBuffer *tb, const char *input, const Token *t, size_t prev_end,
+                             int in_template) {
+    size_t i = tb->count;
+    if (token_buffer_reserve(tb, i + 1) != 0) return -1;
+    uint8_t flags = 0;
+    if (t->escaped) flags |= TOKF_ESCAPED;
+    if (in_template) flags |= TOKF_IN_TEMPLATE;
+    if (i > 0 && t->offset > prev_end && memchr(input + prev_end, '\n', t->offset - prev_end)) {
+        flags |= TOKF_NEWLINE_BEFORE;
+    }
+    if (t->error) {
+        flags |= TOKF_ERROR;
+        if (token_buffer_add_error(tb, i, t->error_kind) != 0) return -1;
+    }
+    tb->types[i] = (uint8_t)t->type;
+    tb->ids[i] = (uint8_t)(t->type == TOKEN_IDENTIFIER ? (int)t->kw :
+                           t->type == TOKEN_NUMBER ? t->bigint : (int)t->punct);
+    tb->flags[i] = flags;
+    tb->offsets[i] = (uint32_t)t->offset;
+    tb->lengths[i] = (uint32_t)t->length;
+    tb->count++;
+    return 0;
+}
+
+int lexer_tokenize_all(const char *input, size_t length, TokenBuffer *out) {
+    memset(out, 0, sizeof(*out));
+    if (length >= UINT32_MAX) return -1;
+    out->input = input;
+    Lexer lx;
+    lexer_init(&lx, input, length);
+    size_t prev_end = 0;
+    for (;;) {
+        int in_template = lx.tmpl_depth > 0;
+        Token t = lexer_next(&lx);
+        if (token_buffer_push(out, input, &t, prev_end, in_template) != 0) {
+            token_buffer_free(out);
+            return -1;
+        }
+        prev_end = t.offset + t.length;
+        if (t.type == TOKEN_EOF) break;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Parallel tokenization
+//
+// The input is cut into chunks that start right after a '\n'. Tokens never
+// depend on what precedes them, so the only lexer state that can cross a
+// line start is "inside a token that may span lines": a block comment, a
+// template, or a string continued with a backslash-newline. Each worker
+// lexes its chunk once from a clean start and, for every other state,
+// scans the rest of the open token and lexes forward until a token starts
+// where one of the clean run's tokens does; from there the streams are
+// identical and the tail is shared. Stitching then walks the chunks in
+// order, following the state each chunk hands to the next.
+//
+// Template substitutions are the exception: a `}` resumes template text
+// only if it closes a `${` opened earlier, so nothing lexed inside one can
+// be guessed from a line start. A template with substitutions that crosses
+// a chunk end is cut from the run, and stitching re-lexes it sequentially
+// until the stream rejoins a clean run outside any template.
+
+typedef enum {
+    LEX_CODE,
+    LEX_IN_SQ_STRING,
+    LEX_IN_DQ_STRING,
+    LEX_IN_TEMPLATE,
+    LEX_IN_BLOCK_COMMENT,
+    LEX__STATES
+} LexState;
+
+#define NO_SYNC SIZE_MAX
+
+typedef struct {
+    int cont;           // token open at the chunk start: 1 closed, 0 unterminated, -1 still open at the end
+    size_t cont_end;
+    TokenBuffer toks;   // tokens starting inside the chunk
+    size_t sync;        // continue with the clean run's tokens from this index (NO_SYNC: none)
+    LexState exit;      // state handed to the next chunk
+    size_t open_start;  // offset of the token left open at the chunk end
+} ChunkRun;
+
+typedef struct {
+    const char *input;
+    size_t length;      // effective input length
+    size_t begin, limit;
+    ChunkRun runs[LEX__STATES];
+    int failed;
+} LexChunk;
+
+static size_t parallel_min_size = 1u << 20;
+
+size_t lexer_parallel_threshold(void) {
+    return parallel_min_size;
+}
+
+void lexer_set_parallel_threshold(size_t bytes) {
+    parallel_min_size = bytes;
+}
+
+static LexState open_state(const char *input, const Token *t) {
+    if (strcmp(t->error_kind, "UnterminatedBlockComment") == 0) return LEX_IN_BLOCK_COMMENT;
+    if (strcmp(t->error_kind, "UnterminatedTemplate") == 0) return LEX_IN_TEMPLATE;
+    return input[t->offset] == '\'' ? LEX_IN_SQ_STRING : LEX_IN_DQ_STRING;
+}
+
+static size_t find_offset(const TokenBuffer *tb, size_t offset) {
+    size_t lo = 0, hi = tb->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tb->offsets[mid] < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < tb->count && tb->offsets[lo] == offset ? lo : NO_SYNC;
+}
+
+// Cut the run back to the template opened at token `head` and hand it to
+// stitching.
+static int cut_open_template(ChunkRun *run, size_t head, size_t head_offset) {
+    TokenBuffer *tb = &run->toks;
+    tb->count = head;
+    while (tb->error_count > 0 && tb->errors[tb->error_count - 1].index >= head) tb->error_count--;
+    run->exit = LEX_IN_TEMPLATE;
+    run->open_start = head_offset;
+    return 0;
+}
+
+// Lex [pos, chunk limit). With `clean`, stop at the first token outside
+// any template that also starts one of its template-free entries.
+static int lex_chunk_tokens(const LexChunk *c, size_t pos, const TokenBuffer *clean, ChunkRun *run) {
+    Lexer lx;
+    lexer_init(&lx, c->input, c->limit);
+    lx.pos = pos;
+    size_t prev_end = pos;
+    size_t head = 0, head_offset = 0; // outermost open template
+    int last = c->limit == c->length;
+    for (;;) {
+        int in_template = lx.tmpl_depth > 0;
+        Token t = lexer_next(&lx);
+        if (t.type == TOKEN_EOF) {
+            // chunks end on a line start, so only the final EOF is real
+            if (!last && in_template) return cut_open_template(run, head, head_offset);
+            if (last && token_buffer_push(&run->toks, c->input, &t, prev_end, in_template) != 0) return -1;
+            return 0;
+        }
+        if (t.error && !last && t.offset + t.length == c->limit) {
+            if (in_template) return cut_open_template(run, head, head_offset);
+            run->exit = open_state(c->input, &t);
+            run->open_start = t.offset;
+            return 0;
+        }
+        if (clean && !in_template) {
+            size_t j = find_offset(clean, t.offset);
+            if (j != NO_SYNC && !(clean->flags[j] & TOKF_IN_TEMPLATE)) {
+                run->sync = j;
+                return 0;
+            }
+        }
+        if (!in_template && lx.tmpl_depth > 0) {
+            head = run->toks.count;
+            head_offset = t.offset;
+        }
+        if (token_buffer_push(&run->toks, c->input, &t, prev_end, in_template) != 0) return -1;
+        prev_end = t.offset + t.length;
+    }
+}
+
+static int lex_chunk_state(LexChunk *c, LexState st) {
+    ChunkRun *run = &c->runs[st];
+    run->cont = 1;
+    run->cont_end = c->begin;
+    run->sync = NO_SYNC;
+    run->exit = LEX_CODE;
+    if (st == LEX_CODE) return lex_chunk_tokens(c, c->begin, NULL, run);
+
+    Lexer lx;
+    lexer_init(&lx, c->input, c->limit);
+    lx.pos = c->begin;
+    int closed, escaped = 0;
+    if (st == LEX_IN_BLOCK_COMMENT) closed = scan_block_comment_body(&lx);
+    else closed = scan_string_body(&lx, st == LEX_IN_SQ_STRING ? '\'' : '"', &escaped);
+    run->cont_end = lx.pos;
+    if (!closed && lx.pos == c->limit && c->limit < c->length) {
+        run->cont = -1;
+        run->exit = st;
+        return 0;
+    }
+    run->cont = closed;
+    return lex_chunk_tokens(c, lx.pos, &c->runs[LEX_CODE].toks, run);
+}
+
+static void *lex_chunk_worker(void *arg) {
+    LexChunk *c = (LexChunk *)arg;
+    for (int st = LEX_CODE; st < LEX__STATES; ++st) {
+        if (st == LEX_IN_TEMPLATE) continue; // re-lexed while stitching
+        if (lex_chunk_state(c, (LexState)st) != 0) {
+            c->failed = 1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Append src[from..to) to out with offsets moved by `delta`, renumbering
+// errors and recomputing the newline flag of the first appended token
+// against the stream so far.
+static int append_tokens(TokenBuffer *out, const char *input, const TokenBuffer *src, size_t from, size_t to,
+                         int64_t delta, size_t *prev_end) {
+    if (from >= to) return 0;
+    size_t n = to - from, base = out->count;
+    if (token_buffer_reserve(out, base + n) != 0) return -1;
+    memcpy(out->types + base, src->types + from, n);
+    memcpy(out->ids + base, src->ids + from, n);
+    memcpy(out->flags + base, src->flags + from, n);
+    memcpy(out->offsets + base, src->offsets + from, n * sizeof(uint32_t));
+    memcpy(out->lengths + base, src->lengths + from, n * sizeof(uint32_t));
+    if (delta != 0) {
+        for (size_t i = base; i < base + n; ++i) out->offsets[i] = (uint32_t)(out->offsets[i] + delta);
+    }
+    out->count += n;
+    uint8_t *f = &out->flags[base];
+    *f &= (uint8_t)~TOKF_NEWLINE_BEFORE;
+    size_t off = out->offsets[base];
+    if (base > 0 && off > *prev_end && memchr(input + *prev_end, '\n', off - *prev_end)) {
+        *f |= TOKF_NEWLINE_BEFORE;
+    }
+    for (size_t k = 0; k < src->error_count; ++k) {
+        size_t idx = src->errors[k].index;
+        if (idx < from || idx >= to) continue;
+        if (token_buffer_add_error(out, base + (idx - from), src->errors[k].kind) != 0) return -1;
+    }
+    size_t last = out->count - 1;
+    *prev_end = (size_t)out->offsets[last] + out->lengths[last];
+    return 0;
+}
+
+// Lex sequentially from the template opened at `open_start` until a token
+// outside any template starts where a template-free token of some chunk's
+// clean run does. Returns 1 with that chunk and token in *k and *sync, 0 if
+// the input ended first, -1 on allocation failure.
+static int relex_open_template(LexChunk *chunks, size_t n, size_t open_start, TokenBuffer *out,
+                               size_t *prev_end, size_t *k, size_t *sync) {
+    const char *input = chunks[0].input;
+    Lexer lx;
+    lexer_init(&lx, input, chunks[0].length);
+    lx.pos = open_start;
+    size_t c = *k;
+    for (;;) {
+        int in_template = lx.tmpl_depth > 0;
+        Token t = lexer_next(&lx);
+        if (!in_template && t.offset > open_start) {
+            while (c < n && chunks[c].limit <= t.offset) c++;
+            if (c < n) {
+                const TokenBuffer *clean = &chunks[c].runs[LEX_CODE].toks;
+                size_t j = find_offset(clean, t.offset);
+                if (j != NO_SYNC && !(clean->flags[j] & TOKF_IN_TEMPLATE)) {
+                    *k = c;
+                    *sync = j;
+                    return 1;
+                }
+            }
+        }
+        if (token_buffer_push(out, input, &t, *prev_end, in_template) != 0) return -1;
+        *prev_end = t.offset + t.length;
+        if (t.type == TOKEN_EOF) return 0;
+    }
+}
+
+static int stitch_chunks(LexChunk *chunks, size_t n, TokenBuffer *out) {
+    const char *input = chunks[0].input;
+    LexState st = LEX_CODE;
+    size_t open_start = 0, prev_end = 0;
+    for (size_t k = 0; k < n; ++k) {
+        if (st == LEX_IN_TEMPLATE) {
+            size_t sync = 0;
+            int r = relex_open_template(chunks, n, open_start, out, &prev_end, &k, &sync);
+            if (r <= 0) return r;
+            const ChunkRun *tail = &chunks[k].runs[LEX_CODE];
+            if (append_tokens(out, input, &tail->toks, sync, tail->toks.count, 0, &prev_end) != 0) return -1;
+            st = tail->exit;
+            open_start = tail->open_start;
+            continue;
+        }
+        ChunkRun *run = &chunks[k].runs[st];
+        if (st != LEX_CODE) {
+            if (run->cont < 0) continue; // the whole chunk is inside the open token
+            static const TokenType closed_type[LEX__STATES] = {
+                TOKEN_EOF, TOKEN_STRING, TOKEN_STRING, TOKEN_EOF, TOKEN_COMMENT_BLOCK
+            };
+            static const char *const error_kind[LEX__STATES] = {
+                NULL, "UnterminatedString", "UnterminatedString", NULL, "UnterminatedBlockComment"
+            };
+            Token t = make_token(closed_type[st], open_start, run->cont_end);
+            // a string only crosses a line start through a backslash-newline
+            t.escaped = closed_type[st] == TOKEN_STRING;
+            if (!run->cont) t = make_error_token(error_kind[st], open_start, run->cont_end);
+            if (token_buffer_push(out, input, &t, prev_end, 0) != 0) return -1;
+            prev_end = run->cont_end;
+        }
+        if (append_tokens(out, input, &run->toks, 0, run->toks.count, 0, &prev_end) != 0) return -1;
+        const ChunkRun *tail = run;
+        if (st != LEX_CODE && run->sync != NO_SYNC) {
+            tail = &chunks[k].runs[LEX_CODE];
+            if (append_tokens(out, input, &tail->toks, run->sync, tail->toks.count, 0, &prev_end) != 0) return -1;
+        }
+        st = tail->exit;
+        open_start = tail->open_start;
+    }
+    return 0;
+}
+
+static size_t online_cpus(void) {
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) return (size_t)n;
+#endif
+    return 1;
+}
+
+int lexer_tokenize_parallel(const char *input, size_t length, size_t threads, TokenBuffer *out) {
+    if (threads == 0) threads = online_cpus();
+    if (threads <= 1 || length < parallel_min_size || length >= UINT32_MAX) {
+        return lexer_tokenize_all(input, length, out);
+    }
+    memset(out, 0, sizeof(*out));
+    // Lexing stops at the first NUL byte, so nothing past it matters.
+    const char *nul = (const char *)memchr(input, '\0', length);
+    if (nul) length = (size_t)(nul - input);
+    if (length / threads < 4096) threads = length / 4096;
+    if (threads <= 1) return lexer_tokenize_all(input, length, out);
+
+    LexChunk *chunks = (LexChunk *)calloc(threads, sizeof(LexChunk));
+    pthread_t *tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    int *started = (int *)calloc(threads, sizeof(int));
+    if (!chunks || !tids || !started) {
+        free(chunks);
+        free(tids);
+        free(started);
+        return -1;
+    }
+    size_t n = 0, begin = 0;
+    for (size_t k = 1; k <= threads && begin < length; ++k) {
+        size_t limit = length;
+        if (k < threads) {
+            size_t target = length / threads * k;
+            const char *nl = target > begin ? (const char *)memchr(input + target, '\n', length - target) : NULL;
+            if (!nl) continue;
+            limit = (size_t)(nl - input) + 1;
+        }
+        chunks[n].input = input;
+        chunks[n].length = length;
+        chunks[n].begin = begin;
+        chunks[n].limit = limit;
+        n++;
+        begin = limit;
+    }
+
+    // Workers share the scan kernels; pick them once here.
+    scan_kernels();
+
+    // The calling thread takes the first chunk itself.
+    for (size_t k = 1; k < n; ++k) {
+        started[k] = pthread_create(&tids[k], NULL, lex_chunk_worker, &chunks[k]) == 0;
+    }
+    lex_chunk_worker(&chunks[0]);
+    int rc = 0;
+    for (size_t k = 0; k < n; ++k) {
+        if (k > 0) {
+            if (started[k]) pthread_join(tids[k], NULL);
+            else lex_chunk_worker(&chunks[k]);
+        }
+        if (chunks[k].failed) rc = -1;
+    }
+    out->input = input;
+    if (rc == 0) rc = stitch_chunks(chunks, n, out);
+    for (size_t k = 0; k < n; ++k) {
+        for (int st = 0; st < LEX__STATES; ++st) token_buffer_free(&chunks[k].runs[st].toks);
+    }
+    free(chunks);
+    free(tids);
+    free(started);
+    if (rc != 0) token_buffer_free(out);
+    return rc;
+}
+
+// ---------------------------------------------------------------------------
+// Incremental re-lexing
+//
+// A token depends only on the bytes from its start through at most
+// LEX_LOOKAHEAD bytes past its end (the punctuator DFA probing for a
+// longer match), so every token whose lookahead stops before the edit is
+// kept. Lexing restarts after the last of them (backing up to where no
+// template substitution is open) and stops at the first new token past
+// the edit that starts where a shifted old token did, both outside any
+// template: from there both streams see the same bytes and state and
+// coincide.
+
+#define LEX_LOOKAHEAD 4
+
+int lexer_relex(TokenBuffer *tb, const char *input, size_t length, TextEdit edit, size_t *relexed) {
+    if (relexed) *relexed = 0;
+    if (length >= UINT32_MAX || edit.inserted > length || edit.offset > length - edit.inserted) return -1;
+    if (tb->count == 0) {
+        TokenBuffer fresh;
+        if (lexer_tokenize_all(input, length, &fresh) != 0) return -1;
+        *tb = fresh;
+        if (relexed) *relexed = fresh.count;
+        return 0;
+    }
+    // the final EOF sits at the end of the text tb was lexed from
+    size_t old_length = tb->offsets[tb->count - 1];
+    if (edit.removed > old_length || edit.offset > old_length - edit.removed ||
+        old_length - edit.removed + edit.inserted != length)
+        return -1;
+    size_t old_end = edit.offset + edit.removed;
+    size_t new_end = edit.offset + edit.inserted;
+    int64_t delta = (int64_t)edit.inserted - (int64_t)edit.removed;
+
+    // first token whose bytes or lookahead reach the edit (token ends are increasing)
+    size_t lo = 0, hi = tb->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((size_t)tb->offsets[mid] + tb->lengths[mid] + LEX_LOOKAHEAD > edit.offset) hi = mid;
+        else lo = mid + 1;
+    }
+    size_t r = lo;
+    // restart outside any template: inside a substitution the lexer state
+    // depends on the tokens before
+    while (r > 0 && r < tb->count && (tb->flags[r] & TOKF_IN_TEMPLATE)) r--;
+
+    TokenBuffer out;
+    memset(&out, 0, sizeof(out));
+    out.input = input;
+    size_t prev_end = 0;
+    if (append_tokens(&out, input, tb, 0, r, 0, &prev_end) != 0) goto fail;
+
+    Lexer lx;
+    lexer_init(&lx, input, length);
+    lx.pos = prev_end;
+    size_t j = r, count = 0;
+    for (;;) {
+        int in_template = lx.tmpl_depth > 0;
+        Token t = lexer_next(&lx);
+        if (t.offset >= new_end && !in_template) {
+            size_t old_off = t.offset - new_end + old_end;
+            while (j < tb->count && tb->offsets[j] < old_off) j++;
+            if (j < tb->count && tb->offsets[j] == old_off && !(tb->flags[j] & TOKF_IN_TEMPLATE)) {
+                if (append_tokens(&out, input, tb, j, tb->count, delta, &prev_end) != 0) goto fail;
+                break;
+            }
+        }
+        if (token_buffer_push(&out, input, &t, prev_end, in_template) != 0) goto fail;
+        prev_end = t.offset + t.length;
+        count++;
+        if (t.type == TOKEN_EOF) break;
+    }
+    token_buffer_free(tb);
+    *tb = out;
+    if (relexed) *relexed = count;
+    return 0;
+
+fail:
+    token_buffer_free(&out);
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+// Streaming lexer
+//
+// The window holds the unconsumed tail of the source. A token is handed
+// out only when it and its lookahead end inside the window (or the source
+// is exhausted); otherwise the consumed prefix is dropped, more input is
+// read and the token is lexed again. The window only grows when a single
+// token does not fit in it.
+
+static long stream_read_fd(void *ctx, char *buf, size_t cap) {
+    int fd = *(const int *)ctx;
+    for (;;) {
+        ssize_t n = read(fd, buf, cap);
+        if (n >= 0 || errno != EINTR) return (long)n;
+    }
+}
+
+int stream_lexer_init(StreamLexer *sl, LexerReadFn read_fn, void *ctx, size_t window) {
+    memset(sl, 0, sizeof(*sl));
+    if (window < 64) window = 64;
+    sl->buf = (char *)malloc(window);
+    if (!sl->buf) return -1;
+    sl->cap = window;
+    sl->read = read_fn;
+    sl->ctx = ctx;
+    sl->line = 1;
+    lexer_init(&sl->lx, NULL, 0);
+    return 0;
+}
+
+int stream_lexer_init_fd(StreamLexer *sl, int fd, size_t window) {
+    if (stream_lexer_init(sl, stream_read_fd, &sl->fd, window) != 0) return -1;
+    sl->fd = fd;
+    return 0;
+}
+
+void stream_lexer_free(StreamLexer *sl) {
+    if (!sl) return;
+    free(sl->buf);
+    memset(sl, 0, sizeof(*sl));
+}
+
+// Count lines up to window index `to`.
+static void stream_count_lines(StreamLexer *sl, size_t to) {
+    if (to <= sl->nl_pos) return;
+    size_t last = 0;
+    size_t n = scan_kernels()->count_nl(sl->buf, sl->nl_pos, to, &last);
+    if (n > 0) {
+        sl->line += (int)n;
+        sl->line_start = sl->base + last + 1;
+    }
+    sl->nl_pos = to;
+}
+
+static void stream_refill(StreamLexer *sl) {
+    size_t keep = sl->pos;
+    stream_count_lines(sl, keep);
+    memmove(sl->buf, sl->buf + keep, sl->len - keep);
+    sl->len -= keep;
+    sl->base += keep;
+    sl->pos = 0;
+    sl->nl_pos -= keep;
+    if (sl->len == sl->cap) {
+        char *nb = (char *)realloc(sl->buf, sl->cap * 2);
+        if (!nb) {
+            sl->io_error = 1;
+            sl->at_end = 1;
+            return;
+        }
+        sl->buf = nb;
+        sl->cap *= 2;
+    }
+    long n = sl->read(sl->ctx, sl->buf + sl->len, sl->cap - sl->len);
+    if (n < 0) sl->io_error = 1;
+    if (n <= 0) sl->at_end = 1;
+    else sl->len += (size_t)n;
+}
+
+Token stream_lexer_next(StreamLexer *sl) {
+    for (;;) {
+        Lexer lx = sl->lx;
+        lx.input = sl->buf;
+        lx.length = sl->len;
+        lx.pos = sl->pos;
+        Token t = lexer_next(&lx);
+        int done;
+        if (t.type == TOKEN_EOF) {
+            done = sl->at_end || t.offset < sl->len; // a NUL byte ends lexing
+            if (!done) sl->pos = sl->len;            // trailing whitespace is consumed
+        } else {
+            done = sl->at_end || t.offset + t.length + LEX_LOOKAHEAD <= sl->len;
+        }
+        if (done) {
+            sl->lx = lx;
+            sl->pos = lx.pos;
+            t.offset += sl->base;
+            return t;
+        }
+        stream_refill(sl);
+    }
+}
+
+const char *stream_lexer_text(const StreamLexer *sl, const Token *tok) {
+    if (!sl || !tok || tok->offset < sl->base || tok->offset - sl->base > sl->len) return "";
+    return sl->buf + (tok->offset - sl->base);
+}
+
+Position stream_lexer_position(StreamLexer *sl, size_t offset) {
+    Position p = {0, 0};
+    if (offset < sl->base + sl->nl_pos || offset > sl->base + sl->len) return p;
+    stream_count_lines(sl, offset - sl->base);
+    p.line = sl->line;
+    p.column = (int)(offset - sl->line_start) + 1;
+    return p;
+}
+
+Token token_buffer_get(const TokenBuffer *tb, size_t i) {
+    Token t;
+    memset(&t, 0, sizeof(t));
+    if (!tb || tb->count == 0) {
+        t.type = TOKEN_EOF;
+        return t;
+    }
+    if (i >= tb->count) i = tb->count - 1;
+    t.type = (TokenType)tb->types[i];
+    if (t.type == TOKEN_IDENTIFIER) t.kw = (KeywordId)tb->ids[i];
+    else if (t.type == TOKEN_PUNCTUATOR) t.punct = (PunctId)tb->ids[i];
+    t.offset = tb->offsets[i];
+    t.length = tb->lengths[i];
+    t.escaped = (tb->flags[i] & TOKF_ESCAPED) != 0;
+    if (t.type == TOKEN_NUMBER) {
+        t.bigint = tb->ids[i];
+        if (tb->input) t.number = decode_number(tb->input + t.offset, t.length);
+    }
+    if (tb->flags[i] & TOKF_ERROR) {
+        t.error = 1;
+        for (size_t k = 0; k < tb->error_count; ++k) {
+            if (tb->errors[k].index == i) { t.error_kind = tb->errors[k].kind; break; }
+        }
+    }
+    return t;
+}
+
+void token_buffer_free(TokenBuffer *tb) {
+    if (!tb) return;
+    free(tb->types);
+    free(tb->ids);
+    free(tb->flags);
+    free(tb->offsets);
+    free(tb->lengths);
+    free(tb->errors);
+    memset(tb, 0, sizeof(*tb));
+}
+
+int line_index_build(LineIndex *li, const char *input, size_t length) {
+    memset(li, 0, sizeof(*li));
+    if (length >= UINT32_MAX) return -1;
+    const ScanKernels *k = scan_kernels();
+    size_t last = 0;
+    size_t lines = 1 + k->count_nl(input, 0, length, &last);
+    li->starts = (uint32_t *)malloc(lines * sizeof(uint32_t));
+    if (!li->starts) return -1;
+    li->starts[0] = 0;
+    size_t n = 1;
+    for (size_t pos = k->find_any(input, 0, length, '\n', '\n', '\n', '\n'); pos < length;
+         pos = k->find_any(input, pos + 1, length, '\n', '\n', '\n', '\n')) {
+        li->starts[n++] = (uint32_t)(pos + 1);
     }
+    li->count = n;
+    li->length = length;
+    return 0;
+}
+
+void line_index_free(LineIndex *li) {
+    if (!li) return;
+    free(li->starts);
+    memset(li, 0, sizeof(*li));
+}
+
+int line_index_copy(LineIndex *dst, const LineIndex *src) {
+    memset(dst, 0, sizeof(*dst));
+    if (!src || src->count == 0) return 0;
+    dst->starts = (uint32_t *)malloc(src->count * sizeof(uint32_t));
+    if (!dst->starts) return -1;
+    memcpy(dst->starts, src->starts, src->count * sizeof(uint32_t));
+    dst->count = src->count;
+    dst->length = src->length;
+    return 0;
+}
+
+int line_index_edit(LineIndex *li, const char *input, size_t length, TextEdit edit) {
+    size_t old_end = edit.offset + edit.removed;
+    if (li->count == 0 || length >= UINT32_MAX || old_end > li->length || li->length - edit.removed + edit.inserted != length) return -1;
+    // line starts after a newline in [offset, old_end) go; later ones move
+    size_t lo = 1, hi = li->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (li->starts[mid] > edit.offset) hi = mid; else lo = mid + 1;
+    }
+    size_t first = lo, last = lo;
+    while (last < li->count && li->starts[last] <= old_end) last++;
+    const ScanKernels *k = scan_kernels();
+    size_t ignored;
+    size_t added = k->count_nl(input, edit.offset, edit.offset + edit.inserted, &ignored);
+    size_t count = li->count - (last - first) + added;
+    if (count > li->count) {
+        uint32_t *grown = (uint32_t *)realloc(li->starts, count * sizeof(uint32_t));
+        if (!grown) return -1;
+        li->starts = grown;
+    }
+    memmove(li->starts + first + added, li->starts + last, (li->count - last) * sizeof(uint32_t));
+    uint32_t delta = (uint32_t)(edit.inserted - edit.removed); // wraps for shrinking edits
+    for (size_t i = first + added; i < count; ++i) li->starts[i] += delta;
+    size_t n = first, end = edit.offset + edit.inserted;
+    for (size_t pos = k->find_any(input, edit.offset, end, '\n', '\n', '\n', '\n'); pos < end;
+         pos = k->find_any(input, pos + 1, end, '\n', '\n', '\n', '\n')) {
+        li->starts[n++] = (uint32_t)(pos + 1);
+    }
+    li->count = count;
+    li->length = length;
+    return 0;
+}
+
+// index of the last line starting at or before offset
+static size_t line_of(const LineIndex *li, size_t offset) {
+    size_t lo = 0, hi = li->count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (li->starts[mid] <= offset) lo = mid; else hi = mid;
+    }
+    return lo;
+}
+
+Position line_index_position(const LineIndex *li, size_t offset) {
+    Position p = {0, 0};
+    if (!li || li->count == 0 || offset == (size_t)-1 || offset == UINT32_MAX) return p;
+    if (offset > li->length) offset = li->length;
+    size_t line = line_of(li, offset);
+    p.line = (int)line + 1;
+    p.column = (int)(offset - li->starts[line]) + 1;
+    return p;
+}
+
+size_t line_index_line_end(const LineIndex *li, size_t offset) {
+    if (!li || li->count == 0) return offset;
+    if (offset > li->length) offset = li->length;
+    size_t line = line_of(li, offset);
+    return line + 1 < li->count ? (size_t)li->starts[line + 1] - 1 : li->length;
+}
+
+const char *token_text(const Lexer *lx, const Token *tok) {
+    if (!lx || !tok || !lx->input) return "";
+    return lx->input + tok->offset;
+}
+
+char *token_lexeme(const Lexer *lx, const Token *tok) {
+    size_t len = tok ? tok->length : 0;
+    char *s = (char *)malloc(len + 1);
+    if (!s) return NULL;
+    if (len) memcpy(s, token_text(lx, tok), len);
+    s[len] = '\0';
+    return s;
+}
+
+int token_equals(const Lexer *lx, const Token *tok, const char *s) {
+    if (!tok || !s) return 0;
+    size_t n = strlen(s);
+    return tok->length == n && memcmp(token_text(lx, tok), s, n) == 0;
 }
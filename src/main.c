@@ -1,13 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "quickjsflow/lexer.h"
 #include "quickjsflow/parser.h"
 #include "quickjsflow/ast.h"
 #include "quickjsflow/cfg.h"
 #include "quickjsflow/codegen.h"
-#include "quickjsflow/scope.h"
 #include "quickjsflow/plugin.h"
+#include "quickjsflow/compact.h"
+#include "quickjsflow/cache.h"
+
+// syntax errors `check` reports positions for; later ones are only counted
+#define CHECK_MAX_DIAGNOSTICS 256
+// size bound of a `generate --cache` directory
+#define GENERATE_CACHE_BYTES (1024ull << 20)
 
 static char *read_file(const char *path, size_t *out_len) {
     FILE *f = fopen(path, "rb");
@@ -31,6 +39,10 @@ static const char *tok_name(TokenType t) {
         case TOKEN_IDENTIFIER: return "Identifier";
         case TOKEN_NUMBER: return "Number";
         case TOKEN_STRING: return "String";
+        case TOKEN_TEMPLATE: return "Template";
+        case TOKEN_TEMPLATE_HEAD: return "TemplateHead";
+        case TOKEN_TEMPLATE_MIDDLE: return "TemplateMiddle";
+        case TOKEN_TEMPLATE_TAIL: return "TemplateTail";
         case TOKEN_PUNCTUATOR: return "Punctuator";
         case TOKEN_COMMENT_LINE: return "LineComment";
         case TOKEN_COMMENT_BLOCK: return "BlockComment";
@@ -39,53 +51,89 @@ static const char *tok_name(TokenType t) {
     }
 }
 
+// Streams the file through a fixed window so arbitrarily large inputs lex
+// in constant memory.
 static int cmd_lex(const char *path) {
-    size_t len = 0;
-    char *src = read_file(path, &len);
-    if (!src) {
+    int fd = open(path, O_RDONLY);
+    StreamLexer sl;
+    if (fd < 0 || stream_lexer_init_fd(&sl, fd, 64 * 1024) != 0) {
+        if (fd >= 0) close(fd);
         fprintf(stderr, "Failed to read file: %s\n", path);
         return 2;
     }
-    Lexer lx;
-    lexer_init(&lx, src, len);
+    JsonWriter out;
+    json_writer_init_fd(&out, STDOUT_FILENO);
     for (;;) {
-        Token t = lexer_next(&lx);
-            printf("{\"type\":\"%s\",\"start\":{\"line\":%d,\"column\":%d},\"end\":{\"line\":%d,\"column\":%d},\"error\":%d,",
-                   tok_name(t.type), t.start_line, t.start_col, t.end_line, t.end_col, t.error);
-            if (t.error_kind) {
-                printf("\"kind\":\"%s\",", t.error_kind);
-            } else {
-                printf("\"kind\":null,");
-            }
-            printf("\"lexeme\":\"");
-        if (t.lexeme) {
-            // naive escaping of quotes and backslashes
-            for (char *p = t.lexeme; *p; ++p) {
-                    if (*p == '"' || *p == '\\') putchar('\\');
-                putchar(*p);
-            }
-        }
-        printf("\"}\n");
-        if (t.type == TOKEN_EOF) { token_free(&t); break; }
-        token_free(&t);
+        Token t = stream_lexer_next(&sl);
+        Position ts = stream_lexer_position(&sl, t.offset);
+        Position te = stream_lexer_position(&sl, t.offset + t.length);
+        const char *type = tok_name(t.type);
+        json_lit(&out, "{\"type\":\"");
+        json_raw(&out, type, strlen(type));
+        json_lit(&out, "\",\"start\":{\"line\":");
+        json_int(&out, ts.line);
+        json_lit(&out, ",\"column\":");
+        json_int(&out, ts.column);
+        json_lit(&out, "},\"end\":{\"line\":");
+        json_int(&out, te.line);
+        json_lit(&out, ",\"column\":");
+        json_int(&out, te.column);
+        json_lit(&out, "},\"error\":");
+        json_int(&out, t.error);
+        json_lit(&out, ",\"kind\":");
+        json_string(&out, t.error_kind);
+        json_lit(&out, ",\"lexeme\":\"");
+        json_escaped(&out, stream_lexer_text(&sl, &t), t.length);
+        json_lit(&out, "\"}\n");
+        if (t.type == TOKEN_EOF) break;
+    }
+    int failed = sl.io_error;
+    stream_lexer_free(&sl);
+    close(fd);
+    if (failed) {
+        json_writer_close(&out);
+        fprintf(stderr, "Failed to read file: %s\n", path);
+        return 2;
+    }
+    if (json_writer_close(&out) != 0) {
+        fprintf(stderr, "Failed to write output\n");
+        return 1;
     }
-    free(src);
     return 0;
 }
 
-static int cmd_generate(const char *path) {
-    size_t len = 0;
-    char *src = read_file(path, &len);
-    if (!src) {
-        fprintf(stderr, "Failed to read file: %s\n", path);
-        return 2;
+static int cmd_generate(const char *path, const char *cache_dir) {
+    // a binary AST written by `parse --binary` is mapped instead of reparsed
+    CompactAst *ca = compact_load(path);
+    char *src = NULL;
+    AstNode *prog = NULL;
+    if (ca) {
+        prog = compact_to_ast(ca, ca->root);
+        compact_free(ca);
+    } else {
+        size_t len = 0;
+        src = read_file(path, &len);
+        if (!src) {
+            fprintf(stderr, "Failed to read file: %s\n", path);
+            return 2;
+        }
+        ParseCache cache;
+        if (cache_dir && parse_cache_open(&cache, cache_dir, GENERATE_CACHE_BYTES) != 0) {
+            fprintf(stderr, "Warning: cache directory unusable, parsing uncached: %s\n", cache_dir);
+            cache_dir = NULL;
+        }
+        if (cache_dir) {
+            ca = parse_cached(&cache, src, len, 0);
+            prog = ca ? compact_to_ast(ca, ca->root) : NULL;
+            compact_free(ca);
+            parse_cache_close(&cache);
+        } else {
+            Parser p;
+            parser_init(&p, src, len);
+            prog = parse_program(&p);
+        }
     }
     
-    // Parse the input as JavaScript (for now, could be extended to parse JSON AST)
-    Parser p;
-    parser_init(&p, src, len);
-    AstNode *prog = parse_program(&p);
-    
     if (!prog) {
         fprintf(stderr, "Failed to parse program\n");
         free(src);
@@ -125,33 +173,28 @@ static int cmd_check(const char *path) {
         return 2;
     }
     
+    // Grammar only: the recognizer builds no tree, so positions are
+    // resolved from a line index made just for the errors
+    Diagnostic diags[CHECK_MAX_DIAGNOSTICS];
     Parser p;
     parser_init(&p, src, len);
-    AstNode *prog = parse_program(&p);
-    
-    if (!prog) {
-        fprintf(stderr, "Error: Failed to parse program\n");
-        free(src);
-        return 1;
-    }
-    
-    // Perform scope analysis
-    ScopeManager sm;
-    scope_manager_init(&sm);
-    int scope_ok = scope_analyze(&sm, prog, 0);
-    
-    if (scope_ok != 0) {
-        fprintf(stderr, "Error: Scope analysis failed\n");
-        scope_manager_free(&sm);
-        ast_free(prog);
+    size_t errors = parse_check(&p, diags, CHECK_MAX_DIAGNOSTICS);
+    if (errors > 0) {
+        LineIndex lines;
+        int have_lines = line_index_build(&lines, src, len) == 0;
+        size_t shown = errors < CHECK_MAX_DIAGNOSTICS ? errors : CHECK_MAX_DIAGNOSTICS;
+        for (size_t i = 0; i < shown; ++i) {
+            Position pos = {0, 0};
+            if (have_lines) pos = line_index_position(&lines, diags[i].start);
+            fprintf(stderr, "%s:%d:%d: error: %s\n", path, pos.line, pos.column, diags[i].kind);
+        }
+        fprintf(stderr, "%zu syntax error%s\n", errors, errors == 1 ? "" : "s");
+        if (have_lines) line_index_free(&lines);
         free(src);
         return 1;
     }
-    
+
     printf("✓ %s: No errors found\n", path);
-    
-    scope_manager_free(&sm);
-    ast_free(prog);
     free(src);
     return 0;
 }
@@ -223,7 +266,9 @@ static void usage(void) {
     fprintf(stderr, "Commands:\n");
     fprintf(stderr, "  lex <file>              Tokenize file and output JSON tokens\n");
     fprintf(stderr, "  parse <file>            Parse file and output AST in JSON format\n");
-    fprintf(stderr, "  generate <file>         Generate code from AST (expects JSON AST)\n");
+    fprintf(stderr, "                          --binary <out>  Write a binary AST instead\n");
+    fprintf(stderr, "  generate <file>         Generate code from a JavaScript file or binary AST\n");
+    fprintf(stderr, "                          --cache <dir>   Reuse parses of unchanged files\n");
     fprintf(stderr, "  check <file>            Parse and check for errors\n");
     fprintf(stderr, "  cfg <file> [format]     Build control flow graph\n");
     fprintf(stderr, "                          format: json (default), dot, mermaid\n");
@@ -232,7 +277,8 @@ static void usage(void) {
     fprintf(stderr, "                          --plugin remove-debugger   Remove debugger statements\n");
     fprintf(stderr, "\nExamples:\n");
     fprintf(stderr, "  quickjsflow parse input.js\n");
-    fprintf(stderr, "  quickjsflow generate ast.json\n");
+    fprintf(stderr, "  quickjsflow parse input.js --binary input.qjfa\n");
+    fprintf(stderr, "  quickjsflow generate input.qjfa\n");
     fprintf(stderr, "  quickjsflow check input.js\n");
     fprintf(stderr, "  quickjsflow run input.js --plugin remove-console\n");
 }
@@ -247,18 +293,38 @@ int main(int argc, char **argv) {
     }
     if (strcmp(cmd, "parse") == 0) {
         if (argc < 3) { usage(); return 1; }
+        const char *binary = NULL;
+        if (argc >= 4 && strcmp(argv[3], "--binary") == 0) {
+            if (argc < 5) { usage(); return 1; }
+            binary = argv[4];
+        }
         size_t len = 0; char *src = read_file(argv[2], &len);
         if (!src) { fprintf(stderr, "Failed to read file: %s\n", argv[2]); return 2; }
         Parser p; parser_init(&p, src, len);
         AstNode *prog = parse_program(&p);
-        ast_print_json(prog);
+        int rc = 0;
+        if (binary) {
+            CompactAst *ca = compact_from_ast(prog);
+            if (!ca || compact_save(ca, binary) != 0) {
+                fprintf(stderr, "Failed to write binary AST: %s\n", binary);
+                rc = 1;
+            }
+            compact_free(ca);
+        } else {
+            ast_print_json(prog);
+        }
         ast_free(prog);
         free(src);
-        return 0;
+        return rc;
     }
     if (strcmp(cmd, "generate") == 0) {
         if (argc < 3) { usage(); return 1; }
-        return cmd_generate(argv[2]);
+        const char *cache_dir = NULL;
+        if (argc >= 4 && strcmp(argv[3], "--cache") == 0) {
+            if (argc < 5) { usage(); return 1; }
+            cache_dir = argv[4];
+        }
+        return cmd_generate(argv[2], cache_dir);
     }
     if (strcmp(cmd, "check") == 0) {
         if (argc < 3) { usage(); return 1; }
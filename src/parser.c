@@ -3,318 +3,939 @@
 #include <ctype.h>
 #include "quickjsflow/parser.h"
 
-// keyword helper
-static int is_keyword(Token *t, const char *kw) {
-    return t->type == TOKEN_IDENTIFIER && t->lexeme && strcmp(t->lexeme, kw) == 0;
+// keyword helper (ids are resolved by the lexer)
+static int is_keyword(const Token *t, KeywordId kw) {
+    return t->type == TOKEN_IDENTIFIER && t->kw == kw;
 }
 
 // punctuation helper
-static int is_punct(Token *t, const char *s) {
-    return t->type == TOKEN_PUNCTUATOR && t->lexeme && strcmp(t->lexeme, s) == 0;
+static int is_punct(const Token *t, PunctId id) {
+    return t->type == TOKEN_PUNCTUATOR && t->punct == id;
 }
 
-static Position pos_start(Token *t) { Position p = { t->start_line, t->start_col }; return p; }
-static Position pos_end(Token *t) { Position p = { t->end_line, t->end_col }; return p; }
+// operator ids of punctuators and keywords; OP_NONE for everything else
+static const AstOperator punct_ops[PUNCT__COUNT] = {
+    [PUNCT_LT] = OP_LT, [PUNCT_GT] = OP_GT, [PUNCT_LE] = OP_LE, [PUNCT_GE] = OP_GE,
+    [PUNCT_EQ] = OP_EQ, [PUNCT_NE] = OP_NE,
+    [PUNCT_STRICT_EQ] = OP_STRICT_EQ, [PUNCT_STRICT_NE] = OP_STRICT_NE,
+    [PUNCT_PLUS] = OP_PLUS, [PUNCT_MINUS] = OP_MINUS, [PUNCT_STAR] = OP_STAR,
+    [PUNCT_SLASH] = OP_SLASH, [PUNCT_PERCENT] = OP_PERCENT, [PUNCT_STAR_STAR] = OP_STAR_STAR,
+    [PUNCT_INC] = OP_INC, [PUNCT_DEC] = OP_DEC,
+    [PUNCT_SHL] = OP_SHL, [PUNCT_SAR] = OP_SAR, [PUNCT_SHR] = OP_SHR,
+    [PUNCT_AMP] = OP_AMP, [PUNCT_PIPE] = OP_PIPE, [PUNCT_CARET] = OP_CARET,
+    [PUNCT_BANG] = OP_BANG, [PUNCT_TILDE] = OP_TILDE,
+    [PUNCT_AND] = OP_AND, [PUNCT_OR] = OP_OR, [PUNCT_NULLISH] = OP_NULLISH,
+    [PUNCT_ASSIGN] = OP_ASSIGN, [PUNCT_PLUS_ASSIGN] = OP_PLUS_ASSIGN,
+    [PUNCT_MINUS_ASSIGN] = OP_MINUS_ASSIGN, [PUNCT_STAR_ASSIGN] = OP_STAR_ASSIGN,
+    [PUNCT_SLASH_ASSIGN] = OP_SLASH_ASSIGN, [PUNCT_PERCENT_ASSIGN] = OP_PERCENT_ASSIGN,
+    [PUNCT_STAR_STAR_ASSIGN] = OP_STAR_STAR_ASSIGN, [PUNCT_SHL_ASSIGN] = OP_SHL_ASSIGN,
+    [PUNCT_SAR_ASSIGN] = OP_SAR_ASSIGN, [PUNCT_SHR_ASSIGN] = OP_SHR_ASSIGN,
+    [PUNCT_AMP_ASSIGN] = OP_AMP_ASSIGN, [PUNCT_PIPE_ASSIGN] = OP_PIPE_ASSIGN,
+    [PUNCT_CARET_ASSIGN] = OP_CARET_ASSIGN, [PUNCT_AND_ASSIGN] = OP_AND_ASSIGN,
+    [PUNCT_OR_ASSIGN] = OP_OR_ASSIGN, [PUNCT_NULLISH_ASSIGN] = OP_NULLISH_ASSIGN,
+};
+
+static const AstOperator keyword_ops[KW__COUNT] = {
+    [KW_IN] = OP_IN, [KW_INSTANCEOF] = OP_INSTANCEOF,
+    [KW_TYPEOF] = OP_TYPEOF, [KW_VOID] = OP_VOID, [KW_DELETE] = OP_DELETE,
+};
+
+static AstOperator tok_op(const Token *t) {
+    if (t->type == TOKEN_PUNCTUATOR) return punct_ops[t->punct];
+    if (t->type == TOKEN_IDENTIFIER && !t->escaped) return keyword_ops[t->kw];
+    return OP_NONE;
+}
 
-static Token next_tok(Parser *p) {
-    if (p->has_lookahead) {
-        p->has_lookahead = 0;
-        return p->lookahead;
+static SrcOffset pos_start(const Token *t) { return (SrcOffset)t->offset; }
+static SrcOffset pos_end(const Token *t) { return (SrcOffset)(t->offset + t->length); }
+
+static AstNode *ident_node(Parser *p, Token *t) {
+    if (t->escaped) {
+        // `\u0061` names `a`; cooked text is never longer than the lexeme
+        char buf[256];
+        char *name = t->length <= sizeof(buf) ? buf : (char *)malloc(t->length);
+        if (name) {
+            size_t n = lexer_cook_string(token_text(&p->lx, t), t->length, name);
+            AstNode *id = ast_identifier_n(name, n, pos_start(t), pos_end(t));
+            if (name != buf) free(name);
+            return id;
+        }
+    }
+    return ast_identifier_n(token_text(&p->lx, t), t->length, pos_start(t), pos_end(t));
+}
+
+static AstNode *literal_node(Parser *p, LiteralKind kind, Token *t, SrcOffset s, SrcOffset e) {
+    return ast_literal_n(kind, token_text(&p->lx, t), t->length, s, e);
+}
+
+// Numbers keep the value the lexer decoded, so consumers never re-parse raw.
+static AstNode *number_node(Parser *p, Token *t) {
+    AstNode *n = literal_node(p, LIT_Number, t, pos_start(t), pos_end(t));
+    Literal *lit = n ? (Literal *)n->data : NULL;
+    if (lit) {
+        lit->number = t->number;
+        if (t->bigint && !p->syntax_only) {
+            char *digits = lexer_bigint_decimal(token_text(&p->lx, t), t->length);
+            if (digits) lit->bigint = ast_strdup_n(digits, strlen(digits));
+            free(digits);
+        }
+    }
+    return n;
+}
+
+// Next token from the source: the pre-lexed buffer in bulk mode (whose
+// last entry, EOF, repeats), the lexer otherwise.
+static Token pull_tok(Parser *p) {
+    if (p->tokens) {
+        Token t = token_buffer_get(p->tokens, p->tok_index);
+        if (p->tok_index + 1 < p->tokens->count) p->tok_index++;
+        return t;
     }
     return lexer_next(&p->lx);
 }
 
-static Token peek_tok(Parser *p) {
-    if (!p->has_lookahead) {
-        p->lookahead = lexer_next(&p->lx);
-        p->has_lookahead = 1;
+static Token *ahead_slots(Parser *p) {
+    return p->ahead ? p->ahead : p->ahead_buf;
+}
+
+// Doubles the ring, unwrapping it so the next token sits in slot 0.
+static int ahead_grow(Parser *p) {
+    size_t cap = p->ahead_cap * 2;
+    Token *grown = (Token *)malloc(cap * sizeof(Token));
+    if (!grown) return 0;
+    Token *slots = ahead_slots(p);
+    for (size_t i = 0; i < p->ahead_count; ++i) {
+        grown[i] = slots[(p->ahead_head + i) & (p->ahead_cap - 1)];
+    }
+    free(p->ahead);
+    p->ahead = grown;
+    p->ahead_head = 0;
+    p->ahead_cap = cap;
+    return 1;
+}
+
+static void ahead_release(Parser *p) {
+    free(p->ahead);
+    p->ahead = NULL;
+    p->ahead_head = 0;
+    p->ahead_count = 0;
+    p->ahead_cap = PARSER_LOOKAHEAD;
+    free(p->arrow_heads);
+    p->arrow_heads = NULL;
+    p->arrow_head_count = p->arrow_head_cap = 0;
+}
+
+// The k-th token ahead of the parse position (0 is the next one), lexed
+// into the ring on demand.
+static const Token *peek_nth(Parser *p, size_t k) {
+    if (k < p->ahead_count) return &ahead_slots(p)[(p->ahead_head + k) & (p->ahead_cap - 1)];
+    while (p->ahead_count <= k) {
+        if (p->ahead_count == p->ahead_cap && !ahead_grow(p)) {
+            k = p->ahead_count - 1; // out of memory: the deepest token buffered
+            break;
+        }
+        Token t = pull_tok(p);
+        ahead_slots(p)[(p->ahead_head + p->ahead_count) & (p->ahead_cap - 1)] = t;
+        p->ahead_count++;
     }
-    return p->lookahead;
+    return &ahead_slots(p)[(p->ahead_head + k) & (p->ahead_cap - 1)];
+}
+
+static Token next_tok(Parser *p) {
+    if (p->ahead_count == 0) return pull_tok(p);
+    Token t = ahead_slots(p)[p->ahead_head];
+    p->ahead_head = (p->ahead_head + 1) & (p->ahead_cap - 1);
+    p->ahead_count--;
+    return t;
+}
+
+static Token peek_tok(Parser *p) {
+    return *peek_nth(p, 0);
 }
 
 void parser_init(Parser *p, const char *input, size_t length) {
     lexer_init(&p->lx, input, length);
-    p->has_lookahead = 0;
+    p->ahead = NULL;
+    p->ahead_head = 0;
+    p->ahead_count = 0;
+    p->ahead_cap = PARSER_LOOKAHEAD;
+    p->arrow_heads = NULL;
+    p->arrow_head_count = 0;
+    p->arrow_head_cap = 0;
     p->comment_sink = NULL;
+    p->tokens = NULL;
+    p->tok_index = 0;
+    p->no_in = 0;
+    p->in_async = 0;
+    p->in_template = 0;
+    p->panic = 0;
+    p->error_count = 0;
+    p->block_depth = 0;
+    p->syntax_only = 0;
+    p->scratch = NULL;
+    p->diags = NULL;
+    p->diag_cap = 0;
+    p->lazy_functions = 0;
+    p->frames = NULL;
+    p->frame_count = 0;
+    p->frame_cap = 0;
+    p->items = NULL;
+    p->item_count = 0;
+    p->item_cap = 0;
+    p->ret = NULL;
 }
 
-// forward decls
-static AstNode *parse_expression(Parser *p);
-static AstNode *parse_statement(Parser *p);
-static AstNode *parse_variable_declaration(Parser *p, VarKind kind);
-static AstNode *parse_function(Parser *p, int is_decl);
+void parser_init_tokens(Parser *p, const char *input, size_t length, const TokenBuffer *tokens) {
+    parser_init(p, input, length);
+    p->tokens = tokens;
+}
 
-// Phase 2: Modern Features
-#ifdef ENABLE_ARROW_FUNCTION_PARSING
-static AstNode *parse_arrow_function(Parser *p, AstNode *param_or_params);
-#endif
-static AstNode *parse_class(Parser *p, int is_decl);
-static AstNode *parse_template_literal(Parser *p);
-
-static char *dup_unquoted_string(const Token *tok) {
-    const char *lex = (tok && tok->lexeme) ? tok->lexeme : "";
-    size_t len = strlen(lex);
-    if (len >= 2 && ((lex[0] == '"' && lex[len - 1] == '"') || (lex[0] == '\'' && lex[len - 1] == '\''))) {
-        size_t n = len - 2;
-        char *out = (char *)malloc(n + 1);
-        if (!out) return NULL;
-        memcpy(out, lex + 1, n);
-        out[n] = '\0';
-        return out;
-    }
-    char *out = (char *)malloc(len + 1);
+// Work stack buffers and the lookahead ring, once a parse is done.
+static void parser_release(Parser *p) {
+    ahead_release(p);
+    free(p->frames);
+    free(p->items);
+    p->frames = NULL;
+    p->items = NULL;
+    p->frame_count = p->frame_cap = 0;
+    p->item_count = p->item_cap = 0;
+}
+
+// --- syntax errors -------------------------------------------------------
+// Panic-mode recovery: every error leaves an Error node in the tree, and
+// the first error of a bad region is also reported as a diagnostic. Until
+// the parse resynchronises (at the next `,` or closer of the enclosing
+// list, or at the next statement boundary) further errors are only the
+// fallout of the first one and are not reported.
+
+static void report_error(Parser *p, const char *kind, SrcOffset s, SrcOffset e) {
+    p->error_count++;
+    if (p->comment_sink) {
+        diagnostic_push(p->comment_sink, kind, s, e);
+    } else if (p->error_count <= p->diag_cap) {
+        Diagnostic *d = &p->diags[p->error_count - 1];
+        d->kind = kind;
+        d->start = s;
+        d->end = e;
+    }
+}
+
+static AstNode *syntax_error(Parser *p, const char *kind, SrcOffset s, SrcOffset e) {
+    if (!p->panic) {
+        p->panic = 1;
+        report_error(p, kind, s, e);
+    }
+    return ast_error(kind, s, e);
+}
+
+// An error at the next token.
+static AstNode *expected(Parser *p, const char *kind) {
+    Token t = peek_tok(p);
+    return syntax_error(p, kind, pos_start(&t), pos_end(&t));
+}
+
+// --- work stack ----------------------------------------------------------
+// Productions that nest run as frames on p->frames instead of as native
+// calls, so input depth is bounded by memory rather than by the caller's
+// stack. A step is called with its frame on top; it parses until it needs
+// a nested production, then calls it with call_child() and returns. Once
+// the child finishes, the step runs again in the state it asked for, with
+// the child's result in p->ret. A step that is done hands its result to
+// finish_frame(). Either way the step returns right after: the frame
+// pointer is stale once the stack changes.
+
+typedef struct ParseFrame ParseFrame;
+typedef void (*ParseStep)(Parser *p, ParseFrame *f);
+
+struct ParseFrame {
+    ParseStep step;
+    int state;        // where the step resumes; 0 on entry
+    int arg;          // the caller's argument
+    int saved;        // parser flag to restore on the way out
+    SrcOffset s, e;   // positions the finished node needs
+    AstNode *node;    // node under construction
+    AstNode *a, *b, *c; // parts parsed so far
+    size_t base;      // parse_expression: its first entry on p->items;
+                      // parse_statement: offset of its first token
+    AstArenaMark mark; // statement lists: scratch memory to rewind to
+};
+
+#define FRAMES_FIRST 64
+
+// Out of memory for the work stack: every open production is dropped, so
+// the parse ends here as it would at the end of the input. The rest of the
+// input is reported as an OutOfMemory error, even in panic mode, so a cut
+// short parse never passes for a clean one.
+static void parse_abandon(Parser *p) {
+    p->frame_count = 0;
+    p->item_count = 0;
+    p->ret = NULL;
+    report_error(p, "OutOfMemory", (SrcOffset)peek_nth(p, 0)->offset, (SrcOffset)p->lx.length);
+}
+
+static ParseFrame *push_frame(Parser *p, ParseStep step, int arg) {
+    if (p->frame_count == p->frame_cap) {
+        size_t cap = p->frame_cap ? p->frame_cap * 2 : FRAMES_FIRST;
+        ParseFrame *grown = (ParseFrame *)realloc(p->frames, cap * sizeof(ParseFrame));
+        if (!grown) {
+            parse_abandon(p);
+            return NULL;
+        }
+        p->frames = grown;
+        p->frame_cap = cap;
+    }
+    ParseFrame *f = &p->frames[p->frame_count++];
+    f->step = step;
+    f->state = 0;
+    f->arg = arg;
+    f->node = NULL;
+    f->a = NULL;
+    return f;
+}
+
+// Run `step` on top of f, resuming f in `state` once it finishes. Returns
+// the child's frame, NULL if the parse was abandoned.
+static ParseFrame *call_child(Parser *p, ParseFrame *f, int state, ParseStep step, int arg) {
+    f->state = state;
+    return push_frame(p, step, arg);
+}
+
+static void finish_frame(Parser *p, AstNode *result) {
+    p->ret = result;
+    p->frame_count--;
+}
+
+// Continue as `step`, whose result becomes this frame's.
+static void tail_call(ParseFrame *f, ParseStep step, int arg) {
+    f->step = step;
+    f->state = 0;
+    f->arg = arg;
+}
+
+// The result of `step` (given `arg` and, in its frame, `node`), run to
+// completion from an empty stack.
+static AstNode *run_frames(Parser *p, ParseStep step, int arg, AstNode *node) {
+    p->ret = NULL;
+    ParseFrame *f = push_frame(p, step, arg);
+    if (!f) return NULL;
+    f->node = node;
+    while (p->frame_count > 0) {
+        f = &p->frames[p->frame_count - 1];
+        f->step(p, f);
+    }
+    return p->ret;
+}
+
+// productions
+static void parse_statement(Parser *p, ParseFrame *f);
+static void parse_expression(Parser *p, ParseFrame *f);
+static void parse_variable_declaration(Parser *p, ParseFrame *f);
+static void parse_function(Parser *p, ParseFrame *f);
+static void parse_class(Parser *p, ParseFrame *f);
+static void parse_template_literal(Parser *p, ParseFrame *f);
+static void parse_binding_element(Parser *p, ParseFrame *f);
+static void parse_arrow_function(Parser *p, ParseFrame *f);
+static int arrow_ahead(Parser *p);
+static int splice_array(AstArena *arena, void **items, size_t size, size_t *count, size_t *cap, size_t at,
+                        size_t removed, const void *add, size_t n);
+
+// Cooked copy of body[0, len): a plain copy unless the lexer flagged a
+// backslash. NULL on a malformed escape or allocation failure.
+static char *cook_body(const char *body, size_t len, int escaped, size_t *out_len) {
+    char *out = (char *)ast_alloc(len + 1);
     if (!out) return NULL;
-    memcpy(out, lex, len + 1);
+    size_t n = len;
+    if (escaped) n = lexer_cook_string(body, len, out);
+    else memcpy(out, body, len);
+    if (n == LEXER_BAD_ESCAPE) {
+        ast_unalloc(out);
+        return NULL;
+    }
+    out[n] = '\0';
+    *out_len = n;
+    return out;
+}
+
+// Value of a string token; a malformed escape keeps the raw body.
+static char *string_value(Parser *p, const Token *tok, size_t *out_len) {
+    const char *lex = token_text(&p->lx, tok);
+    size_t len = tok->length >= 2 ? tok->length - 2 : 0;
+    char *out = cook_body(lex + 1, len, tok->escaped, out_len);
+    if (!out && tok->escaped) out = cook_body(lex + 1, len, 0, out_len);
     return out;
 }
 
+static char *dup_unquoted_string(Parser *p, const Token *tok) {
+    size_t len;
+    return string_value(p, tok, &len);
+}
+
+static AstNode *string_node(Parser *p, Token *t) {
+    AstNode *n = literal_node(p, LIT_String, t, pos_start(t), pos_end(t));
+    Literal *lit = n ? (Literal *)n->data : NULL;
+    if (lit && !p->syntax_only) lit->cooked = string_value(p, t, &lit->cooked_length);
+    return n;
+}
+
 static void record_comment(Parser *p, const Token *tok) {
     if (!p || !tok || !p->comment_sink) return;
-    Comment *c = (Comment *)calloc(1, sizeof(Comment));
+    Comment *c = (Comment *)ast_alloc(sizeof(Comment));
     if (!c) return;
     c->is_block = (tok->type == TOKEN_COMMENT_BLOCK);
-    if (tok->lexeme) {
-        const char *lex = tok->lexeme;
-        size_t len = strlen(lex);
-        size_t start = 0, end = len;
-        if (len >= 2 && lex[0] == '/' && lex[1] == '/') start = 2;
-        else if (len >= 4 && lex[0] == '/' && lex[1] == '*') { start = 2; if (lex[len - 2] == '*' && lex[len - 1] == '/') end = len - 2; }
-        size_t out_len = (end > start) ? (end - start) : 0;
-        c->text = (char *)malloc(out_len + 1);
-        if (c->text) {
-            memcpy(c->text, lex + start, out_len);
-            c->text[out_len] = '\0';
-        }
-    }
+    const char *lex = token_text(&p->lx, tok);
+    size_t len = tok->length;
+    size_t start = 0, end = len;
+    if (len >= 2 && lex[0] == '/' && lex[1] == '/') start = 2;
+    else if (len >= 4 && lex[0] == '/' && lex[1] == '*') { start = 2; if (lex[len - 2] == '*' && lex[len - 1] == '/') end = len - 2; }
+    size_t out_len = (end > start) ? (end - start) : 0;
+    c->text = ast_strdup_n(lex + start, out_len);
     c->start = pos_start((Token *)tok);
     c->end = pos_end((Token *)tok);
     commentvec_push(p->comment_sink, c);
 }
 
-static int expect_punct(Parser *p, const char *s, Token *out) {
+// On a mismatch *out still gets the offending token, for the error.
+static int expect_punct(Parser *p, PunctId id, Token *out) {
     Token t = peek_tok(p);
-    if (!is_punct(&t, s)) return 0;
+    if (out) *out = t;
+    if (!is_punct(&t, id)) return 0;
     next_tok(p);
-    if (out) *out = t; else token_free(&t);
     return 1;
 }
 
+static int is_opener(const Token *t) {
+    return is_punct(t, PUNCT_LPAREN) || is_punct(t, PUNCT_LBRACKET) || is_punct(t, PUNCT_LBRACE);
+}
+
+static int is_closer(const Token *t) {
+    return is_punct(t, PUNCT_RPAREN) || is_punct(t, PUNCT_RBRACKET) || is_punct(t, PUNCT_RBRACE);
+}
+
+// Whether only blanks separate t from a preceding line break.
+static int line_break_before(const Parser *p, const Token *t) {
+    for (size_t i = t->offset; i > 0; --i) {
+        char c = p->lx.input[i - 1];
+        if (c == '\n' || c == '\r') return 1;
+        if (c != ' ' && c != '\t') return 0;
+    }
+    return 0;
+}
+
+static int starts_statement(const Token *t) {
+    if (t->type != TOKEN_IDENTIFIER || t->escaped) return 0;
+    switch (t->kw) {
+    case KW_IF: case KW_FOR: case KW_WHILE: case KW_DO: case KW_SWITCH: case KW_TRY:
+    case KW_THROW: case KW_FUNCTION: case KW_CLASS: case KW_IMPORT: case KW_EXPORT:
+    case KW_RETURN: case KW_BREAK: case KW_CONTINUE: case KW_VAR: case KW_LET: case KW_CONST:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Statement-level synchronisation: skip what is left of a bad statement,
+// up to and including a `;` at its nesting level, or up to the `}` of the
+// enclosing block or a statement keyword or new line that begins the
+// next statement.
+static void sync_statement(Parser *p) {
+    size_t depth = 0;
+    for (;;) {
+        Token t = peek_tok(p);
+        if (t.type == TOKEN_EOF) break;
+        if (t.type == TOKEN_COMMENT_LINE || t.type == TOKEN_COMMENT_BLOCK) { Token ct = next_tok(p); record_comment(p, &ct); continue; }
+        if (depth == 0) {
+            if (is_punct(&t, PUNCT_RBRACE) && p->block_depth > 0) break;
+            if (is_punct(&t, PUNCT_SEMICOLON)) { next_tok(p); break; }
+            if (starts_statement(&t) || line_break_before(p, &t)) break;
+        }
+        if (is_opener(&t)) depth++;
+        else if (is_closer(&t) && depth > 0) depth--;
+        next_tok(p);
+    }
+    p->panic = 0;
+}
+
+// List-level synchronisation inside a (...), [...] or {...} list that
+// closes with `close`: skip to the next `,` or the closer at the list's
+// nesting level. Returns 0, still panicking, when a statement boundary
+// comes first.
+static int sync_list(Parser *p, PunctId close) {
+    size_t depth = 0;
+    for (;;) {
+        Token t = peek_tok(p);
+        if (t.type == TOKEN_EOF) return 0;
+        if (t.type == TOKEN_COMMENT_LINE || t.type == TOKEN_COMMENT_BLOCK) { Token ct = next_tok(p); record_comment(p, &ct); continue; }
+        if (depth == 0) {
+            if (is_punct(&t, close) || is_punct(&t, PUNCT_COMMA)) { p->panic = 0; return 1; }
+            if (is_punct(&t, PUNCT_SEMICOLON) || is_closer(&t)) return 0;
+            if (starts_statement(&t) && line_break_before(p, &t)) return 0;
+        }
+        if (is_opener(&t)) depth++;
+        else if (is_closer(&t)) depth--;
+        next_tok(p);
+    }
+}
+
+// A recognizer's tree keeps no statement lists, so once a statement of a
+// list is parsed nothing points at its nodes: the next one is built over
+// the same scratch memory. Peak memory is then the nodes along the path
+// to the statement being parsed, not the whole tree.
+static AstArenaMark statements_mark(Parser *p) {
+    AstArenaMark m = {0};
+    if (p->scratch) m = ast_arena_mark(p->scratch);
+    return m;
+}
+
+static void statements_rewind(Parser *p, AstArenaMark m) {
+    if (p->scratch) ast_arena_rewind(p->scratch, m);
+}
+
+// The statements around the parse position cannot be reparsed on their
+// own (see parse_program_edit).
+static void mark_tangled(Parser *p) {
+    if (p->comment_sink) p->comment_sink->tangled = 1;
+}
+
+// statements of an opened block (f->node), up to and including its
+// closing brace
+static void parse_block_statements(Parser *p, ParseFrame *f) {
+    AstNode *blk = f->node;
+    AstNode *stmt = p->ret;
+    if (f->state == 0) {
+        f->saved = p->no_in; // function bodies inside a for head
+        p->no_in = 0;
+        p->block_depth++;
+        f->mark = statements_mark(p);
+        // still recovering from an error before the `{`: the statements
+        // inside do not parse the same on their own
+        if (p->panic) mark_tangled(p);
+    } else if (stmt) {
+        astvec_push(&((BlockStatement *)blk->data)->body, stmt);
+    }
+    // a NULL statement is the end of the input
+    while (f->state == 0 || stmt) {
+        const Token *t = peek_nth(p, 0);
+        // an unterminated block runs to the end of the input
+        if (t->type == TOKEN_EOF) { blk->end = pos_start(t); break; }
+        if (is_punct(t, PUNCT_RBRACE)) { blk->end = pos_end(t); next_tok(p); break; }
+        // skip comments but record them
+        if (t->type == TOKEN_COMMENT_LINE || t->type == TOKEN_COMMENT_BLOCK) { Token ct = next_tok(p); record_comment(p, &ct); continue; }
+        statements_rewind(p, f->mark);
+        call_child(p, f, 1, parse_statement, 0);
+        return;
+    }
+    p->block_depth--;
+    p->no_in = f->saved;
+    finish_frame(p, blk);
+}
+
 // block statement { ... }
-static AstNode *parse_block(Parser *p) {
+static void parse_block(Parser *p, ParseFrame *f) {
     Token lbrace;
-    if (!expect_punct(p, "{", &lbrace)) {
-        return ast_error("ExpectedBlockOpen", pos_start(&lbrace), pos_end(&lbrace));
+    if (!expect_punct(p, PUNCT_LBRACE, &lbrace)) {
+        finish_frame(p, syntax_error(p, "ExpectedBlockOpen", pos_start(&lbrace), pos_end(&lbrace)));
+        return;
     }
-    Position s = pos_start(&lbrace);
+    SrcOffset s = pos_start(&lbrace);
+    tail_call(f, parse_block_statements, 0);
+    f->node = ast_block_statement(s, s);
+}
+
+// Lazy function body: only the braces are matched (template substitutions
+// lex as balanced tokens) and the block keeps its source range; comments
+// inside are still recorded, once, here.
+static AstNode *skip_function_body(Parser *p) {
+    Token lbrace;
+    if (!expect_punct(p, PUNCT_LBRACE, &lbrace)) {
+        return syntax_error(p, "ExpectedBlockOpen", pos_start(&lbrace), pos_end(&lbrace));
+    }
+    SrcOffset s = pos_start(&lbrace);
     AstNode *blk = ast_block_statement(s, s);
     BlockStatement *bs = (BlockStatement *)blk->data;
+    bs->lazy_source = p->lx.input;
+    bs->lazy_length = p->lx.length;
+    size_t depth = 1;
     for (;;) {
-        Token t = peek_tok(p);
-        if (t.type == TOKEN_EOF) break;
-        if (is_punct(&t, "}")) { next_tok(p); blk->end = pos_end(&t); break; }
-        // skip comments but record them
-        if (t.type == TOKEN_COMMENT_LINE || t.type == TOKEN_COMMENT_BLOCK) { Token ct = next_tok(p); record_comment(p, &ct); token_free(&ct); continue; }
-        AstNode *stmt = parse_statement(p);
-        if (!stmt) break;
-        astvec_push(&bs->body, stmt);
+        Token t = next_tok(p);
+        if (t.type == TOKEN_EOF) { blk->end = pos_start(&t); break; } // as parse_block_statements
+        if (t.type == TOKEN_COMMENT_LINE || t.type == TOKEN_COMMENT_BLOCK) { record_comment(p, &t); continue; }
+        if (is_punct(&t, PUNCT_LBRACE)) depth++;
+        else if (is_punct(&t, PUNCT_RBRACE) && --depth == 0) { blk->end = pos_end(&t); break; }
     }
-    token_free(&lbrace);
     return blk;
 }
 
-static AstNode *parse_function(Parser *p, int is_decl) {
+// Function body, skipped in lazy mode.
+static void parse_function_body(Parser *p, ParseFrame *f) {
+    if (p->lazy_functions) {
+        finish_frame(p, skip_function_body(p));
+        return;
+    }
+    tail_call(f, parse_block, 0);
+}
+
+int ast_materialize_body(AstNode *n) {
+    if (!n || !n->data) return 0;
+    if (n->type == AST_FunctionDeclaration || n->type == AST_FunctionExpression) {
+        n = ((FunctionBody *)n->data)->body;
+    } else if (n->type == AST_ArrowFunctionExpression) {
+        n = ((ArrowFunctionExpression *)n->data)->body;
+    }
+    if (!n || n->type != AST_BlockStatement || !n->data) return 0;
+    BlockStatement *bs = (BlockStatement *)n->data;
+    if (!bs->lazy_source) return 0;
+    // A heap tree (a clone) has nothing to drop the nodes error recovery
+    // abandons: parse into a scratch arena and keep heap copies of the
+    // statements.
+    AstArena *tmp = n->arena ? NULL : ast_arena_new();
+    if (!n->arena && !tmp) return 0;
+
+    Parser p;
+    parser_init(&p, bs->lazy_source, bs->lazy_length);
+    p.lazy_functions = 1;
+    p.lx.pos = n->start;
+    p.in_async = bs->lazy_async;
+    bs->lazy_source = NULL;
+    bs->lazy_length = 0;
+    // errors go to a sink first; its comments were recorded by the skip
+    Program *owner = ast_arena_owner(n->arena);
+    Program sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.arena = n->arena;
+    if (owner) p.comment_sink = &sink;
+    AstArena *prev = ast_arena_use(n->arena ? n->arena : tmp);
+    Token lbrace = next_tok(&p);
+    if (is_punct(&lbrace, PUNCT_LBRACE)) run_frames(&p, parse_block_statements, 0, n);
+    parser_release(&p);
+    if (tmp) {
+        ast_arena_use(NULL);
+        for (size_t i = 0; i < bs->body.count; ++i) bs->body.items[i] = ast_clone(bs->body.items[i]);
+        ast_arena_free(tmp);
+    }
+    ast_arena_use(prev);
+    if (owner && sink.diagnostic_count) {
+        // the owner's diagnostics all lie outside the body
+        size_t at = 0;
+        while (at < owner->diagnostic_count && owner->diagnostics[at].start < n->start) at++;
+        void *diags = owner->diagnostics;
+        if (splice_array(owner->arena, &diags, sizeof(Diagnostic), &owner->diagnostic_count,
+                         &owner->diagnostic_capacity, at, 0, sink.diagnostics, sink.diagnostic_count) == 0)
+            owner->diagnostics = (Diagnostic *)diags;
+    }
+    if (owner) owner->tangled |= sink.tangled;
+    return 1;
+}
+
+// f->arg: a declaration, whose name is required
+static void parse_function(Parser *p, ParseFrame *f) {
+    if (f->state == 1) {
+        AstNode *fn = f->node, *body = p->ret;
+        p->in_async = f->saved;
+        fn->end = body ? body->end : f->e;
+        ((FunctionBody *)fn->data)->body = body;
+        finish_frame(p, fn);
+        return;
+    }
     Token ft = next_tok(p); // consume 'function'
-    Position s = pos_start(&ft);
+    SrcOffset s = pos_start(&ft);
 
     Token name_tok = peek_tok(p);
-    char *name_cstr = NULL;
     int has_name = 0;
     if (name_tok.type == TOKEN_IDENTIFIER) {
         has_name = 1;
         next_tok(p);
-        name_cstr = name_tok.lexeme;
     }
     // For declarations, name is required
-    if (is_decl && !has_name) {
-        return ast_error("ExpectedFunctionName", s, s);
+    if (f->arg && !has_name) {
+        finish_frame(p, expected(p, "ExpectedFunctionName"));
+        return;
     }
 
     Token lparen;
-    if (!expect_punct(p, "(", &lparen)) return ast_error("ExpectedOpenParen", s, s);
+    if (!expect_punct(p, PUNCT_LPAREN, &lparen)) {
+        finish_frame(p, expected(p, "ExpectedOpenParen"));
+        return;
+    }
     AstVec params; astvec_init(&params);
     Token t = peek_tok(p);
-    if (!is_punct(&t, ")")) {
+    if (!is_punct(&t, PUNCT_RPAREN)) {
         for (;;) {
             Token ptok = peek_tok(p);
-            if (ptok.type != TOKEN_IDENTIFIER) return ast_error("ExpectedParam", pos_start(&ptok), pos_end(&ptok));
-            Token pid = next_tok(p);
-            AstNode *pidn = ast_identifier(pid.lexeme, pos_start(&pid), pos_end(&pid));
-            astvec_push(&params, pidn);
+            if (ptok.type == TOKEN_IDENTIFIER) {
+                Token pid = next_tok(p);
+                astvec_push(&params, ident_node(p, &pid));
+            } else {
+                astvec_push(&params, syntax_error(p, "ExpectedParam", pos_start(&ptok), pos_end(&ptok)));
+                if (!sync_list(p, PUNCT_RPAREN)) break;
+            }
             Token comma = peek_tok(p);
-            if (!is_punct(&comma, ",")) break;
+            if (!is_punct(&comma, PUNCT_COMMA)) break;
             next_tok(p);
         }
     }
     Token rparen;
-    if (!expect_punct(p, ")", &rparen)) return ast_error("ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen));
+    if (!expect_punct(p, PUNCT_RPAREN, &rparen)) {
+        finish_frame(p, syntax_error(p, "ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen)));
+        return;
+    }
 
-    AstNode *body = parse_block(p);
-    Position e = body ? body->end : pos_end(&rparen);
-    AstNode *fn = is_decl ? ast_function_declaration(name_cstr ? name_cstr : "", s, e)
-                           : ast_function_expression(name_cstr, s, e);
+    AstNode *fn = f->arg ? ast_function_declaration(NULL, s, s) : ast_function_expression(NULL, s, s);
     FunctionBody *fb = (FunctionBody *)fn->data;
+    if (has_name) fb->name = ast_intern_n(token_text(&p->lx, &name_tok), name_tok.length, NULL);
     fb->params = params; // shallow move
-    fb->body = body;
-    token_free(&ft);
-    if (has_name) token_free(&name_tok);
-    return fn;
+    f->node = fn;
+    f->e = pos_end(&rparen);
+    f->saved = p->in_async;
+    p->in_async = 0;
+    call_child(p, f, 1, parse_function_body, 0);
 }
 
-static AstNode *parse_if(Parser *p) {
-    Token ift = next_tok(p);
-    Position s = pos_start(&ift);
-    if (!expect_punct(p, "(", NULL)) return ast_error("ExpectedOpenParen", s, s);
-    AstNode *test = parse_expression(p);
-    Token rparen;
-    if (!expect_punct(p, ")", &rparen)) return ast_error("ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen));
-    AstNode *cons = parse_statement(p);
-    Token t = peek_tok(p);
-    AstNode *alt = NULL;
-    if (is_keyword(&t, "else")) { next_tok(p); alt = parse_statement(p); }
-    Position e = alt ? alt->end : (cons ? cons->end : pos_end(&rparen));
-    return ast_if_statement(test, cons, alt, s, e);
+static void parse_if(Parser *p, ParseFrame *f) {
+    switch (f->state) {
+    case 0: {
+        Token ift = next_tok(p);
+        f->s = pos_start(&ift);
+        if (!expect_punct(p, PUNCT_LPAREN, NULL)) { finish_frame(p, expected(p, "ExpectedOpenParen")); return; }
+        call_child(p, f, 1, parse_expression, 0);
+        return;
+    }
+    case 1: {
+        f->a = p->ret; // test
+        Token rparen;
+        if (!expect_punct(p, PUNCT_RPAREN, &rparen)) {
+            finish_frame(p, syntax_error(p, "ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen)));
+            return;
+        }
+        f->e = pos_end(&rparen);
+        call_child(p, f, 2, parse_statement, 0);
+        return;
+    }
+    case 2: {
+        f->b = p->ret; // consequent
+        Token t = peek_tok(p);
+        if (is_keyword(&t, KW_ELSE)) { next_tok(p); call_child(p, f, 3, parse_statement, 0); return; }
+        p->ret = NULL;
+    }
+    // fallthrough
+    default: {
+        AstNode *alt = p->ret;
+        SrcOffset e = alt ? alt->end : (f->b ? f->b->end : f->e);
+        finish_frame(p, ast_if_statement(f->a, f->b, alt, f->s, e));
+    }
+    }
 }
 
-static AstNode *parse_while(Parser *p) {
-    Token wt = next_tok(p);
-    Position s = pos_start(&wt);
-    if (!expect_punct(p, "(", NULL)) return ast_error("ExpectedOpenParen", s, s);
-    AstNode *test = parse_expression(p);
-    Token rparen;
-    if (!expect_punct(p, ")", &rparen)) return ast_error("ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen));
-    AstNode *body = parse_statement(p);
-    Position e = body ? body->end : pos_end(&rparen);
-    return ast_while_statement(test, body, s, e);
-}
-
-static AstNode *parse_do_while(Parser *p) {
-    Token dt = next_tok(p);
-    Position s = pos_start(&dt);
-    AstNode *body = parse_statement(p);
-    Token wt = peek_tok(p);
-    if (!is_keyword(&wt, "while")) return ast_error("ExpectedWhile", pos_start(&wt), pos_end(&wt));
-    next_tok(p);
-    if (!expect_punct(p, "(", NULL)) return ast_error("ExpectedOpenParen", pos_start(&wt), pos_end(&wt));
-    AstNode *test = parse_expression(p);
-    Token rparen;
-    if (!expect_punct(p, ")", &rparen)) return ast_error("ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen));
-    // optional trailing ;
-    Token semi = peek_tok(p);
-    if (is_punct(&semi, ";")) next_tok(p);
-    Position e = body ? body->end : pos_end(&rparen);
-    return ast_do_while_statement(body, test, s, e);
-}
-
-static AstNode *parse_switch(Parser *p) {
-    Token st = next_tok(p);
-    Position s = pos_start(&st);
-    if (!expect_punct(p, "(", NULL)) return ast_error("ExpectedOpenParen", s, s);
-    AstNode *disc = parse_expression(p);
-    if (!expect_punct(p, ")", NULL)) return ast_error("ExpectedCloseParen", s, s);
-    if (!expect_punct(p, "{", NULL)) return ast_error("ExpectedOpenBrace", s, s);
-    AstNode *sw = ast_switch_statement(disc, s, s);
-    SwitchStatement *ss = (SwitchStatement *)sw->data;
+static void parse_while(Parser *p, ParseFrame *f) {
+    switch (f->state) {
+    case 0: {
+        Token wt = next_tok(p);
+        f->s = pos_start(&wt);
+        if (!expect_punct(p, PUNCT_LPAREN, NULL)) { finish_frame(p, expected(p, "ExpectedOpenParen")); return; }
+        call_child(p, f, 1, parse_expression, 0);
+        return;
+    }
+    case 1: {
+        f->a = p->ret; // test
+        Token rparen;
+        if (!expect_punct(p, PUNCT_RPAREN, &rparen)) {
+            finish_frame(p, syntax_error(p, "ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen)));
+            return;
+        }
+        f->e = pos_end(&rparen);
+        call_child(p, f, 2, parse_statement, 0);
+        return;
+    }
+    default: {
+        AstNode *body = p->ret;
+        SrcOffset e = body ? body->end : f->e;
+        finish_frame(p, ast_while_statement(f->a, body, f->s, e));
+    }
+    }
+}
+
+static void parse_do_while(Parser *p, ParseFrame *f) {
+    switch (f->state) {
+    case 0: {
+        Token dt = next_tok(p);
+        f->s = pos_start(&dt);
+        call_child(p, f, 1, parse_statement, 0);
+        return;
+    }
+    case 1: {
+        f->a = p->ret; // body
+        Token wt = peek_tok(p);
+        if (!is_keyword(&wt, KW_WHILE)) {
+            finish_frame(p, syntax_error(p, "ExpectedWhile", pos_start(&wt), pos_end(&wt)));
+            return;
+        }
+        next_tok(p);
+        if (!expect_punct(p, PUNCT_LPAREN, NULL)) {
+            finish_frame(p, syntax_error(p, "ExpectedOpenParen", pos_start(&wt), pos_end(&wt)));
+            return;
+        }
+        call_child(p, f, 2, parse_expression, 0);
+        return;
+    }
+    default: {
+        AstNode *body = f->a, *test = p->ret;
+        Token rparen;
+        if (!expect_punct(p, PUNCT_RPAREN, &rparen)) {
+            finish_frame(p, syntax_error(p, "ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen)));
+            return;
+        }
+        // optional trailing ;
+        Token semi = peek_tok(p);
+        if (is_punct(&semi, PUNCT_SEMICOLON)) next_tok(p);
+        SrcOffset e = body ? body->end : pos_end(&rparen);
+        finish_frame(p, ast_do_while_statement(body, test, f->s, e));
+    }
+    }
+}
+
+// statements of a switch clause (f->node), up to the next clause or the
+// switch's closing brace
+static void parse_switch_case(Parser *p, ParseFrame *f) {
+    AstNode *stmt = p->ret;
+    if (f->state == 0) f->mark = statements_mark(p);
+    else if (stmt) astvec_push(&((SwitchCase *)f->node->data)->consequent, stmt);
+    while (f->state == 0 || stmt) {
+        Token tt = peek_tok(p);
+        if (tt.type == TOKEN_EOF || is_punct(&tt, PUNCT_RBRACE) || is_keyword(&tt, KW_CASE) || is_keyword(&tt, KW_DEFAULT)) break;
+        statements_rewind(p, f->mark);
+        call_child(p, f, 1, parse_statement, 0);
+        return;
+    }
+    finish_frame(p, f->node);
+}
+
+static void parse_switch(Parser *p, ParseFrame *f) {
+    switch (f->state) {
+    case 0: {
+        Token st = next_tok(p);
+        f->s = pos_start(&st);
+        if (!expect_punct(p, PUNCT_LPAREN, NULL)) { finish_frame(p, expected(p, "ExpectedOpenParen")); return; }
+        call_child(p, f, 1, parse_expression, 0);
+        return;
+    }
+    case 1: // the discriminant
+        if (!expect_punct(p, PUNCT_RPAREN, NULL)) { finish_frame(p, expected(p, "ExpectedCloseParen")); return; }
+        if (!expect_punct(p, PUNCT_LBRACE, NULL)) { finish_frame(p, expected(p, "ExpectedOpenBrace")); return; }
+        f->node = ast_switch_statement(p->ret, f->s, f->s);
+        p->block_depth++;
+        f->mark = statements_mark(p);
+        break;
+    case 2: { // a case test
+        if (!expect_punct(p, PUNCT_COLON, NULL)) expected(p, "ExpectedColon"); // parse on as if present
+        AstNode *test = p->ret;
+        ParseFrame *clause = call_child(p, f, 3, parse_switch_case, 0);
+        if (clause) clause->node = ast_switch_case(test);
+        return;
+    }
+    default: // a clause
+        astvec_push(&((SwitchStatement *)f->node->data)->cases, p->ret);
+        break;
+    }
+    AstNode *sw = f->node;
     for (;;) {
+        statements_rewind(p, f->mark);
         Token t = peek_tok(p);
-        if (is_punct(&t, "}")) { next_tok(p); sw->end = pos_end(&t); break; }
-        if (is_keyword(&t, "case")) {
+        if (is_punct(&t, PUNCT_RBRACE)) { next_tok(p); sw->end = pos_end(&t); break; }
+        if (is_keyword(&t, KW_CASE)) {
             next_tok(p);
-            AstNode *test = parse_expression(p);
-            if (!expect_punct(p, ":", NULL)) return ast_error("ExpectedColon", pos_start(&t), pos_end(&t));
-            AstNode *scn = ast_switch_case(test);
-            SwitchCase *scd = (SwitchCase *)scn->data;
-            for (;;) {
-                Token tt = peek_tok(p);
-                if (tt.type == TOKEN_EOF || is_punct(&tt, "}" ) || is_keyword(&tt, "case") || is_keyword(&tt, "default")) break;
-                AstNode *stn = parse_statement(p);
-                if (!stn) break;
-                astvec_push(&scd->consequent, stn);
-            }
-            astvec_push(&ss->cases, scn);
-            continue;
+            call_child(p, f, 2, parse_expression, 0);
+            return;
         }
-        if (is_keyword(&t, "default")) {
+        if (is_keyword(&t, KW_DEFAULT)) {
             next_tok(p);
-            if (!expect_punct(p, ":", NULL)) return ast_error("ExpectedColon", pos_start(&t), pos_end(&t));
-            AstNode *scn = ast_switch_case(NULL);
-            SwitchCase *scd = (SwitchCase *)scn->data;
-            for (;;) {
-                Token tt = peek_tok(p);
-                if (tt.type == TOKEN_EOF || is_punct(&tt, "}" ) || is_keyword(&tt, "case") || is_keyword(&tt, "default")) break;
-                AstNode *stn = parse_statement(p);
-                if (!stn) break;
-                astvec_push(&scd->consequent, stn);
-            }
-            astvec_push(&ss->cases, scn);
-            continue;
+            if (!expect_punct(p, PUNCT_COLON, NULL)) expected(p, "ExpectedColon"); // parse on as if present
+            ParseFrame *clause = call_child(p, f, 3, parse_switch_case, 0);
+            if (clause) clause->node = ast_switch_case(NULL);
+            return;
+        }
+        if (t.type == TOKEN_EOF) {
+            p->block_depth--;
+            finish_frame(p, expected(p, "ExpectedCloseBrace"));
+            return;
+        }
+        // skip to the next clause
+        syntax_error(p, "ExpectedCase", pos_start(&t), pos_end(&t));
+        while (t.type != TOKEN_EOF && !is_punct(&t, PUNCT_RBRACE) && !is_keyword(&t, KW_CASE) && !is_keyword(&t, KW_DEFAULT)) {
+            next_tok(p);
+            t = peek_tok(p);
         }
-        // unexpected, bail
-        return ast_error("ExpectedCase", pos_start(&t), pos_end(&t));
+        p->panic = 0;
     }
-    return sw;
+    p->block_depth--;
+    finish_frame(p, sw);
 }
 
-static AstNode *parse_try(Parser *p) {
-    Token tt = next_tok(p);
-    Position s = pos_start(&tt);
-    AstNode *block = parse_block(p);
-    AstNode *try_stmt = ast_try_statement(block, s, s);
-    TryStatement *ts = (TryStatement *)try_stmt->data;
-
-    Token t = peek_tok(p);
-    if (is_keyword(&t, "catch")) {
+static void parse_try(Parser *p, ParseFrame *f) {
+    switch (f->state) {
+    case 0: {
+        Token tt = next_tok(p);
+        f->s = pos_start(&tt);
+        call_child(p, f, 1, parse_block, 0);
+        return;
+    }
+    case 1: { // the block
+        f->node = ast_try_statement(p->ret, f->s, f->s);
+        Token t = peek_tok(p);
+        if (!is_keyword(&t, KW_CATCH)) break;
         next_tok(p);
-        if (!expect_punct(p, "(", NULL)) return ast_error("ExpectedOpenParen", s, s);
+        if (!expect_punct(p, PUNCT_LPAREN, NULL)) { finish_frame(p, expected(p, "ExpectedOpenParen")); return; }
         Token idt = peek_tok(p);
-        AstNode *param = NULL;
-        if (idt.type == TOKEN_IDENTIFIER) {
-            next_tok(p);
-            param = ast_identifier(idt.lexeme, pos_start(&idt), pos_end(&idt));
-            token_free(&idt);
-        } else {
-            return ast_error("ExpectedCatchParam", pos_start(&idt), pos_end(&idt));
+        if (idt.type != TOKEN_IDENTIFIER) {
+            finish_frame(p, syntax_error(p, "ExpectedCatchParam", pos_start(&idt), pos_end(&idt)));
+            return;
         }
-        if (!expect_punct(p, ")", NULL)) return ast_error("ExpectedCloseParen", s, s);
-        AstNode *cb = parse_block(p);
-        AstNode *cc = ast_catch_clause(param, cb);
-        astvec_push(&ts->handlers, cc);
-    }
-
-    t = peek_tok(p);
-    if (is_keyword(&t, "finally")) {
         next_tok(p);
-        ts->finalizer = parse_block(p);
+        f->a = ident_node(p, &idt);
+        if (!expect_punct(p, PUNCT_RPAREN, NULL)) { finish_frame(p, expected(p, "ExpectedCloseParen")); return; }
+        call_child(p, f, 2, parse_block, 0);
+        return;
+    }
+    case 2: // the catch block
+        astvec_push(&((TryStatement *)f->node->data)->handlers, ast_catch_clause(f->a, p->ret));
+        break;
+    default: // the finally block
+        ((TryStatement *)f->node->data)->finalizer = p->ret;
+        break;
+    }
+    AstNode *try_stmt = f->node;
+    TryStatement *ts = (TryStatement *)try_stmt->data;
+    if (f->state != 3) {
+        Token t = peek_tok(p);
+        if (is_keyword(&t, KW_FINALLY)) {
+            next_tok(p);
+            call_child(p, f, 3, parse_block, 0);
+            return;
+        }
     }
 
-    Position e = block ? block->end : s;
+    SrcOffset e = ts->block ? ts->block->end : f->s;
     if (ts->finalizer) e = ts->finalizer->end;
     try_stmt->end = e;
-    return try_stmt;
+    finish_frame(p, try_stmt);
 }
 
-static AstNode *parse_throw(Parser *p) {
-    Token th = next_tok(p);
-    Position s = pos_start(&th);
-    AstNode *arg = parse_expression(p);
+static void parse_throw(Parser *p, ParseFrame *f) {
+    if (f->state == 0) {
+        Token th = next_tok(p);
+        f->s = pos_start(&th);
+        f->e = pos_end(&th);
+        call_child(p, f, 1, parse_expression, 0);
+        return;
+    }
+    AstNode *arg = p->ret;
     Token semi = peek_tok(p);
-    if (is_punct(&semi, ";")) next_tok(p);
-    Position e = arg ? arg->end : pos_end(&th);
-    return ast_throw_statement(arg, s, e);
+    if (is_punct(&semi, PUNCT_SEMICOLON)) next_tok(p);
+    SrcOffset e = arg ? arg->end : f->e;
+    finish_frame(p, ast_throw_statement(arg, f->s, e));
 }
 
 static AstNode *parse_import(Parser *p) {
     Token it = next_tok(p);
-    Position s = pos_start(&it);
+    SrcOffset s = pos_start(&it);
     AstNode *imp = ast_import_declaration("", s, s);
     ImportDeclaration *id = (ImportDeclaration *)imp->data;
 
@@ -323,855 +944,1929 @@ static AstNode *parse_import(Parser *p) {
     // default import: import defaultExport from 'module'
     if (t.type == TOKEN_IDENTIFIER) {
         Token def = next_tok(p);
-        AstNode *local = ast_identifier(def.lexeme, pos_start(&def), pos_end(&def));
+        AstNode *local = ident_node(p, &def);
         AstNode *spec = ast_import_default_specifier(local, pos_start(&def), pos_end(&def));
         astvec_push(&id->specifiers, spec);
-        token_free(&def);
         
         // Check for comma (mixed import: import defaultExport, { named } from 'module')
         Token comma = peek_tok(p);
-        if (is_punct(&comma, ",")) {
+        if (is_punct(&comma, PUNCT_COMMA)) {
             next_tok(p);
             t = peek_tok(p);
         }
     }
     
     // namespace import: import * as name from 'module'
-    if (is_punct(&t, "*")) {
+    if (is_punct(&t, PUNCT_STAR)) {
         next_tok(p); // consume *
         Token as_tok = peek_tok(p);
-        if (!is_keyword(&as_tok, "as")) return ast_error("ExpectedAs", pos_start(&as_tok), pos_end(&as_tok));
+        if (!is_keyword(&as_tok, KW_AS)) return syntax_error(p, "ExpectedAs", pos_start(&as_tok), pos_end(&as_tok));
         next_tok(p); // consume 'as'
         
         Token name = peek_tok(p);
-        if (name.type != TOKEN_IDENTIFIER) return ast_error("ExpectedIdentifier", pos_start(&name), pos_end(&name));
+        if (name.type != TOKEN_IDENTIFIER) return syntax_error(p, "ExpectedIdentifier", pos_start(&name), pos_end(&name));
         next_tok(p);
         
-        AstNode *local = ast_identifier(name.lexeme, pos_start(&name), pos_end(&name));
+        AstNode *local = ident_node(p, &name);
         AstNode *spec = ast_import_namespace_specifier(local, pos_start(&name), pos_end(&name));
         astvec_push(&id->specifiers, spec);
-        token_free(&name);
         t = peek_tok(p);
     }
 
     // named imports: import { x, y } from 'module'
     t = peek_tok(p);
-    if (is_punct(&t, "{")) {
+    if (is_punct(&t, PUNCT_LBRACE)) {
         next_tok(p);
         Token nt = peek_tok(p);
-        if (!is_punct(&nt, "}")) {
+        if (!is_punct(&nt, PUNCT_RBRACE)) {
             for (;;) {
                 Token ntok = peek_tok(p);
-                if (ntok.type != TOKEN_IDENTIFIER) return ast_error("ExpectedImportSpecifier", pos_start(&ntok), pos_end(&ntok));
+                if (ntok.type != TOKEN_IDENTIFIER) return syntax_error(p, "ExpectedImportSpecifier", pos_start(&ntok), pos_end(&ntok));
                 Token name = next_tok(p);
-                AstNode *imported = ast_identifier(name.lexeme, pos_start(&name), pos_end(&name));
-                AstNode *local = ast_identifier(name.lexeme, pos_start(&name), pos_end(&name));
+                AstNode *imported = ident_node(p, &name);
+                AstNode *local = ident_node(p, &name);
                 
                 // Check for 'as' alias: import { x as y }
                 Token as_check = peek_tok(p);
-                if (is_keyword(&as_check, "as")) {
+                if (is_keyword(&as_check, KW_AS)) {
                     next_tok(p); // consume 'as'
                     Token alias = peek_tok(p);
-                    if (alias.type != TOKEN_IDENTIFIER) return ast_error("ExpectedIdentifier", pos_start(&alias), pos_end(&alias));
+                    if (alias.type != TOKEN_IDENTIFIER) return syntax_error(p, "ExpectedIdentifier", pos_start(&alias), pos_end(&alias));
                     next_tok(p);
                     ast_release(local);
-                    local = ast_identifier(alias.lexeme, pos_start(&alias), pos_end(&alias));
-                    token_free(&alias);
+                    local = ident_node(p, &alias);
                 }
                 
                 AstNode *spec = ast_import_specifier(imported, local);
                 astvec_push(&id->specifiers, spec);
-                token_free(&name);
                 Token comma = peek_tok(p);
-                if (!is_punct(&comma, ",")) break;
+                if (!is_punct(&comma, PUNCT_COMMA)) break;
                 next_tok(p);
             }
         }
-        if (!expect_punct(p, "}", NULL)) return ast_error("ExpectedCloseBrace", pos_start(&t), pos_end(&t));
+        if (!expect_punct(p, PUNCT_RBRACE, NULL)) return syntax_error(p, "ExpectedCloseBrace", pos_start(&t), pos_end(&t));
     }
 
     // from "module"
     Token fromt = peek_tok(p);
-    if (!is_keyword(&fromt, "from")) return ast_error("ExpectedFrom", pos_start(&fromt), pos_end(&fromt));
+    if (!is_keyword(&fromt, KW_FROM)) return syntax_error(p, "ExpectedFrom", pos_start(&fromt), pos_end(&fromt));
     next_tok(p);
     Token src = peek_tok(p);
-    if (src.type != TOKEN_STRING) return ast_error("ExpectedModuleString", pos_start(&src), pos_end(&src));
+    if (src.type != TOKEN_STRING) return syntax_error(p, "ExpectedModuleString", pos_start(&src), pos_end(&src));
     next_tok(p);
-    free(id->source);
-    id->source = dup_unquoted_string(&src);
-    token_free(&src);
+    ast_node_free_string(imp, id->source);
+    id->source = dup_unquoted_string(p, &src);
     Token semi = peek_tok(p);
-    if (is_punct(&semi, ";")) next_tok(p);
+    if (is_punct(&semi, PUNCT_SEMICOLON)) next_tok(p);
     imp->end = pos_end(&src);
     return imp;
 }
 
-static AstNode *parse_export(Parser *p) {
-    Token et = next_tok(p);
-    Position s = pos_start(&et);
-    Token t = peek_tok(p);
-    if (is_keyword(&t, "default")) {
-        next_tok(p);
-        Token ft = peek_tok(p);
-        AstNode *decl = NULL;
-        AstNode *expr = NULL;
-        if (is_keyword(&ft, "function")) {
-            decl = parse_function(p, 0);
-        } else {
-            expr = parse_expression(p);
+// export { ... } from "module"; (or without from)
+static AstNode *parse_export_list(Parser *p, SrcOffset s) {
+    Token t = next_tok(p);
+    AstNode *ed = ast_export_named_declaration(NULL, s, s);
+    ExportNamedDeclaration *end = (ExportNamedDeclaration *)ed->data;
+    Token nt = peek_tok(p);
+    if (!is_punct(&nt, PUNCT_RBRACE)) {
+        for (;;) {
+            Token ntok = peek_tok(p);
+            if (ntok.type != TOKEN_IDENTIFIER) return syntax_error(p, "ExpectedExportSpecifier", pos_start(&ntok), pos_end(&ntok));
+            next_tok(p);
+            AstNode *idn = ident_node(p, &ntok);
+            astvec_push(&end->specifiers, idn);
+            Token comma = peek_tok(p);
+            if (!is_punct(&comma, PUNCT_COMMA)) break;
+            next_tok(p);
         }
-        Token semi = peek_tok(p);
-        if (is_punct(&semi, ";")) next_tok(p);
-        AstNode *ed = ast_export_default_declaration(s, expr ? expr->end : (decl ? decl->end : s));
-        ExportDefaultDeclaration *edd = (ExportDefaultDeclaration *)ed->data;
-        edd->declaration = decl;
-        edd->expression = expr;
-        return ed;
     }
-
-    // export { ... } from "module"; (or without from)
-    if (is_punct(&t, "{")) {
+    if (!expect_punct(p, PUNCT_RBRACE, NULL)) return syntax_error(p, "ExpectedCloseBrace", pos_start(&t), pos_end(&t));
+    Token fromt = peek_tok(p);
+    if (is_keyword(&fromt, KW_FROM)) {
         next_tok(p);
-        AstNode *ed = ast_export_named_declaration(NULL, s, s);
-        ExportNamedDeclaration *end = (ExportNamedDeclaration *)ed->data;
-        Token nt = peek_tok(p);
-        if (!is_punct(&nt, "}")) {
-            for (;;) {
-                Token ntok = peek_tok(p);
-                if (ntok.type != TOKEN_IDENTIFIER) return ast_error("ExpectedExportSpecifier", pos_start(&ntok), pos_end(&ntok));
-                next_tok(p);
-                AstNode *idn = ast_identifier(ntok.lexeme, pos_start(&ntok), pos_end(&ntok));
-                astvec_push(&end->specifiers, idn);
-                Token comma = peek_tok(p);
-                if (!is_punct(&comma, ",")) break;
-                next_tok(p);
-            }
-        }
-        if (!expect_punct(p, "}", NULL)) return ast_error("ExpectedCloseBrace", pos_start(&t), pos_end(&t));
-        Token fromt = peek_tok(p);
-        if (is_keyword(&fromt, "from")) {
-            next_tok(p);
-            Token src = peek_tok(p);
-            if (src.type != TOKEN_STRING) return ast_error("ExpectedModuleString", pos_start(&src), pos_end(&src));
+        Token src = peek_tok(p);
+        if (src.type != TOKEN_STRING) return syntax_error(p, "ExpectedModuleString", pos_start(&src), pos_end(&src));
+        next_tok(p);
+        ast_node_free_string(ed, end->source);
+        end->source = dup_unquoted_string(p, &src);
+    }
+    Token semi = peek_tok(p);
+    if (is_punct(&semi, PUNCT_SEMICOLON)) next_tok(p);
+    return ed;
+}
+
+enum { EXPORT_DEFAULT_DECLARATION = 1, EXPORT_DEFAULT_EXPRESSION, EXPORT_DECLARATION };
+
+static void parse_export(Parser *p, ParseFrame *f) {
+    if (f->state == 0) {
+        Token et = next_tok(p);
+        f->s = pos_start(&et);
+        Token t = peek_tok(p);
+        if (is_keyword(&t, KW_DEFAULT)) {
             next_tok(p);
-            free(end->source);
-            end->source = dup_unquoted_string(&src);
-            token_free(&src);
+            Token ft = peek_tok(p);
+            if (is_keyword(&ft, KW_FUNCTION)) call_child(p, f, EXPORT_DEFAULT_DECLARATION, parse_function, 0);
+            else call_child(p, f, EXPORT_DEFAULT_EXPRESSION, parse_expression, 0);
+            return;
         }
-        Token semi = peek_tok(p);
-        if (is_punct(&semi, ";")) next_tok(p);
-        return ed;
+        if (is_punct(&t, PUNCT_LBRACE)) {
+            finish_frame(p, parse_export_list(p, f->s));
+            return;
+        }
+        // export function declaration
+        if (is_keyword(&t, KW_FUNCTION)) {
+            call_child(p, f, EXPORT_DECLARATION, parse_function, 1);
+            return;
+        }
+        finish_frame(p, expected(p, "UnsupportedExport"));
+        return;
     }
 
-    // export function declaration
-    if (is_keyword(&t, "function")) {
-        AstNode *decl = parse_function(p, 1);
+    SrcOffset s = f->s;
+    if (f->state == EXPORT_DECLARATION) {
+        AstNode *decl = p->ret;
         AstNode *ed = ast_export_named_declaration(NULL, s, decl ? decl->end : s);
         ExportNamedDeclaration *end = (ExportNamedDeclaration *)ed->data;
         end->declaration = decl;
-        return ed;
+        finish_frame(p, ed);
+        return;
     }
-
-    return ast_error("UnsupportedExport", s, s);
+    AstNode *decl = f->state == EXPORT_DEFAULT_DECLARATION ? p->ret : NULL;
+    AstNode *expr = f->state == EXPORT_DEFAULT_EXPRESSION ? p->ret : NULL;
+    Token semi = peek_tok(p);
+    if (is_punct(&semi, PUNCT_SEMICOLON)) next_tok(p);
+    AstNode *ed = ast_export_default_declaration(s, expr ? expr->end : (decl ? decl->end : s));
+    ExportDefaultDeclaration *edd = (ExportDefaultDeclaration *)ed->data;
+    edd->declaration = decl;
+    edd->expression = expr;
+    finish_frame(p, ed);
 }
 
-static AstNode *parse_for(Parser *p) {
-    Token ft = next_tok(p);
-    Position s = pos_start(&ft);
-    if (!expect_punct(p, "(", NULL)) return ast_error("ExpectedOpenParen", s, s);
-
-    // init/left side
-    AstNode *left = NULL;
-    Token t = peek_tok(p);
-    if (is_keyword(&t, "var")) { 
-        next_tok(p); 
-        left = parse_variable_declaration(p, VD_Var); 
-    }
-    else if (is_keyword(&t, "let")) { 
-        next_tok(p); 
-        left = parse_variable_declaration(p, VD_Let); 
-    }
-    else if (is_keyword(&t, "const")) { 
-        next_tok(p); 
-        left = parse_variable_declaration(p, VD_Const); 
+// States of parse_for after its head's first part; f->arg tells the loops
+// apart once `of` or `in` was seen.
+enum { FOR_INIT = 1, FOR_TEST, FOR_UPDATE, FOR_RIGHT, FOR_BODY };
+enum { FOR_PLAIN, FOR_OF, FOR_IN };
+
+static void parse_for(Parser *p, ParseFrame *f) {
+    switch (f->state) {
+    case 0: {
+        Token ft = next_tok(p);
+        f->s = pos_start(&ft);
+        if (!expect_punct(p, PUNCT_LPAREN, NULL)) { finish_frame(p, expected(p, "ExpectedOpenParen")); return; }
+
+        // init/left side; a top-level `in` here starts a for-in
+        f->saved = p->no_in;
+        p->no_in = 1;
+        Token t = peek_tok(p);
+        if (is_keyword(&t, KW_VAR)) { call_child(p, f, FOR_INIT, parse_variable_declaration, VD_Var); return; }
+        if (is_keyword(&t, KW_LET)) { call_child(p, f, FOR_INIT, parse_variable_declaration, VD_Let); return; }
+        if (is_keyword(&t, KW_CONST)) { call_child(p, f, FOR_INIT, parse_variable_declaration, VD_Const); return; }
+        if (!is_punct(&t, PUNCT_SEMICOLON)) {
+            // Try to parse left side - could be identifier for for-in/for-of
+            call_child(p, f, FOR_INIT, parse_expression, 0);
+            return;
+        }
+        p->ret = NULL;
     }
-    else if (!is_punct(&t, ";")) {
-        // Try to parse left side - could be identifier for for-in/for-of
-        left = parse_expression(p);
+    // fallthrough
+    case FOR_INIT: {
+        f->a = p->ret;
+        p->no_in = f->saved;
+
+        // Check for 'of' or 'in' keyword
+        Token look = peek_tok(p);
+        if (is_keyword(&look, KW_OF) || is_keyword(&look, KW_IN)) {
+            f->arg = is_keyword(&look, KW_OF) ? FOR_OF : FOR_IN;
+            next_tok(p);
+            call_child(p, f, FOR_RIGHT, parse_expression, 0);
+            return;
+        }
+
+        // Regular for loop
+        Token t = peek_tok(p);
+        if (!is_punct(&t, PUNCT_SEMICOLON)) { call_child(p, f, FOR_TEST, parse_expression, 0); return; }
+        p->ret = NULL;
     }
+    // fallthrough
+    case FOR_TEST: {
+        f->b = p->ret;
+        Token semi2;
+        expect_punct(p, PUNCT_SEMICOLON, &semi2);
 
-    // Check for 'of' keyword
-    Token look = peek_tok(p);
-    if (is_keyword(&look, "of")) {
-        next_tok(p); // consume 'of'
-        AstNode *right = parse_expression(p);
-        Token rparen;
-        expect_punct(p, ")", &rparen);
-        AstNode *body = parse_statement(p);
-        Position e = body ? body->end : pos_end(&rparen);
-        return ast_for_of_statement(left, right, body, s, e);
+        // update
+        Token t = peek_tok(p);
+        if (!is_punct(&t, PUNCT_RPAREN)) { call_child(p, f, FOR_UPDATE, parse_expression, 0); return; }
+        p->ret = NULL;
+    }
+    // fallthrough
+    case FOR_UPDATE:
+        f->c = p->ret;
+        break;
+    case FOR_RIGHT:
+        f->b = p->ret;
+        break;
+    default: {
+        AstNode *body = p->ret;
+        SrcOffset e = body ? body->end : f->e;
+        if (f->arg == FOR_OF) finish_frame(p, ast_for_of_statement(f->a, f->b, body, f->s, e));
+        else if (f->arg == FOR_IN) finish_frame(p, ast_for_in_statement(f->a, f->b, body, f->s, e));
+        else finish_frame(p, ast_for_statement(f->a, f->b, f->c, body, f->s, e));
+        return;
     }
-    
-    // Check for 'in' keyword
-    if (is_keyword(&look, "in")) {
-        next_tok(p); // consume 'in'
-        AstNode *right = parse_expression(p);
-        Token rparen;
-        expect_punct(p, ")", &rparen);
-        AstNode *body = parse_statement(p);
-        Position e = body ? body->end : pos_end(&rparen);
-        return ast_for_in_statement(left, right, body, s, e);
     }
-
-    // Regular for loop
-    AstNode *test = NULL;
-    t = peek_tok(p);
-    if (!is_punct(&t, ";")) { test = parse_expression(p); }
-    Token semi2;
-    expect_punct(p, ";", &semi2);
-
-    // update
-    AstNode *update = NULL;
-    t = peek_tok(p);
-    if (!is_punct(&t, ")")) { update = parse_expression(p); }
     Token rparen;
-    expect_punct(p, ")", &rparen);
-
-    AstNode *body = parse_statement(p);
-    Position e = body ? body->end : pos_end(&rparen);
-    return ast_for_statement(left, test, update, body, s, e);
+    expect_punct(p, PUNCT_RPAREN, &rparen);
+    f->e = pos_end(&rparen);
+    call_child(p, f, FOR_BODY, parse_statement, 0);
 }
 
-static AstNode *parse_return(Parser *p) {
-    Token rt = next_tok(p);
-    Position s = pos_start(&rt);
-    Token t = peek_tok(p);
-    AstNode *arg = NULL;
-    if (!is_punct(&t, ";") && t.type != TOKEN_EOF && !is_punct(&t, "}")) {
-        arg = parse_expression(p);
+static void parse_return(Parser *p, ParseFrame *f) {
+    if (f->state == 0) {
+        Token rt = next_tok(p);
+        f->s = pos_start(&rt);
+        f->e = pos_end(&rt);
+        Token t = peek_tok(p);
+        if (!is_punct(&t, PUNCT_SEMICOLON) && t.type != TOKEN_EOF && !is_punct(&t, PUNCT_RBRACE)) {
+            call_child(p, f, 1, parse_expression, 0);
+            return;
+        }
+        p->ret = NULL;
     }
+    AstNode *arg = p->ret;
     Token semi = peek_tok(p);
-    if (is_punct(&semi, ";")) { next_tok(p); }
-    Position e = arg ? arg->end : pos_end(&rt);
-    return ast_return_statement(arg, s, e);
+    if (is_punct(&semi, PUNCT_SEMICOLON)) { next_tok(p); }
+    SrcOffset e = arg ? arg->end : f->e;
+    finish_frame(p, ast_return_statement(arg, f->s, e));
 }
 
 static AstNode *parse_break(Parser *p) {
     Token bt = next_tok(p);
-    Position s = pos_start(&bt);
+    SrcOffset s = pos_start(&bt);
     Token semi = peek_tok(p);
-    if (is_punct(&semi, ";")) next_tok(p);
+    if (is_punct(&semi, PUNCT_SEMICOLON)) next_tok(p);
     return ast_break_statement(s, pos_end(&bt));
 }
 
 static AstNode *parse_continue(Parser *p) {
     Token ct = next_tok(p);
-    Position s = pos_start(&ct);
+    SrcOffset s = pos_start(&ct);
     Token semi = peek_tok(p);
-    if (is_punct(&semi, ";")) next_tok(p);
+    if (is_punct(&semi, PUNCT_SEMICOLON)) next_tok(p);
     return ast_continue_statement(s, pos_end(&ct));
 }
 
 // literal keywords: null/true/false/undefined
-static AstNode *parse_literal_keyword(Token t) {
-    Position s = pos_start(&t);
-    Position e = pos_end(&t);
+static AstNode *parse_literal_keyword(Parser *p, Token t) {
+    SrcOffset s = pos_start(&t);
+    SrcOffset e = pos_end(&t);
     AstNode *lit = NULL;
     
-    if (is_keyword(&t, "true")) {
+    if (is_keyword(&t, KW_TRUE)) {
         lit = ast_literal(LIT_Boolean, "true", s, e);
-    } else if (is_keyword(&t, "false")) {
+    } else if (is_keyword(&t, KW_FALSE)) {
         lit = ast_literal(LIT_Boolean, "false", s, e);
-    } else if (is_keyword(&t, "null")) {
+    } else if (is_keyword(&t, KW_NULL)) {
         lit = ast_literal(LIT_Null, "null", s, e);
-    } else if (is_keyword(&t, "undefined")) {
+    } else if (is_keyword(&t, KW_UNDEFINED)) {
         lit = ast_literal(LIT_Undefined, "undefined", s, e);
     } else {
         // Fallback for other keywords as string literals
-        lit = ast_literal(LIT_String, t.lexeme, s, e);
+        lit = literal_node(p, LIT_String, &t, s, e);
     }
     
-    token_free(&t);
     return lit;
 }
 
-// object literal
-static AstNode *parse_object_literal(Parser *p) {
-    Token lbrace = next_tok(p);
-    Position s = pos_start(&lbrace);
-    AstNode *obj = ast_object_expression(s, s);
-    ObjectExpression *oe = (ObjectExpression *)obj->data;
-
-    Token look = peek_tok(p);
-    if (!is_punct(&look, "}")) {
-        for (;;) {
-            Token key_tok = next_tok(p);
-            AstNode *key = NULL;
-            if (key_tok.type == TOKEN_IDENTIFIER) {
-                key = ast_identifier(key_tok.lexeme, pos_start(&key_tok), pos_end(&key_tok));
-            } else if (key_tok.type == TOKEN_STRING) {
-                key = ast_literal(LIT_String, key_tok.lexeme, pos_start(&key_tok), pos_end(&key_tok));
-            } else {
-                AstNode *err = ast_error("ExpectedPropertyKey", pos_start(&key_tok), pos_end(&key_tok));
-                astvec_push(&oe->properties, err);
-                token_free(&key_tok);
-                break;
-            }
-            token_free(&key_tok);
+// After an element of a [...] or {...} literal closed by `close`: consumes
+// the `,` before the next element and returns 1, or returns 0 at the end
+// of the list, after recovering from a missing `,` (reported as `kind`).
+static int next_element(Parser *p, AstVec *items, PunctId close, const char *kind) {
+    if (p->panic && !sync_list(p, close)) return 0;
+
+    Token sep = peek_tok(p);
+    if (is_punct(&sep, close)) return 0;
+    if (!is_punct(&sep, PUNCT_COMMA)) {
+        AstNode *err = syntax_error(p, kind, pos_start(&sep), pos_end(&sep));
+        astvec_push(items, err);
+        if (!sync_list(p, close)) return 0;
+        sep = peek_tok(p);
+        if (is_punct(&sep, close)) return 0;
+    }
+    next_tok(p); // consume ','
+    return 1;
+}
 
-            Token colon = peek_tok(p);
-            if (!is_punct(&colon, ":")) {
-                AstNode *err = ast_error("ExpectedColon", pos_start(&colon), pos_end(&colon));
-                astvec_push(&oe->properties, err);
-                break;
-            }
-            next_tok(p); // consume ':'
+// object literal
+static void parse_object_literal(Parser *p, ParseFrame *f) {
+    int more;
+    if (f->state == 0) {
+        Token lbrace = next_tok(p);
+        SrcOffset s = pos_start(&lbrace);
+        f->node = ast_object_expression(s, s);
+        Token look = peek_tok(p);
+        more = !is_punct(&look, PUNCT_RBRACE);
+    } else {
+        // a property value
+        AstNode *key = f->a, *value = p->ret;
+        AstNode *prop = ast_property(key, value, 0);
+        prop->start = key->start;
+        prop->end = value->end;
+        astvec_push(&((ObjectExpression *)f->node->data)->properties, prop);
+        more = next_element(p, &((ObjectExpression *)f->node->data)->properties, PUNCT_RBRACE, "ExpectedCommaOrCloseBrace");
+    }
+    AstNode *obj = f->node;
+    ObjectExpression *oe = (ObjectExpression *)obj->data;
 
-            AstNode *value = parse_expression(p);
-            AstNode *prop = ast_property(key, value, 0);
-            astvec_push(&oe->properties, prop);
+    while (more) {
+        Token key_tok = next_tok(p);
+        AstNode *key = NULL;
+        if (key_tok.type == TOKEN_IDENTIFIER) {
+            key = ident_node(p, &key_tok);
+        } else if (key_tok.type == TOKEN_STRING) {
+            key = string_node(p, &key_tok);
+        }
 
-            Token sep = peek_tok(p);
-            if (is_punct(&sep, "}")) break;
-            if (!is_punct(&sep, ",")) {
-                AstNode *err = ast_error("ExpectedCommaOrCloseBrace", pos_start(&sep), pos_end(&sep));
-                astvec_push(&oe->properties, err);
-                break;
-            }
-            next_tok(p); // consume ','
+        Token colon = peek_tok(p);
+        if (!key) {
+            astvec_push(&oe->properties, syntax_error(p, "ExpectedPropertyKey", pos_start(&key_tok), pos_end(&key_tok)));
+        } else if (!is_punct(&colon, PUNCT_COLON)) {
+            astvec_push(&oe->properties, syntax_error(p, "ExpectedColon", pos_start(&colon), pos_end(&colon)));
+        } else {
+            next_tok(p); // consume ':'
+            f->a = key;
+            call_child(p, f, 1, parse_expression, 0);
+            return;
         }
+        more = next_element(p, &oe->properties, PUNCT_RBRACE, "ExpectedCommaOrCloseBrace");
     }
 
     Token rbrace = peek_tok(p);
-    if (!is_punct(&rbrace, "}")) {
-        AstNode *err = ast_error("ExpectedCloseBrace", pos_start(&rbrace), pos_end(&rbrace));
+    if (!is_punct(&rbrace, PUNCT_RBRACE)) {
+        AstNode *err = syntax_error(p, "ExpectedCloseBrace", pos_start(&rbrace), pos_end(&rbrace));
         astvec_push(&oe->properties, err);
     } else {
         next_tok(p);
         obj->end = pos_end(&rbrace);
     }
-    token_free(&lbrace);
-    return obj;
+    finish_frame(p, obj);
 }
 
 // array literal
-static AstNode *parse_array_literal(Parser *p) {
-    Token lbracket = next_tok(p);
-    Position s = pos_start(&lbracket);
-    AstNode *arr = ast_array_expression(s, s);
+static void parse_array_literal(Parser *p, ParseFrame *f) {
+    int more;
+    if (f->state == 0) {
+        Token lbracket = next_tok(p);
+        SrcOffset s = pos_start(&lbracket);
+        f->node = ast_array_expression(s, s);
+        Token look = peek_tok(p);
+        more = !is_punct(&look, PUNCT_RBRACKET);
+    } else {
+        // an element
+        astvec_push(&((ArrayExpression *)f->node->data)->elements, p->ret);
+        more = next_element(p, &((ArrayExpression *)f->node->data)->elements, PUNCT_RBRACKET, "ExpectedCommaOrCloseBracket");
+    }
+    AstNode *arr = f->node;
     ArrayExpression *ae = (ArrayExpression *)arr->data;
 
-    Token look = peek_tok(p);
-    if (!is_punct(&look, "]")) {
-        for (;;) {
-            Token t = peek_tok(p);
-            if (is_punct(&t, ",")) {
-                astvec_push(&ae->elements, NULL); // hole
-                next_tok(p);
-                continue;
-            }
-            if (is_punct(&t, "]")) break;
-
-            AstNode *elem = parse_expression(p);
-            astvec_push(&ae->elements, elem);
-
-            Token sep = peek_tok(p);
-            if (is_punct(&sep, "]")) break;
-            if (!is_punct(&sep, ",")) {
-                AstNode *err = ast_error("ExpectedCommaOrCloseBracket", pos_start(&sep), pos_end(&sep));
-                astvec_push(&ae->elements, err);
-                break;
-            }
+    while (more) {
+        Token t = peek_tok(p);
+        if (is_punct(&t, PUNCT_COMMA)) {
+            astvec_push(&ae->elements, NULL); // hole
             next_tok(p);
+            continue;
         }
+        if (is_punct(&t, PUNCT_RBRACKET)) break;
+        call_child(p, f, 1, parse_expression, 0);
+        return;
     }
 
     Token rbracket = peek_tok(p);
-    if (!is_punct(&rbracket, "]")) {
-        AstNode *err = ast_error("ExpectedCloseBracket", pos_start(&rbracket), pos_end(&rbracket));
+    if (!is_punct(&rbracket, PUNCT_RBRACKET)) {
+        AstNode *err = syntax_error(p, "ExpectedCloseBracket", pos_start(&rbracket), pos_end(&rbracket));
         astvec_push(&ae->elements, err);
     } else {
         next_tok(p);
         arr->end = pos_end(&rbracket);
     }
-    token_free(&lbracket);
-    return arr;
+    finish_frame(p, arr);
 }
 
-// primary expressions
+// Primary expressions of a single token; the others are started by
+// parse_expression.
 static AstNode *parse_primary(Parser *p) {
-    Token t = peek_tok(p);
+    const Token *look = peek_nth(p, 0);
 
-    if (is_keyword(&t, "function")) return parse_function(p, 0);
-    if (is_keyword(&t, "this")) {
+    if (look->type == TOKEN_IDENTIFIER && look->kw == KW_NONE) {
+        Token t = next_tok(p);
+        return ident_node(p, &t);
+    }
+    Token t = *look;
+    if (is_keyword(&t, KW_THIS)) {
         Token this_tok = next_tok(p);
         AstNode *node = ast_this_expression(pos_start(&this_tok), pos_end(&this_tok));
-        token_free(&this_tok);
         return node;
     }
-    if (is_keyword(&t, "super")) {
+    if (is_keyword(&t, KW_SUPER)) {
         Token super_tok = next_tok(p);
         AstNode *node = ast_super(pos_start(&super_tok), pos_end(&super_tok));
-        token_free(&super_tok);
         return node;
     }
-    if (is_punct(&t, "{")) return parse_object_literal(p);
-    if (is_punct(&t, "[")) return parse_array_literal(p);
-    
-    // Check for template literal
-    Token peek = peek_tok(p);
-    if (peek.type == TOKEN_TEMPLATE) {
-        return parse_template_literal(p);
-    }
 
-    if (is_punct(&t, "(")) {
-        next_tok(p); // consume '('
-        Position s = pos_start(&t);
-        AstNode *expr = parse_expression(p);
-        Token rparen = peek_tok(p);
-        if (!is_punct(&rparen, ")")) {
-            AstNode *err = ast_error("ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen));
-            return err;
-        }
-        next_tok(p);
-        expr->start = s;
-        expr->end = pos_end(&rparen);
-        token_free(&t);
-        return expr;
+    // leave list and statement ends to the recovery that owns them
+    if (t.type == TOKEN_EOF || is_closer(&t) || is_punct(&t, PUNCT_SEMICOLON) || is_punct(&t, PUNCT_COMMA)) {
+        return syntax_error(p, "UnexpectedToken", pos_start(&t), pos_end(&t));
     }
-
     t = next_tok(p);
 
-    if (is_keyword(&t, "null") || is_keyword(&t, "true") || is_keyword(&t, "false")) {
-        return parse_literal_keyword(t);
+    if (is_keyword(&t, KW_NULL) || is_keyword(&t, KW_TRUE) || is_keyword(&t, KW_FALSE)) {
+        return parse_literal_keyword(p, t);
     }
 
     if (t.type == TOKEN_IDENTIFIER) {
-        AstNode *id = ast_identifier(t.lexeme, pos_start(&t), pos_end(&t));
-        token_free(&t);
+        AstNode *id = ident_node(p, &t);
         return id;
     }
     if (t.type == TOKEN_NUMBER) {
-        AstNode *lit = ast_literal(LIT_Number, t.lexeme, pos_start(&t), pos_end(&t));
-        token_free(&t);
-        return lit;
+        return number_node(p, &t);
     }
     if (t.type == TOKEN_STRING) {
-        AstNode *lit = ast_literal(LIT_String, t.lexeme, pos_start(&t), pos_end(&t));
-        token_free(&t);
-        return lit;
+        return string_node(p, &t);
     }
     if (t.type == TOKEN_ERROR) {
-        AstNode *err = ast_error(t.error_kind ? t.error_kind : "LexerError", pos_start(&t), pos_end(&t));
-        token_free(&t);
+        AstNode *err = syntax_error(p, t.error_kind ? t.error_kind : "LexerError", pos_start(&t), pos_end(&t));
         return err;
     }
-    AstNode *err = ast_error("UnexpectedToken", pos_start(&t), pos_end(&t));
-    token_free(&t);
+    AstNode *err = syntax_error(p, "UnexpectedToken", pos_start(&t), pos_end(&t));
     return err;
 }
 
-// postfix: member access, call, postfix ++/--
-static AstNode *parse_postfix(Parser *p) {
-    AstNode *expr = parse_primary(p);
+// Production of a primary expression that nests: functions, object and
+// array literals, templates. NULL for the others.
+static ParseStep primary_production(const Token *t) {
+    if (is_keyword(t, KW_FUNCTION)) return parse_function;
+    if (is_punct(t, PUNCT_LBRACE)) return parse_object_literal;
+    if (is_punct(t, PUNCT_LBRACKET)) return parse_array_literal;
+    if (t->type == TOKEN_TEMPLATE || t->type == TOKEN_TEMPLATE_HEAD) return parse_template_literal;
+    return NULL;
+}
+
+// Prefix operators, plus `await` inside async arrow bodies.
+static int is_prefix_tok(const Parser *p, const Token *t) {
+    if (ast_operator_info(tok_op(t))->flags & OPF_PREFIX) return 1;
+    return p->in_async && is_keyword(t, KW_AWAIT) && !t->escaped;
+}
+
+// --- expressions ---------------------------------------------------------
+// One parse_expression frame parses an assignment expression with all the
+// operators and brackets in it; what is still open waits on p->items, the
+// innermost on top:
+//   XI_PREFIX  a prefix operator (op OP_NONE: `await`) at s, for its operand
+//   XI_BINARY  a binary operator with its left operand, for the right one
+//   XI_ASSIGN  an assignment operator with its target, for the value
+//   XI_PAREN   a `(` at s, for the expression inside; saved is no_in outside
+//   XI_INDEX   `node[`, for the index
+//   XI_ARG     the call `node(`, for its next argument
+// Binary operators go by precedence climbing over the operator table: a
+// right operand takes the operators binding tighter than the one before
+// it, or as tight for right-associative ones.
+
+typedef enum { XI_PREFIX, XI_BINARY, XI_ASSIGN, XI_PAREN, XI_INDEX, XI_ARG } ExprItemKind;
+
+struct ExprItem {
+    ExprItemKind kind;
+    AstOperator op;
+    SrcOffset s;
+    int saved;
+    AstNode *node;
+};
+
+typedef struct ExprItem ExprItem;
+
+// parse_expression's f->arg
+enum { EXPR_ASSIGNMENT, EXPR_PRIMARY };
+
+// States of parse_expression, by what comes next; the expression parsed
+// so far is in p->ret when the frame resumes.
+enum {
+    X_START,
+    X_ASSIGNMENT, // an assignment expression (or an arrow function)
+    X_OPERAND,    // a unary expression
+    X_PRIMARY,    // a primary expression
+    X_POSTFIX,    // member, call and update suffixes of the expression
+    X_UNARY,      // the prefix operators waiting for the expression
+    X_OPERATOR,   // a binary or assignment operator after the expression
+    X_COMPLETE,   // the expression is an assignment expression: close items
+};
+
+static ExprItem *push_item(Parser *p, ExprItemKind kind, AstOperator op, SrcOffset s, AstNode *node) {
+    if (p->item_count == p->item_cap) {
+        size_t cap = p->item_cap ? p->item_cap * 2 : FRAMES_FIRST;
+        ExprItem *grown = (ExprItem *)realloc(p->items, cap * sizeof(ExprItem));
+        if (!grown) {
+            parse_abandon(p);
+            return NULL;
+        }
+        p->items = grown;
+        p->item_cap = cap;
+    }
+    ExprItem *it = &p->items[p->item_count++];
+    it->kind = kind;
+    it->op = op;
+    it->s = s;
+    it->saved = 0;
+    it->node = node;
+    return it;
+}
+
+static ExprItem *top_item(Parser *p, size_t base) {
+    return p->item_count > base ? &p->items[p->item_count - 1] : NULL;
+}
+
+// The `)` closing the arguments of `call`; 0 if it is missing, which ends
+// the suffixes.
+static int close_call(Parser *p, AstNode *call) {
+    Token rparen = peek_tok(p);
+    if (!is_punct(&rparen, PUNCT_RPAREN)) {
+        // keep the call, with what was parsed of its arguments
+        astvec_push(&((CallExpression *)call->data)->arguments, syntax_error(p, "ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen)));
+        call->end = pos_start(&rparen);
+        return 0;
+    }
+    next_tok(p);
+    call->end = pos_end(&rparen);
+    return 1;
+}
 
+// Postfix suffixes of *expr: member access, calls, postfix ++/--. Returns
+// X_ASSIGNMENT once a `[` or an argument list opens, X_UNARY when the
+// suffixes end, or X_START if the parse was abandoned.
+static int parse_suffixes(Parser *p, AstNode **expr) {
     for (;;) {
-        Token t = peek_tok(p);
+        const Token *look = peek_nth(p, 0);
+        if (look->type != TOKEN_PUNCTUATOR) return X_UNARY;
+        Token t = *look;
 
         // member access: obj.prop
-        if (is_punct(&t, ".")) {
+        if (is_punct(&t, PUNCT_DOT)) {
             next_tok(p);
             Token prop = next_tok(p);
             if (prop.type != TOKEN_IDENTIFIER) {
-                AstNode *err = ast_error("ExpectedIdentifier", pos_start(&prop), pos_end(&prop));
-                token_free(&prop);
-                return err;
+                *expr = syntax_error(p, "ExpectedIdentifier", pos_start(&prop), pos_end(&prop));
+                return X_UNARY;
             }
-            AstNode *prop_node = ast_identifier(prop.lexeme, pos_start(&prop), pos_end(&prop));
-            Position s = expr->start;
-            Position e = prop_node->end;
-            expr = ast_member_expression(expr, prop_node, 0, s, e);
-            token_free(&prop);
+            AstNode *prop_node = ident_node(p, &prop);
+            SrcOffset s = (*expr)->start;
+            SrcOffset e = prop_node->end;
+            *expr = ast_member_expression(*expr, prop_node, 0, s, e);
             continue;
         }
 
         // computed member: obj[expr]
-        if (is_punct(&t, "[")) {
-            next_tok(p);
-            AstNode *index = parse_expression(p);
-            Token close = peek_tok(p);
-            if (!is_punct(&close, "]")) {
-                AstNode *err = ast_error("ExpectedCloseBracket", pos_start(&close), pos_end(&close));
-                return err;
-            }
+        if (is_punct(&t, PUNCT_LBRACKET)) {
             next_tok(p);
-            Position s = expr->start;
-            Position e = pos_end(&close);
-            expr = ast_member_expression(expr, index, 1, s, e);
-            continue;
+            return push_item(p, XI_INDEX, OP_NONE, 0, *expr) ? X_ASSIGNMENT : X_START;
         }
 
         // call expression
-        if (is_punct(&t, "(")) {
+        if (is_punct(&t, PUNCT_LPAREN)) {
             next_tok(p);
-            Position s = expr->start;
-            AstNode *call = ast_call_expression(expr, s, s);
-            CallExpression *ce = (CallExpression *)call->data;
-
+            SrcOffset s = (*expr)->start;
+            AstNode *call = ast_call_expression(*expr, s, s);
             Token arg_first = peek_tok(p);
-            if (!is_punct(&arg_first, ")")) {
-                for (;;) {
-                    AstNode *arg = parse_expression(p);
-                    astvec_push(&ce->arguments, arg);
-                    Token comma = peek_tok(p);
-                    if (!is_punct(&comma, ",")) break;
-                    next_tok(p);
-                }
-            }
-
-            Token rparen = peek_tok(p);
-            if (!is_punct(&rparen, ")")) {
-                AstNode *err = ast_error("ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen));
-                return err;
+            if (!is_punct(&arg_first, PUNCT_RPAREN)) {
+                return push_item(p, XI_ARG, OP_NONE, 0, call) ? X_ASSIGNMENT : X_START;
             }
-            next_tok(p);
-            call->end = pos_end(&rparen);
-            expr = call;
+            *expr = call;
+            if (!close_call(p, call)) return X_UNARY;
             continue;
         }
 
         // postfix ++/--
-        if ((is_punct(&t, "++") || is_punct(&t, "--")) && expr && expr->type == AST_Identifier) {
+        if ((is_punct(&t, PUNCT_INC) || is_punct(&t, PUNCT_DEC)) && *expr && (*expr)->type == AST_Identifier) {
             next_tok(p);
-            Position s = expr->start;
-            Position e = pos_end(&t);
-            expr = ast_update_expression(t.lexeme, 0, expr, s, e);
+            SrcOffset s = (*expr)->start;
+            SrcOffset e = pos_end(&t);
+            *expr = ast_update_expression(tok_op(&t), 0, *expr, s, e);
             continue;
         }
 
-        break;
+        return X_UNARY;
     }
-
-    return expr;
 }
 
-// unary (prefix) including ++/--
-static AstNode *parse_unary(Parser *p) {
-    Token t = peek_tok(p);
-    if (is_punct(&t, "++") || is_punct(&t, "--") || is_punct(&t, "-") || is_punct(&t, "+") || is_punct(&t, "!") || is_keyword(&t, "typeof") || is_keyword(&t, "void") || is_keyword(&t, "delete")) {
+// Close the item on top of p->items with the assignment expression *expr
+// parsed for it; returns the state to go on in.
+static int close_item(Parser *p, AstNode **expr) {
+    ExprItem *it = &p->items[p->item_count - 1];
+    AstNode *inner = *expr;
+    if (it->kind == XI_ARG) {
+        AstNode *call = it->node;
+        astvec_push(&((CallExpression *)call->data)->arguments, inner);
+        if (!p->panic || sync_list(p, PUNCT_RPAREN)) {
+            Token comma = peek_tok(p);
+            if (is_punct(&comma, PUNCT_COMMA)) {
+                next_tok(p);
+                return X_ASSIGNMENT; // the call waits for its next argument
+            }
+        }
+        p->item_count--;
+        *expr = call;
+        return close_call(p, call) ? X_POSTFIX : X_UNARY;
+    }
+    p->item_count--;
+    if (it->kind == XI_PAREN) {
+        p->no_in = it->saved;
+        Token rparen = peek_tok(p);
+        if (!is_punct(&rparen, PUNCT_RPAREN)) {
+            *expr = syntax_error(p, "ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen));
+            return X_POSTFIX;
+        }
         next_tok(p);
-        Position s = pos_start(&t);
-        AstNode *arg = parse_unary(p);
-        Position e = arg->end;
-        AstNode *un = NULL;
-        if (is_punct(&t, "++") || is_punct(&t, "--")) {
-            un = ast_update_expression(t.lexeme, 1, arg, s, e);
-        } else {
-            un = ast_unary_expression(t.lexeme, 1, arg, s, e);
+        inner->start = it->s;
+        inner->end = pos_end(&rparen);
+        return X_POSTFIX;
+    }
+    if (it->kind == XI_INDEX) {
+        Token close = peek_tok(p);
+        if (!is_punct(&close, PUNCT_RBRACKET)) {
+            *expr = syntax_error(p, "ExpectedCloseBracket", pos_start(&close), pos_end(&close));
+            return X_UNARY;
         }
-        token_free(&t);
-        return un;
+        next_tok(p);
+        *expr = ast_member_expression(it->node, inner, 1, it->node->start, pos_end(&close));
+        return X_POSTFIX;
     }
-    return parse_postfix(p);
+    // XI_ASSIGN: prefix and binary items never wait for an assignment expression
+    *expr = ast_assignment_expression(it->op, it->node, inner, it->node->start, inner->end);
+    return X_COMPLETE;
 }
 
-// binary precedence
-static int get_binary_precedence(const char *op) {
-    if (!op) return 0;
-    if (strcmp(op, "*") == 0 || strcmp(op, "/") == 0 || strcmp(op, "%") == 0) return 5;
-    if (strcmp(op, "+") == 0 || strcmp(op, "-") == 0) return 4;
-    if (strcmp(op, "<") == 0 || strcmp(op, ">") == 0 || strcmp(op, "<=") == 0 || strcmp(op, ">=") == 0) return 3;
-    if (strcmp(op, "==") == 0 || strcmp(op, "!=") == 0 || strcmp(op, "===") == 0 || strcmp(op, "!==") == 0) return 3;
-    if (strcmp(op, "&&") == 0) return 2;
-    if (strcmp(op, "||") == 0) return 1;
-    return 0;
+// Apply the prefix operators waiting for *expr, innermost first.
+static void apply_prefixes(Parser *p, size_t base, AstNode **expr) {
+    ExprItem *it;
+    while ((it = top_item(p, base)) != NULL && it->kind == XI_PREFIX) {
+        p->item_count--;
+        AstOperator op = it->op;
+        SrcOffset s = it->s;
+        SrcOffset e = (*expr)->end;
+        if (op == OP_NONE) *expr = ast_await_expression(*expr, s, e);
+        else if (ast_operator_info(op)->flags & OPF_UPDATE) *expr = ast_update_expression(op, 1, *expr, s, e);
+        else *expr = ast_unary_expression(op, 1, *expr, s, e);
+    }
 }
 
-static AstNode *parse_binary_expr(Parser *p, int min_prec) {
-    AstNode *left = parse_unary(p);
+// After the unary expression *expr: a binary operator that takes it as
+// its left operand is pushed (returns X_OPERAND), or the binary items it
+// completes are folded in and an assignment operator may follow.
+static int parse_operator(Parser *p, size_t base, AstNode **expr) {
+    AstOperator op = tok_op(peek_nth(p, 0));
+    const AstOperatorInfo *info = ast_operator_info(op);
+    for (;;) {
+        ExprItem *top = top_item(p, base);
+        int binary = top && top->kind == XI_BINARY;
+        int min_prec = 0;
+        if (binary) {
+            const AstOperatorInfo *left = ast_operator_info(top->op);
+            min_prec = (left->flags & OPF_RIGHT_ASSOC) ? left->precedence : left->precedence + 1;
+        }
+        if (info->precedence > 0 && info->precedence >= min_prec && !(op == OP_IN && p->no_in)) {
+            next_tok(p);
+            return push_item(p, XI_BINARY, op, 0, *expr) ? X_OPERAND : X_START;
+        }
+        if (!binary) break;
+        p->item_count--;
+        AstNode *left = top->node;
+        *expr = ast_binary_expression(top->op, left, *expr, left->start, (*expr)->end);
+    }
 
+    if (info->flags & OPF_ASSIGN) {
+        next_tok(p);
+        return push_item(p, XI_ASSIGN, op, 0, *expr) ? X_ASSIGNMENT : X_START;
+    }
+    return X_COMPLETE;
+}
+
+// An assignment expression, or with f->arg EXPR_PRIMARY a primary one.
+static void parse_expression(Parser *p, ParseFrame *f) {
+    AstNode *expr = p->ret;
+    int at = f->state;
+    if (at == X_START) {
+        f->base = p->item_count;
+        at = f->arg == EXPR_PRIMARY ? X_PRIMARY : X_ASSIGNMENT;
+    }
     for (;;) {
-        Token t = peek_tok(p);
-        if (t.type != TOKEN_PUNCTUATOR && !is_keyword(&t, "in") && !is_keyword(&t, "instanceof")) break;
+        switch (at) {
+        case X_ASSIGNMENT: {
+            int arrow = arrow_ahead(p);
+            if (arrow) {
+                call_child(p, f, X_COMPLETE, parse_arrow_function, arrow);
+                return;
+            }
+            at = X_OPERAND;
+            break;
+        }
+        case X_OPERAND:
+            // a run of prefix operators does not nest: each waits for the operand
+            while (is_prefix_tok(p, peek_nth(p, 0))) {
+                Token t = next_tok(p);
+                if (!push_item(p, XI_PREFIX, tok_op(&t), pos_start(&t), NULL)) return;
+            }
+            at = X_PRIMARY;
+            break;
+        case X_PRIMARY: {
+            const Token *look = peek_nth(p, 0);
+            ParseStep step = primary_production(look);
+            if (step) {
+                call_child(p, f, X_POSTFIX, step, 0);
+                return;
+            }
+            if (is_punct(look, PUNCT_LPAREN)) {
+                Token t = next_tok(p); // consume '('
+                ExprItem *paren = push_item(p, XI_PAREN, OP_NONE, pos_start(&t), NULL);
+                if (!paren) return;
+                paren->saved = p->no_in;
+                p->no_in = 0;
+                at = X_ASSIGNMENT;
+                break;
+            }
+            expr = parse_primary(p);
+            at = X_POSTFIX;
+            break;
+        }
+        case X_POSTFIX:
+            if (f->arg == EXPR_PRIMARY && p->item_count == f->base) {
+                finish_frame(p, expr);
+                return;
+            }
+            at = parse_suffixes(p, &expr);
+            if (at == X_START) return;
+            break;
+        case X_UNARY:
+            apply_prefixes(p, f->base, &expr);
+            at = X_OPERATOR;
+            break;
+        case X_OPERATOR:
+            at = parse_operator(p, f->base, &expr);
+            if (at == X_START) return;
+            break;
+        default: // X_COMPLETE
+            if (p->item_count == f->base) {
+                finish_frame(p, expr);
+                return;
+            }
+            at = close_item(p, &expr);
+            break;
+        }
+    }
+}
 
-        int prec = get_binary_precedence(t.lexeme);
-        if (prec == 0 || prec < min_prec) break; // not a binary operator
+// --- arrow functions -----------------------------------------------------
+// An arrow's head is recognised before any of it is parsed, by peeking
+// through the token ring to the `=>`, so parameters are parsed as binding
+// patterns directly instead of as expressions to be reinterpreted.
 
+static int is_comment_tok(const Token *t) {
+    return t->type == TOKEN_COMMENT_LINE || t->type == TOKEN_COMMENT_BLOCK;
+}
+
+// Lookahead index of the first non-comment token at or after k.
+static size_t skip_comments_ahead(Parser *p, size_t k) {
+    while (is_comment_tok(peek_nth(p, k))) k++;
+    return k;
+}
+
+// Every `(` a scan passes is recorded with whether its own `)` is followed
+// by `=>`, in source order. A `(` nested in one already scanned is then
+// answered from the record, so no token is scanned twice however deeply
+// parenthesised lists nest.
+typedef struct ArrowHead {
+    size_t offset; // of the `(`
+    size_t outer;  // record of the enclosing `(` while scanning
+    int arrow;
+} ArrowHead;
+
+static const ArrowHead *arrow_head_find(const Parser *p, size_t offset) {
+    size_t lo = 0, hi = p->arrow_head_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (p->arrow_heads[mid].offset < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < p->arrow_head_count && p->arrow_heads[lo].offset == offset ? &p->arrow_heads[lo] : NULL;
+}
+
+static int arrow_head_push(Parser *p, size_t offset, size_t outer) {
+    if (p->arrow_head_count == p->arrow_head_cap) {
+        size_t cap = p->arrow_head_cap ? p->arrow_head_cap * 2 : FRAMES_FIRST;
+        ArrowHead *grown = (ArrowHead *)realloc(p->arrow_heads, cap * sizeof(ArrowHead));
+        if (!grown) return 0;
+        p->arrow_heads = grown;
+        p->arrow_head_cap = cap;
+    }
+    ArrowHead *h = &p->arrow_heads[p->arrow_head_count++];
+    h->offset = offset;
+    h->outer = outer;
+    h->arrow = 0; // an unmatched `(` opens no parameter list
+    return 1;
+}
+
+// Whether the `(` at lookahead k opens an arrow parameter list: its
+// matching `)` is followed by `=>`. Only tokens that can begin a parameter
+// list start the scan, so ordinary parenthesised expressions are rejected
+// after a token or two.
+static int arrow_params_ahead(Parser *p, size_t k) {
+    size_t i = skip_comments_ahead(p, k + 1);
+    const Token *t = peek_nth(p, i);
+    if (t->type == TOKEN_IDENTIFIER) {
+        const Token *after = peek_nth(p, skip_comments_ahead(p, i + 1));
+        if (!is_punct(after, PUNCT_COMMA) && !is_punct(after, PUNCT_RPAREN) && !is_punct(after, PUNCT_ASSIGN)) return 0;
+    } else if (!is_punct(t, PUNCT_RPAREN) && !is_punct(t, PUNCT_ELLIPSIS) &&
+               !is_punct(t, PUNCT_LBRACE) && !is_punct(t, PUNCT_LBRACKET)) {
+        return 0;
+    }
+    const ArrowHead *seen = arrow_head_find(p, peek_nth(p, k)->offset);
+    if (seen) return seen->arrow;
+    p->arrow_head_count = 0;
+    int record = 1;
+    size_t depth = 0, open = 0;
+    for (i = k;; ++i) {
+        t = peek_nth(p, i);
+        if (t->type == TOKEN_EOF) return 0;
+        if (is_punct(t, PUNCT_LPAREN)) {
+            depth++;
+            if (record && !arrow_head_push(p, t->offset, open)) {
+                p->arrow_head_count = 0; // out of memory: scan without the record
+                record = 0;
+            }
+            if (record) open = p->arrow_head_count - 1;
+        } else if (is_punct(t, PUNCT_RPAREN)) {
+            int arrow = is_punct(peek_nth(p, skip_comments_ahead(p, i + 1)), PUNCT_ARROW);
+            if (record) {
+                p->arrow_heads[open].arrow = arrow;
+                open = p->arrow_heads[open].outer;
+            }
+            if (--depth == 0) return arrow;
+        }
+    }
+}
+
+// 0 when no arrow function starts here, 1 for a plain and 2 for an async
+// one.
+static int arrow_ahead(Parser *p) {
+    size_t i = skip_comments_ahead(p, 0);
+    const Token *t = peek_nth(p, i);
+    if (is_punct(t, PUNCT_LPAREN)) return arrow_params_ahead(p, i);
+    if (t->type != TOKEN_IDENTIFIER) return 0;
+    size_t j = skip_comments_ahead(p, i + 1);
+    const Token *u = peek_nth(p, j);
+    if (is_punct(u, PUNCT_ARROW)) return 1;
+    if (!is_keyword(t, KW_ASYNC) || t->escaped) return 0;
+    if (is_punct(u, PUNCT_LPAREN)) return arrow_params_ahead(p, j) ? 2 : 0;
+    if (u->type == TOKEN_IDENTIFIER && is_punct(peek_nth(p, skip_comments_ahead(p, j + 1)), PUNCT_ARROW)) return 2;
+    return 0;
+}
+
+static void skip_comments(Parser *p) {
+    while (is_comment_tok(peek_nth(p, 0))) {
+        Token ct = next_tok(p);
+        record_comment(p, &ct);
+    }
+}
+
+// `...target`
+static void parse_rest_element(Parser *p, ParseFrame *f) {
+    if (f->state == 0) {
+        Token dots = next_tok(p);
+        f->s = pos_start(&dots);
+        skip_comments(p);
+        Token t = peek_tok(p);
+        if (t.type != TOKEN_IDENTIFIER) {
+            call_child(p, f, 1, parse_binding_element, 0);
+            return;
+        }
         next_tok(p);
-        AstNode *right = parse_binary_expr(p, prec + 1);
-        Position s = left->start;
-        Position e = right->end;
-        left = ast_binary_expression(t.lexeme, left, right, s, e);
-        token_free(&t);
+        p->ret = ident_node(p, &t);
     }
+    AstNode *arg = p->ret;
+    finish_frame(p, ast_rest_element(arg, f->s, arg->end));
+}
 
-    return left;
+// After an element of a binding pattern closed by `close`: 1 once the `,`
+// before the next one is consumed, 0 at the closer, -1 after reporting a
+// missing `,` as `kind`.
+static int next_pattern_element(Parser *p, AstVec *items, PunctId close, const char *kind) {
+    skip_comments(p);
+    Token sep = peek_tok(p);
+    if (is_punct(&sep, close)) return 0;
+    if (!is_punct(&sep, PUNCT_COMMA)) {
+        astvec_push(items, syntax_error(p, kind, pos_start(&sep), pos_end(&sep)));
+        return -1;
+    }
+    next_tok(p);
+    return 1;
 }
 
-// assignment expression
-static int is_assign_op(Token *t) {
-    return is_punct(t, "=") || is_punct(t, "+=") || is_punct(t, "-=") ||
-           is_punct(t, "*=") || is_punct(t, "/=") || is_punct(t, "%=");
+static AstNode *pattern_property(AstNode *key, AstNode *value) {
+    AstNode *prop = ast_property(key, value, 0);
+    prop->start = key->start;
+    prop->end = value->end;
+    return prop;
 }
 
-static AstNode *parse_assignment(Parser *p) {
-    AstNode *left = parse_binary_expr(p, 0);
+// States of parse_object_pattern, by the element just parsed.
+enum { OBJECT_PATTERN_REST = 1, OBJECT_PATTERN_VALUE, OBJECT_PATTERN_DEFAULT };
 
-    Token t = peek_tok(p);
-    
-    // Check for arrow function: identifier => or (params) =>
-    if (is_punct(&t, "=>")) {
-        next_tok(p); // consume '=>'
-        Position s = left->start;
-        
-        // Parse arrow function body
-        Token body_peek = peek_tok(p);
-        AstNode *body = NULL;
-        if (is_punct(&body_peek, "{")) {
-            // Block body
-            body = parse_block(p);
-        } else {
-            // Expression body
-            body = parse_assignment(p);
+// `{ a, b: c, d = 1, ...rest }`; shorthand properties get a value node of
+// their own, so the key and the binding are never shared.
+static void parse_object_pattern(Parser *p, ParseFrame *f) {
+    int more = 1;
+    if (f->state == 0) {
+        Token lbrace = next_tok(p);
+        f->node = ast_object_pattern(pos_start(&lbrace), pos_end(&lbrace));
+    } else {
+        AstNode *item = p->ret;
+        if (f->state == OBJECT_PATTERN_DEFAULT) item = ast_assignment_pattern(f->b, item, f->b->start, item->end);
+        if (f->state != OBJECT_PATTERN_REST) item = pattern_property(f->a, item);
+        ObjectPattern *op = (ObjectPattern *)f->node->data;
+        astvec_push(&op->properties, item);
+        more = next_pattern_element(p, &op->properties, PUNCT_RBRACE, "ExpectedCommaOrCloseBrace");
+    }
+    AstNode *pat = f->node;
+    ObjectPattern *op = (ObjectPattern *)pat->data;
+    while (more > 0) {
+        skip_comments(p);
+        Token t = peek_tok(p);
+        if (is_punct(&t, PUNCT_RBRACE)) {
+            more = 0;
+            break;
         }
-        
-        Position e = body ? body->end : pos_end(&t);
-        AstNode *arrow = ast_arrow_function_expression(0, s, e);
-        ArrowFunctionExpression *afe = (ArrowFunctionExpression *)arrow->data;
-        
-        // Handle parameters
-        // If left is an identifier, it's a single param
-        if (left && left->type == AST_Identifier) {
-            astvec_push(&afe->params, left);
+        if (is_punct(&t, PUNCT_ELLIPSIS)) {
+            call_child(p, f, OBJECT_PATTERN_REST, parse_rest_element, 0);
+            return;
+        } else if (t.type == TOKEN_IDENTIFIER || t.type == TOKEN_STRING) {
+            next_tok(p);
+            AstNode *key = t.type == TOKEN_STRING ? string_node(p, &t) : ident_node(p, &t);
+            AstNode *value;
+            Token sep = peek_tok(p);
+            if (is_punct(&sep, PUNCT_COLON)) {
+                next_tok(p);
+                skip_comments(p);
+                f->a = key;
+                call_child(p, f, OBJECT_PATTERN_VALUE, parse_binding_element, 0);
+                return;
+            } else if (t.type == TOKEN_IDENTIFIER) {
+                value = ident_node(p, &t);
+                if (is_punct(&sep, PUNCT_ASSIGN)) {
+                    next_tok(p);
+                    f->a = key;
+                    f->b = value;
+                    call_child(p, f, OBJECT_PATTERN_DEFAULT, parse_expression, 0);
+                    return;
+                }
+            } else {
+                value = syntax_error(p, "ExpectedColon", pos_start(&sep), pos_end(&sep));
+            }
+            astvec_push(&op->properties, pattern_property(key, value));
         } else {
-            // TODO: Handle multiple params from parenthesized list
-            // For now, just add the expression as-is
-            if (left) astvec_push(&afe->params, left);
+            astvec_push(&op->properties, syntax_error(p, "ExpectedPropertyKey", pos_start(&t), pos_end(&t)));
+            more = -1;
+            break;
         }
-        
-        afe->body = body;
-        token_free(&t);
-        return arrow;
+        more = next_pattern_element(p, &op->properties, PUNCT_RBRACE, "ExpectedCommaOrCloseBrace");
     }
-    
-    if (is_assign_op(&t)) {
-        next_tok(p);
-        AstNode *right = parse_assignment(p);
-        Position s = left->start;
-        Position e = right->end;
-        AstNode *assign = ast_assignment_expression(t.lexeme, left, right, s, e);
-        token_free(&t);
-        return assign;
+    if (more == 0) {
+        Token rbrace = next_tok(p);
+        pat->end = pos_end(&rbrace);
     }
+    finish_frame(p, pat);
+}
 
-    return left;
+// `[a, , b = 1, ...rest]`; holes are NULL elements.
+static void parse_array_pattern(Parser *p, ParseFrame *f) {
+    int more = 1;
+    if (f->state == 0) {
+        Token lbracket = next_tok(p);
+        f->node = ast_array_pattern(pos_start(&lbracket), pos_end(&lbracket));
+    } else {
+        ArrayPattern *ap = (ArrayPattern *)f->node->data;
+        astvec_push(&ap->elements, p->ret);
+        more = next_pattern_element(p, &ap->elements, PUNCT_RBRACKET, "ExpectedCommaOrCloseBracket");
+    }
+    AstNode *pat = f->node;
+    ArrayPattern *ap = (ArrayPattern *)pat->data;
+    while (more > 0) {
+        skip_comments(p);
+        Token t = peek_tok(p);
+        if (is_punct(&t, PUNCT_RBRACKET)) {
+            more = 0;
+            break;
+        }
+        if (is_punct(&t, PUNCT_COMMA)) {
+            astvec_push(&ap->elements, NULL);
+            next_tok(p);
+            continue;
+        }
+        call_child(p, f, 1, is_punct(&t, PUNCT_ELLIPSIS) ? parse_rest_element : parse_binding_element, 0);
+        return;
+    }
+    if (more == 0) {
+        Token rbracket = next_tok(p);
+        pat->end = pos_end(&rbracket);
+    }
+    finish_frame(p, pat);
 }
 
-static AstNode *parse_expression(Parser *p) {
-    return parse_assignment(p);
+// A binding target with an optional `= default`.
+static void parse_binding_element(Parser *p, ParseFrame *f) {
+    switch (f->state) {
+    case 0: {
+        Token t = peek_tok(p);
+        if (is_punct(&t, PUNCT_LBRACE)) {
+            call_child(p, f, 1, parse_object_pattern, 0);
+            return;
+        }
+        if (is_punct(&t, PUNCT_LBRACKET)) {
+            call_child(p, f, 1, parse_array_pattern, 0);
+            return;
+        }
+        next_tok(p);
+        if (t.type != TOKEN_IDENTIFIER) {
+            finish_frame(p, syntax_error(p, "ExpectedParam", pos_start(&t), pos_end(&t)));
+            return;
+        }
+        p->ret = ident_node(p, &t);
+    }
+    // fallthrough
+    case 1: {
+        AstNode *target = f->a = p->ret;
+        skip_comments(p);
+        Token eq = peek_tok(p);
+        if (!is_punct(&eq, PUNCT_ASSIGN)) {
+            finish_frame(p, target);
+            return;
+        }
+        next_tok(p);
+        call_child(p, f, 2, parse_expression, 0);
+        return;
+    }
+    default: {
+        AstNode *target = f->a, *init = p->ret;
+        finish_frame(p, ast_assignment_pattern(target, init, target->start, init->end));
+    }
+    }
 }
 
-static AstNode *parse_variable_declaration(Parser *p, VarKind kind) {
-    AstNode *decl = ast_variable_declaration(kind);
-    VariableDeclaration *vd = (VariableDeclaration *)decl->data;
+// `=>` and the body of the arrow function f->node.
+static void parse_arrow_body(Parser *p, ParseFrame *f) {
+    skip_comments(p);
+    Token arrow_tok = next_tok(p); // '=>'
+    f->e = pos_end(&arrow_tok);
+
+    f->saved = p->in_async;
+    p->in_async = f->arg == 2;
+    skip_comments(p);
+    Token body_peek = peek_tok(p);
+    if (is_punct(&body_peek, PUNCT_LBRACE)) call_child(p, f, 2, parse_function_body, 0);
+    else call_child(p, f, 3, parse_expression, 0);
+}
 
-    Token t = peek_tok(p);
-    if (t.type != TOKEN_IDENTIFIER) {
-        AstNode *err = ast_error("ExpectedIdentifier", pos_start(&t), pos_end(&t));
-        astvec_push(&vd->declarations, err);
-        return decl;
+// Called where arrow_ahead() reported an arrow (f->arg 2: async), so the
+// head is known to be well formed up to its `=>`.
+static void parse_arrow_function(Parser *p, ParseFrame *f) {
+    ArrowFunctionExpression *afe = f->node ? (ArrowFunctionExpression *)f->node->data : NULL;
+    switch (f->state) {
+    case 0: {
+        skip_comments(p);
+        Token first = peek_tok(p);
+        SrcOffset s = pos_start(&first);
+        if (f->arg == 2) {
+            next_tok(p); // 'async'
+            skip_comments(p);
+        }
+        f->node = ast_arrow_function_expression(f->arg == 2, s, s);
+        afe = (ArrowFunctionExpression *)f->node->data;
+        Token t = next_tok(p);
+        if (t.type == TOKEN_IDENTIFIER) {
+            astvec_push(&afe->params, ident_node(p, &t));
+            parse_arrow_body(p, f);
+            return;
+        }
+        break;
     }
-    Token idt = next_tok(p);
-    AstNode *id = ast_identifier(idt.lexeme, pos_start(&idt), pos_end(&idt));
-    token_free(&idt);
-
-    AstNode *init = NULL;
+    case 1: { // a parameter
+        astvec_push(&afe->params, p->ret);
+        skip_comments(p);
+        Token sep = peek_tok(p);
+        if (is_punct(&sep, PUNCT_COMMA)) {
+            next_tok(p);
+            break;
+        }
+        skip_comments(p);
+        Token rparen = next_tok(p);
+        if (!is_punct(&rparen, PUNCT_RPAREN)) {
+            astvec_push(&afe->params, syntax_error(p, "ExpectedCloseParen", pos_start(&rparen), pos_end(&rparen)));
+        }
+        parse_arrow_body(p, f);
+        return;
+    }
+    default: { // the body
+        AstNode *arrow = f->node, *body = p->ret;
+        if (f->state == 2) {
+            BlockStatement *bs = p->lazy_functions && body->type == AST_BlockStatement ? (BlockStatement *)body->data : NULL;
+            if (bs && bs->lazy_source) bs->lazy_async = f->arg == 2;
+        }
+        p->in_async = f->saved;
+        afe->body = body;
+        arrow->end = body ? body->end : f->e;
+        finish_frame(p, arrow);
+        return;
+    }
+    }
+    // the next parameter, or the end of the list
+    skip_comments(p);
     Token pt = peek_tok(p);
-    if (is_punct(&pt, "=")) {
+    if (is_punct(&pt, PUNCT_RPAREN)) {
         next_tok(p);
-        init = parse_expression(p);
+        parse_arrow_body(p, f);
+        return;
+    }
+    call_child(p, f, 1, is_punct(&pt, PUNCT_ELLIPSIS) ? parse_rest_element : parse_binding_element, 0);
+}
+
+// f->arg is the VarKind; the declaration's keyword is next.
+static void parse_variable_declaration(Parser *p, ParseFrame *f) {
+    if (f->state == 0) {
+        Token kw = next_tok(p);
+        AstNode *decl = ast_variable_declaration((VarKind)f->arg);
+        VariableDeclaration *vd = (VariableDeclaration *)decl->data;
+        decl->start = pos_start(&kw);
+
+        Token t = peek_tok(p);
+        if (t.type != TOKEN_IDENTIFIER) {
+            AstNode *err = syntax_error(p, "ExpectedIdentifier", pos_start(&t), pos_end(&t));
+            astvec_push(&vd->declarations, err);
+            decl->end = err->end;
+            finish_frame(p, decl);
+            return;
+        }
+        Token idt = next_tok(p);
+        f->node = decl;
+        f->a = ident_node(p, &idt);
+
+        Token pt = peek_tok(p);
+        if (is_punct(&pt, PUNCT_ASSIGN)) {
+            next_tok(p);
+            call_child(p, f, 1, parse_expression, 0);
+            return;
+        }
+        p->ret = NULL;
     }
+    AstNode *decl = f->node, *id = f->a, *init = p->ret;
+    VariableDeclaration *vd = (VariableDeclaration *)decl->data;
 
     AstNode *vdtr = ast_variable_declarator(id, init);
+    vdtr->start = id->start;
+    vdtr->end = init ? init->end : id->end;
     astvec_push(&vd->declarations, vdtr);
+    decl->end = vdtr->end;
 
     Token semi = peek_tok(p);
-    if (is_punct(&semi, ";")) { next_tok(p); }
-    return decl;
+    if (is_punct(&semi, PUNCT_SEMICOLON)) { next_tok(p); decl->end = pos_end(&semi); }
+    finish_frame(p, decl);
 }
 
 // Phase 2: Modern Features
 
-static AstNode *parse_template_literal(Parser *p) {
-    Token backtick = next_tok(p); // consume template token
-    Position s = pos_start(&backtick);
-    AstNode *tl_node = ast_template_literal(s, pos_end(&backtick));
-    TemplateLiteral *tl = (TemplateLiteral *)tl_node->data;
-
-    // Extract template string content (removing backticks)
-    if (backtick.lexeme) {
-        const char *lex = backtick.lexeme;
-        size_t len = strlen(lex);
-        if (len >= 2 && lex[0] == '`' && lex[len-1] == '`') {
-            // Extract content between backticks
-            size_t content_len = len - 2;
-            char *content = (char *)malloc(content_len + 1);
-            if (content) {
-                memcpy(content, lex + 1, content_len);
-                content[content_len] = '\0';
-                
-                // For now, create a single template element with the whole content
-                // TODO: Parse ${expression} interpolations
-                AstNode *elem = ast_template_element(content, 1, s, pos_end(&backtick));
-                astvec_push(&tl->quasis, elem);
-                free(content);
-            }
-        }
-    }
-    
-    token_free(&backtick);
-    return tl_node;
-// Arrow function parser (currently not used, reserved for future implementation)
-#ifdef ENABLE_ARROW_FUNCTION_PARSING
+// One quasi: the text between the chunk's delimiters (` or } before, ` or
+// ${ after).
+static AstNode *template_element_node(Parser *p, Token *t, int tail) {
+    if (p->syntax_only) return ast_template_element(NULL, tail, pos_start(t), pos_end(t));
+    const char *lex = token_text(&p->lx, t);
+    size_t close = tail ? 1 : 2;
+    size_t len = t->length >= 1 + close ? t->length - 1 - close : 0;
+    char *raw = (char *)malloc(len + 1);
+    if (!raw) return NULL;
+    memcpy(raw, lex + 1, len);
+    raw[len] = '\0';
+    AstNode *elem = ast_template_element(raw, tail, pos_start(t), pos_end(t));
+    free(raw);
+    TemplateElement *te = elem ? (TemplateElement *)elem->data : NULL;
+    if (te) te->cooked = cook_body(lex + 1, len, t->escaped, &te->cooked_length);
+    return elem;
 }
 
-static AstNode *parse_arrow_function(Parser *p, AstNode *param_or_params) {
-    // param_or_params is the parsed left side (single identifier or paren-enclosed list)
-    // Now we expect '=>' and then the body
-    Position s = param_or_params ? param_or_params->start : p->lx.pos > 0 ? ((Position){1, 1}) : ((Position){0, 0});
-    
-    // Consume '=>'
-    Token arrow = peek_tok(p);
-    if (!is_punct(&arrow, "=>")) {
-        return param_or_params; // Not an arrow function, return the expr as-is
-    }
-    next_tok(p);
-
-    // Parse body
-    Token next = peek_tok(p);
-    AstNode *body = NULL;
-    if (is_punct(&next, "{")) {
-        body = parse_block(p);
+// The lexer splits templates at their substitutions: a whole `...` token,
+// or a head `...${, middles }...${ and a tail }...` around expressions.
+static void parse_template_literal(Parser *p, ParseFrame *f) {
+    if (f->state == 0) {
+        Token head = next_tok(p);
+        SrcOffset s = pos_start(&head);
+        f->node = ast_template_literal(s, pos_end(&head));
+        TemplateLiteral *tl = (TemplateLiteral *)f->node->data;
+        if (head.type == TOKEN_TEMPLATE) {
+            astvec_push(&tl->quasis, template_element_node(p, &head, 1));
+            finish_frame(p, f->node);
+            return;
+        }
+        astvec_push(&tl->quasis, template_element_node(p, &head, 0));
     } else {
-        // Expression body
-        body = parse_assignment(p);
-    }
-
-    AstNode *arrow_fn = ast_arrow_function_expression(0, s, body ? body->end : pos_end(&arrow));
-    ArrowFunctionExpression *afe = (ArrowFunctionExpression *)arrow_fn->data;
-    
-    // Extract params from param_or_params
-    if (param_or_params && param_or_params->type == AST_Identifier) {
-        astvec_push(&afe->params, param_or_params);
-    } else if (param_or_params) {
-        // Could be from array pattern or other pattern
-        astvec_push(&afe->params, param_or_params);
+        // a substitution
+        AstNode *tl_node = f->node;
+        TemplateLiteral *tl = (TemplateLiteral *)tl_node->data;
+        p->in_template--;
+        astvec_push(&tl->expressions, p->ret);
+        Token chunk = peek_tok(p);
+        if (chunk.type != TOKEN_TEMPLATE_MIDDLE && chunk.type != TOKEN_TEMPLATE_TAIL) {
+            AstNode *err = syntax_error(p, "ExpectedTemplateContinuation", pos_start(&chunk), pos_end(&chunk));
+            astvec_push(&tl->expressions, err);
+            tl_node->end = pos_end(&chunk);
+            finish_frame(p, tl_node);
+            return;
+        }
+        next_tok(p);
+        int tail = chunk.type == TOKEN_TEMPLATE_TAIL;
+        astvec_push(&tl->quasis, template_element_node(p, &chunk, tail));
+        tl_node->end = pos_end(&chunk);
+        if (tail) {
+            finish_frame(p, tl_node);
+            return;
+        }
     }
-    
-    afe->body = body;
-    return arrow_fn;
-#endif
+    p->in_template++;
+    call_child(p, f, 1, parse_expression, 0);
 }
 
-static AstNode *parse_class(Parser *p, int is_decl) {
-    Token class_tok = next_tok(p); // consume 'class'
-    Position s = pos_start(&class_tok);
+// f->arg: a declaration, whose name is required
+static void parse_class(Parser *p, ParseFrame *f) {
+    if (f->state == 0) {
+        Token class_tok = next_tok(p); // consume 'class'
+        f->s = pos_start(&class_tok);
 
-    Token name_tok = peek_tok(p);
-    AstNode *class_id = NULL;
-    if (name_tok.type == TOKEN_IDENTIFIER) {
-        class_id = ast_identifier(name_tok.lexeme, pos_start(&name_tok), pos_end(&name_tok));
-        next_tok(p);
-    } else if (is_decl) {
-        return ast_error("ExpectedClassName", s, s);
-    }
+        Token name_tok = peek_tok(p);
+        if (name_tok.type == TOKEN_IDENTIFIER) {
+            f->a = ident_node(p, &name_tok);
+            next_tok(p);
+        } else if (f->arg) {
+            finish_frame(p, expected(p, "ExpectedClassName"));
+            return;
+        }
 
-    AstNode *super_class = NULL;
-    Token look = peek_tok(p);
-    if (is_keyword(&look, "extends")) {
-        next_tok(p); // consume 'extends'
-        super_class = parse_primary(p);
+        Token look = peek_tok(p);
+        if (is_keyword(&look, KW_EXTENDS)) {
+            next_tok(p); // consume 'extends'
+            call_child(p, f, 1, parse_expression, EXPR_PRIMARY);
+            return;
+        }
+        p->ret = NULL;
     }
+    AstNode *class_id = f->a, *super_class = p->ret;
+    SrcOffset s = f->s;
 
-    if (!expect_punct(p, "{", NULL)) {
-        return ast_error("ExpectedClassBody", s, s);
+    if (!expect_punct(p, PUNCT_LBRACE, NULL)) {
+        finish_frame(p, expected(p, "ExpectedClassBody"));
+        return;
     }
 
-    AstNode *class_node = is_decl ? ast_class_declaration(class_id, super_class, s, s)
-                                   : ast_class_expression(class_id, super_class, s, s);
+    AstNode *class_node = f->arg ? ast_class_declaration(class_id, super_class, s, s)
+                                 : ast_class_expression(class_id, super_class, s, s);
     
-    // Parse class body methods
+    // For now, skip method parsing - simplified, up to the matching brace
+    size_t depth = 0;
     for (;;) {
         Token t = peek_tok(p);
-        if (is_punct(&t, "}")) {
+        if (is_punct(&t, PUNCT_RBRACE) && depth == 0) {
             next_tok(p);
             class_node->end = pos_end(&t);
             break;
         }
-        // For now, skip method parsing - simplified
+        if (t.type == TOKEN_EOF) {
+            expected(p, "ExpectedCloseBrace");
+            break;
+        }
+        if (is_punct(&t, PUNCT_LBRACE)) depth++;
+        else if (is_punct(&t, PUNCT_RBRACE)) depth--;
         next_tok(p);
     }
 
-    token_free(&class_tok);
-    if (name_tok.type == TOKEN_IDENTIFIER) token_free(&name_tok);
-    return class_node;
+    finish_frame(p, class_node);
+}
+
+// Production of the statement starting with t, with its argument in *arg;
+// NULL for an expression statement.
+static ParseStep statement_production(const Token *t, int *arg) {
+    *arg = 0;
+    if (is_punct(t, PUNCT_LBRACE)) return parse_block;
+    if (t->type != TOKEN_IDENTIFIER) return NULL;
+    switch (t->kw) {
+    case KW_IF: return parse_if;
+    case KW_WHILE: return parse_while;
+    case KW_DO: return parse_do_while;
+    case KW_FOR: return parse_for;
+    case KW_SWITCH: return parse_switch;
+    case KW_TRY: return parse_try;
+    case KW_THROW: return parse_throw;
+    case KW_FUNCTION: *arg = 1; return parse_function;
+    case KW_CLASS: *arg = 1; return parse_class;
+    case KW_EXPORT: return parse_export;
+    case KW_RETURN: return parse_return;
+    case KW_VAR: *arg = VD_Var; return parse_variable_declaration;
+    case KW_LET: *arg = VD_Let; return parse_variable_declaration;
+    case KW_CONST: *arg = VD_Const; return parse_variable_declaration;
+    default: return NULL;
+    }
+}
+
+// Tokens a statement may leave buffered past its end; more means its
+// parse depended on text beyond the next statement.
+#define STATEMENT_LOOKAHEAD 2
+
+// End of the statement begun in f: resynchronise if it contained a syntax
+// error; a bad statement always consumes at least one token.
+static void statement_done(Parser *p, ParseFrame *f, AstNode *stmt) {
+    if (p->panic) {
+        Token t = peek_tok(p);
+        if (t.offset == f->base && t.type != TOKEN_EOF && !(is_punct(&t, PUNCT_RBRACE) && p->block_depth > 0)) next_tok(p);
+        sync_statement(p);
+    }
+    // an arrow scan over unbalanced brackets looked past the statement
+    if (p->ahead_count > STATEMENT_LOOKAHEAD) mark_tangled(p);
+    finish_frame(p, stmt);
 }
 
-static AstNode *parse_statement(Parser *p) {
+// A statement; NULL at the end of the input.
+static void parse_statement(Parser *p, ParseFrame *f) {
+    if (f->state == 1) {
+        statement_done(p, f, p->ret);
+        return;
+    }
+    if (f->state == 2) {
+        // an expression statement
+        AstNode *expr = p->ret;
+        Token endt = peek_tok(p);
+        SrcOffset e = pos_start(&endt);
+        if (is_punct(&endt, PUNCT_SEMICOLON)) { next_tok(p); endt = peek_tok(p); }
+        statement_done(p, f, ast_expression_statement(expr, f->s, e));
+        return;
+    }
+    f->base = peek_nth(p, 0)->offset;
+    // outside the substitutions being parsed, an open one was left behind
+    // by a syntax error: lexing from here depends on the text before
+    if (p->lx.tmpl_depth > 0 && p->in_template == 0) mark_tangled(p);
+
     Token t = peek_tok(p);
     // skip comments
-    if (t.type == TOKEN_COMMENT_LINE || t.type == TOKEN_COMMENT_BLOCK) {
+    while (t.type == TOKEN_COMMENT_LINE || t.type == TOKEN_COMMENT_BLOCK) {
         Token ct = next_tok(p);
         record_comment(p, &ct);
-        token_free(&ct);
-        return parse_statement(p);
-    }
-
-    if (is_punct(&t, "{")) return parse_block(p);
-    if (is_keyword(&t, "if")) return parse_if(p);
-    if (is_keyword(&t, "while")) return parse_while(p);
-    if (is_keyword(&t, "do")) return parse_do_while(p);
-    if (is_keyword(&t, "for")) return parse_for(p);
-    if (is_keyword(&t, "switch")) return parse_switch(p);
-    if (is_keyword(&t, "try")) return parse_try(p);
-    if (is_keyword(&t, "throw")) return parse_throw(p);
-    if (is_keyword(&t, "function")) return parse_function(p, 1);
-    if (is_keyword(&t, "class")) return parse_class(p, 1);
-    if (is_keyword(&t, "import")) return parse_import(p);
-    if (is_keyword(&t, "export")) return parse_export(p);
-    if (is_keyword(&t, "return")) return parse_return(p);
-    if (is_keyword(&t, "break")) return parse_break(p);
-    if (is_keyword(&t, "continue")) return parse_continue(p);
-    if (is_keyword(&t, "var")) { next_tok(p); return parse_variable_declaration(p, VD_Var); }
-    if (is_keyword(&t, "let")) { next_tok(p); return parse_variable_declaration(p, VD_Let); }
-    if (is_keyword(&t, "const")) { next_tok(p); return parse_variable_declaration(p, VD_Const); }
-    if (t.type == TOKEN_EOF) { return NULL; }
-
-    Position s = pos_start(&t);
-    AstNode *expr = parse_expression(p);
-    Token endt = peek_tok(p);
-    Position e = pos_start(&endt);
-    if (is_punct(&endt, ";")) { next_tok(p); endt = peek_tok(p); }
-    AstNode *stmt = ast_expression_statement(expr, s, e);
-    return stmt;
+        t = peek_tok(p);
+    }
+
+    int arg;
+    ParseStep step = statement_production(&t, &arg);
+    if (step) {
+        call_child(p, f, 1, step, arg);
+        return;
+    }
+    if (t.type == TOKEN_IDENTIFIER) {
+        switch (t.kw) {
+        case KW_IMPORT: statement_done(p, f, parse_import(p)); return;
+        case KW_BREAK: statement_done(p, f, parse_break(p)); return;
+        case KW_CONTINUE: statement_done(p, f, parse_continue(p)); return;
+        default: break;
+        }
+    }
+    if (t.type == TOKEN_EOF) {
+        statement_done(p, f, NULL);
+        return;
+    }
+
+    f->s = pos_start(&t);
+    call_child(p, f, 2, parse_expression, 0);
 }
 
+// The tree is built in its own arena, handed to the Program, so freeing
+// it is a handful of slab frees instead of a walk over every node.
 AstNode *parse_program(Parser *p) {
+    AstArena *arena = ast_arena_new();
+    AstArena *prev = ast_arena_use(arena);
     AstNode *prog = ast_program();
     Program *pr = (Program *)prog->data;
+    pr->owns_arena = arena != NULL;
+    ast_arena_set_owner(arena, pr);
     p->comment_sink = pr;
+    line_index_build(&pr->lines, p->lx.input, p->lx.length);
     for (;;) {
         Token t = peek_tok(p);
         if (t.type == TOKEN_COMMENT_LINE || t.type == TOKEN_COMMENT_BLOCK) {
             Token ct = next_tok(p);
             record_comment(p, &ct);
-            token_free(&ct);
             continue;
         }
         if (t.type == TOKEN_EOF) { break; }
-        AstNode *stmt = parse_statement(p);
+        AstNode *stmt = run_frames(p, parse_statement, 0, NULL);
         if (!stmt) break;
         astvec_push(&pr->body, stmt);
     }
+    parser_release(p);
+    ast_arena_use(prev);
+    pr->lazy_bodies = p->lazy_functions;
+    // a pre-lexed stream hides the template state from mark_tangled
+    if (!p->tokens) pr->parsed_bytes = ast_arena_bytes(arena);
     return prog;
 }
+
+size_t parse_check(Parser *p, Diagnostic *diags, size_t cap) {
+    p->diags = diags;
+    p->diag_cap = diags ? cap : 0;
+    AstArena *scratch = ast_arena_new_scratch();
+    if (!scratch) {
+        // no scratch arena: a full parse answers as well
+        AstNode *prog = parse_program(p);
+        Program *pr = prog ? (Program *)prog->data : NULL;
+        for (size_t i = 0; pr && i < pr->diagnostic_count && i < p->diag_cap; ++i) diags[i] = pr->diagnostics[i];
+        ast_free(prog);
+        return p->error_count;
+    }
+    AstArena *prev = ast_arena_use(scratch);
+    p->comment_sink = NULL;
+    p->lazy_functions = 0;
+    p->syntax_only = 1;
+    p->scratch = scratch;
+    AstArenaMark m = statements_mark(p);
+    for (;;) {
+        const Token *t = peek_nth(p, 0);
+        if (is_comment_tok(t)) { next_tok(p); continue; }
+        statements_rewind(p, m);
+        if (t->type == TOKEN_EOF || !run_frames(p, parse_statement, 0, NULL)) break;
+    }
+    p->syntax_only = 0;
+    p->scratch = NULL;
+    parser_release(p);
+    ast_arena_use(prev);
+    ast_arena_free(scratch);
+    return p->error_count;
+}
+
+// --- incremental reparsing -----------------------------------------------
+// An edit is reparsed inside the innermost block (or the Program) whose
+// braces it leaves alone: from the start of the statement before the one
+// it begins in, until the parse reaches the start of an old statement past
+// the edit or the block's `}`. From such a statement on, both parses see
+// the same bytes in the same state, so the old statements are kept. If the
+// `}` turns up anywhere but where it was, the edit changed the block's
+// structure and the next enclosing block is tried instead. Statements a
+// syntax error tied to their neighbours (Program.tangled, on either side
+// of the edit) make it a full parse. The tree is
+// updated in place: the new statements replace the old ones, which stay
+// behind in the arena, and the kept nodes past the edit move by its length
+// change.
+
+// Past this multiple of its size after parse_program, the arena holds
+// enough replaced statements that a full parse is due.
+#define EDIT_GARBAGE_FACTOR 2
+
+// Child pointers of a node.
+typedef struct {
+    AstNode **one[4];
+    size_t one_count;
+    AstVec *many[2];
+    size_t many_count;
+} ChildSlots;
+
+static void add_one(ChildSlots *cs, AstNode **slot) {
+    cs->one[cs->one_count++] = slot;
+}
+
+static void add_many(ChildSlots *cs, AstVec *v) {
+    cs->many[cs->many_count++] = v;
+}
+
+static void child_slots(AstNode *n, ChildSlots *cs) {
+    cs->one_count = 0;
+    cs->many_count = 0;
+    void *d = n->data;
+    if (!d) return;
+    switch (n->type) {
+    case AST_Program: add_many(cs, &((Program *)d)->body); break;
+    case AST_VariableDeclaration: add_many(cs, &((VariableDeclaration *)d)->declarations); break;
+    case AST_VariableDeclarator: add_one(cs, &((VariableDeclarator *)d)->id); add_one(cs, &((VariableDeclarator *)d)->init); break;
+    case AST_ExpressionStatement: add_one(cs, &((ExpressionStatement *)d)->expression); break;
+    case AST_UpdateExpression: add_one(cs, &((UpdateExpression *)d)->argument); break;
+    case AST_BinaryExpression: add_one(cs, &((BinaryExpression *)d)->left); add_one(cs, &((BinaryExpression *)d)->right); break;
+    case AST_AssignmentExpression: add_one(cs, &((AssignmentExpression *)d)->left); add_one(cs, &((AssignmentExpression *)d)->right); break;
+    case AST_UnaryExpression: add_one(cs, &((UnaryExpression *)d)->argument); break;
+    case AST_ObjectExpression: add_many(cs, &((ObjectExpression *)d)->properties); break;
+    case AST_Property: add_one(cs, &((Property *)d)->key); add_one(cs, &((Property *)d)->value); break;
+    case AST_ArrayExpression: add_many(cs, &((ArrayExpression *)d)->elements); break;
+    case AST_MemberExpression: add_one(cs, &((MemberExpression *)d)->object); add_one(cs, &((MemberExpression *)d)->property); break;
+    case AST_CallExpression: add_one(cs, &((CallExpression *)d)->callee); add_many(cs, &((CallExpression *)d)->arguments); break;
+    case AST_FunctionDeclaration:
+    case AST_FunctionExpression: add_many(cs, &((FunctionBody *)d)->params); add_one(cs, &((FunctionBody *)d)->body); break;
+    case AST_BlockStatement: add_many(cs, &((BlockStatement *)d)->body); break;
+    case AST_IfStatement: {
+        IfStatement *s = (IfStatement *)d;
+        add_one(cs, &s->test); add_one(cs, &s->consequent); add_one(cs, &s->alternate);
+        break;
+    }
+    case AST_WhileStatement: add_one(cs, &((WhileStatement *)d)->test); add_one(cs, &((WhileStatement *)d)->body); break;
+    case AST_DoWhileStatement: add_one(cs, &((DoWhileStatement *)d)->body); add_one(cs, &((DoWhileStatement *)d)->test); break;
+    case AST_ForStatement: {
+        ForStatement *s = (ForStatement *)d;
+        add_one(cs, &s->init); add_one(cs, &s->test); add_one(cs, &s->update); add_one(cs, &s->body);
+        break;
+    }
+    case AST_SwitchStatement: add_one(cs, &((SwitchStatement *)d)->discriminant); add_many(cs, &((SwitchStatement *)d)->cases); break;
+    case AST_SwitchCase: add_one(cs, &((SwitchCase *)d)->test); add_many(cs, &((SwitchCase *)d)->consequent); break;
+    case AST_TryStatement: {
+        TryStatement *s = (TryStatement *)d;
+        add_one(cs, &s->block); add_many(cs, &s->handlers); add_one(cs, &s->finalizer);
+        break;
+    }
+    case AST_CatchClause: add_one(cs, &((CatchClause *)d)->param); add_one(cs, &((CatchClause *)d)->body); break;
+    case AST_ThrowStatement: add_one(cs, &((ThrowStatement *)d)->argument); break;
+    case AST_ReturnStatement: add_one(cs, &((ReturnStatement *)d)->argument); break;
+    case AST_ImportDeclaration: add_many(cs, &((ImportDeclaration *)d)->specifiers); break;
+    case AST_ImportSpecifier: add_one(cs, &((ImportSpecifier *)d)->imported); add_one(cs, &((ImportSpecifier *)d)->local); break;
+    case AST_ImportDefaultSpecifier: add_one(cs, &((ImportDefaultSpecifier *)d)->local); break;
+    case AST_ImportNamespaceSpecifier: add_one(cs, &((ImportNamespaceSpecifier *)d)->local); break;
+    case AST_ExportNamedDeclaration:
+        add_many(cs, &((ExportNamedDeclaration *)d)->specifiers); add_one(cs, &((ExportNamedDeclaration *)d)->declaration);
+        break;
+    case AST_ExportDefaultDeclaration:
+        add_one(cs, &((ExportDefaultDeclaration *)d)->declaration); add_one(cs, &((ExportDefaultDeclaration *)d)->expression);
+        break;
+    case AST_ArrowFunctionExpression:
+        add_many(cs, &((ArrowFunctionExpression *)d)->params); add_one(cs, &((ArrowFunctionExpression *)d)->body);
+        break;
+    case AST_TemplateLiteral: add_many(cs, &((TemplateLiteral *)d)->quasis); add_many(cs, &((TemplateLiteral *)d)->expressions); break;
+    case AST_SpreadElement: add_one(cs, &((SpreadElement *)d)->argument); break;
+    case AST_ObjectPattern: add_many(cs, &((ObjectPattern *)d)->properties); break;
+    case AST_ArrayPattern: add_many(cs, &((ArrayPattern *)d)->elements); break;
+    case AST_AssignmentPattern: add_one(cs, &((AssignmentPattern *)d)->left); add_one(cs, &((AssignmentPattern *)d)->right); break;
+    case AST_RestElement: add_one(cs, &((RestElement *)d)->argument); break;
+    case AST_ForOfStatement: {
+        ForOfStatement *s = (ForOfStatement *)d;
+        add_one(cs, &s->left); add_one(cs, &s->right); add_one(cs, &s->body);
+        break;
+    }
+    case AST_ForInStatement: {
+        ForInStatement *s = (ForInStatement *)d;
+        add_one(cs, &s->left); add_one(cs, &s->right); add_one(cs, &s->body);
+        break;
+    }
+    case AST_ClassDeclaration: {
+        ClassDeclaration *c = (ClassDeclaration *)d;
+        add_one(cs, &c->id); add_one(cs, &c->superClass); add_many(cs, &c->body);
+        break;
+    }
+    case AST_ClassExpression: {
+        ClassExpression *c = (ClassExpression *)d;
+        add_one(cs, &c->id); add_one(cs, &c->superClass); add_many(cs, &c->body);
+        break;
+    }
+    case AST_MethodDefinition: {
+        MethodDefinition *m = (MethodDefinition *)d;
+        add_one(cs, &m->key); add_many(cs, &m->params); add_one(cs, &m->value);
+        break;
+    }
+    case AST_AwaitExpression: add_one(cs, &((AwaitExpression *)d)->argument); break;
+    case AST_YieldExpression: add_one(cs, &((YieldExpression *)d)->argument); break;
+    default: break;
+    }
+}
+
+static int covers(const AstNode *n, SrcOffset s, SrcOffset e) {
+    return n && n->start != SRC_OFFSET_NONE && n->end != SRC_OFFSET_NONE && n->start <= s && e <= n->end;
+}
+
+// Number of statements of `list` that start before `offset`.
+static size_t statements_before(const AstVec *list, SrcOffset offset) {
+    size_t lo = 0, hi = list->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (list->items[mid]->start < offset) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// The child of `n` whose range holds [s, e], NULL if none does.
+static AstNode *covering_child(AstNode *n, SrcOffset s, SrcOffset e) {
+    ChildSlots cs;
+    child_slots(n, &cs);
+    for (size_t i = 0; i < cs.one_count; ++i) {
+        if (covers(*cs.one[i], s, e)) return *cs.one[i];
+    }
+    for (size_t i = 0; i < cs.many_count; ++i) {
+        const AstVec *v = cs.many[i];
+        if (n->type == AST_BlockStatement || n->type == AST_Program) {
+            size_t k = statements_before(v, s + 1);
+            if (k > 0 && covers(v->items[k - 1], s, e)) return v->items[k - 1];
+            continue;
+        }
+        for (size_t k = 0; k < v->count; ++k) {
+            if (covers(v->items[k], s, e)) return v->items[k];
+        }
+    }
+    return NULL;
+}
+
+typedef struct {
+    AstNode *block; // BlockStatement whose statements are reparsed, NULL for the Program's
+    int in_async;   // `await` is an operator in it (async arrow body)
+} EditScope;
+
+// Blocks holding the edit with both braces untouched, outermost first.
+// Blocks inside template substitutions are left out: the lexer cannot
+// restart within one. NULL with *count 0 if there are none.
+static EditScope *enclosing_blocks(AstNode *program, SrcOffset s, SrcOffset e, size_t *count) {
+    EditScope *out = NULL;
+    size_t cap = 0;
+    *count = 0;
+    int in_async = 0;
+    for (AstNode *n = covering_child(program, s, e); n && n->type != AST_TemplateLiteral; n = covering_child(n, s, e)) {
+        if (n->type == AST_ArrowFunctionExpression) in_async = ((ArrowFunctionExpression *)n->data)->is_async;
+        else if (n->type == AST_FunctionDeclaration || n->type == AST_FunctionExpression) in_async = 0;
+        if (n->type != AST_BlockStatement || n->start >= s || e >= n->end) continue;
+        if (*count == cap) {
+            size_t next = cap ? cap * 2 : 8;
+            EditScope *grown = (EditScope *)realloc(out, next * sizeof(EditScope));
+            if (!grown) break;
+            out = grown;
+            cap = next;
+        }
+        out[*count].block = n;
+        out[*count].in_async = in_async;
+        (*count)++;
+        if (((BlockStatement *)n->data)->lazy_source) break; // nothing parsed inside
+    }
+    return out;
+}
+
+// Old source range [start, end) a reparse replaced, and the statements of
+// `list` parsed from it: [first, first + removed). list is NULL when a
+// skipped body was only brace-matched again.
+typedef struct {
+    AstVec *list;
+    size_t first;
+    size_t removed;
+    SrcOffset start;
+    SrcOffset end;
+    int to_close; // ran up to the scope's `}` or the end: errors reported there are the region's too
+} EditRegion;
+
+static int has_diagnostic_at(const Program *pr, SrcOffset offset) {
+    size_t lo = 0, hi = pr->diagnostic_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (pr->diagnostics[mid].start < offset) lo = mid + 1; else hi = mid;
+    }
+    return lo < pr->diagnostic_count && pr->diagnostics[lo].start == offset;
+}
+
+// Whether parsing from `stmt` reproduces it: an Error node carries the
+// error's range, not where its parse began, and an error reported at its
+// start may be the previous statement's.
+static int reparse_anchor(const Program *pr, const AstNode *stmt) {
+    return stmt->type != AST_Error && stmt->start != SRC_OFFSET_NONE && !has_diagnostic_at(pr, stmt->start);
+}
+
+static void parser_seek(Parser *p, size_t pos) {
+    ahead_release(p);
+    p->lx.pos = pos;
+    p->lx.tmpl_depth = 0;
+    p->in_template = 0;
+    p->panic = 0;
+    p->no_in = 0;
+}
+
+// Reparse the region of `scope` around the edit into `out`; 0 if the
+// scope's closing brace moved.
+static int reparse_region(Parser *p, AstNode *program, const EditScope *scope, TextEdit edit, size_t old_length,
+                          AstVec *out, EditRegion *r) {
+    SrcOffset old_end = (SrcOffset)(edit.offset + edit.removed);
+    SrcOffset new_end = (SrcOffset)(edit.offset + edit.inserted);
+    AstNode *block = scope->block;
+    BlockStatement *bs = block ? (BlockStatement *)block->data : NULL;
+    p->in_async = scope->in_async;
+    p->block_depth = block ? 1 : 0;
+    if (bs && bs->lazy_source) {
+        // still a skipped body: match its braces again
+        parser_seek(p, block->start);
+        AstNode *again = skip_function_body(p);
+        r->list = NULL;
+        r->first = r->removed = 0;
+        r->start = block->start;
+        r->end = block->end;
+        r->to_close = 1;
+        return again && again->type == AST_BlockStatement && again->end == block->end - old_end + new_end;
+    }
+    Program *pr = (Program *)program->data;
+    AstVec *list = bs ? &bs->body : &pr->body;
+    SrcOffset list_start = block ? block->start + 1 : 0;
+    SrcOffset list_end = block ? block->end - 1 : (SrcOffset)old_length; // its `}` or the end
+    // from the statement before the one the edit begins in: how that one
+    // ends may depend on the first token of the next
+    size_t before = statements_before(list, (SrcOffset)edit.offset);
+    size_t first = before >= 2 ? before - 2 : 0;
+    while (first > 0 && !reparse_anchor(pr, list->items[first])) first--;
+    SrcOffset start = first < before && reparse_anchor(pr, list->items[first]) ? list->items[first]->start : list_start;
+    size_t k = statements_before(list, old_end);
+    int resumed = 0;
+    parser_seek(p, start);
+    for (;;) {
+        const Token *t = peek_nth(p, 0);
+        if (is_comment_tok(t)) { Token ct = next_tok(p); record_comment(p, &ct); continue; }
+        if (t->type == TOKEN_EOF || (block && is_punct(t, PUNCT_RBRACE))) break;
+        // the old statements past the edit were lexed outside any template
+        if (t->offset >= new_end && p->lx.tmpl_depth == 0) {
+            size_t old_off = t->offset - new_end + old_end;
+            while (k < list->count && list->items[k]->start < old_off) k++;
+            if (k < list->count && list->items[k]->start == old_off && reparse_anchor(pr, list->items[k])) {
+                resumed = 1;
+                break;
+            }
+        }
+        AstNode *stmt = run_frames(p, parse_statement, 0, NULL);
+        if (!stmt) break;
+        astvec_push(out, stmt);
+    }
+    if (!resumed && block) {
+        const Token *t = peek_nth(p, 0);
+        if (!is_punct(t, PUNCT_RBRACE) || t->offset != (size_t)list_end - old_end + new_end) return 0;
+    }
+    r->list = list;
+    r->first = first;
+    r->removed = (resumed ? k : list->count) - first;
+    r->start = start;
+    r->end = resumed ? list->items[k]->start : list_end;
+    r->to_close = !resumed;
+    return 1;
+}
+
+// Move the offsets at or past the end of the replaced text by the edit's
+// length change and point skipped bodies at the new source. Subtrees that
+// end before the edit are passed over unless they may hold skipped bodies.
+static int shift_tree(AstNode *program, TextEdit edit, const char *input, size_t length) {
+    Program *pr = (Program *)program->data;
+    SrcOffset old_end = (SrcOffset)(edit.offset + edit.removed);
+    SrcOffset delta = (SrcOffset)(edit.inserted - edit.removed); // wraps for shrinking edits
+    AstNode **stack = NULL;
+    size_t count = 0, cap = 0;
+    int rc = 0;
+    ChildSlots cs;
+    AstNode *n = program;
+    for (;;) {
+        child_slots(n, &cs);
+        size_t need = count + cs.one_count;
+        for (size_t i = 0; i < cs.many_count; ++i) need += cs.many[i]->count;
+        if (need > cap) {
+            size_t next = cap ? cap * 2 : 256;
+            while (next < need) next *= 2;
+            AstNode **grown = (AstNode **)realloc(stack, next * sizeof(AstNode *));
+            if (!grown) { rc = -1; break; }
+            stack = grown;
+            cap = next;
+        }
+        for (size_t i = 0; i < cs.one_count; ++i) stack[count++] = *cs.one[i];
+        for (size_t i = 0; i < cs.many_count; ++i) {
+            if (cs.many[i]->count) memcpy(stack + count, cs.many[i]->items, cs.many[i]->count * sizeof(AstNode *));
+            count += cs.many[i]->count;
+        }
+        for (n = NULL; count > 0 && !n;) {
+            n = stack[--count];
+            if (!n || (n->end < edit.offset && !pr->lazy_bodies)) { n = NULL; continue; }
+            if (n->start != SRC_OFFSET_NONE && n->start >= old_end) n->start += delta;
+            if (n->end != SRC_OFFSET_NONE && n->end >= old_end) n->end += delta;
+            BlockStatement *bs = n->type == AST_BlockStatement ? (BlockStatement *)n->data : NULL;
+            if (bs && bs->lazy_source) {
+                bs->lazy_source = input;
+                bs->lazy_length = length;
+            }
+        }
+        if (!n) break;
+    }
+    free(stack);
+    return rc;
+}
+
+// Replace elements [at, at + removed) of the array *items of *count
+// `size`-byte elements by add[0, n). Arena arrays that outgrow *cap move
+// to a fresh block, heap ones are reallocated. Returns 0 on success, -1
+// on allocation failure.
+static int splice_array(AstArena *arena, void **items, size_t size, size_t *count, size_t *cap, size_t at,
+                        size_t removed, const void *add, size_t n) {
+    size_t total = *count - removed + n;
+    char *base = (char *)*items;
+    if (total > *cap) {
+        size_t next = *cap ? *cap : 4;
+        while (next < total) next *= 2;
+        char *grown = (char *)(arena ? ast_arena_alloc(arena, next * size) : realloc(base, next * size));
+        if (!grown) return -1;
+        if (arena && *count) memcpy(grown, base, *count * size);
+        base = grown;
+        *cap = next;
+    }
+    if (*count > at + removed) memmove(base + (at + n) * size, base + (at + removed) * size, (*count - at - removed) * size);
+    if (n) memcpy(base + at * size, add, n * size);
+    *count = total;
+    *items = base;
+    return 0;
+}
+
+// Comments and diagnostics of the replaced range give way to the ones the
+// reparse recorded in `sink`; later ones move.
+static int splice_records(Program *pr, const Program *sink, const EditRegion *r, SrcOffset delta) {
+    size_t c0 = 0, c1;
+    while (c0 < pr->comment_count && pr->comments[c0]->start < r->start) c0++;
+    for (c1 = c0; c1 < pr->comment_count && pr->comments[c1]->start < r->end; ++c1) {}
+    for (size_t i = c1; i < pr->comment_count; ++i) {
+        pr->comments[i]->start += delta;
+        pr->comments[i]->end += delta;
+    }
+    void *comments = pr->comments;
+    if (splice_array(pr->arena, &comments, sizeof(Comment *), &pr->comment_count, &pr->comment_capacity, c0, c1 - c0,
+                     sink->comments, sink->comment_count) != 0)
+        return -1;
+    pr->comments = (Comment **)comments;
+    size_t d0 = 0, d1;
+    while (d0 < pr->diagnostic_count && pr->diagnostics[d0].start < r->start) d0++;
+    for (d1 = d0; d1 < pr->diagnostic_count; ++d1) {
+        SrcOffset at = pr->diagnostics[d1].start;
+        if (at > r->end || (at == r->end && !r->to_close)) break;
+    }
+    for (size_t i = d1; i < pr->diagnostic_count; ++i) {
+        pr->diagnostics[i].start += delta;
+        pr->diagnostics[i].end += delta;
+    }
+    void *diags = pr->diagnostics;
+    if (splice_array(pr->arena, &diags, sizeof(Diagnostic), &pr->diagnostic_count, &pr->diagnostic_capacity, d0,
+                     d1 - d0, sink->diagnostics, sink->diagnostic_count) != 0)
+        return -1;
+    pr->diagnostics = (Diagnostic *)diags;
+    return 0;
+}
+
+static AstNode *parse_program_again(Parser *p, AstNode *program) {
+    int lazy = p->lazy_functions;
+    ast_free(program);
+    parser_init(p, p->lx.input, p->lx.length);
+    p->lazy_functions = lazy;
+    return parse_program(p);
+}
+
+AstNode *parse_program_edit(Parser *p, AstNode *program, TextEdit edit) {
+    Program *pr = program && program->type == AST_Program ? (Program *)program->data : NULL;
+    size_t length = p->lx.length;
+    size_t old_length = pr ? pr->lines.length : 0;
+    int in_place = pr && pr->owns_arena && pr->parsed_bytes && !pr->tangled && pr->lines.count > 0 &&
+                   program->refcount == 1 &&
+                   ast_arena_refs(pr->arena) == 1 &&
+                   ast_arena_bytes(pr->arena) <= pr->parsed_bytes * EDIT_GARBAGE_FACTOR &&
+                   length < UINT32_MAX && edit.offset + edit.removed <= old_length &&
+                   old_length - edit.removed + edit.inserted == length;
+    if (!in_place) return parse_program_again(p, program);
+    if (edit.removed == 0 && edit.inserted == 0) return program;
+
+    SrcOffset s = (SrcOffset)edit.offset, e = (SrcOffset)(edit.offset + edit.removed);
+    size_t depth;
+    EditScope *scopes = enclosing_blocks(program, s, e, &depth);
+    AstArena *prev = ast_arena_use(pr->arena);
+    Program sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.arena = pr->arena;
+    AstVec stmts;
+    astvec_init(&stmts);
+    stmts.arena = NULL; // scratch list on the heap
+    EditRegion r = {0};
+    int ok = 0;
+    p->tokens = NULL;
+    p->comment_sink = &sink;
+    // innermost block first, the Program's statements last
+    for (size_t i = depth + 1; i-- > 0 && !ok;) {
+        EditScope scope = {NULL, 0};
+        if (i > 0) scope = scopes[i - 1];
+        sink.comment_count = 0;
+        sink.diagnostic_count = 0;
+        sink.tangled = 0;
+        stmts.count = 0;
+        ok = reparse_region(p, program, &scope, edit, old_length, &stmts, &r) && !sink.tangled;
+    }
+    p->comment_sink = pr;
+    parser_release(p);
+    free(scopes);
+
+    SrcOffset delta = (SrcOffset)(edit.inserted - edit.removed);
+    ok = ok && shift_tree(program, edit, p->lx.input, length) == 0 && splice_records(pr, &sink, &r, delta) == 0 &&
+         line_index_edit(&pr->lines, p->lx.input, length, edit) == 0;
+    if (ok && r.list) {
+        void *items = r.list->items;
+        ok = splice_array(r.list->arena, &items, sizeof(AstNode *), &r.list->count, &r.list->capacity, r.first, r.removed,
+                          stmts.items, stmts.count) == 0;
+        r.list->items = (AstNode **)items;
+    }
+    free(stmts.items);
+    ast_arena_use(prev);
+    if (!ok) return parse_program_again(p, program);
+    pr->lazy_bodies |= p->lazy_functions;
+    return program;
+}
@@ -108,6 +108,7 @@ static AstNode *traverse_with_plugin(AstNode *node, Plugin *plugin, PluginContex
             break;
         }
         case AST_BlockStatement: {
+            ast_materialize_body(result);
             BlockStatement *block = (BlockStatement *)result->data;
             for (size_t i = 0; i < block->body.count; i++) {
                 AstNode *child = traverse_with_plugin(block->body.items[i], plugin, ctx);
@@ -234,18 +235,31 @@ Plugin *plugin_remove_debugger(void) {
 typedef struct {
     const char *old_name;
     const char *new_name;
+    unsigned long long arena; // serial of the arena old_atom was looked up in
+    Atom old_atom;
 } RenameData;
 
+static int is_renamed(RenameData *data, const AstNode *node, const Identifier *id) {
+    if (!node->arena || id->atom == ATOM_NONE) {
+        return id->name && strcmp(id->name, data->old_name) == 0;
+    }
+    // interned names: one lookup per arena, then integer compares. The
+    // arena is told apart by serial: a later tree may get a freed one's address.
+    if (ast_arena_serial(node->arena) != data->arena) {
+        data->arena = ast_arena_serial(node->arena);
+        data->old_atom = atom_lookup(ast_arena_atoms(node->arena), data->old_name, strlen(data->old_name));
+    }
+    return id->atom == data->old_atom && data->old_atom != ATOM_NONE;
+}
+
 static AstNode *rename_identifier_visitor(AstNode *node, void *context) {
     PluginContext *ctx = (PluginContext *)context;
     RenameData *data = (RenameData *)ctx->userdata;
     
     if (node->type == AST_Identifier) {
         Identifier *id = (Identifier *)node->data;
-        if (id->name && strcmp(id->name, data->old_name) == 0) {
-            // Create a copy with new name
-            free(id->name);
-            id->name = strdup(data->new_name);
+        if (id && is_renamed(data, node, id)) {
+            ast_identifier_set_name(node, data->new_name);
         }
     }
     
@@ -261,6 +275,8 @@ Plugin *plugin_rename_identifier(const char *old_name, const char *new_name) {
     
     data.old_name = old_name;
     data.new_name = new_name;
+    data.arena = 0;
+    data.old_atom = ATOM_NONE;
     
     p.visit_identifier = rename_identifier_visitor;
     p.userdata = &data;
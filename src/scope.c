@@ -8,12 +8,12 @@ struct ScopeMapEntry {
     Scope *scope;
 };
 
-static int pos_cmp(Position a, Position b) {
-    if (a.line < b.line) return -1;
-    if (a.line > b.line) return 1;
-    if (a.column < b.column) return -1;
-    if (a.column > b.column) return 1;
-    return 0;
+// line index of the Program the scope tree was built from, if any
+static const LineIndex *scope_lines(const Scope *s) {
+    while (s && s->parent) s = s->parent;
+    if (s && s->lines) return s->lines;
+    if (!s || !s->node || s->node->type != AST_Program || !s->node->data) return NULL;
+    return &((const Program *)s->node->data)->lines;
 }
 
 static void bindingvec_push(BindingVec *v, Binding *b) {
@@ -77,18 +77,8 @@ void scope_manager_init(ScopeManager *sm) {
     sm->map = NULL;
     sm->map_count = 0;
     sm->map_capacity = 0;
-}
-
-static void free_binding(Binding *b) {
-    if (!b) return;
-    free(b->name);
-    free(b);
-}
-
-static void free_reference(Reference *r) {
-    if (!r) return;
-    free(r->name);
-    free(r);
+    sm->atoms = NULL;
+    sm->owns_atoms = 0;
 }
 
 static void free_scope(Scope *s) {
@@ -96,8 +86,8 @@ static void free_scope(Scope *s) {
     for (size_t i = 0; i < s->children.count; ++i) {
         free_scope(s->children.items[i]);
     }
-    for (size_t i = 0; i < s->bindings.count; ++i) free_binding(s->bindings.items[i]);
-    for (size_t i = 0; i < s->references.count; ++i) free_reference(s->references.items[i]);
+    for (size_t i = 0; i < s->bindings.count; ++i) free(s->bindings.items[i]);
+    for (size_t i = 0; i < s->references.count; ++i) free(s->references.items[i]);
     free(s->children.items);
     free(s->bindings.items);
     free(s->references.items);
@@ -112,15 +102,9 @@ void scope_manager_free(ScopeManager *sm) {
     sm->map = NULL;
     sm->map_count = 0;
     sm->map_capacity = 0;
-}
-
-static char *dup_name(const char *name) {
-    if (!name) return NULL;
-    size_t len = strlen(name);
-    char *n = (char *)malloc(len + 1);
-    if (!n) return NULL;
-    memcpy(n, name, len + 1);
-    return n;
+    if (sm->owns_atoms) atom_table_free(sm->atoms);
+    sm->atoms = NULL;
+    sm->owns_atoms = 0;
 }
 
 static Scope *new_scope(ScopeManager *sm, ScopeType type, Scope *parent, const AstNode *node) {
@@ -153,6 +137,23 @@ Binding *scope_resolve(Scope *scope, const char *name) {
     return NULL;
 }
 
+Binding *scope_lookup_local_atom(Scope *scope, Atom atom) {
+    if (!scope || atom == ATOM_NONE) return NULL;
+    for (size_t i = 0; i < scope->bindings.count; ++i) {
+        Binding *b = scope->bindings.items[i];
+        if (b && b->atom == atom) return b;
+    }
+    return NULL;
+}
+
+Binding *scope_resolve_atom(Scope *scope, Atom atom) {
+    for (Scope *s = scope; s; s = s->parent) {
+        Binding *b = scope_lookup_local_atom(s, atom);
+        if (b) return b;
+    }
+    return NULL;
+}
+
 Scope *scope_of_node(const ScopeManager *sm, const AstNode *node) {
     return map_lookup(sm, node);
 }
@@ -166,12 +167,13 @@ static BindingKind var_kind_to_binding(VarKind k) {
     }
 }
 
-static Binding *add_binding(Scope *scope, BindingKind kind, const char *name, const AstNode *node, Position loc) {
-    if (!scope || !name) return NULL;
-    Binding *outer = scope ? scope_resolve(scope->parent, name) : NULL;
+static Binding *add_binding(ScopeManager *sm, Scope *scope, BindingKind kind, Atom atom, const AstNode *node, SrcOffset loc) {
+    if (!scope || atom == ATOM_NONE) return NULL;
+    Binding *outer = scope_resolve_atom(scope->parent, atom);
     Binding *b = (Binding *)calloc(1, sizeof(Binding));
     if (!b) return NULL;
-    b->name = dup_name(name);
+    b->name = (char *)atom_name(sm->atoms, atom);
+    b->atom = atom;
     b->kind = kind;
     b->loc = loc;
     b->node = node;
@@ -181,14 +183,15 @@ static Binding *add_binding(Scope *scope, BindingKind kind, const char *name, co
     return b;
 }
 
-static Reference *add_reference(Scope *scope, const char *name, int is_write, const AstNode *node) {
-    if (!scope || !name) return NULL;
+static Reference *add_reference(ScopeManager *sm, Scope *scope, Atom atom, int is_write, const AstNode *node, SrcOffset loc) {
+    if (!scope || atom == ATOM_NONE) return NULL;
     Reference *r = (Reference *)calloc(1, sizeof(Reference));
     if (!r) return NULL;
-    r->name = dup_name(name);
+    r->name = (char *)atom_name(sm->atoms, atom);
+    r->atom = atom;
     r->is_write = is_write;
     r->node = node;
-    r->loc = node ? node->start : (Position){0, 0};
+    r->loc = loc;
     r->scope = scope;
     referencevec_push(&scope->references, r);
     return r;
@@ -209,10 +212,17 @@ static int is_identifier(const AstNode *n) {
     return n && n->type == AST_Identifier;
 }
 
-static const char *identifier_name(const AstNode *n) {
-    if (!n || n->type != AST_Identifier) return NULL;
-    Identifier *id = (Identifier *)n->data;
-    return id ? id->name : NULL;
+static Atom name_atom(ScopeManager *sm, const char *name) {
+    return name ? atom_intern(sm->atoms, name, strlen(name)) : ATOM_NONE;
+}
+
+// Identifiers parsed into the tree's arena already carry an atom of the
+// manager's table; others (heap nodes, foreign arenas) are interned here.
+static Atom identifier_atom(ScopeManager *sm, const AstNode *n) {
+    if (!n || n->type != AST_Identifier || !n->data) return ATOM_NONE;
+    const Identifier *id = (const Identifier *)n->data;
+    if (id->atom != ATOM_NONE && n->arena && ast_arena_atoms(n->arena) == sm->atoms) return id->atom;
+    return name_atom(sm, id->name);
 }
 
 // Forward declarations for the two-pass walk
@@ -246,6 +256,7 @@ static void collect_decls(ScopeManager *sm, Scope *scope, AstNode *node, int all
             if (allow_block_scope) {
                 blk_scope = new_scope(sm, SCOPE_BLOCK, scope, node);
             }
+            ast_materialize_body(node);
             BlockStatement *bs = (BlockStatement *)node->data;
             collect_decls_list(sm, blk_scope, &bs->body);
             break;
@@ -257,9 +268,8 @@ static void collect_decls(ScopeManager *sm, Scope *scope, AstNode *node, int all
                 if (!decl || decl->type != AST_VariableDeclarator) continue;
                 VariableDeclarator *vdt = (VariableDeclarator *)decl->data;
                 AstNode *id = vdt->id;
-                const char *name = identifier_name(id);
                 Scope *target = (vd->kind == VD_Var) ? find_var_scope(scope) : scope;
-                add_binding(target, var_kind_to_binding(vd->kind), name, id, id ? id->start : (Position){0, 0});
+                add_binding(sm, target, var_kind_to_binding(vd->kind), identifier_atom(sm, id), id, id ? id->start : SRC_OFFSET_NONE);
                 if (vdt->init) collect_decls(sm, scope, vdt->init, 1);
             }
             break;
@@ -268,14 +278,13 @@ static void collect_decls(ScopeManager *sm, Scope *scope, AstNode *node, int all
             FunctionBody *fb = (FunctionBody *)node->data;
             Scope *target = find_var_scope(scope);
             if (fb && fb->name) {
-                add_binding(target, BIND_FUNCTION, fb->name, node, node->start);
+                add_binding(sm, target, BIND_FUNCTION, name_atom(sm, fb->name), node, node->start);
             }
             Scope *fn_scope = new_scope(sm, SCOPE_FUNCTION, scope, node);
             if (fb) {
                 for (size_t i = 0; i < fb->params.count; ++i) {
                     AstNode *p = fb->params.items[i];
-                    const char *pname = identifier_name(p);
-                    add_binding(fn_scope, BIND_PARAM, pname, p, p ? p->start : (Position){0, 0});
+                    add_binding(sm, fn_scope, BIND_PARAM, identifier_atom(sm, p), p, p ? p->start : SRC_OFFSET_NONE);
                 }
                 if (fb->body) collect_decls(sm, fn_scope, fb->body, 0);
             }
@@ -285,13 +294,12 @@ static void collect_decls(ScopeManager *sm, Scope *scope, AstNode *node, int all
             FunctionBody *fb = (FunctionBody *)node->data;
             Scope *fn_scope = new_scope(sm, SCOPE_FUNCTION, scope, node);
             if (fb && fb->name && fb->name[0]) {
-                add_binding(fn_scope, BIND_FUNCTION, fb->name, node, node->start);
+                add_binding(sm, fn_scope, BIND_FUNCTION, name_atom(sm, fb->name), node, node->start);
             }
             if (fb) {
                 for (size_t i = 0; i < fb->params.count; ++i) {
                     AstNode *p = fb->params.items[i];
-                    const char *pname = identifier_name(p);
-                    add_binding(fn_scope, BIND_PARAM, pname, p, p ? p->start : (Position){0, 0});
+                    add_binding(sm, fn_scope, BIND_PARAM, identifier_atom(sm, p), p, p ? p->start : SRC_OFFSET_NONE);
                 }
                 if (fb->body) collect_decls(sm, fn_scope, fb->body, 0);
             }
@@ -331,8 +339,7 @@ static void collect_decls(ScopeManager *sm, Scope *scope, AstNode *node, int all
             CatchClause *cc = (CatchClause *)node->data;
             Scope *catch_scope = new_scope(sm, SCOPE_CATCH, scope, node);
             if (cc->param && is_identifier(cc->param)) {
-                const char *name = identifier_name(cc->param);
-                add_binding(catch_scope, BIND_CATCH, name, cc->param, cc->param->start);
+                add_binding(sm, catch_scope, BIND_CATCH, identifier_atom(sm, cc->param), cc->param, cc->param->start);
             }
             if (cc->body) collect_decls(sm, catch_scope, cc->body, 0);
             break;
@@ -343,8 +350,7 @@ static void collect_decls(ScopeManager *sm, Scope *scope, AstNode *node, int all
                 AstNode *spec = id->specifiers.items[i];
                 if (!spec || spec->type != AST_ImportSpecifier) continue;
                 ImportSpecifier *is = (ImportSpecifier *)spec->data;
-                const char *local = identifier_name(is->local);
-                add_binding(scope, BIND_IMPORT, local, is->local, is->local ? is->local->start : (Position){0, 0});
+                add_binding(sm, scope, BIND_IMPORT, identifier_atom(sm, is->local), is->local, is->local ? is->local->start : SRC_OFFSET_NONE);
             }
             break;
         }
@@ -480,28 +486,33 @@ static void collect_decls(ScopeManager *sm, Scope *scope, AstNode *node, int all
 static void maybe_mark_tdz(Reference *ref, Binding *b) {
     if (!ref || !b) return;
     if (b->kind == BIND_LET || b->kind == BIND_CONST || b->kind == BIND_CATCH || b->kind == BIND_IMPORT) {
-        if (b->scope == ref->scope && pos_cmp(ref->loc, b->loc) < 0) {
+        if (b->scope == ref->scope && ref->loc < b->loc) {
             ref->in_tdz = 1;
         }
     }
 }
 
-static void note_identifier_ref(ScopeManager *sm, Scope *scope, AstNode *id_node, int is_write) {
-    if (!id_node || id_node->type != AST_Identifier) return;
-    const char *name = identifier_name(id_node);
-    Reference *ref = add_reference(scope, name, is_write, id_node);
+// Record a reference to `atom` at `loc` and resolve it, declaring an
+// implicit global when nothing binds it.
+static void note_reference(ScopeManager *sm, Scope *scope, Atom atom, int is_write, const AstNode *id_node, SrcOffset loc) {
+    Reference *ref = add_reference(sm, scope, atom, is_write, id_node, loc);
     if (!ref) return;
-    ref->resolved = scope_resolve(scope, name);
+    ref->resolved = scope_resolve_atom(scope, atom);
     if (!ref->resolved && sm && sm->root && sm->root->type == SCOPE_GLOBAL) {
-        Binding *imp = scope_lookup_local(sm->root, name);
+        Binding *imp = scope_lookup_local_atom(sm->root, atom);
         if (!imp) {
-            imp = add_binding(sm->root, BIND_IMPLICIT, name, id_node, ref->loc);
+            imp = add_binding(sm, sm->root, BIND_IMPLICIT, atom, id_node, ref->loc);
         }
         ref->resolved = imp;
     }
     maybe_mark_tdz(ref, ref->resolved);
 }
 
+static void note_identifier_ref(ScopeManager *sm, Scope *scope, AstNode *id_node, int is_write) {
+    if (!id_node || id_node->type != AST_Identifier) return;
+    note_reference(sm, scope, identifier_atom(sm, id_node), is_write, id_node, id_node->start);
+}
+
 static void collect_refs(ScopeManager *sm, Scope *scope, AstNode *node, int allow_block_scope) {
     if (!node || !scope) return;
     Scope *scoped = map_lookup(sm, node);
@@ -699,12 +710,297 @@ int scope_analyze(ScopeManager *sm, AstNode *root, int is_module) {
     if (!sm || !root) return -1;
     scope_manager_free(sm);
     scope_manager_init(sm);
+    sm->atoms = root->arena ? ast_arena_atoms(root->arena) : NULL;
+    if (!sm->atoms) {
+        sm->atoms = atom_table_new();
+        if (!sm->atoms) return -1;
+        sm->owns_atoms = 1;
+    }
     sm->root = new_scope(sm, is_module ? SCOPE_MODULE : SCOPE_GLOBAL, NULL, root);
     collect_decls(sm, sm->root, root, 1);
     collect_refs(sm, sm->root, root, 1);
     return 0;
 }
 
+// ---------------------------------------------------------------------------
+// The same two passes over compact records. Each case mirrors its
+// collect_decls/collect_refs counterpart; node types those recurse into
+// child by child are walked through compact_children().
+
+typedef struct {
+    ScopeManager *sm;
+    const CompactAst *ca;
+    Scope **scope_of; // per record id, the scope it opened
+} CompactWalk;
+
+static void compact_decls(CompactWalk *w, Scope *scope, CompactId id, int allow_block_scope);
+static void compact_refs(CompactWalk *w, Scope *scope, CompactId id, int allow_block_scope);
+
+static Scope *compact_new_scope(CompactWalk *w, ScopeType type, Scope *parent, CompactId id) {
+    Scope *s = new_scope(w->sm, type, parent, NULL);
+    if (s) w->scope_of[id] = s;
+    return s;
+}
+
+static Atom compact_name_atom(CompactWalk *w, uint32_t s) {
+    return name_atom(w->sm, compact_string(w->ca, s));
+}
+
+static Atom compact_identifier_atom(CompactWalk *w, CompactId id) {
+    const CompactNode *r = compact_node(w->ca, id);
+    if (!r || r->type != AST_Identifier) return ATOM_NONE;
+    return compact_name_atom(w, r->a);
+}
+
+static SrcOffset compact_start(CompactWalk *w, CompactId id) {
+    const CompactNode *r = compact_node(w->ca, id);
+    return r ? r->start : SRC_OFFSET_NONE;
+}
+
+static void compact_walk_children(CompactWalk *w, Scope *scope, CompactId id,
+                                  void (*visit)(CompactWalk *, Scope *, CompactId, int)) {
+    CompactId small[16];
+    CompactId *kids = small;
+    size_t n = compact_children(w->ca, id, small, 16);
+    if (n > 16) {
+        kids = (CompactId *)malloc(n * sizeof(CompactId));
+        if (!kids) return;
+        compact_children(w->ca, id, kids, n);
+    }
+    for (size_t i = 0; i < n; ++i) visit(w, scope, kids[i], 1);
+    if (kids != small) free(kids);
+}
+
+static void compact_visit_list(CompactWalk *w, Scope *scope, uint32_t l,
+                               void (*visit)(CompactWalk *, Scope *, CompactId, int)) {
+    uint32_t count;
+    const CompactId *items = compact_list(w->ca, l, &count);
+    for (uint32_t i = 0; i < count; ++i) visit(w, scope, items[i], 1);
+}
+
+static void compact_function_decls(CompactWalk *w, Scope *fn_scope, const CompactNode *r) {
+    uint32_t count;
+    const CompactId *params = compact_list(w->ca, r->b, &count);
+    for (uint32_t i = 0; i < count; ++i) {
+        add_binding(w->sm, fn_scope, BIND_PARAM, compact_identifier_atom(w, params[i]), NULL, compact_start(w, params[i]));
+    }
+    compact_decls(w, fn_scope, r->c, 0);
+}
+
+static void compact_decls(CompactWalk *w, Scope *scope, CompactId id, int allow_block_scope) {
+    const CompactNode *r = compact_node(w->ca, id);
+    if (!r || !scope) return;
+    ScopeManager *sm = w->sm;
+    switch (r->type) {
+        case AST_Program:
+            compact_visit_list(w, scope, r->a, compact_decls);
+            break;
+        case AST_BlockStatement: {
+            Scope *blk_scope = scope;
+            if (allow_block_scope) blk_scope = compact_new_scope(w, SCOPE_BLOCK, scope, id);
+            compact_visit_list(w, blk_scope, r->a, compact_decls);
+            break;
+        }
+        case AST_VariableDeclaration: {
+            uint32_t count;
+            const CompactId *decls = compact_list(w->ca, r->a, &count);
+            Scope *target = (r->kind == VD_Var) ? find_var_scope(scope) : scope;
+            for (uint32_t i = 0; i < count; ++i) {
+                const CompactNode *d = compact_node(w->ca, decls[i]);
+                if (!d || d->type != AST_VariableDeclarator) continue;
+                add_binding(sm, target, var_kind_to_binding((VarKind)r->kind), compact_identifier_atom(w, d->a), NULL, compact_start(w, d->a));
+                compact_decls(w, scope, d->b, 1);
+            }
+            break;
+        }
+        case AST_FunctionDeclaration: {
+            const char *name = compact_string(w->ca, r->a);
+            if (name) add_binding(sm, find_var_scope(scope), BIND_FUNCTION, name_atom(sm, name), NULL, r->start);
+            compact_function_decls(w, compact_new_scope(w, SCOPE_FUNCTION, scope, id), r);
+            break;
+        }
+        case AST_FunctionExpression: {
+            const char *name = compact_string(w->ca, r->a);
+            Scope *fn_scope = compact_new_scope(w, SCOPE_FUNCTION, scope, id);
+            if (name && name[0]) add_binding(sm, fn_scope, BIND_FUNCTION, name_atom(sm, name), NULL, r->start);
+            compact_function_decls(w, fn_scope, r);
+            break;
+        }
+        case AST_ForStatement: {
+            Scope *loop_scope = scope;
+            const CompactNode *init = compact_node(w->ca, r->a);
+            if (init && init->type == AST_VariableDeclaration && (init->kind == VD_Let || init->kind == VD_Const)) {
+                loop_scope = compact_new_scope(w, SCOPE_FOR, scope, id);
+            }
+            compact_walk_children(w, loop_scope, id, compact_decls);
+            break;
+        }
+        case AST_SwitchStatement:
+            compact_walk_children(w, compact_new_scope(w, SCOPE_BLOCK, scope, id), id, compact_decls);
+            break;
+        case AST_SwitchCase:
+            compact_walk_children(w, scope, id, compact_decls);
+            break;
+        case AST_CatchClause: {
+            Scope *catch_scope = compact_new_scope(w, SCOPE_CATCH, scope, id);
+            if (compact_type(w->ca, r->a) == AST_Identifier) {
+                add_binding(sm, catch_scope, BIND_CATCH, compact_identifier_atom(w, r->a), NULL, compact_start(w, r->a));
+            }
+            compact_decls(w, catch_scope, r->b, 0);
+            break;
+        }
+        case AST_ImportDeclaration: {
+            uint32_t count;
+            const CompactId *specs = compact_list(w->ca, r->a, &count);
+            for (uint32_t i = 0; i < count; ++i) {
+                const CompactNode *spec = compact_node(w->ca, specs[i]);
+                if (!spec || spec->type != AST_ImportSpecifier) continue;
+                add_binding(sm, scope, BIND_IMPORT, compact_identifier_atom(w, spec->b), NULL, compact_start(w, spec->b));
+            }
+            break;
+        }
+        case AST_ExportNamedDeclaration:
+            compact_decls(w, scope, r->c, 1);
+            break;
+        case AST_ExportDefaultDeclaration:
+            compact_decls(w, scope, r->a != COMPACT_NONE ? r->a : r->b, 1);
+            break;
+        case AST_Property:
+            if (r->flags & COMPACT_COMPUTED) compact_decls(w, scope, r->a, 1);
+            compact_decls(w, scope, r->b, 1);
+            break;
+        case AST_MemberExpression:
+            compact_decls(w, scope, r->a, 1);
+            if (r->flags & COMPACT_COMPUTED) compact_decls(w, scope, r->b, 1);
+            break;
+        case AST_ExpressionStatement:
+        case AST_UpdateExpression:
+        case AST_BinaryExpression:
+        case AST_AssignmentExpression:
+        case AST_UnaryExpression:
+        case AST_ObjectExpression:
+        case AST_ArrayExpression:
+        case AST_CallExpression:
+        case AST_IfStatement:
+        case AST_WhileStatement:
+        case AST_DoWhileStatement:
+        case AST_TryStatement:
+        case AST_ThrowStatement:
+        case AST_ReturnStatement:
+            compact_walk_children(w, scope, id, compact_decls);
+            break;
+        default:
+            break;
+    }
+}
+
+static void compact_identifier_ref(CompactWalk *w, Scope *scope, CompactId id, int is_write) {
+    const CompactNode *r = compact_node(w->ca, id);
+    if (!r || r->type != AST_Identifier) return;
+    note_reference(w->sm, scope, compact_name_atom(w, r->a), is_write, NULL, r->start);
+}
+
+static void compact_refs(CompactWalk *w, Scope *scope, CompactId id, int allow_block_scope) {
+    (void)allow_block_scope;
+    const CompactNode *r = compact_node(w->ca, id);
+    if (!r || !scope) return;
+    Scope *current = w->scope_of[id] ? w->scope_of[id] : scope;
+    switch (r->type) {
+        case AST_Program:
+        case AST_BlockStatement:
+            compact_visit_list(w, current, r->a, compact_refs);
+            break;
+        case AST_VariableDeclaration: {
+            uint32_t count;
+            const CompactId *decls = compact_list(w->ca, r->a, &count);
+            for (uint32_t i = 0; i < count; ++i) {
+                const CompactNode *d = compact_node(w->ca, decls[i]);
+                if (d && d->type == AST_VariableDeclarator) compact_refs(w, current, d->b, 1);
+            }
+            break;
+        }
+        case AST_FunctionDeclaration:
+        case AST_FunctionExpression:
+            compact_refs(w, current, r->c, 0);
+            break;
+        case AST_CatchClause:
+            compact_refs(w, current, r->b, 0);
+            break;
+        case AST_UpdateExpression:
+            if (compact_type(w->ca, r->a) == AST_Identifier) compact_identifier_ref(w, current, r->a, 1);
+            else compact_refs(w, current, r->a, 1);
+            break;
+        case AST_AssignmentExpression:
+            if (compact_type(w->ca, r->a) == AST_Identifier) compact_identifier_ref(w, current, r->a, 1);
+            else compact_refs(w, current, r->a, 1);
+            compact_refs(w, current, r->b, 1);
+            break;
+        case AST_Property:
+            if (r->flags & COMPACT_COMPUTED) compact_refs(w, current, r->a, 1);
+            compact_refs(w, current, r->b, 1);
+            break;
+        case AST_MemberExpression:
+            compact_refs(w, current, r->a, 1);
+            if (r->flags & COMPACT_COMPUTED) compact_refs(w, current, r->b, 1);
+            break;
+        case AST_ExportNamedDeclaration: {
+            compact_refs(w, current, r->c, 1);
+            uint32_t count;
+            const CompactId *specs = compact_list(w->ca, r->a, &count);
+            for (uint32_t i = 0; i < count; ++i) compact_identifier_ref(w, current, specs[i], 0);
+            break;
+        }
+        case AST_ExportDefaultDeclaration:
+            compact_refs(w, current, r->a, 1);
+            compact_refs(w, current, r->b, 1);
+            break;
+        case AST_Identifier:
+            compact_identifier_ref(w, current, id, 0);
+            break;
+        case AST_ForStatement:
+        case AST_SwitchStatement:
+        case AST_SwitchCase:
+        case AST_ExpressionStatement:
+        case AST_BinaryExpression:
+        case AST_UnaryExpression:
+        case AST_ObjectExpression:
+        case AST_ArrayExpression:
+        case AST_CallExpression:
+        case AST_IfStatement:
+        case AST_WhileStatement:
+        case AST_DoWhileStatement:
+        case AST_TryStatement:
+        case AST_ThrowStatement:
+        case AST_ReturnStatement:
+            compact_walk_children(w, current, id, compact_refs);
+            break;
+        default:
+            break;
+    }
+}
+
+int scope_analyze_compact(ScopeManager *sm, const CompactAst *ca, int is_module) {
+    if (!sm || !ca || !compact_node(ca, ca->root)) return -1;
+    scope_manager_free(sm);
+    scope_manager_init(sm);
+    sm->atoms = atom_table_new();
+    if (!sm->atoms) return -1;
+    sm->owns_atoms = 1;
+    CompactWalk w = { sm, ca, (Scope **)calloc(ca->node_count, sizeof(Scope *)) };
+    if (!w.scope_of) return -1;
+    sm->root = new_scope(sm, is_module ? SCOPE_MODULE : SCOPE_GLOBAL, NULL, NULL);
+    if (!sm->root) {
+        free(w.scope_of);
+        return -1;
+    }
+    w.scope_of[ca->root] = sm->root;
+    if (compact_type(ca, ca->root) == AST_Program) sm->root->lines = &ca->lines;
+    compact_decls(&w, sm->root, ca->root, 1);
+    compact_refs(&w, sm->root, ca->root, 1);
+    free(w.scope_of);
+    return 0;
+}
+
 static const char *scope_name(ScopeType t) {
     switch (t) {
         case SCOPE_GLOBAL: return "Global";
@@ -745,7 +1041,8 @@ static void dump_scope(const Scope *s, int indent) {
     for (size_t i = 0; i < s->bindings.count; ++i) {
         Binding *b = s->bindings.items[i];
         indent_print(indent + 4);
-        printf("%s [%s] @%d:%d\n", b->name ? b->name : "<anon>", binding_name(b->kind), b->loc.line, b->loc.column);
+        Position loc = line_index_position(scope_lines(s), b->loc);
+        printf("%s [%s] @%d:%d\n", b->name ? b->name : "<anon>", binding_name(b->kind), loc.line, loc.column);
     }
 
     indent_print(indent + 2);
@@ -769,56 +1066,57 @@ void scope_dump(const Scope *scope, int indent) {
     dump_scope(scope, indent);
 }
 
-static void print_json_string(const char *s) {
-    if (!s) { printf("null"); return; }
-    putchar('"');
-    for (const char *p = s; *p; ++p) {
-        if (*p == '"' || *p == '\\') putchar('\\');
-        putchar(*p);
-    }
-    putchar('"');
-}
-
-static void print_pos_json(Position p) {
-    printf("{\"line\":%d,\"column\":%d}", p.line, p.column);
+static void print_pos_json(JsonWriter *w, const LineIndex *lines, SrcOffset off) {
+    Position p = line_index_position(lines, off);
+    json_lit(w, "{\"line\":");
+    json_int(w, p.line);
+    json_lit(w, ",\"column\":");
+    json_int(w, p.column);
+    json_char(w, '}');
 }
 
-static void dump_scope_json_rec(const Scope *s) {
-    if (!s) { printf("null"); return; }
-    printf("{\"type\":\"");
-    printf("%s\"", scope_name(s->type));
-    printf(",\"bindings\":[");
+static void dump_scope_json_rec(JsonWriter *w, const Scope *s, const LineIndex *lines) {
+    if (!s) { json_lit(w, "null"); return; }
+    json_lit(w, "{\"type\":\"");
+    json_raw(w, scope_name(s->type), strlen(scope_name(s->type)));
+    json_lit(w, "\",\"bindings\":[");
     for (size_t i = 0; i < s->bindings.count; ++i) {
-        if (i) printf(",");
+        if (i) json_char(w, ',');
         Binding *b = s->bindings.items[i];
-        printf("{\"name\":"); print_json_string(b ? b->name : NULL);
-        printf(",\"kind\":\""); printf("%s\"", b ? binding_name(b->kind) : "binding");
-        printf(",\"loc\":"); print_pos_json(b ? b->loc : (Position){0,0});
-        printf(",\"shadowed\":");
-        if (b && b->shadowed && b->shadowed->name) print_json_string(b->shadowed->name); else printf("null");
-        printf("}");
-    }
-    printf("],\"references\":[");
+        const char *kind = b ? binding_name(b->kind) : "binding";
+        json_lit(w, "{\"name\":"); json_string(w, b ? b->name : NULL);
+        json_lit(w, ",\"kind\":\""); json_raw(w, kind, strlen(kind)); json_char(w, '"');
+        json_lit(w, ",\"loc\":"); print_pos_json(w, lines, b ? b->loc : SRC_OFFSET_NONE);
+        json_lit(w, ",\"shadowed\":"); json_string(w, b && b->shadowed ? b->shadowed->name : NULL);
+        json_char(w, '}');
+    }
+    json_lit(w, "],\"references\":[");
     for (size_t i = 0; i < s->references.count; ++i) {
-        if (i) printf(",");
+        if (i) json_char(w, ',');
         Reference *r = s->references.items[i];
-        printf("{\"name\":"); print_json_string(r ? r->name : NULL);
-        printf(",\"write\":%s", (r && r->is_write) ? "true" : "false");
-        printf(",\"tdz\":%s", (r && r->in_tdz) ? "true" : "false");
-        printf(",\"loc\":"); print_pos_json(r ? r->loc : (Position){0,0});
-        printf(",\"resolved\":");
-        if (r && r->resolved && r->resolved->name) print_json_string(r->resolved->name); else printf("null");
-        printf("}");
-    }
-    printf("],\"children\":[");
+        json_lit(w, "{\"name\":"); json_string(w, r ? r->name : NULL);
+        json_lit(w, ",\"write\":"); json_bool(w, r && r->is_write);
+        json_lit(w, ",\"tdz\":"); json_bool(w, r && r->in_tdz);
+        json_lit(w, ",\"loc\":"); print_pos_json(w, lines, r ? r->loc : SRC_OFFSET_NONE);
+        json_lit(w, ",\"resolved\":"); json_string(w, r && r->resolved ? r->resolved->name : NULL);
+        json_char(w, '}');
+    }
+    json_lit(w, "],\"children\":[");
     for (size_t i = 0; i < s->children.count; ++i) {
-        if (i) printf(",");
-        dump_scope_json_rec(s->children.items[i]);
+        if (i) json_char(w, ',');
+        dump_scope_json_rec(w, s->children.items[i], lines);
     }
-    printf("]}");
+    json_lit(w, "]}");
+}
+
+void scope_write_json(JsonWriter *w, const Scope *scope) {
+    dump_scope_json_rec(w, scope, scope_lines(scope));
 }
 
 void scope_dump_json(const Scope *scope) {
-    dump_scope_json_rec(scope);
-    printf("\n");
+    JsonWriter w;
+    json_writer_init_file(&w, stdout);
+    scope_write_json(&w, scope);
+    json_char(&w, '\n');
+    json_writer_close(&w);
 }
@@ -129,6 +129,46 @@ static const char* LARGE_CODE =
     "  return accumulator;\n"
     "}\n";
 
+// Shaped like a minified bundle: a license banner and long string literals.
+static char* make_bundle_code(void) {
+    const size_t reps = 2000;
+    size_t cap = reps * 160 + 4096;
+    char* s = (char*)malloc(cap);
+    if (!s) return NULL;
+    size_t len = 0;
+    len += (size_t)snprintf(s + len, cap - len, "/*! license\n");
+    for (int i = 0; i < 40; i++) {
+        len += (size_t)snprintf(s + len, cap - len,
+                                " * Permission is hereby granted, free of charge, to any person.\n");
+    }
+    len += (size_t)snprintf(s + len, cap - len, " */\n");
+    for (size_t i = 0; i < reps; i++) {
+        len += (size_t)snprintf(s + len, cap - len,
+                                "var m%zu=\"lorem ipsum dolor sit amet, consectetur adipiscing elit, "
+                                "sed do eiusmod tempor\\n\";\n", i);
+    }
+    return s;
+}
+
+// threads == 1 uses lexer_tokenize_all(); otherwise the parallel mode.
+static void benchmark_tokenize(BenchmarkSuite* suite, const char* name,
+                               const char* code, int iterations, size_t threads) {
+    size_t len = strlen(code);
+    
+    for (int i = 0; i < iterations; i++) {
+        BenchmarkTimer timer;
+        benchmark_start(&timer);
+        
+        TokenBuffer tokens;
+        int rc = threads == 1 ? lexer_tokenize_all(code, len, &tokens)
+                              : lexer_tokenize_parallel(code, len, threads, &tokens);
+        
+        benchmark_end(&timer);
+        benchmark_suite_update(suite, name, timer.elapsed_ms, len);
+        if (rc == 0) token_buffer_free(&tokens);
+    }
+}
+
 static void benchmark_lexer(BenchmarkSuite* suite, const char* name, 
                            const char* code, int iterations) {
     size_t len = strlen(code);
@@ -143,7 +183,6 @@ static void benchmark_lexer(BenchmarkSuite* suite, const char* name,
         Token token;
         do {
             token = lexer_next(&lexer);
-            token_free(&token);
         } while (token.type != TOKEN_EOF && token.type != TOKEN_ERROR);
         
         benchmark_end(&timer);
@@ -173,6 +212,33 @@ static void benchmark_parser(BenchmarkSuite* suite, const char* name,
     }
 }
 
+// Tokenize once into the SoA buffer, then parse by index.
+static void benchmark_parser_bulk(BenchmarkSuite* suite, const char* name,
+                                  const char* code, int iterations) {
+    size_t len = strlen(code);
+    
+    for (int i = 0; i < iterations; i++) {
+        BenchmarkTimer timer;
+        benchmark_start(&timer);
+        
+        TokenBuffer tokens;
+        AstNode* program = NULL;
+        if (lexer_tokenize_all(code, len, &tokens) == 0) {
+            Parser parser;
+            parser_init_tokens(&parser, code, len, &tokens);
+            program = parse_program(&parser);
+            token_buffer_free(&tokens);
+        }
+        
+        benchmark_end(&timer);
+        benchmark_suite_update(suite, name, timer.elapsed_ms, len);
+        
+        if (program) {
+            ast_free(program);
+        }
+    }
+}
+
 static void benchmark_full_pipeline(BenchmarkSuite* suite, const char* name,
                                    const char* code, int iterations) {
     size_t len = strlen(code);
@@ -218,12 +284,29 @@ int main(void) {
     benchmark_lexer(suite, "Lexer - Small (100 iter)", SMALL_CODE, 100);
     benchmark_lexer(suite, "Lexer - Medium (50 iter)", MEDIUM_CODE, 50);
     benchmark_lexer(suite, "Lexer - Large (20 iter)", LARGE_CODE, 20);
+    char* bundle = make_bundle_code();
+    if (bundle) {
+        printf("  scan backend: %s\n", lexer_scan_backend());
+        benchmark_lexer(suite, "Lexer - Bundle (20 iter)", bundle, 20);
+        // a multi-megabyte concatenation for the parallel mode
+        size_t blen = strlen(bundle), copies = 16;
+        char* big = (char*)malloc(blen * copies + 1);
+        if (big) {
+            for (size_t k = 0; k < copies; k++) memcpy(big + k * blen, bundle, blen);
+            big[blen * copies] = '\0';
+            benchmark_tokenize(suite, "Tokenize - Big bundle (10 iter)", big, 10, 1);
+            benchmark_tokenize(suite, "Tokenize (parallel) - Big bundle (10 iter)", big, 10, 0);
+            free(big);
+        }
+        free(bundle);
+    }
     
     // Parser benchmarks
     printf("Running parser benchmarks...\n");
     benchmark_parser(suite, "Parser - Small (100 iter)", SMALL_CODE, 100);
     benchmark_parser(suite, "Parser - Medium (50 iter)", MEDIUM_CODE, 50);
     benchmark_parser(suite, "Parser - Large (20 iter)", LARGE_CODE, 20);
+    benchmark_parser_bulk(suite, "Parser (bulk) - Large (20 iter)", LARGE_CODE, 20);
     
     // Full pipeline benchmarks
     printf("Running full pipeline benchmarks...\n");
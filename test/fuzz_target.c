@@ -39,7 +39,6 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
     int token_count = 0;
     do {
         token = lexer_next(&lexer);
-        token_free(&token);
         token_count++;
         if (token_count > 100000) break; // Prevent infinite loops
     } while (token.type != TOKEN_EOF && token.type != TOKEN_ERROR);
@@ -117,7 +116,6 @@ int main(int argc, char** argv) {
         int token_count = 0;
         do {
             token = lexer_next(&lexer);
-            token_free(&token);
             token_count++;
             if (token_count > 100000) break;
         } while (token.type != TOKEN_EOF && token.type != TOKEN_ERROR);
@@ -31,7 +31,7 @@ MockLexer *mock_lexer_create(Token *tokens, size_t count) {
 
 Token mock_lexer_next(MockLexer *ml) {
     if (!ml || ml->pos >= ml->count) {
-        Token eof = {.type = TOKEN_EOF, .lexeme = NULL};
+        Token eof = {.type = TOKEN_EOF, .offset = 0, .length = 0};
         return eof;
     }
     return ml->tokens[ml->pos++];
@@ -39,7 +39,7 @@ Token mock_lexer_next(MockLexer *ml) {
 
 Token mock_lexer_peek(MockLexer *ml) {
     if (!ml || ml->pos >= ml->count) {
-        Token eof = {.type = TOKEN_EOF, .lexeme = NULL};
+        Token eof = {.type = TOKEN_EOF, .offset = 0, .length = 0};
         return eof;
     }
     return ml->tokens[ml->pos];
@@ -56,18 +56,18 @@ void mock_lexer_free(MockLexer *ml) {
  * ============================================================================ */
 
 AstNode *mock_parser_create_program(int statement_count) {
-    AstNode *prog = malloc(sizeof(AstNode));
+    AstNode *prog = calloc(1, sizeof(AstNode));
     if (!prog) return NULL;
     
-    Program *p = malloc(sizeof(Program));
+    Program *p = calloc(1, sizeof(Program));
     if (!p) {
         free(prog);
         return NULL;
     }
     
     prog->type = AST_Program;
-    prog->start = (Position){1, 0};
-    prog->end = (Position){1, 0};
+    prog->start = 0;
+    prog->end = 0;
     prog->refcount = 1;
     prog->data = p;
     
@@ -77,6 +77,7 @@ AstNode *mock_parser_create_program(int statement_count) {
     p->comments = NULL;
     p->comment_count = 0;
     p->comment_capacity = 0;
+    p->lines = (LineIndex){0};
     
     // Create placeholder statements
     for (int i = 0; i < statement_count; i++) {
@@ -87,10 +88,11 @@ AstNode *mock_parser_create_program(int statement_count) {
 }
 
 AstNode *mock_parser_create_identifier(const char *name, int line, int col) {
-    AstNode *node = malloc(sizeof(AstNode));
+    AstNode *node = calloc(1, sizeof(AstNode));
+    (void)line; // offsets only; lines come from the Program's LineIndex
     if (!node) return NULL;
     
-    Identifier *id = malloc(sizeof(Identifier));
+    Identifier *id = calloc(1, sizeof(Identifier));
     if (!id) {
         free(node);
         return NULL;
@@ -105,8 +107,8 @@ AstNode *mock_parser_create_identifier(const char *name, int line, int col) {
     strcpy(id->name, name);
     
     node->type = AST_Identifier;
-    node->start = (Position){line, col};
-    node->end = (Position){line, col + (int)strlen(name)};
+    node->start = (SrcOffset)col;
+    node->end = (SrcOffset)(col + strlen(name));
     node->refcount = 1;
     node->data = id;
     
@@ -114,10 +116,10 @@ AstNode *mock_parser_create_identifier(const char *name, int line, int col) {
 }
 
 AstNode *mock_parser_create_literal(const char *raw, LiteralKind kind) {
-    AstNode *node = malloc(sizeof(AstNode));
+    AstNode *node = calloc(1, sizeof(AstNode));
     if (!node) return NULL;
     
-    Literal *lit = malloc(sizeof(Literal));
+    Literal *lit = calloc(1, sizeof(Literal));
     if (!lit) {
         free(node);
         return NULL;
@@ -131,10 +133,14 @@ AstNode *mock_parser_create_literal(const char *raw, LiteralKind kind) {
     }
     strcpy(lit->raw, raw);
     lit->kind = kind;
+    lit->number = 0.0;
+    lit->bigint = NULL;
+    lit->cooked = NULL;
+    lit->cooked_length = 0;
     
     node->type = AST_Literal;
-    node->start = (Position){1, 0};
-    node->end = (Position){1, (int)strlen(raw)};
+    node->start = 0;
+    node->end = (SrcOffset)strlen(raw);
     node->refcount = 1;
     node->data = lit;
     
@@ -142,29 +148,29 @@ AstNode *mock_parser_create_literal(const char *raw, LiteralKind kind) {
 }
 
 AstNode *mock_parser_create_var_decl(const char *var_name, VarKind kind) {
-    AstNode *node = malloc(sizeof(AstNode));
+    AstNode *node = calloc(1, sizeof(AstNode));
     if (!node) return NULL;
     
-    VariableDeclaration *vd = malloc(sizeof(VariableDeclaration));
+    VariableDeclaration *vd = calloc(1, sizeof(VariableDeclaration));
     if (!vd) {
         free(node);
         return NULL;
     }
     
     vd->kind = kind;
-    vd->declarations.items = malloc(sizeof(VariableDeclarator));
+    vd->declarations.items = calloc(1, sizeof(VariableDeclarator));
     vd->declarations.count = 1;
     vd->declarations.capacity = 1;
     
-    VariableDeclarator *decl = malloc(sizeof(VariableDeclarator));
+    VariableDeclarator *decl = calloc(1, sizeof(VariableDeclarator));
     memcpy(vd->declarations.items, &decl, sizeof(VariableDeclarator *));
     
     decl->id = mock_parser_create_identifier(var_name, 1, 0);
     decl->init = NULL;
     
     node->type = AST_VariableDeclaration;
-    node->start = (Position){1, 0};
-    node->end = (Position){1, 10};
+    node->start = 0;
+    node->end = 10;
     node->refcount = 1;
     node->data = vd;
     
@@ -172,10 +178,10 @@ AstNode *mock_parser_create_var_decl(const char *var_name, VarKind kind) {
 }
 
 AstNode *mock_parser_create_expr_stmt(AstNode *expr) {
-    AstNode *node = malloc(sizeof(AstNode));
+    AstNode *node = calloc(1, sizeof(AstNode));
     if (!node) return NULL;
     
-    ExpressionStatement *es = malloc(sizeof(ExpressionStatement));
+    ExpressionStatement *es = calloc(1, sizeof(ExpressionStatement));
     if (!es) {
         free(node);
         return NULL;
@@ -184,8 +190,8 @@ AstNode *mock_parser_create_expr_stmt(AstNode *expr) {
     es->expression = expr;
     
     node->type = AST_ExpressionStatement;
-    node->start = expr ? expr->start : (Position){1, 0};
-    node->end = expr ? expr->end : (Position){1, 0};
+    node->start = expr ? expr->start : 0;
+    node->end = expr ? expr->end : 0;
     node->refcount = 1;
     node->data = es;
     
@@ -239,7 +245,7 @@ char *mock_codegen_get_output(const AstNode *root) {
 
 Scope *mock_scope_create(ScopeType type, Scope *parent,
                         MockScopeBindings *bindings) {
-    Scope *scope = malloc(sizeof(Scope));
+    Scope *scope = calloc(1, sizeof(Scope));
     if (!scope) return NULL;
     
     scope->type = type;
@@ -253,11 +259,11 @@ Scope *mock_scope_create(ScopeType type, Scope *parent,
         scope->bindings.capacity = bindings->count;
         
         for (size_t i = 0; i < bindings->count; i++) {
-            Binding *b = malloc(sizeof(Binding));
+            Binding *b = calloc(1, sizeof(Binding));
             b->name = malloc(strlen(bindings->names[i]) + 1);
             strcpy(b->name, bindings->names[i]);
             b->kind = bindings->kinds[i];
-            b->loc = (Position){1, 0};
+            b->loc = 0;
             b->node = NULL;
             b->scope = scope;
             b->shadowed = NULL;
@@ -282,7 +288,7 @@ Scope *mock_scope_create(ScopeType type, Scope *parent,
 }
 
 ScopeManager *mock_scope_manager_create(Scope *root) {
-    ScopeManager *sm = malloc(sizeof(ScopeManager));
+    ScopeManager *sm = calloc(1, sizeof(ScopeManager));
     if (!sm) return NULL;
     
     sm->root = root;
@@ -341,8 +347,7 @@ int assert_token_sequence_equal(Token *t1, size_t count1,
             fprintf(stderr, "assert_token_sequence_equal: token %zu type mismatch\n", i);
             return 0;
         }
-        if ((t1[i].lexeme && t2[i].lexeme && strcmp(t1[i].lexeme, t2[i].lexeme) != 0) ||
-            (t1[i].lexeme != NULL) != (t2[i].lexeme != NULL)) {
+        if (t1[i].length != t2[i].length) {
             fprintf(stderr, "assert_token_sequence_equal: token %zu lexeme mismatch\n", i);
             return 0;
         }
@@ -39,13 +39,12 @@ void mock_lexer_free(MockLexer *ml);
  */
 static inline Token token_create(TokenType type, const char *lexeme, 
                                  int line, int col) {
+    (void)line;
+    (void)col;
     Token t = {
         .type = type,
-        .start_line = line,
-        .start_col = col,
-        .end_line = line,
-        .end_col = col + (lexeme ? strlen(lexeme) : 0),
-        .lexeme = (char *)lexeme,
+        .offset = 0,
+        .length = lexeme ? strlen(lexeme) : 0,
         .error = 0,
         .error_kind = NULL
     };
@@ -0,0 +1,273 @@
+#define _POSIX_C_SOURCE 200809L // directory cleanup, utimensat
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "quickjsflow/cache.h"
+#include "quickjsflow/parser.h"
+#include "quickjsflow/codegen.h"
+#include "test_framework.h"
+
+#define CACHE_DIR "build/test_cache.d"
+
+static const char *sample =
+    "// vendor\n"
+    "function f(a, b) { for (let i = 0; i < a; i++) { b += `x${i}`; } return { k: [1, 'z', 2n] }; }\n"
+    "export default class K extends Base {}\n";
+
+static void clear_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *de;
+    char path[512];
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+static size_t count_entries(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    size_t n = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strstr(de->d_name, ".qjfc")) n++;
+    }
+    closedir(d);
+    return n;
+}
+
+static char *generate_compact(const CompactAst *ca) {
+    AstNode *root = compact_to_ast(ca, ca->root);
+    CodegenResult r = codegen_generate(root, NULL);
+    ast_free(root);
+    return r.code;
+}
+
+static char *generate_source(const char *src) {
+    Parser p; parser_init(&p, src, strlen(src));
+    AstNode *root = parse_program(&p);
+    CodegenResult r = codegen_generate(root, NULL);
+    ast_free(root);
+    return r.code;
+}
+
+static void test_hits_and_misses(void) {
+    clear_dir(CACHE_DIR);
+    ParseCache c;
+    ASSERT_EQ(parse_cache_open(&c, CACHE_DIR, 0), 0, "cache opened");
+    size_t len = strlen(sample);
+    char *expected = generate_source(sample);
+
+    CompactAst *ca = parse_cached(&c, sample, len, 0);
+    ASSERT_NOT_NULL(ca, "cold parse");
+    ASSERT_EQ(ca->is_view, 0, "parsed, not loaded");
+    ASSERT_EQ(c.misses, 1, "cold run misses");
+    ASSERT_EQ(c.stores, 1, "and stores");
+    compact_free(ca);
+
+    ca = parse_cached(&c, sample, len, 0);
+    ASSERT_NOT_NULL(ca, "warm parse");
+    ASSERT_EQ(ca->is_view, 1, "mapped from the cache");
+    ASSERT_EQ(c.hits, 1, "warm run hits");
+    char *code = generate_compact(ca);
+    ASSERT_STR_EQ(code, expected, "cached tree generates the same code");
+    ASSERT_EQ(ca->comment_count, 1, "comments cached");
+    free(code);
+    compact_free(ca);
+
+    // the key covers the options and every source byte
+    ASSERT_EQ(parse_cache_get(&c, sample, len, PARSE_CACHE_LAZY) == NULL, 1, "other options miss");
+    char *changed = (char *)malloc(len + 1);
+    memcpy(changed, sample, len + 1);
+    changed[len - 3] = 'X';
+    ASSERT_EQ(parse_cache_get(&c, changed, len, 0) == NULL, 1, "changed source misses");
+    ASSERT_EQ(parse_cache_get(&c, sample, len - 1, 0) == NULL, 1, "shorter source misses");
+    free(changed);
+
+    // a damaged entry is a miss and is replaced
+    DIR *d = opendir(CACHE_DIR);
+    struct dirent *de;
+    char path[512] = "";
+    while ((de = readdir(d)) != NULL) {
+        if (strstr(de->d_name, ".qjfc")) snprintf(path, sizeof(path), "%s/%s", CACHE_DIR, de->d_name);
+    }
+    closedir(d);
+    ASSERT_EQ(truncate(path, 100), 0, "entry truncated");
+    size_t misses = c.misses;
+    ca = parse_cached(&c, sample, len, 0);
+    ASSERT_EQ(c.misses, misses + 1, "damaged entry misses");
+    compact_free(ca);
+    ca = parse_cache_get(&c, sample, len, 0);
+    ASSERT_NOT_NULL(ca, "entry rewritten");
+    compact_free(ca);
+    ASSERT_EQ(count_entries(CACHE_DIR), 1, "one entry per source");
+
+    free(expected);
+    parse_cache_close(&c);
+    clear_dir(CACHE_DIR);
+}
+
+// A hit on a file with syntax errors reports the errors the miss did.
+static void test_cached_diagnostics(void) {
+    clear_dir(CACHE_DIR);
+    ParseCache c;
+    ASSERT_EQ(parse_cache_open(&c, CACHE_DIR, 0), 0, "cache opened");
+    const char *src = "x = ;\nfunction f() { var = ; }\ny = 'open";
+    size_t len = strlen(src);
+    CompactAst *miss = parse_cached(&c, src, len, 0);
+    CompactAst *hit = parse_cached(&c, src, len, 0);
+    ASSERT_EQ(miss && hit && !miss->is_view && hit->is_view, 1, "a miss, then a hit");
+    AstNode *a = miss ? compact_to_ast(miss, miss->root) : NULL;
+    AstNode *b = hit ? compact_to_ast(hit, hit->root) : NULL;
+    ASSERT_EQ(a && b, 1, "both expanded");
+    if (a && b) {
+        const Program *pa = (const Program *)a->data, *pb = (const Program *)b->data;
+        ASSERT_EQ(pa->diagnostic_count, 3, "miss reports the errors");
+        ASSERT_EQ(pb->diagnostic_count, pa->diagnostic_count, "hit reports them too");
+        for (size_t i = 0; i < pa->diagnostic_count && i < pb->diagnostic_count; ++i) {
+            ASSERT_STR_EQ(pb->diagnostics[i].kind, pa->diagnostics[i].kind, "same kind");
+            ASSERT_EQ(pb->diagnostics[i].start, pa->diagnostics[i].start, "same start");
+            ASSERT_EQ(pb->diagnostics[i].end, pa->diagnostics[i].end, "same end");
+        }
+    }
+    ast_free(a);
+    ast_free(b);
+    compact_free(miss);
+    compact_free(hit);
+    parse_cache_close(&c);
+    clear_dir(CACHE_DIR);
+}
+
+static void test_eviction(void) {
+    clear_dir(CACHE_DIR);
+    ParseCache c;
+    ASSERT_EQ(parse_cache_open(&c, CACHE_DIR, 0), 0, "cache opened");
+    char src[64];
+    snprintf(src, sizeof(src), "var v0 = 0;");
+    CompactAst *ca = parse_cached(&c, src, strlen(src), 0);
+    compact_free(ca);
+    uint64_t entry = c.bytes;
+    parse_cache_close(&c);
+
+    // room for four entries
+    ASSERT_EQ(parse_cache_open(&c, CACHE_DIR, entry * 4 + entry / 2), 0, "bounded cache opened");
+    ASSERT_EQ(c.bytes, entry, "existing entries counted");
+    for (int i = 1; i < 10; ++i) {
+        // keep the first entry in use
+        snprintf(src, sizeof(src), "var v0 = 0;");
+        ca = parse_cache_get(&c, src, strlen(src), 0);
+        ASSERT_NOT_NULL(ca, "recently used entry kept");
+        compact_free(ca);
+        snprintf(src, sizeof(src), "var v%d = %d;", i, i);
+        ca = parse_cached(&c, src, strlen(src), 0);
+        compact_free(ca);
+    }
+    ASSERT_EQ(c.evictions > 0, 1, "old entries evicted");
+    ASSERT_EQ(c.bytes <= c.max_bytes, 1, "size bound kept");
+    ASSERT_EQ(count_entries(CACHE_DIR) <= 4, 1, "at most four entries");
+    snprintf(src, sizeof(src), "var v1 = 1;");
+    ASSERT_EQ(parse_cache_get(&c, src, strlen(src), 0) == NULL, 1, "least recently used entry gone");
+    parse_cache_close(&c);
+    clear_dir(CACHE_DIR);
+}
+
+static size_t count_temp_files(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    size_t n = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strstr(de->d_name, ".tmp")) n++;
+    }
+    closedir(d);
+    return n;
+}
+
+static void write_temp_file(const char *name, size_t size, time_t age) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", CACHE_DIR, name);
+    FILE *f = fopen(path, "wb");
+    for (size_t i = 0; i < size; ++i) fputc('x', f);
+    fclose(f);
+    struct timespec times[2] = {{time(NULL) - age, 0}, {time(NULL) - age, 0}};
+    utimensat(AT_FDCWD, path, times, 0);
+}
+
+typedef struct {
+    const char *src;
+    int failures;
+} StoreJob;
+
+static void *store_repeatedly(void *arg) {
+    StoreJob *job = (StoreJob *)arg;
+    ParseCache c;
+    if (parse_cache_open(&c, CACHE_DIR, 0) != 0) {
+        job->failures++;
+        return NULL;
+    }
+    Parser p;
+    parser_init(&p, job->src, strlen(job->src));
+    AstNode *root = parse_program(&p);
+    CompactAst *ca = compact_from_ast(root);
+    ast_free(root);
+    for (int i = 0; i < 50; ++i) {
+        if (parse_cache_put(&c, job->src, strlen(job->src), 0, ca) != 0) job->failures++;
+    }
+    compact_free(ca);
+    parse_cache_close(&c);
+    return NULL;
+}
+
+static void test_temp_files(void) {
+    clear_dir(CACHE_DIR);
+    ParseCache c;
+    ASSERT_EQ(parse_cache_open(&c, CACHE_DIR, 0), 0, "cache opened");
+    parse_cache_close(&c);
+    // one left by a run that died, one still being written
+    write_temp_file("0123456789abcdef0123456789abcdef.tmp123456", 100, 2 * 3600);
+    write_temp_file("fedcba9876543210fedcba9876543210.tmpabcdef", 50, 0);
+    ASSERT_EQ(parse_cache_open(&c, CACHE_DIR, 0), 0, "cache reopened");
+    ASSERT_EQ(count_temp_files(CACHE_DIR), 1, "stale temporary file removed");
+    ASSERT_EQ(c.bytes, 50, "the other one counts toward the bound");
+    parse_cache_close(&c);
+
+    // threads of one process storing the same entry do not share a
+    // temporary file
+    StoreJob jobs[4];
+    pthread_t tids[4];
+    for (int i = 0; i < 4; ++i) {
+        jobs[i].src = sample;
+        jobs[i].failures = 0;
+        pthread_create(&tids[i], NULL, store_repeatedly, &jobs[i]);
+    }
+    int failures = 0;
+    for (int i = 0; i < 4; ++i) {
+        pthread_join(tids[i], NULL);
+        failures += jobs[i].failures;
+    }
+    ASSERT_EQ(failures, 0, "every concurrent store succeeded");
+    ASSERT_EQ(count_temp_files(CACHE_DIR), 1, "no temporary files left behind");
+    ASSERT_EQ(parse_cache_open(&c, CACHE_DIR, 0), 0, "cache reopened");
+    CompactAst *ca = parse_cache_get(&c, sample, strlen(sample), 0);
+    ASSERT_NOT_NULL(ca, "stored entry is complete");
+    compact_free(ca);
+    parse_cache_close(&c);
+    clear_dir(CACHE_DIR);
+}
+
+int main(void) {
+    test_hits_and_misses();
+    test_cached_diagnostics();
+    test_eviction();
+    test_temp_files();
+    TEST_SUMMARY();
+}
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "quickjsflow/parser.h"
+#include "quickjsflow/compact.h"
+#include "quickjsflow/codegen.h"
+#include "quickjsflow/scope.h"
+#include "quickjsflow/cfg.h"
+#include "test_framework.h"
+
+static const char *sample =
+    "// header\n"
+    "import def, { a as b } from './m';\n"
+    "import * as ns from 'ns';\n"
+    "const c = 1n;\n"
+    "export { c };\n"
+    "export function h(x) { return x; }\n"
+    "export default class K extends Base { static make(x) { return new K(x); } }\n"
+    "function f(p, q, r) {\n"
+    "  for (let i = 0; i < q; i++) { if (i % 2) continue; else break; }\n"
+    "  for (const k in p) {} for (const v of r) { p.push(v); }\n"
+    "  do { q--; } while (q > 0);\n"
+    "  while (q) q = !q;\n"
+    "  switch (p) { case 1: r = 'a\\tb'; break; default: r = `t${p}u\\n`; }\n"
+    "  try { throw new Error('e'); } catch (err) { r = -err; } finally { r = typeof r; }\n"
+    "  var o = { k: 1, m: [1, 2] };\n"
+    "  return async (w) => await w + o.m[0] + 0x10;\n"
+    "}\n"
+    "/* tail */\n";
+
+static AstNode *parse_source(const char *src) {
+    Parser p; parser_init(&p, src, strlen(src));
+    return parse_program(&p);
+}
+
+static char *generate(const AstNode *root) {
+    CodegenResult r = codegen_generate(root, NULL);
+    return r.code;
+}
+
+static CompactId find_type(const CompactAst *ca, AstNodeType t) {
+    for (CompactId i = 0; i < ca->node_count; ++i) {
+        if (compact_type(ca, i) == t) return i;
+    }
+    return COMPACT_NONE;
+}
+
+static void test_roundtrip_codegen(void) {
+    AstNode *root = parse_source(sample);
+    CompactAst *ca = compact_from_ast(root);
+    ASSERT_NOT_NULL(ca, "flatten succeeds");
+    ASSERT_EQ(ca->root, 0, "root is the first record");
+    ASSERT_EQ(ca->comment_count, 2, "comments carried over");
+    ASSERT_EQ(find_type(ca, AST_Error), COMPACT_NONE, "sample parses cleanly");
+
+    AstNode *back = compact_to_ast(ca, ca->root);
+    ASSERT_NOT_NULL(back, "expand succeeds");
+    char *a = generate(root);
+    char *b = generate(back);
+    ASSERT_STR_EQ(b, a, "codegen identical after compact round trip");
+    Position p1 = ast_position(root, ((Program *)root->data)->body.items[2]->start);
+    Position p2 = ast_position(back, ((Program *)back->data)->body.items[2]->start);
+    ASSERT_EQ(p2.line, p1.line, "line index carried over");
+    free(a);
+    free(b);
+    ast_free(back);
+    compact_free(ca);
+    ast_free(root);
+}
+
+static void test_layout_and_accessors(void) {
+    AstNode *root = parse_source("var n = 1.5 + x; `a${n}b`; foo(1, [2, 3]);");
+    CompactAst *ca = compact_from_ast(root);
+
+    // pre-order: every child comes after its parent
+    int ordered = 1;
+    CompactId kids[16];
+    for (CompactId i = 0; i < ca->node_count; ++i) {
+        size_t n = compact_children(ca, i, kids, 16);
+        for (size_t k = 0; k < n && k < 16; ++k) {
+            if (kids[k] <= i) ordered = 0;
+        }
+    }
+    ASSERT_EQ(ordered, 1, "nodes stored in pre-order");
+    ASSERT_EQ(compact_children(ca, ca->root, NULL, 0), 3, "program children counted");
+
+    CompactId lit = find_type(ca, AST_Literal);
+    ASSERT_EQ(compact_number(ca, lit) == 1.5, 1, "number decoded");
+    CompactId bin = find_type(ca, AST_BinaryExpression);
+    ASSERT_EQ(compact_node(ca, bin)->kind, OP_PLUS, "operator id");
+    CompactId id = find_type(ca, AST_Identifier);
+    ASSERT_STR_EQ(compact_string(ca, compact_node(ca, id)->a), "n", "identifier name");
+
+    CompactId tl = find_type(ca, AST_TemplateLiteral);
+    ASSERT_EQ(compact_children(ca, tl, kids, 16), 3, "template children");
+    ASSERT_EQ(compact_type(ca, kids[0]), AST_TemplateElement, "quasi first");
+    ASSERT_EQ(compact_type(ca, kids[1]), AST_Identifier, "then expression");
+
+    CompactId arr = find_type(ca, AST_ArrayExpression);
+    uint32_t count;
+    const CompactId *items = compact_list(ca, compact_node(ca, arr)->a, &count);
+    ASSERT_EQ(count, 2, "array elements listed");
+    ASSERT_EQ(compact_type(ca, items[1]), AST_Literal, "list items are node ids");
+    ASSERT_EQ(compact_type(ca, ca->node_count), 0, "out-of-range id");
+
+    compact_free(ca);
+    ast_free(root);
+}
+
+static void test_analyses_on_expansion(void) {
+    AstNode *root = parse_source(sample);
+    CompactAst *ca = compact_from_ast(root);
+    AstNode *back = compact_to_ast(ca, ca->root);
+
+    ScopeManager s1, s2;
+    scope_manager_init(&s1);
+    scope_manager_init(&s2);
+    scope_analyze(&s1, root, 1);
+    scope_analyze(&s2, back, 1);
+    ASSERT_EQ(s2.root->bindings.count, s1.root->bindings.count, "same module bindings");
+    ASSERT_EQ(s2.root->children.count, s1.root->children.count, "same child scopes");
+    scope_manager_free(&s1);
+    scope_manager_free(&s2);
+
+    // a function subtree expands on its own
+    Program *pr = (Program *)root->data;
+    AstNode *orig = pr->body.items[pr->body.count - 1];
+    uint32_t count;
+    const CompactId *body = compact_list(ca, compact_node(ca, ca->root)->a, &count);
+    AstNode *f = compact_to_ast(ca, body[count - 1]);
+    ASSERT_EQ(f->type, AST_FunctionDeclaration, "subtree expanded");
+    ASSERT_EQ(f->start, orig->start, "subtree keeps its offsets");
+    CFG *c1 = qjs_build_cfg(orig, NULL, NULL);
+    CFG *c2 = qjs_build_cfg(f, NULL, NULL);
+    ASSERT_EQ(c2->block_count, c1->block_count, "same CFG shape");
+    ASSERT_EQ(c2->edge_count, c1->edge_count, "same CFG edges");
+    qjs_cfg_free(c1);
+    qjs_cfg_free(c2);
+    ast_free(f);
+
+    ast_free(back);
+    compact_free(ca);
+    ast_free(root);
+}
+
+static void test_memory(void) {
+    size_t len = strlen(sample);
+    size_t reps = 50;
+    char *big = (char *)malloc(len * reps + 1);
+    for (size_t i = 0; i < reps; ++i) {
+        memcpy(big + i * len, sample, len);
+    }
+    big[len * reps] = '\0';
+    AstNode *root = parse_source(big);
+    CompactAst *ca = compact_from_ast(root);
+    size_t tree = ast_arena_bytes(root->arena);
+    size_t flat = compact_bytes(ca);
+    ASSERT_EQ(flat * 2 < tree, 1, "compact form under half the pointer tree");
+    ASSERT_EQ(sizeof(CompactNode), 24, "24-byte node records");
+    compact_free(ca);
+    ast_free(root);
+    free(big);
+}
+
+// Image of `ca` in a fresh buffer (malloc keeps the 8-byte alignment)
+static void *image_of(const CompactAst *ca, size_t *size) {
+    *size = compact_image_size(ca);
+    void *buf = malloc(*size);
+    compact_write_image(ca, buf);
+    return buf;
+}
+
+static void test_binary_image(void) {
+    AstNode *root = parse_source(sample);
+    CompactAst *ca = compact_from_ast(root);
+    char *expected = generate(root);
+
+    size_t size;
+    void *buf = image_of(ca, &size);
+    CompactAst *view = compact_view(buf, size);
+    ASSERT_NOT_NULL(view, "image accepted");
+    ASSERT_EQ(view->node_count, ca->node_count, "all records in the image");
+    ASSERT_EQ((const void *)view->nodes > buf && (const char *)view->nodes < (const char *)buf + size, 1, "records used in place");
+    ASSERT_EQ(view->comment_count, 2, "comments in the image");
+    AstNode *back = compact_to_ast(view, view->root);
+    char *code = generate(back);
+    ASSERT_STR_EQ(code, expected, "codegen identical from an image");
+    Position p1 = ast_position(root, ((Program *)root->data)->body.items[2]->start);
+    Position p2 = ast_position(back, ((Program *)back->data)->body.items[2]->start);
+    ASSERT_EQ(p2.line, p1.line, "line index in the image");
+    free(code);
+    ast_free(back);
+    compact_free(view);
+
+    // rejected, not trusted
+    ASSERT_EQ(compact_view(buf, size - 8) == NULL, 1, "truncated image");
+    ((char *)buf)[0] = 'X';
+    ASSERT_EQ(compact_view(buf, size) == NULL, 1, "bad magic");
+    free(buf);
+    CompactId stmt = find_type(ca, AST_ExpressionStatement);
+    uint32_t saved = ca->nodes[stmt].a;
+    ca->nodes[stmt].a = stmt; // a cycle
+    buf = image_of(ca, &size);
+    ASSERT_EQ(compact_view(buf, size) == NULL, 1, "child before its parent");
+    free(buf);
+    ca->nodes[stmt].a = saved;
+    CompactId id = find_type(ca, AST_Identifier);
+    saved = ca->nodes[id].a;
+    ca->nodes[id].a = ca->string_bytes;
+    buf = image_of(ca, &size);
+    ASSERT_EQ(compact_view(buf, size) == NULL, 1, "string out of range");
+    free(buf);
+    ca->nodes[id].a = saved;
+
+    // through a mapped file
+    const char *path = "build/test_compact.qjfa";
+    ASSERT_EQ(compact_save(ca, path), 0, "image saved");
+    view = compact_load(path);
+    ASSERT_NOT_NULL(view, "image mapped");
+    back = view ? compact_to_ast(view, view->root) : NULL;
+    code = back ? generate(back) : NULL;
+    ASSERT_STR_EQ(code ? code : "", expected, "codegen identical from a mapped image");
+    free(code);
+    ast_free(back);
+    compact_free(view);
+    remove(path);
+    ASSERT_EQ(compact_load(path) == NULL, 1, "missing file");
+
+    free(expected);
+    compact_free(ca);
+    ast_free(root);
+}
+
+// Syntax errors travel with the Program through the compact form and its
+// image.
+static void test_diagnostics_round_trip(void) {
+    const char *src = "x = ;\nfunction f() { var = ; }\ny = 'open";
+    AstNode *root = parse_source(src);
+    const Program *pr = (const Program *)root->data;
+    ASSERT_EQ(pr->diagnostic_count, 3, "three errors");
+    CompactAst *ca = compact_from_ast(root);
+    ASSERT_EQ(ca->diagnostic_count, 3, "flattened");
+    size_t size;
+    void *buf = image_of(ca, &size);
+    CompactAst *view = compact_view(buf, size);
+    ASSERT_NOT_NULL(view, "image accepted");
+    for (int k = 0; k < 2; ++k) {
+        AstNode *back = compact_to_ast(k ? view : ca, ca->root);
+        const Program *bp = (const Program *)back->data;
+        ASSERT_EQ(bp->diagnostic_count, pr->diagnostic_count, k ? "diagnostics from the image" : "diagnostics expanded");
+        for (size_t i = 0; i < bp->diagnostic_count && i < pr->diagnostic_count; ++i) {
+            ASSERT_STR_EQ(bp->diagnostics[i].kind, pr->diagnostics[i].kind, "same kind");
+            ASSERT_EQ(bp->diagnostics[i].start, pr->diagnostics[i].start, "same start");
+            ASSERT_EQ(bp->diagnostics[i].end, pr->diagnostics[i].end, "same end");
+        }
+        ast_free(back);
+    }
+    compact_free(view);
+    free(buf);
+
+    uint32_t saved = ca->diagnostics[1].kind;
+    ca->diagnostics[1].kind = ca->string_bytes;
+    buf = image_of(ca, &size);
+    ASSERT_EQ(compact_view(buf, size) == NULL, 1, "diagnostic kind out of range");
+    free(buf);
+    ca->diagnostics[1].kind = saved;
+    compact_free(ca);
+    ast_free(root);
+}
+
+// Flattening and expansion keep their work on the heap, so nesting the
+// parser accepts round-trips too.
+static void test_deep_nesting(void) {
+    static const char *shapes[][3] = {{"x = ", "[", "]"}, {"", "{", "}"}};
+    size_t depth = 100000;
+    for (size_t k = 0; k < 2; ++k) {
+        size_t lead = strlen(shapes[k][0]);
+        char *src = (char *)malloc(lead + depth * 2 + 4);
+        memcpy(src, shapes[k][0], lead);
+        memset(src + lead, shapes[k][1][0], depth);
+        src[lead + depth] = '1';
+        memset(src + lead + depth + 1, shapes[k][2][0], depth);
+        strcpy(src + lead + depth * 2 + 1, ";\n");
+        AstNode *root = parse_source(src);
+        CompactAst *ca = compact_from_ast(root);
+        ASSERT_NOT_NULL(ca, k ? "deep blocks flattened" : "deep arrays flattened");
+        size_t s1 = 0, s2 = 0;
+        void *a = ca ? image_of(ca, &s1) : NULL;
+        AstNode *back = ca ? compact_to_ast(ca, ca->root) : NULL;
+        ASSERT_NOT_NULL(back, k ? "deep blocks expanded" : "deep arrays expanded");
+        CompactAst *again = back ? compact_from_ast(back) : NULL;
+        void *b = again ? image_of(again, &s2) : NULL;
+        ASSERT_EQ(a && b && s1 == s2 && memcmp(a, b, s1) == 0, 1, "same image after a round trip");
+        // a subtree expands on its own
+        CompactId inner = ca ? find_type(ca, k ? AST_BlockStatement : AST_ArrayExpression) : COMPACT_NONE;
+        AstNode *sub = inner != COMPACT_NONE ? compact_to_ast(ca, inner) : NULL;
+        ASSERT_EQ(sub != NULL && sub->type == (k ? AST_BlockStatement : AST_ArrayExpression), 1, "deep subtree expanded");
+        ast_free(sub);
+        free(a);
+        free(b);
+        compact_free(again);
+        ast_free(back);
+        compact_free(ca);
+        ast_free(root);
+        free(src);
+    }
+}
+
+int main(void) {
+    test_roundtrip_codegen();
+    test_layout_and_accessors();
+    test_analyses_on_expansion();
+    test_memory();
+    test_binary_image();
+    test_diagnostics_round_trip();
+    test_deep_nesting();
+    TEST_SUMMARY();
+}
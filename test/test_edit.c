@@ -24,7 +24,7 @@ static void test_replace_literal(void) {
     VariableDeclarator *decl = (VariableDeclarator *)vd->declarations.items[0]->data;
     AstNode *lit_two = decl->init;
 
-    AstNode *replacement = ast_literal(LIT_Number, "3", (Position){0,0}, (Position){0,0});
+    AstNode *replacement = ast_literal(LIT_Number, "3", SRC_OFFSET_NONE, SRC_OFFSET_NONE);
     AstNode *new_root = NULL;
     EditStatus st = edit_replace(root, lit_two, replacement, &new_root);
     ASSERT_EQ(st.code, 0, "replace succeeds");
@@ -62,8 +62,8 @@ static void test_insert_statement(void) {
     AstNode *root = parse_source("var a = 1;");
     AstNode *new_decl = ast_variable_declaration(VD_Var);
     VariableDeclaration *vd = (VariableDeclaration *)new_decl->data;
-    AstNode *id = ast_identifier("b", (Position){0,0}, (Position){0,0});
-    AstNode *lit = ast_literal(LIT_Number, "2", (Position){0,0}, (Position){0,0});
+    AstNode *id = ast_identifier("b", SRC_OFFSET_NONE, SRC_OFFSET_NONE);
+    AstNode *lit = ast_literal(LIT_Number, "2", SRC_OFFSET_NONE, SRC_OFFSET_NONE);
     AstNode *decl = ast_variable_declarator(id, lit);
     astvec_push(&vd->declarations, decl);
 
@@ -159,6 +159,47 @@ static void test_move_detects_capture(void) {
     if (new_root) ast_free(new_root);
 }
 
+static void test_arena_lifetime(void) {
+    AstNode *root = parse_source("// note\nfunction f(a) { return a + 1; } var x = f(2);");
+    Program *pr = (Program *)root->data;
+    ASSERT_NOT_NULL(root->arena, "parsed tree lives in an arena");
+    ASSERT_EQ(pr->owns_arena, 1, "program owns its arena");
+    ASSERT_EQ(pr->body.items[1]->arena == root->arena, 1, "nodes share the program's arena");
+    ASSERT_EQ(ast_arena_bytes(root->arena) > 0, 1, "arena holds the tree");
+
+    // edits copy into heap nodes that outlive the source tree
+    AstNode *second = pr->body.items[1];
+    AstNode *new_root = NULL;
+    EditStatus st = edit_remove(root, pr->body.items[0], &new_root);
+    ASSERT_EQ(st.code, 0, "remove from arena tree succeeds");
+    ASSERT_EQ(new_root->arena == NULL, 1, "edited tree is heap-allocated");
+
+    // a retained node keeps the whole arena alive past the program
+    ast_retain(second);
+    ast_free(root);
+    VariableDeclaration *vd = (VariableDeclaration *)second->data;
+    VariableDeclarator *decl = (VariableDeclarator *)vd->declarations.items[0]->data;
+    ASSERT_STR_EQ(id_name(decl->id), "x", "retained node still readable");
+    ast_release(second);
+
+    Program *npr = (Program *)new_root->data;
+    ASSERT_EQ(npr->body.count, 1, "edited tree intact after the arena is gone");
+    ast_free(new_root);
+
+    // caller-managed arena
+    AstArena *arena = ast_arena_new();
+    AstArena *prev = ast_arena_use(arena);
+    AstNode *id = ast_identifier("y", SRC_OFFSET_NONE, SRC_OFFSET_NONE);
+    ast_arena_use(prev);
+    ASSERT_EQ(id->arena == arena, 1, "constructors use the active arena");
+    char *renamed = ast_node_strdup(id, "zz");
+    ast_node_free_string(id, ((Identifier *)id->data)->name);
+    ((Identifier *)id->data)->name = renamed;
+    ASSERT_STR_EQ(id_name(id), "zz", "strings replaced inside the arena");
+    ast_release(id); // no-op for arena nodes
+    ast_arena_free(arena);
+}
+
 int main(void) {
     test_replace_literal();
     test_remove_statement();
@@ -166,5 +207,6 @@ int main(void) {
     test_rename_conflict_shadow();
     test_rename_updates_references();
     test_move_detects_capture();
+    test_arena_lifetime();
     TEST_SUMMARY();
 }
@@ -2,6 +2,7 @@
 #include <string.h>
 #include "quickjsflow/parser.h"
 #include "quickjsflow/ast.h"
+#include "quickjsflow/codegen.h"
 #include "test_framework.h"
 
 static Program *parse_prog(const char *src, AstNode **out_root) {
@@ -61,7 +62,7 @@ static void test_member_call_assignment(void) {
     ExpressionStatement *es = (ExpressionStatement *)stmt->data;
     ASSERT_EQ(es->expression->type, AST_AssignmentExpression, "root is assignment");
     AssignmentExpression *ae = (AssignmentExpression *)es->expression->data;
-    ASSERT_STR_EQ(ae->operator, "=", "assignment operator");
+    ASSERT_EQ(ae->operator, OP_ASSIGN, "assignment operator");
     ASSERT_EQ(ae->left->type, AST_MemberExpression, "lhs is member");
     MemberExpression *me = (MemberExpression *)ae->left->data;
     ASSERT_EQ(me->computed, 0, "dot access");
@@ -82,7 +83,7 @@ static void test_unary_update_binary_precedence(void) {
     ExpressionStatement *es = (ExpressionStatement *)pr->body.items[0]->data;
     ASSERT_EQ(es->expression->type, AST_BinaryExpression, "root is binary");
     BinaryExpression *add = (BinaryExpression *)es->expression->data;
-    ASSERT_STR_EQ(add->operator, "+", "outer op plus");
+    ASSERT_EQ(add->operator, OP_PLUS, "outer op plus");
 
     ASSERT_EQ(add->left->type, AST_UpdateExpression, "left is postfix update");
     UpdateExpression *ue = (UpdateExpression *)add->left->data;
@@ -90,18 +91,237 @@ static void test_unary_update_binary_precedence(void) {
 
     ASSERT_EQ(add->right->type, AST_BinaryExpression, "right is binary mul");
     BinaryExpression *mul = (BinaryExpression *)add->right->data;
-    ASSERT_STR_EQ(mul->operator, "*", "inner op mul");
+    ASSERT_EQ(mul->operator, OP_STAR, "inner op mul");
     ASSERT_EQ(mul->left->type, AST_Literal, "mul left literal");
     ASSERT_EQ(mul->right->type, AST_UnaryExpression, "mul right unary");
     UnaryExpression *un = (UnaryExpression *)mul->right->data;
-    ASSERT_STR_EQ(un->operator, "-", "unary minus");
+    ASSERT_EQ(un->operator, OP_MINUS, "unary minus");
 
     ast_free(root);
 }
 
+static void test_numeric_literal_values(void) {
+    const char *src = "x = [0x1F, 1_000.5, .25, 0xFFFF_FFFF_FFFF_FFFFn];";
+    AstNode *root = NULL;
+    Program *pr = parse_prog(src, &root);
+    ExpressionStatement *es = (ExpressionStatement *)pr->body.items[0]->data;
+    AssignmentExpression *as = (AssignmentExpression *)es->expression->data;
+    ArrayExpression *arr = (ArrayExpression *)as->right->data;
+    ASSERT_EQ(arr->elements.count, 4, "four numbers");
+    Literal *hex = (Literal *)arr->elements.items[0]->data;
+    Literal *sep = (Literal *)arr->elements.items[1]->data;
+    Literal *frac = (Literal *)arr->elements.items[2]->data;
+    Literal *big = (Literal *)arr->elements.items[3]->data;
+    ASSERT_EQ(hex->number == 31.0, 1, "hex value decoded");
+    ASSERT_STR_EQ(hex->raw, "0x1F", "raw text kept");
+    ASSERT_EQ(sep->number == 1000.5, 1, "separators skipped");
+    ASSERT_EQ(frac->number == 0.25, 1, "leading-dot fraction");
+    ASSERT_EQ(hex->bigint == NULL, 1, "plain numbers have no bigint digits");
+    ASSERT_STR_EQ(big->bigint, "18446744073709551615", "BigInt keeps exact digits");
+    ast_free(root);
+}
+
+static void test_cooked_strings_and_templates(void) {
+    const char *src = "x = ['a\\tb', `p\\n${y + 1}q${`in${z}`}r`];";
+    AstNode *root = NULL;
+    Program *pr = parse_prog(src, &root);
+    ExpressionStatement *es = (ExpressionStatement *)pr->body.items[0]->data;
+    AssignmentExpression *as = (AssignmentExpression *)es->expression->data;
+    ArrayExpression *arr = (ArrayExpression *)as->right->data;
+    ASSERT_EQ(arr->elements.count, 2, "string and template");
+    Literal *str = (Literal *)arr->elements.items[0]->data;
+    ASSERT_STR_EQ(str->raw, "'a\\tb'", "raw string kept");
+    ASSERT_STR_EQ(str->cooked, "a\tb", "string cooked");
+    AstNode *tn = arr->elements.items[1];
+    ASSERT_EQ(tn->type, AST_TemplateLiteral, "template literal");
+    TemplateLiteral *tl = (TemplateLiteral *)tn->data;
+    ASSERT_EQ(tl->quasis.count, 3, "three quasis");
+    ASSERT_EQ(tl->expressions.count, 2, "two substitutions");
+    TemplateElement *q0 = (TemplateElement *)tl->quasis.items[0]->data;
+    TemplateElement *q2 = (TemplateElement *)tl->quasis.items[2]->data;
+    ASSERT_STR_EQ(q0->value, "p\\n", "raw quasi");
+    ASSERT_STR_EQ(q0->cooked, "p\n", "cooked quasi");
+    ASSERT_EQ(q0->tail, 0, "head is not the tail");
+    ASSERT_STR_EQ(q2->value, "r", "last quasi");
+    ASSERT_EQ(q2->tail, 1, "last quasi is the tail");
+    ASSERT_EQ(tl->expressions.items[0]->type, AST_BinaryExpression, "first substitution");
+    ASSERT_EQ(tl->expressions.items[1]->type, AST_TemplateLiteral, "nested template");
+    ast_free(root);
+}
+
+static void test_unicode_identifier_names(void) {
+    AstNode *root = NULL;
+    Program *pr = parse_prog("\\u0061\\u{62} = caf\xc3\xa9;", &root);
+    ExpressionStatement *es = (ExpressionStatement *)pr->body.items[0]->data;
+    AssignmentExpression *as = (AssignmentExpression *)es->expression->data;
+    ASSERT_STR_EQ(((Identifier *)as->left->data)->name, "ab", "escapes decoded in identifier names");
+    ASSERT_STR_EQ(((Identifier *)as->right->data)->name, "caf\xc3\xa9", "UTF-8 identifier kept");
+    ast_free(root);
+}
+
+static BinaryExpression *binary_of(AstNode *n) {
+    return n && n->type == AST_BinaryExpression ? (BinaryExpression *)n->data : NULL;
+}
+
+static AstNode *first_expression(Program *pr) {
+    return ((ExpressionStatement *)pr->body.items[0]->data)->expression;
+}
+
+static void test_operator_table(void) {
+    AstNode *root = NULL;
+    // == binds looser than <, | looser than &, ** groups to the right
+    Program *pr = parse_prog("a == b < c | d & e ** f ** g;", &root);
+    BinaryExpression *bor = binary_of(first_expression(pr));
+    ASSERT_EQ(bor->operator, OP_PIPE, "| is loosest");
+    BinaryExpression *eq = binary_of(bor->left);
+    ASSERT_EQ(eq->operator, OP_EQ, "== under |");
+    ASSERT_EQ(binary_of(eq->right)->operator, OP_LT, "< binds tighter than ==");
+    BinaryExpression *band = binary_of(bor->right);
+    ASSERT_EQ(band->operator, OP_AMP, "& under |");
+    BinaryExpression *pow = binary_of(band->right);
+    ASSERT_EQ(pow->operator, OP_STAR_STAR, "** under &");
+    ASSERT_EQ(pow->left->type, AST_Identifier, "** is right-associative");
+    ASSERT_EQ(binary_of(pow->right)->operator, OP_STAR_STAR, "nested ** on the right");
+    ast_free(root);
+
+    pr = parse_prog("x = k in o || !~y ?? z instanceof C;", &root);
+    AssignmentExpression *as = (AssignmentExpression *)first_expression(pr)->data;
+    BinaryExpression *nullish = binary_of(as->right);
+    ASSERT_EQ(nullish->operator, OP_NULLISH, "?? and || share a level, left to right");
+    ASSERT_EQ(binary_of(nullish->left)->operator, OP_OR, "|| on the left");
+    ASSERT_EQ(binary_of(binary_of(nullish->left)->left)->operator, OP_IN, "in is relational");
+    ASSERT_EQ(binary_of(nullish->right)->operator, OP_INSTANCEOF, "instanceof is relational");
+    ast_free(root);
+
+    pr = parse_prog("for (k in o) {} for (var i = 0; i < n; i++) {}", &root);
+    ASSERT_EQ(pr->body.items[0]->type, AST_ForInStatement, "in ends a for head expression");
+    ASSERT_EQ(pr->body.items[1]->type, AST_ForStatement, "plain for still parses");
+    ast_free(root);
+
+    ASSERT_STR_EQ(ast_operator_str(OP_SHR_ASSIGN), ">>>=", "operator spelling");
+    ASSERT_EQ(ast_operator_from_str("instanceof"), OP_INSTANCEOF, "spelling to id");
+    ASSERT_EQ(ast_operator_from_str("=>"), OP_NONE, "not an operator");
+    ASSERT_STR_EQ(ast_operator_str(OP__COUNT), "", "out of range");
+}
+
+static void test_operator_codegen(void) {
+    // parentheses are kept exactly where grouping needs them
+    const char *cases[][2] = {
+        {"a - (b - c);", "a - (b - c);"},
+        {"(a - b) - c;", "a - b - c;"},
+        {"(a ** b) ** c;", "(a ** b) ** c;"},
+        {"a ** (b ** c);", "a ** b ** c;"},
+        {"(-a) ** b;", "(- a) ** b;"},
+        {"(a || b) ?? c;", "(a || b) ?? c;"},
+        {"a == (b < c);", "a == b < c;"},
+        {"(a == b) < c;", "(a == b) < c;"},
+        {"(a | b) & c;", "(a | b) & c;"},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        AstNode *root = NULL;
+        parse_prog(cases[i][0], &root);
+        CodegenResult r = codegen_generate(root, NULL);
+        size_t n = strlen(r.code);
+        while (n > 0 && r.code[n - 1] == '\n') r.code[--n] = '\0';
+        ASSERT_STR_EQ(r.code, cases[i][1], cases[i][0]);
+        codegen_result_free(&r);
+        ast_free(root);
+    }
+}
+
+static void test_arrow_functions(void) {
+    const char *src = "f = ({a, b: c = 1, ...o}, [, d], ...rest) => a;";
+    AstNode *root = NULL;
+    Program *pr = parse_prog(src, &root);
+    ASSERT_EQ(pr->body.count, 1, "one statement");
+    ExpressionStatement *es = (ExpressionStatement *)pr->body.items[0]->data;
+    AssignmentExpression *ae = (AssignmentExpression *)es->expression->data;
+    ASSERT_EQ(ae->right->type, AST_ArrowFunctionExpression, "right side is an arrow");
+    ArrowFunctionExpression *afe = (ArrowFunctionExpression *)ae->right->data;
+    ASSERT_EQ(afe->is_async, 0, "not async");
+    ASSERT_EQ(afe->params.count, 3, "three params");
+    ASSERT_EQ(afe->params.items[0]->type, AST_ObjectPattern, "object pattern param");
+    ASSERT_EQ(afe->params.items[1]->type, AST_ArrayPattern, "array pattern param");
+    ASSERT_EQ(afe->params.items[2]->type, AST_RestElement, "rest param");
+    ObjectPattern *op = (ObjectPattern *)afe->params.items[0]->data;
+    ASSERT_EQ(op->properties.count, 3, "three pattern entries");
+    Property *shorthand = (Property *)op->properties.items[0]->data;
+    ASSERT_EQ(shorthand->value->type, AST_Identifier, "shorthand binds a name");
+    ASSERT_EQ(shorthand->value != shorthand->key, 1, "shorthand value is its own node");
+    Property *renamed = (Property *)op->properties.items[1]->data;
+    ASSERT_EQ(renamed->value->type, AST_AssignmentPattern, "renamed entry has a default");
+    ASSERT_EQ(op->properties.items[2]->type, AST_RestElement, "object rest");
+    ArrayPattern *ap = (ArrayPattern *)afe->params.items[1]->data;
+    ASSERT_EQ(ap->elements.count, 2, "hole and element");
+    ASSERT_EQ(ap->elements.items[0] == NULL, 1, "leading hole");
+    ASSERT_EQ(afe->body->type, AST_Identifier, "expression body");
+    ast_free(root);
+
+    const char *cases[][2] = {
+        {"f = (a, b) => a + b;", "f = (a, b) => a + b;"},
+        {"f = () => 1;", "f = () => 1;"},
+        {"f = x => x;", "f = (x) => x;"},
+        {"f = async => async;", "f = (async) => async;"},
+        {"f = async x => x;", "f = async (x) => x;"},
+        {"f = async (w) => await w;", "f = async (w) => await w;"},
+        {"f = async () => (await a) ** 2;", "f = async () => (await a) ** 2;"},
+        {"f = async () => await (a + b);", "f = async () => await (a + b);"},
+        {"f = ({a, b: c = 1, ...o}, [, d, ,], ...r) => a;", "f = ({a, b: c = 1, ...o}, [, d, ,], ...r) => a;"},
+        {"f = (a = 1, {b} = {}) => a;", "f = (a = 1, {b} = {}) => a;"},
+        {"f = () => ({x: 1});", "f = () => ({x: 1});"},
+        {"g((x) => x * 2, y);", "g((x) => x * 2, y);"},
+        {"f = (/* a */ a, /* b */ b) /* c */ => a;", "f = (a, b) => a;\n/* a */\n/* b */\n/* c */"},
+        {"async(a, b);", "async(a, b);"},
+        {"(a) + (b);", "a + b;"},
+        {"await(x);", "await(x);"},
+        // heads nested in a scanned one are answered from its scan
+        {"f = (a = (b) => b, c = (d)) => (g) => g;", "f = (a = (b) => b, c = d) => (g) => g;"},
+        {"h((a, [b]) => a, (c), (e) => e);", "h((a, [b]) => a, c, (e) => e);"},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        root = NULL;
+        parse_prog(cases[i][0], &root);
+        CodegenResult r = codegen_generate(root, NULL);
+        size_t n = strlen(r.code);
+        while (n > 0 && r.code[n - 1] == '\n') r.code[--n] = '\0';
+        ASSERT_STR_EQ(r.code, cases[i][1], cases[i][0]);
+        codegen_result_free(&r);
+        ast_free(root);
+    }
+
+    // a skipped async body still parses `await` once materialized, from
+    // the lexer and from a pre-lexed buffer alike
+    const char *lazy_src = "f = async () => { await g(); };";
+    TokenBuffer tb;
+    ASSERT_EQ(lexer_tokenize_all(lazy_src, strlen(lazy_src), &tb), 0, "tokenized");
+    for (int bulk = 0; bulk < 2; ++bulk) {
+        Parser p;
+        if (bulk) parser_init_tokens(&p, lazy_src, strlen(lazy_src), &tb);
+        else parser_init(&p, lazy_src, strlen(lazy_src));
+        p.lazy_functions = 1;
+        root = parse_program(&p);
+        pr = (Program *)root->data;
+        es = (ExpressionStatement *)pr->body.items[0]->data;
+        ae = (AssignmentExpression *)es->expression->data;
+        ASSERT_EQ(ast_materialize_body(ae->right), 1, "body materialized");
+        BlockStatement *bs = (BlockStatement *)((ArrowFunctionExpression *)ae->right->data)->body->data;
+        ASSERT_EQ(bs->body.count, 1, "one body statement");
+        ExpressionStatement *inner = (ExpressionStatement *)bs->body.items[0]->data;
+        ASSERT_EQ(inner->expression->type, AST_AwaitExpression, "await parsed in the async body");
+        ast_free(root);
+    }
+    token_buffer_free(&tb);
+}
+
 int main(void) {
     test_object_and_array_literals();
     test_member_call_assignment();
     test_unary_update_binary_precedence();
+    test_numeric_literal_values();
+    test_cooked_strings_and_templates();
+    test_unicode_identifier_names();
+    test_operator_table();
+    test_operator_codegen();
+    test_arrow_functions();
     TEST_SUMMARY();
 }
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "quickjsflow/parser.h"
+#include "quickjsflow/compact.h"
+#include "test_framework.h"
+
+static const char *sample =
+    "// header\n"
+    "import { a } from './m';\n"
+    "const total = 1;\n"
+    "function first(x) {\n"
+    "  let y = x + 1;\n"
+    "  if (y > 2) { y = y * 2; }\n"
+    "  return y;\n"
+    "}\n"
+    "/* between */\n"
+    "function second(p) {\n"
+    "  const q = [p, `t${p}`];\n"
+    "  return q.map((v) => v + total);\n"
+    "}\n"
+    "export default second;\n";
+
+// src with [offset, offset + removed) replaced by `ins`
+static char *apply_edit(const char *src, TextEdit *edit, size_t offset, size_t removed, const char *ins) {
+    size_t len = strlen(src), il = strlen(ins);
+    char *next = (char *)malloc(len - removed + il + 1);
+    memcpy(next, src, offset);
+    memcpy(next + offset, ins, il);
+    memcpy(next + offset + il, src + offset + removed, len - offset - removed + 1);
+    edit->offset = offset;
+    edit->removed = removed;
+    edit->inserted = il;
+    return next;
+}
+
+static AstNode *parse_text(const char *src, int lazy) {
+    Parser p;
+    parser_init(&p, src, strlen(src));
+    p.lazy_functions = lazy;
+    return parse_program(&p);
+}
+
+static AstNode *reparse(AstNode *tree, const char *src, TextEdit edit, int lazy) {
+    Parser p;
+    parser_init(&p, src, strlen(src));
+    p.lazy_functions = lazy;
+    return parse_program_edit(&p, tree, edit);
+}
+
+// Binary image of a clone with every body parsed, so lazy trees compare
+// without being materialized themselves.
+static void *image_of(const AstNode *tree, size_t *size) {
+    AstNode *copy = ast_clone(tree);
+    compact_free(compact_from_ast(copy)); // materializing can move a body's end
+    CompactAst *ca = compact_from_ast(copy);
+    *size = compact_image_size(ca);
+    void *buf = malloc(*size);
+    compact_write_image(ca, buf);
+    compact_free(ca);
+    ast_free(copy);
+    return buf;
+}
+
+// Same nodes, comments, diagnostics and line starts as a full parse of src.
+static int same_as_full(const AstNode *tree, const char *src, int lazy) {
+    AstNode *full = parse_text(src, lazy);
+    size_t s1, s2;
+    void *a = image_of(tree, &s1), *b = image_of(full, &s2);
+    const Program *pa = (const Program *)tree->data, *pb = (const Program *)full->data;
+    int same = s1 == s2 && memcmp(a, b, s1) == 0 && pa->comment_count == pb->comment_count &&
+               pa->lines.count == pb->lines.count &&
+               memcmp(pa->lines.starts, pb->lines.starts, pa->lines.count * sizeof(uint32_t)) == 0;
+    // a lazy parse only reports the errors of bodies parsed so far
+    if (!lazy) same = same && pa->diagnostic_count == pb->diagnostic_count;
+    for (size_t i = 0; same && !lazy && i < pa->diagnostic_count; ++i) {
+        same = pa->diagnostics[i].start == pb->diagnostics[i].start && pa->diagnostics[i].end == pb->diagnostics[i].end &&
+               strcmp(pa->diagnostics[i].kind, pb->diagnostics[i].kind) == 0;
+    }
+    free(a);
+    free(b);
+    ast_free(full);
+    return same;
+}
+
+static AstNode *function_named(const AstNode *program, const char *name) {
+    const Program *pr = (const Program *)program->data;
+    for (size_t i = 0; i < pr->body.count; ++i) {
+        AstNode *n = pr->body.items[i];
+        if (n->type != AST_FunctionDeclaration) continue;
+        const FunctionBody *fb = (const FunctionBody *)n->data;
+        if (fb->name && strcmp(fb->name, name) == 0) return n;
+    }
+    return NULL;
+}
+
+static AstNode *body_statement(const AstNode *fn, size_t i) {
+    const BlockStatement *bs = (const BlockStatement *)((const FunctionBody *)fn->data)->body->data;
+    return i < bs->body.count ? bs->body.items[i] : NULL;
+}
+
+static void test_block_local_edit(void) {
+    AstNode *tree = parse_text(sample, 0);
+    AstNode *kept = body_statement(function_named(tree, "second"), 1);
+    SrcOffset kept_start = kept->start;
+    const Comment *between = ((const Program *)tree->data)->comments[1];
+    SrcOffset comment_start = between->start;
+
+    TextEdit edit;
+    size_t at = (size_t)(strstr(sample, "x + 1") - sample);
+    char *next = apply_edit(sample, &edit, at, 5, "x - 100");
+    AstNode *updated = reparse(tree, next, edit, 0);
+    ASSERT_EQ(updated == tree, 1, "tree updated in place");
+    ASSERT_EQ(same_as_full(updated, next, 0), 1, "matches a full parse");
+    AstNode *again = body_statement(function_named(updated, "second"), 1);
+    ASSERT_EQ(again == kept, 1, "statements of other functions kept");
+    ASSERT_EQ(again->start, kept_start + 2, "and moved by the length change");
+    ASSERT_EQ(((const Program *)updated->data)->comments[1]->start, comment_start + 2, "comments moved");
+    Position pos = ast_position(updated, again->start);
+    ASSERT_EQ(pos.line, 12, "line of a moved statement");
+    ast_free(updated);
+    free(next);
+}
+
+static void test_structure_changing_edits(void) {
+    // each edit applies to the previous result
+    static const struct { const char *find; size_t removed; const char *ins; } edits[] = {
+        {"if (y > 2) {", 0, "{"},           // unbalanced: the block grows to the end
+        {"{if (y > 2) {", 1, ""},           // and shrinks back
+        {"let y", 0, "`"},                  // opens a template across statements
+        {"`let y", 1, ""},
+        {"return y;\n}", 11, "return y;\n"}, // merges the two functions
+        {"/* between */", 0, "}"},
+        {"const q", 5, "const q = (a, b"},  // unbalanced arrow scan
+        {"const q = (a, b", 15, "const q"},
+        {"import", 0, "x = 1\n"},           // a new first statement
+        {"total = 1;", 10, "total = 1 +\n"},  // joins a declaration with the next line
+    };
+    char *src = (char *)malloc(strlen(sample) + 1);
+    strcpy(src, sample);
+    for (int lazy = 0; lazy < 2; ++lazy) {
+        AstNode *tree = parse_text(src, lazy);
+        int all_ok = 1;
+        for (size_t i = 0; i < sizeof(edits) / sizeof(edits[0]); ++i) {
+            const char *hit = strstr(src, edits[i].find);
+            if (!hit) { all_ok = 0; break; }
+            TextEdit edit;
+            char *next = apply_edit(src, &edit, (size_t)(hit - src), edits[i].removed, edits[i].ins);
+            tree = reparse(tree, next, edit, lazy);
+            if (!same_as_full(tree, next, lazy)) {
+                fprintf(stderr, "incremental parse differs after edit %zu (lazy %d)\n", i, lazy);
+                all_ok = 0;
+            }
+            free(src);
+            src = next;
+        }
+        ASSERT_EQ(all_ok, 1, lazy ? "lazy tree matches a full parse after every edit"
+                                  : "tree matches a full parse after every edit");
+        ast_free(tree);
+        free(src);
+        src = (char *)malloc(strlen(sample) + 1);
+        strcpy(src, sample);
+    }
+    free(src);
+}
+
+static void test_random_edits(void) {
+    static const char *inserts[] = {"", "x", "{", "}", "(", ")", ";", "\n", "`", "${", "'", "/*c*/", "// c\n",
+                                    "function g(){", "=>", "var v = 1;", "async ", "await ", "return ", "[", ","};
+    size_t len = strlen(sample);
+    char *src = (char *)malloc(len * 8 + 1);
+    for (int i = 0; i < 8; ++i) memcpy(src + i * len, sample, len);
+    len *= 8;
+    src[len] = '\0';
+    AstNode *tree = parse_text(src, 0);
+    unsigned r = 7;
+    int all_ok = 1;
+    for (int step = 0; step < 300; ++step) {
+        r = r * 1103515245u + 12345u;
+        size_t offset = (r >> 8) % (len + 1);
+        r = r * 1103515245u + 12345u;
+        size_t removed = (r >> 8) % 8;
+        if (offset + removed > len) removed = len - offset;
+        const char *ins = inserts[(r >> 20) % (sizeof(inserts) / sizeof(inserts[0]))];
+        TextEdit edit;
+        char *next = apply_edit(src, &edit, offset, removed, ins);
+        tree = reparse(tree, next, edit, 0);
+        if (!same_as_full(tree, next, 0)) {
+            fprintf(stderr, "incremental parse differs after edit %d at %zu\n", step, offset);
+            all_ok = 0;
+            ast_free(tree);
+            tree = parse_text(next, 0);
+        }
+        free(src);
+        src = next;
+        len = strlen(src);
+    }
+    ASSERT_EQ(all_ok, 1, "Incremental parse matches a full parse after every edit");
+    ast_free(tree);
+    free(src);
+}
+
+static void test_lazy_body_edit(void) {
+    AstNode *tree = parse_text(sample, 1);
+    TextEdit edit;
+    size_t at = (size_t)(strstr(sample, "y * 2") - sample);
+    char *next = apply_edit(sample, &edit, at, 5, "y * 3 + f()");
+    AstNode *updated = reparse(tree, next, edit, 1);
+    ASSERT_EQ(updated == tree, 1, "skipped body brace-matched again in place");
+    ASSERT_EQ(same_as_full(updated, next, 1), 1, "matches a full lazy parse");
+    // the bodies read the new text once parsed
+    AstNode *fn = function_named(updated, "second");
+    ASSERT_EQ(ast_materialize_body(fn), 1, "body parsed on demand");
+    AstNode *full = parse_text(next, 0);
+    AstNode *expect = function_named(full, "second");
+    ASSERT_EQ(body_statement(fn, 1)->start, body_statement(expect, 1)->start, "materialized at the new offsets");
+    ast_free(full);
+    ast_free(updated);
+    free(next);
+}
+
+static void test_full_parse_fallbacks(void) {
+    TextEdit edit;
+    size_t at = (size_t)(strstr(sample, "x + 1") - sample);
+    char *next = apply_edit(sample, &edit, at, 1, "z");
+
+    AstNode *tree = parse_text(sample, 0);
+    ast_retain(tree);
+    AstNode *updated = reparse(tree, next, edit, 0);
+    ASSERT_EQ(updated != tree, 1, "shared tree is parsed again, not changed");
+    ASSERT_EQ(same_as_full(updated, next, 0), 1, "the new tree matches");
+    ASSERT_EQ(same_as_full(tree, sample, 0), 1, "the shared one is untouched");
+    ast_release(tree);
+    ast_free(updated);
+
+    tree = parse_text(sample, 0);
+    TextEdit wrong = {at, 2, 1}; // does not match the new length
+    updated = reparse(tree, next, wrong, 0);
+    ASSERT_EQ(same_as_full(updated, next, 0), 1, "mismatched edit falls back to a full parse");
+    ast_free(updated);
+    free(next);
+
+    // the body is parsed while still recovering from the error in the head
+    const char *bad_head = "for (i <; i) { a; }";
+    tree = parse_text(bad_head, 0);
+    next = apply_edit(bad_head, &edit, 15, 0, "(");
+    updated = reparse(tree, next, edit, 0);
+    ASSERT_EQ(same_as_full(updated, next, 0), 1, "block entered during error recovery");
+    ast_free(updated);
+    free(next);
+}
+
+int main(void) {
+    test_block_local_edit();
+    test_structure_changing_edits();
+    test_random_edits();
+    test_lazy_body_edit();
+    test_full_parse_fallbacks();
+    TEST_SUMMARY();
+}
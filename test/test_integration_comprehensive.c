@@ -33,7 +33,12 @@ void test_lexer_produces_tokens(void) {
     
     Token t1 = lexer_next(&lex);
     ASSERT_EQ(t1.type, TOKEN_IDENTIFIER, "First token is identifier");
-    ASSERT_STR_EQ(t1.lexeme, "var", "First token is 'var'");
+    ASSERT_EQ(t1.offset, 0, "First token starts at offset 0");
+    ASSERT_EQ(t1.length, 3, "First token spans 3 bytes");
+    ASSERT_EQ(token_equals(&lex, &t1, "var"), 1, "First token is 'var'");
+    char *owned = token_lexeme(&lex, &t1);
+    ASSERT_STR_EQ(owned, "var", "Owned lexeme copy is 'var'");
+    free(owned);
     
     Token t2 = lexer_next(&lex);
     ASSERT_EQ(t2.type, TOKEN_IDENTIFIER, "Second token is identifier");
@@ -52,6 +57,36 @@ void test_parser_consumes_tokens(void) {
     ASSERT_NOT_NULL(p.lx.input, "Parser lexer initialized");
 }
 
+void test_parser_consumes_token_buffer(void) {
+    const char *src = "let a = 1;\nfunction f(x) { return x + a; }\n// tail\nf(a);";
+    size_t len = strlen(src);
+
+    TokenBuffer tb;
+    ASSERT_EQ(lexer_tokenize_all(src, len, &tb), 0, "Bulk tokenization succeeds");
+    ASSERT_EQ(tb.types[tb.count - 1], TOKEN_EOF, "Token buffer ends with EOF");
+
+    Parser streaming;
+    parser_init(&streaming, src, len);
+    AstNode *expected = parse_program(&streaming);
+
+    Parser bulk;
+    parser_init_tokens(&bulk, src, len, &tb);
+    AstNode *actual = parse_program(&bulk);
+
+    ASSERT_TRUE(ast_nodes_equal(expected, actual), "Bulk and streaming parses agree");
+
+    CodegenOptions opts = {2, ' ', 0, NULL};
+    CodegenResult r1 = codegen_generate(expected, &opts);
+    CodegenResult r2 = codegen_generate(actual, &opts);
+    ASSERT_STR_EQ(r1.code, r2.code, "Bulk and streaming parses generate the same code");
+    codegen_result_free(&r1);
+    codegen_result_free(&r2);
+
+    ast_free(expected);
+    ast_free(actual);
+    token_buffer_free(&tb);
+}
+
 void test_lexer_parser_round_trip(void) {
     const char *src = "let x = 'hello';";
     size_t len = strlen(src);
@@ -78,7 +113,7 @@ void test_ast_node_has_position_info(void) {
     AstNode *prog = parse_program(&p);
     
     ASSERT_NOT_NULL(prog, "Program created");
-    ASSERT_TRUE(prog->start.line >= 0, "Start position has valid line");
+    ASSERT_TRUE(ast_position(prog, prog->start).line >= 0, "Start position has valid line");
     
     Program *pr = (Program *)prog->data;
     ASSERT_NE((int)pr->body.count, 0, "Body has statements");
@@ -385,6 +420,7 @@ int main(void) {
     printf("=== Lexer → Parser Interface Tests ===\n");
     run_test_case("lexer_produces_tokens", NULL, NULL, test_lexer_produces_tokens);
     run_test_case("parser_consumes_tokens", NULL, NULL, test_parser_consumes_tokens);
+    run_test_case("parser_consumes_token_buffer", NULL, NULL, test_parser_consumes_token_buffer);
     run_test_case("lexer_parser_round_trip", NULL, NULL, test_lexer_parser_round_trip);
     
     printf("\n=== Parser → ScopeManager Interface Tests ===\n");
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "quickjsflow/json_writer.h"
+#include "quickjsflow/parser.h"
+#include "quickjsflow/scope.h"
+#include "test_framework.h"
+
+// The escaping ast_print_json has always produced, one byte at a time.
+static size_t reference_escape(const char *s, size_t n, char *out) {
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        switch (c) {
+            case '"': k += (size_t)sprintf(out + k, "\\\""); break;
+            case '\\': k += (size_t)sprintf(out + k, "\\\\"); break;
+            case '\n': k += (size_t)sprintf(out + k, "\\n"); break;
+            case '\r': k += (size_t)sprintf(out + k, "\\r"); break;
+            case '\t': k += (size_t)sprintf(out + k, "\\t"); break;
+            case '\b': k += (size_t)sprintf(out + k, "\\b"); break;
+            case '\f': k += (size_t)sprintf(out + k, "\\f"); break;
+            default:
+                if (c < 32 || c == 127) k += (size_t)sprintf(out + k, "\\u%04x", c);
+                else out[k++] = (char)c;
+                break;
+        }
+    }
+    out[k] = '\0';
+    return k;
+}
+
+static char *escaped(const char *s, size_t n) {
+    JsonWriter w;
+    json_writer_init_memory(&w);
+    json_escaped(&w, s, n);
+    return json_writer_take(&w, NULL);
+}
+
+// Every byte value alone and at each position of a long plain run, so all
+// vector widths and tails see it.
+static int escapes_match_reference(void) {
+    char buf[160], expect[1024];
+    for (int c = 0; c < 256; ++c) {
+        for (size_t at = 0; at < 100; at += (at < 40 ? 1 : 13)) {
+            memset(buf, 'a', 100);
+            buf[at] = (char)c;
+            reference_escape(buf, 100, expect);
+            char *got = escaped(buf, 100);
+            int same = got && strcmp(got, expect) == 0;
+            free(got);
+            if (!same) {
+                fprintf(stderr, "byte 0x%02x at %zu escaped differently\n", c, at);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static void test_escaping(void) {
+    static const char *backends[] = {"scalar", "sse2", "avx2"};
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+        if (lexer_set_scan_backend(backends[i]) != 0) continue; // not on this CPU
+        ASSERT_EQ(escapes_match_reference(), 1, backends[i]);
+    }
+    lexer_set_scan_backend(NULL);
+
+    char *s = escaped("tab\there \"q\" \x7f\xc3\xa9", 16);
+    ASSERT_STR_EQ(s, "tab\\there \\\"q\\\" \\u007f\xc3\xa9", "escapes, UTF-8 kept");
+    free(s);
+
+    JsonWriter w;
+    json_writer_init_memory(&w);
+    json_string(&w, "a\\b");
+    json_char(&w, ',');
+    json_string(&w, NULL);
+    s = json_writer_take(&w, NULL);
+    ASSERT_STR_EQ(s, "\"a\\\\b\",null", "quoted strings and null");
+    free(s);
+    json_writer_close(&w);
+}
+
+static void test_numbers(void) {
+    JsonWriter w;
+    json_writer_init_memory(&w);
+    json_int(&w, 0); json_char(&w, ' ');
+    json_int(&w, -7); json_char(&w, ' ');
+    json_int(&w, 1234567890); json_char(&w, ' ');
+    json_int(&w, LLONG_MIN); json_char(&w, ' ');
+    json_uint(&w, ULLONG_MAX); json_char(&w, ' ');
+    json_bool(&w, 2); json_char(&w, ' ');
+    json_bool(&w, 0);
+    size_t len;
+    char *s = json_writer_take(&w, &len);
+    char buf[128];
+    snprintf(buf, sizeof(buf), "0 -7 1234567890 %lld %llu true false", LLONG_MIN, ULLONG_MAX);
+    const char *expect = buf;
+    ASSERT_STR_EQ(s, expect, "integers formatted");
+    ASSERT_EQ(len, strlen(expect), "length reported");
+    free(s);
+    json_writer_close(&w);
+}
+
+// Output larger than the buffer, written through each kind of sink.
+static void test_sinks(void) {
+    size_t pieces = JSON_WRITER_BUFFER / 8 * 3;
+    FILE *via_file = tmpfile(), *via_fd = tmpfile();
+    JsonWriter wf, wd, wm;
+    json_writer_init_file(&wf, via_file);
+    json_writer_init_fd(&wd, fileno(via_fd));
+    json_writer_init_memory(&wm);
+    JsonWriter *all[] = {&wf, &wd, &wm};
+    for (size_t i = 0; i < pieces; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            json_lit(all[k], "[\"x\",");
+            json_int(all[k], (long long)(i % 100));
+            json_char(all[k], ']');
+        }
+    }
+    size_t len;
+    char *mem = json_writer_take(&wm, &len);
+    ASSERT_NOT_NULL(mem, "memory output");
+    ASSERT_EQ(json_writer_close(&wf), 0, "file writer closed");
+    ASSERT_EQ(json_writer_close(&wd), 0, "fd writer closed");
+    json_writer_close(&wm);
+
+    FILE *files[] = {via_file, via_fd};
+    for (int k = 0; k < 2; ++k) {
+        fflush(files[k]);
+        rewind(files[k]);
+        char *back = (char *)malloc(len + 1);
+        size_t got = fread(back, 1, len + 1, files[k]);
+        ASSERT_EQ(got, len, k ? "fd output complete" : "file output complete");
+        ASSERT_EQ(memcmp(back, mem, len), 0, k ? "fd output matches memory" : "file output matches memory");
+        free(back);
+        fclose(files[k]);
+    }
+    free(mem);
+}
+
+static void test_ast_json(void) {
+    const char *src = "let s = 'a\"b';\nt = `x\x01\\n${s}`;\n";
+    Parser p;
+    parser_init(&p, src, strlen(src));
+    AstNode *prog = parse_program(&p);
+    JsonWriter w;
+    json_writer_init_memory(&w);
+    ast_write_json(&w, prog);
+    char *s = json_writer_take(&w, NULL);
+    ASSERT_STR_EQ(s,
+        "{\"type\":\"Program\",\"start\":{\"line\":0,\"column\":0},\"end\":{\"line\":0,\"column\":0},\"body\":["
+        "{\"type\":\"VariableDeclaration\",\"start\":{\"line\":1,\"column\":1},\"end\":{\"line\":1,\"column\":15},"
+        "\"kind\":\"let\",\"declarations\":[{\"type\":\"VariableDeclarator\",\"start\":{\"line\":1,\"column\":5},"
+        "\"end\":{\"line\":1,\"column\":14},\"id\":{\"type\":\"Identifier\",\"start\":{\"line\":1,\"column\":5},"
+        "\"end\":{\"line\":1,\"column\":6},\"name\":\"s\"},\"init\":{\"type\":\"Literal\",\"start\":{\"line\":1,"
+        "\"column\":9},\"end\":{\"line\":1,\"column\":14},\"raw\":\"'a\\\"b'\"}}]},{\"type\":\"ExpressionStatement\","
+        "\"start\":{\"line\":2,\"column\":1},\"end\":{\"line\":2,\"column\":15},\"expression\":{\"type\":"
+        "\"AssignmentExpression\",\"start\":{\"line\":2,\"column\":1},\"end\":{\"line\":2,\"column\":15},"
+        "\"operator\":\"=\",\"left\":{\"type\":\"Identifier\",\"start\":{\"line\":2,\"column\":1},\"end\":{\"line\":2,"
+        "\"column\":2},\"name\":\"t\"},\"right\":{\"type\":\"TemplateLiteral\",\"start\":{\"line\":2,\"column\":5},"
+        "\"end\":{\"line\":2,\"column\":15},\"quasis\":[{\"type\":\"TemplateElement\",\"start\":{\"line\":2,"
+        "\"column\":5},\"end\":{\"line\":2,\"column\":12},\"value\":{\"raw\":\"x\\u0001\\\\n\",\"cooked\":"
+        "\"x\\u0001\\n\"},\"tail\":false},{\"type\":\"TemplateElement\",\"start\":{\"line\":2,\"column\":13},"
+        "\"end\":{\"line\":2,\"column\":15},\"value\":{\"raw\":\"\",\"cooked\":\"\"},\"tail\":true}],"
+        "\"expressions\":[{\"type\":\"Identifier\",\"start\":{\"line\":2,\"column\":12},\"end\":{\"line\":2,"
+        "\"column\":13},\"name\":\"s\"}]}}}]}",
+        "AST JSON unchanged");
+    free(s);
+
+    ScopeManager sm;
+    scope_manager_init(&sm);
+    scope_analyze(&sm, prog, 0);
+    scope_write_json(&w, sm.root);
+    s = json_writer_take(&w, NULL);
+    ASSERT_EQ(strstr(s, "{\"name\":\"s\",\"kind\":\"let\",\"loc\":{\"line\":1,\"column\":5},\"shadowed\":null}") != NULL, 1,
+              "scope JSON written");
+    free(s);
+    json_writer_close(&w);
+    scope_manager_free(&sm);
+    ast_free(prog);
+}
+
+// The printer keeps its work on the heap, so nesting the parser accepts is
+// printed too, far past what native recursion survives.
+static void test_deep_ast_json(void) {
+    size_t depth = 200000;
+    char *src = (char *)malloc(depth * 2 + 8);
+    memcpy(src, "x = ", 4);
+    memset(src + 4, '[', depth);
+    memset(src + 4 + depth, ']', depth);
+    strcpy(src + 4 + depth * 2, ";\n");
+    Parser p;
+    parser_init(&p, src, strlen(src));
+    AstNode *prog = parse_program(&p);
+    JsonWriter w;
+    json_writer_init_memory(&w);
+    ast_write_json(&w, prog);
+    char *s = json_writer_take(&w, NULL);
+    size_t arrays = 0;
+    for (const char *at = s; at && (at = strstr(at, "\"ArrayExpression\"")); ++at) ++arrays;
+    ASSERT_EQ(arrays == depth, 1, "every nested array printed");
+    ASSERT_EQ(s != NULL && strcmp(s + strlen(s) - 6, "]}}}]}") == 0, 1, "deep AST JSON closed");
+    free(s);
+    json_writer_close(&w);
+    ast_free(prog);
+    free(src);
+}
+
+int main(void) {
+    test_escaping();
+    test_numbers();
+    test_sinks();
+    test_ast_json();
+    test_deep_ast_json();
+    TEST_SUMMARY();
+}
@@ -0,0 +1,756 @@
+#include <stdlib.h>
+#include <string.h>
+#include "quickjsflow/lexer.h"
+#include "test_framework.h"
+
+#define MAX_TOKENS 256
+
+static size_t lex_all(const char *src, size_t len, Token *out) {
+    Lexer lx;
+    lexer_init(&lx, src, len);
+    size_t n = 0;
+    for (;;) {
+        Token t = lexer_next(&lx);
+        if (n < MAX_TOKENS) out[n++] = t;
+        if (t.type == TOKEN_EOF || n >= MAX_TOKENS) break;
+    }
+    return n;
+}
+
+// Builds a source with runs long enough to exercise the vector loops and
+// their scalar tails.
+static char *make_long_source(size_t *len_out) {
+    size_t cap = 8192, len = 0;
+    char *s = (char *)malloc(cap);
+    const char *parts[] = {
+        "   \t\t  \r\n\n        \n",
+        "var s = \"", NULL, "\\\"tail\";\n",
+        "/* license ", NULL, "\n * line two\n * line three ", NULL, " */\n",
+        "// line comment ", NULL, "\n",
+        "let t = `first ", NULL, "\n second \\` ${x} ", NULL, "`;\n",
+        "                                                   x;\n",
+        "'unterminated ", NULL, "\n",
+        "/* never closed ", NULL
+    };
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i) {
+        if (parts[i]) {
+            size_t pl = strlen(parts[i]);
+            memcpy(s + len, parts[i], pl);
+            len += pl;
+        } else {
+            // filler of an awkward length
+            for (size_t k = 0; k < 77 + i * 5; ++k) s[len++] = (char)('a' + (k % 26));
+        }
+    }
+    s[len] = '\0';
+    *len_out = len;
+    return s;
+}
+
+static void test_backend_available(void) {
+    ASSERT_NOT_NULL(lexer_scan_backend(), "A scan backend is selected");
+    ASSERT_EQ(lexer_set_scan_backend("scalar"), 0, "Scalar backend is always available");
+    ASSERT_STR_EQ(lexer_scan_backend(), "scalar", "Scalar backend is active");
+    ASSERT_EQ(lexer_set_scan_backend("no-such-backend"), -1, "Unknown backend is rejected");
+    ASSERT_EQ(lexer_set_scan_backend(NULL), 0, "Auto-detection can be restored");
+}
+
+static void test_backends_agree(void) {
+    size_t len = 0;
+    char *src = make_long_source(&len);
+    static Token ref[MAX_TOKENS], got[MAX_TOKENS];
+
+    lexer_set_scan_backend("scalar");
+    size_t nref = lex_all(src, len, ref);
+    ASSERT_EQ(ref[nref - 1].type, TOKEN_EOF, "Scalar lexing reaches EOF");
+
+    const char *names[] = {"sse2", "avx2"};
+    for (size_t b = 0; b < 2; ++b) {
+        if (lexer_set_scan_backend(names[b]) != 0) continue;
+        size_t ngot = lex_all(src, len, got);
+        ASSERT_EQ(ngot, nref, "Vector backend produces the same token count");
+        int same = 1;
+        for (size_t i = 0; i < nref && i < ngot; ++i) {
+            if (got[i].type != ref[i].type || got[i].offset != ref[i].offset ||
+                got[i].length != ref[i].length || got[i].error != ref[i].error) {
+                same = 0;
+            }
+        }
+        ASSERT_EQ(same, 1, "Vector backend matches scalar tokens");
+    }
+    lexer_set_scan_backend(NULL);
+    free(src);
+}
+
+static void test_positions_after_long_runs(void) {
+    const char *src = "/* a\n bb\n ccc */\n\n    `x\ny` z";
+    size_t len = strlen(src);
+    Token toks[MAX_TOKENS];
+    size_t n = lex_all(src, len, toks);
+    ASSERT_EQ(n, 4, "Comment, template, identifier and EOF");
+
+    LineIndex li;
+    ASSERT_EQ(line_index_build(&li, src, len), 0, "Line index builds");
+    Position p = line_index_position(&li, toks[0].offset + toks[0].length);
+    ASSERT_EQ(toks[0].type, TOKEN_COMMENT_BLOCK, "Block comment token");
+    ASSERT_EQ(p.line, 3, "Block comment ends on line 3");
+    ASSERT_EQ(p.column, 8, "Block comment end column");
+    p = line_index_position(&li, toks[1].offset);
+    ASSERT_EQ(toks[1].type, TOKEN_TEMPLATE, "Template token");
+    ASSERT_EQ(p.line, 5, "Template starts on line 5");
+    ASSERT_EQ(p.column, 5, "Template start column");
+    ASSERT_EQ(line_index_position(&li, toks[1].offset + toks[1].length).line, 6, "Template ends on line 6");
+    ASSERT_EQ(line_index_position(&li, toks[2].offset).column, 4, "Identifier column after multi-line template");
+    line_index_free(&li);
+}
+
+static void test_line_index(void) {
+    size_t len = 0;
+    char *src = make_long_source(&len);
+    LineIndex li;
+    ASSERT_EQ(line_index_build(&li, src, len), 0, "Line index builds on long input");
+    size_t lines = 1;
+    for (size_t i = 0; i < len; ++i) if (src[i] == '\n') lines++;
+    ASSERT_EQ(li.count, lines, "One entry per line");
+
+    // Walk every byte and compare with a naive line/column count.
+    int ok = 1, line = 1, col = 1;
+    for (size_t i = 0; i <= len; ++i) {
+        Position p = line_index_position(&li, i);
+        if (p.line != line || p.column != col) ok = 0;
+        if (i < len && src[i] == '\n') { line++; col = 1; } else col++;
+    }
+    ASSERT_EQ(ok, 1, "Binary search agrees with a linear scan");
+
+    Position none = line_index_position(&li, SIZE_MAX);
+    ASSERT_EQ(none.line, 0, "Unknown offset has line 0");
+    ASSERT_EQ(none.column, 0, "Unknown offset has column 0");
+    line_index_free(&li);
+    free(src);
+
+    const char *three = "ab\ncd\n";
+    ASSERT_EQ(line_index_build(&li, three, strlen(three)), 0, "Small index builds");
+    ASSERT_EQ(line_index_line_end(&li, 0), 2, "First line ends at its newline");
+    ASSERT_EQ(line_index_line_end(&li, 4), 5, "Second line ends at its newline");
+    ASSERT_EQ(line_index_line_end(&li, 6), 6, "Last empty line ends at EOF");
+    line_index_free(&li);
+}
+
+static void test_embedded_nul_stops_string(void) {
+    const char src[] = {'"', 'a', 'b', '\0', 'c', '"'};
+    Token toks[MAX_TOKENS];
+    lex_all(src, sizeof(src), toks);
+    ASSERT_EQ(toks[0].type, TOKEN_ERROR, "String cut by NUL is unterminated");
+    ASSERT_EQ(toks[0].length, 3, "Unterminated string stops before the NUL");
+}
+
+static void test_keyword_ids(void) {
+    int all_ok = 1;
+    for (int k = KW_NONE + 1; k < KW__COUNT; ++k) {
+        const char *kw = keyword_str((KeywordId)k);
+        Lexer lx;
+        lexer_init(&lx, kw, strlen(kw));
+        Token t = lexer_next(&lx);
+        if (t.type != TOKEN_IDENTIFIER || t.kw != (KeywordId)k) {
+            fprintf(stderr, "keyword '%s' not classified\n", kw);
+            all_ok = 0;
+        }
+    }
+    ASSERT_EQ(all_ok, 1, "Every keyword is classified with its own id");
+
+    const char *src = "iff form classy x in_ $var";
+    Token toks[MAX_TOKENS];
+    size_t n = lex_all(src, strlen(src), toks);
+    int none = 1;
+    for (size_t i = 0; i + 1 < n; ++i) {
+        if (toks[i].kw != KW_NONE) none = 0;
+    }
+    ASSERT_EQ(none, 1, "Keyword lookalikes are plain identifiers");
+}
+
+static void test_punct_ids(void) {
+    const char *src = "{ ( ) ; => ... == != <= >= ++ -- && || + = }";
+    const PunctId want[] = {
+        PUNCT_LBRACE, PUNCT_LPAREN, PUNCT_RPAREN, PUNCT_SEMICOLON, PUNCT_ARROW, PUNCT_ELLIPSIS,
+        PUNCT_EQ, PUNCT_NE, PUNCT_LE, PUNCT_GE, PUNCT_INC, PUNCT_DEC, PUNCT_AND, PUNCT_OR,
+        PUNCT_PLUS, PUNCT_ASSIGN, PUNCT_RBRACE
+    };
+    Token toks[MAX_TOKENS];
+    size_t n = lex_all(src, strlen(src), toks);
+    ASSERT_EQ(n, sizeof(want) / sizeof(want[0]) + 1, "Punctuator count");
+    int all_ok = 1;
+    for (size_t i = 0; i < sizeof(want) / sizeof(want[0]); ++i) {
+        if (toks[i].punct != want[i]) all_ok = 0;
+    }
+    ASSERT_EQ(all_ok, 1, "Punctuators carry their ids");
+    ASSERT_STR_EQ(punct_str(PUNCT_ARROW), "=>", "punct_str spells ids");
+    ASSERT_STR_EQ(punct_str(PUNCT_NONE), "", "punct_str of PUNCT_NONE is empty");
+}
+
+static void test_all_punctuators_single_token(void) {
+    int all_ok = 1;
+    for (int id = PUNCT_NONE + 1; id < PUNCT__COUNT; ++id) {
+        const char *text = punct_str((PunctId)id);
+        Lexer lx;
+        lexer_init(&lx, text, strlen(text));
+        Token t = lexer_next(&lx);
+        Token eof = lexer_next(&lx);
+        if (t.type != TOKEN_PUNCTUATOR || t.punct != (PunctId)id ||
+            t.length != strlen(text) || eof.type != TOKEN_EOF) {
+            fprintf(stderr, "punctuator '%s' not scanned as one token\n", text);
+            all_ok = 0;
+        }
+    }
+    ASSERT_EQ(all_ok, 1, "Every ES punctuator is a single token");
+}
+
+static void test_maximal_munch(void) {
+    const char *src = "a>>>=b!==c**=d?.e?\?=f:g...h..i";
+    const PunctId want[] = {
+        PUNCT_SHR_ASSIGN, PUNCT_STRICT_NE, PUNCT_STAR_STAR_ASSIGN, PUNCT_OPTIONAL_CHAIN,
+        PUNCT_NULLISH_ASSIGN, PUNCT_COLON, PUNCT_ELLIPSIS, PUNCT_DOT, PUNCT_DOT
+    };
+    Token toks[MAX_TOKENS];
+    size_t n = lex_all(src, strlen(src), toks);
+    size_t k = 0;
+    int all_ok = 1;
+    for (size_t i = 0; i < n; ++i) {
+        if (toks[i].type != TOKEN_PUNCTUATOR) continue;
+        if (k >= sizeof(want) / sizeof(want[0]) || toks[i].punct != want[k]) all_ok = 0;
+        k++;
+    }
+    ASSERT_EQ(k, sizeof(want) / sizeof(want[0]), "Punctuator count with maximal munch");
+    ASSERT_EQ(all_ok, 1, "Longest punctuator wins");
+
+    const char *cond = "a?.5:b";
+    n = lex_all(cond, strlen(cond), toks);
+    ASSERT_EQ(toks[1].punct, PUNCT_QUESTION, "?. before a digit is a conditional");
+    ASSERT_EQ(toks[1].length, 1, "Conditional ? is one byte");
+}
+
+static void test_tokenize_all_matches_lexer_next(void) {
+    size_t len = 0;
+    char *src = make_long_source(&len);
+    static Token ref[MAX_TOKENS];
+    size_t nref = lex_all(src, len, ref);
+
+    TokenBuffer tb;
+    ASSERT_EQ(lexer_tokenize_all(src, len, &tb), 0, "lexer_tokenize_all succeeds");
+    ASSERT_EQ(tb.count, nref, "Bulk and pull lexing give the same token count");
+    int same = 1;
+    for (size_t i = 0; i < nref && i < tb.count; ++i) {
+        Token t = token_buffer_get(&tb, i);
+        if (t.type != ref[i].type || t.offset != ref[i].offset || t.length != ref[i].length ||
+            t.kw != ref[i].kw || t.punct != ref[i].punct || t.error != ref[i].error ||
+            (t.error && strcmp(t.error_kind, ref[i].error_kind) != 0)) {
+            same = 0;
+        }
+    }
+    ASSERT_EQ(same, 1, "token_buffer_get rebuilds the pulled tokens");
+    ASSERT_EQ(tb.error_count, 2, "Both unterminated tokens are recorded as errors");
+    ASSERT_EQ(token_buffer_get(&tb, tb.count + 5).type, TOKEN_EOF, "Out-of-range index clamps to EOF");
+    token_buffer_free(&tb);
+    free(src);
+
+    const char *two_lines = "a b\nc";
+    ASSERT_EQ(lexer_tokenize_all(two_lines, strlen(two_lines), &tb), 0, "Small input tokenizes");
+    ASSERT_EQ(tb.flags[1] & TOKF_NEWLINE_BEFORE, 0, "No newline before b");
+    ASSERT_EQ(tb.flags[2] & TOKF_NEWLINE_BEFORE, TOKF_NEWLINE_BEFORE, "Newline before c");
+    token_buffer_free(&tb);
+}
+
+static int same_token_buffers(const TokenBuffer *a, const TokenBuffer *b) {
+    if (a->count != b->count || a->error_count != b->error_count) return 0;
+    for (size_t i = 0; i < a->count; ++i) {
+        if (a->types[i] != b->types[i] || a->ids[i] != b->ids[i] || a->flags[i] != b->flags[i] ||
+            a->offsets[i] != b->offsets[i] || a->lengths[i] != b->lengths[i]) {
+            return 0;
+        }
+    }
+    for (size_t k = 0; k < a->error_count; ++k) {
+        if (a->errors[k].index != b->errors[k].index || strcmp(a->errors[k].kind, b->errors[k].kind) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Random mix of fragments chosen so that chunk boundaries land inside
+// multi-line comments, templates and backslash-continued strings.
+static char *make_chunky_source(unsigned seed, size_t target, const char *tail, size_t *len_out) {
+    static const char *frags[] = {
+        "var a = b + c;\n", "x >>>= 1; y ?? z;\n", "// comment ` ' \" /*\n",
+        "/* block\n * ` ' \"\n */\n", "let t = `line\n${a}\n\\`still\n`;\n",
+        "s = 'one \\\n two';\n", "d = \"x\\\ny\\\nz\";\n", "u = 'broken\n",
+        "    \n\n", "if (a) { b(); } else { c(); }\n", "`\n\n\n\n`\n", "/*\n\n\n*/ q\n",
+        "q = `a${ {k: `in${x}\n`}.k }b${\n f({}) // }\n }\n`;\n", "h = `${\n\n`${'}'}`\n\n}`;\n"
+    };
+    size_t cap = target + 4096, len = 0;
+    char *s = (char *)malloc(cap);
+    unsigned r = seed;
+    while (len < target) {
+        r = r * 1103515245u + 12345u;
+        const char *f = frags[(r >> 16) % (sizeof(frags) / sizeof(frags[0]))];
+        size_t fl = strlen(f);
+        memcpy(s + len, f, fl);
+        len += fl;
+    }
+    size_t tl = strlen(tail);
+    memcpy(s + len, tail, tl);
+    len += tl;
+    s[len] = '\0';
+    *len_out = len;
+    return s;
+}
+
+static void test_tokenize_parallel_matches_sequential(void) {
+    size_t saved = lexer_parallel_threshold();
+    lexer_set_parallel_threshold(0);
+    const char *tails[] = {"", "\n", "`open template\n\n", "/* open comment\n", "'a\\\n", "`t${ {\n a +\n"};
+    const size_t threads[] = {2, 3, 7, 16};
+    int all_ok = 1;
+    for (unsigned seed = 1; seed <= 6; ++seed) {
+        size_t len = 0;
+        char *src = make_chunky_source(seed, 96 * 1024, tails[seed % 6], &len);
+        TokenBuffer ref;
+        lexer_tokenize_all(src, len, &ref);
+        for (size_t k = 0; k < sizeof(threads) / sizeof(threads[0]); ++k) {
+            TokenBuffer got;
+            if (lexer_tokenize_parallel(src, len, threads[k], &got) != 0 || !same_token_buffers(&ref, &got)) {
+                fprintf(stderr, "parallel lexing differs: seed %u, %zu threads\n", seed, threads[k]);
+                all_ok = 0;
+            }
+            token_buffer_free(&got);
+        }
+        token_buffer_free(&ref);
+        free(src);
+    }
+    ASSERT_EQ(all_ok, 1, "Parallel tokenization reproduces the sequential stream");
+
+    // One template spanning every chunk, and a NUL that ends the stream early.
+    size_t len = 64 * 1024;
+    char *src = (char *)malloc(len + 1);
+    memset(src, '\n', len);
+    src[0] = '`';
+    src[len - 2] = '`';
+    src[len / 2 + 3] = '\0';
+    TokenBuffer ref, got;
+    lexer_tokenize_all(src, len, &ref);
+    ASSERT_EQ(lexer_tokenize_parallel(src, len, 8, &got), 0, "Parallel tokenization succeeds");
+    ASSERT_EQ(same_token_buffers(&ref, &got), 1, "Chunk-spanning token and NUL match");
+    ASSERT_EQ(got.count, 2, "Unterminated template then EOF");
+    token_buffer_free(&ref);
+    token_buffer_free(&got);
+    free(src);
+    lexer_set_parallel_threshold(saved);
+}
+
+static void test_relex_matches_full_lex(void) {
+    static const char *inserts[] = {"", "x", "/*", "*/", "`", "'", "\\", "\n", ">", ">=", "?.", "5", " ", "a\nb",
+                                    "${", "}", "{", "`${x}`"};
+    size_t len = 0;
+    char *src = make_chunky_source(7, 8 * 1024, "", &len);
+    TokenBuffer tb;
+    lexer_tokenize_all(src, len, &tb);
+    unsigned r = 99;
+    int all_ok = 1;
+    for (int step = 0; step < 400; ++step) {
+        r = r * 1103515245u + 12345u;
+        size_t offset = (r >> 8) % (len + 1);
+        r = r * 1103515245u + 12345u;
+        size_t removed = (r >> 8) % 6;
+        if (offset + removed > len) removed = len - offset;
+        const char *ins = inserts[(r >> 20) % (sizeof(inserts) / sizeof(inserts[0]))];
+        size_t il = strlen(ins);
+
+        char *next = (char *)malloc(len - removed + il + 1);
+        memcpy(next, src, offset);
+        memcpy(next + offset, ins, il);
+        memcpy(next + offset + il, src + offset + removed, len - offset - removed);
+        len = len - removed + il;
+        next[len] = '\0';
+        free(src);
+        src = next;
+
+        TextEdit edit = {offset, removed, il};
+        TokenBuffer ref;
+        lexer_tokenize_all(src, len, &ref);
+        if (lexer_relex(&tb, src, len, edit, NULL) != 0 || !same_token_buffers(&ref, &tb)) {
+            fprintf(stderr, "relex differs after edit %d at %zu\n", step, offset);
+            all_ok = 0;
+            token_buffer_free(&tb);
+            tb = ref;
+            continue;
+        }
+        token_buffer_free(&ref);
+    }
+    ASSERT_EQ(all_ok, 1, "Incremental relex matches a full relex after every edit");
+    token_buffer_free(&tb);
+    free(src);
+
+    // A local edit in a large file only touches the tokens around it.
+    char *big = make_chunky_source(3, 256 * 1024, "", &len);
+    lexer_tokenize_all(big, len, &tb);
+    size_t at = (size_t)(strstr(big + len / 2, "b + c;") - big) + 5;
+    big[at] = ',';
+    size_t relexed = 0;
+    TextEdit edit = {at, 1, 1};
+    ASSERT_EQ(lexer_relex(&tb, big, len, edit, &relexed), 0, "Relex succeeds");
+    ASSERT_EQ(relexed <= 4, 1, "Only the tokens near the edit are re-lexed");
+    TokenBuffer ref;
+    lexer_tokenize_all(big, len, &ref);
+    ASSERT_EQ(same_token_buffers(&ref, &tb), 1, "Local edit result matches a full relex");
+    token_buffer_free(&ref);
+    token_buffer_free(&tb);
+    free(big);
+
+    TextEdit bad = {10, 0, 5};
+    ASSERT_EQ(lexer_relex(&tb, "abc", 3, bad, NULL), -1, "Edit outside the input is rejected");
+
+    // the edit must turn the old text's length into the new one's
+    const char *old_src = "a = 1; b = 2; c = 3;";
+    lexer_tokenize_all(old_src, strlen(old_src), &tb);
+    size_t old_count = tb.count;
+    TextEdit unrelated = {2, 0, 0};
+    ASSERT_EQ(lexer_relex(&tb, "a = 1;", 6, unrelated, NULL), -1, "Edit that does not match the old text is rejected");
+    ASSERT_EQ(tb.count, old_count, "Rejected edit leaves the tokens alone");
+    TextEdit past_end = {18, 5, 3};
+    ASSERT_EQ(lexer_relex(&tb, old_src, 18, past_end, NULL), -1, "Edit past the old text is rejected");
+    TextEdit shrink = {6, 14, 0};
+    ASSERT_EQ(lexer_relex(&tb, "a = 1;", 6, shrink, NULL), 0, "Matching edit is accepted");
+    ASSERT_EQ(tb.count, 5, "a = 1 ; EOF");
+    token_buffer_free(&tb);
+}
+
+typedef struct {
+    const char *src;
+    size_t len, pos;
+    unsigned seed;
+} MemSource;
+
+// Hands out 1..13 bytes per call to exercise every window boundary.
+static long read_mem(void *ctx, char *buf, size_t cap) {
+    MemSource *m = (MemSource *)ctx;
+    m->seed = m->seed * 1103515245u + 12345u;
+    size_t n = 1 + (m->seed >> 16) % 13;
+    if (n > cap) n = cap;
+    if (n > m->len - m->pos) n = m->len - m->pos;
+    memcpy(buf, m->src + m->pos, n);
+    m->pos += n;
+    return (long)n;
+}
+
+static int stream_matches(const char *src, size_t len, size_t window) {
+    Lexer lx;
+    lexer_init(&lx, src, len);
+    LineIndex li;
+    line_index_build(&li, src, len);
+    MemSource m = {src, len, 0, 5};
+    StreamLexer sl;
+    if (stream_lexer_init(&sl, read_mem, &m, window) != 0) return 0;
+    int ok = 1;
+    for (;;) {
+        Token want = lexer_next(&lx);
+        Token got = stream_lexer_next(&sl);
+        Position ps = stream_lexer_position(&sl, got.offset);
+        Position pe = stream_lexer_position(&sl, got.offset + got.length);
+        Position ws = line_index_position(&li, want.offset);
+        Position we = line_index_position(&li, want.offset + want.length);
+        if (got.type != want.type || got.offset != want.offset || got.length != want.length ||
+            got.kw != want.kw || got.punct != want.punct || got.error != want.error ||
+            memcmp(stream_lexer_text(&sl, &got), src + want.offset, want.length) != 0 ||
+            ps.line != ws.line || ps.column != ws.column || pe.line != we.line || pe.column != we.column) {
+            ok = 0;
+            break;
+        }
+        if (want.type == TOKEN_EOF) break;
+    }
+    stream_lexer_free(&sl);
+    line_index_free(&li);
+    return ok;
+}
+
+static void test_stream_lexer(void) {
+    size_t len = 0;
+    char *src = make_long_source(&len);
+    ASSERT_EQ(stream_matches(src, len, 64), 1, "Streaming with a tiny window matches lexer_next");
+    free(src);
+    src = make_chunky_source(11, 32 * 1024, "`open\n", &len);
+    ASSERT_EQ(stream_matches(src, len, 256), 1, "Tokens straddling windows are rebuilt");
+    ASSERT_EQ(stream_matches(src, len, 4096), 1, "Larger window gives the same stream");
+    free(src);
+
+    // A token longer than the window grows it; the rest stays bounded.
+    char big[5000];
+    memset(big, 'x', sizeof(big));
+    big[0] = '"';
+    big[sizeof(big) - 2] = '"';
+    big[sizeof(big) - 1] = ';';
+    MemSource m = {big, sizeof(big), 0, 1};
+    StreamLexer sl;
+    stream_lexer_init(&sl, read_mem, &m, 64);
+    Token t = stream_lexer_next(&sl);
+    ASSERT_EQ(t.type, TOKEN_STRING, "Long string is one token");
+    ASSERT_EQ(t.length, sizeof(big) - 1, "Long string length");
+    ASSERT_EQ(stream_lexer_next(&sl).punct, PUNCT_SEMICOLON, "Lexing continues after it");
+    ASSERT_EQ(stream_lexer_next(&sl).type, TOKEN_EOF, "Then EOF");
+    stream_lexer_free(&sl);
+}
+
+static void test_numeric_forms(void) {
+    const char *src = "0x1F 0o17 0b101 017 019 1_000 .5 1e3 1.5e-3 10n 0XFFn 1_0.0_1 0 0.0 1.";
+    const double want[] = {31, 15, 5, 15, 19, 1000, 0.5, 1000, 1.5e-3, 10, 255, 10.01, 0, 0, 1};
+    const size_t count = sizeof(want) / sizeof(want[0]);
+    Token toks[MAX_TOKENS];
+    size_t n = lex_all(src, strlen(src), toks);
+    ASSERT_EQ(n, count + 1, "Every form is one token");
+    int all_ok = 1;
+    for (size_t i = 0; i < count; ++i) {
+        if (toks[i].type != TOKEN_NUMBER || toks[i].number != want[i]) {
+            fprintf(stderr, "numeric literal %zu decoded as %g\n", i, toks[i].number);
+            all_ok = 0;
+        }
+    }
+    ASSERT_EQ(all_ok, 1, "Numeric forms decode to their values");
+    ASSERT_EQ(toks[9].bigint, 1, "BigInt suffix is flagged");
+    ASSERT_EQ(toks[5].bigint, 0, "Plain number is not a BigInt");
+
+    const char *bad[] = {"1__0", "1_", "0x", "3in", "1.5n", "017n", "0_1", "1e", "0b12", "1._5"};
+    all_ok = 1;
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        n = lex_all(bad[i], strlen(bad[i]), toks);
+        if (n != 2 || toks[0].type != TOKEN_ERROR || strcmp(toks[0].error_kind, "InvalidNumericLiteral") != 0) {
+            fprintf(stderr, "'%s' not rejected as one token\n", bad[i]);
+            all_ok = 0;
+        }
+    }
+    ASSERT_EQ(all_ok, 1, "Malformed numbers are single InvalidNumericLiteral tokens");
+
+    char *d = lexer_bigint_decimal("0xFFFF_FFFF_FFFF_FFFF_FFFFn", 26);
+    ASSERT_STR_EQ(d, "1208925819614629174706175", "Hex BigInt to decimal");
+    free(d);
+    d = lexer_bigint_decimal("0n", 2);
+    ASSERT_STR_EQ(d, "0", "Zero BigInt");
+    free(d);
+    d = lexer_bigint_decimal("000_123n", 8);
+    ASSERT_STR_EQ(d, "123", "Leading zeros and separators dropped");
+    free(d);
+
+    // 2^1600 - 1 written with 400 hex and 1600 binary digits: more limbs
+    // than the same number of decimal digits would need
+    char big[1700];
+    memcpy(big, "0x", 2);
+    memset(big + 2, 'f', 400);
+    memcpy(big + 402, "n", 2);
+    char *hex = lexer_bigint_decimal(big, 403);
+    memcpy(big, "0b", 2);
+    memset(big + 2, '1', 1600);
+    memcpy(big + 1602, "n", 2);
+    char *bin = lexer_bigint_decimal(big, 1603);
+    ASSERT_NOT_NULL(hex, "Long hex BigInt converted");
+    ASSERT_EQ(strlen(hex), 482, "Long hex BigInt has every digit");
+    ASSERT_EQ(strncmp(hex, "44462416477094044620", 20), 0, "Long hex BigInt leading digits");
+    ASSERT_STR_EQ(hex + 462, "57296160626364645375", "Long hex BigInt trailing digits");
+    ASSERT_STR_EQ(bin, hex, "Long binary BigInt matches");
+    free(hex);
+    free(bin);
+}
+
+static void test_template_chunks(void) {
+    const char *src = "`a${ {b: `c${d}e` }.b }f${g}h` }";
+    Token toks[MAX_TOKENS];
+    size_t n = lex_all(src, strlen(src), toks);
+    static const TokenType want[] = {
+        TOKEN_TEMPLATE_HEAD, TOKEN_PUNCTUATOR, TOKEN_IDENTIFIER, TOKEN_PUNCTUATOR, TOKEN_TEMPLATE_HEAD,
+        TOKEN_IDENTIFIER, TOKEN_TEMPLATE_TAIL, TOKEN_PUNCTUATOR, TOKEN_PUNCTUATOR, TOKEN_IDENTIFIER,
+        TOKEN_TEMPLATE_MIDDLE, TOKEN_IDENTIFIER, TOKEN_TEMPLATE_TAIL, TOKEN_PUNCTUATOR, TOKEN_EOF
+    };
+    ASSERT_EQ(n, sizeof(want) / sizeof(want[0]), "Template chunk token count");
+    int types_ok = 1;
+    for (size_t i = 0; i < n && i < sizeof(want) / sizeof(want[0]); ++i) {
+        if (toks[i].type != want[i]) types_ok = 0;
+    }
+    ASSERT_EQ(types_ok, 1, "Substitutions split templates; nested braces stay punctuators");
+    ASSERT_EQ(toks[0].length, 4, "Head spans `a${");
+    ASSERT_EQ(toks[10].length, 4, "Middle spans }f${");
+    ASSERT_EQ(toks[13].punct, PUNCT_RBRACE, "Brace after the template is a punctuator");
+
+    n = lex_all("`x${y", 5, toks);
+    ASSERT_EQ(toks[0].type, TOKEN_TEMPLATE_HEAD, "Head of an unclosed substitution");
+    ASSERT_EQ(toks[2].type, TOKEN_EOF, "Then EOF");
+    n = lex_all("`x${y}z", 7, toks);
+    ASSERT_EQ(toks[2].type, TOKEN_ERROR, "Unterminated tail");
+    ASSERT_STR_EQ(toks[2].error_kind, "UnterminatedTemplate", "Tail error kind");
+    (void)n;
+
+    char deep[LEXER_MAX_TEMPLATE_DEPTH * 3 + 4];
+    size_t dl = 0;
+    for (int i = 0; i <= LEXER_MAX_TEMPLATE_DEPTH; ++i) {
+        memcpy(deep + dl, "`${", 3);
+        dl += 3;
+    }
+    n = lex_all(deep, dl, toks);
+    ASSERT_EQ(toks[LEXER_MAX_TEMPLATE_DEPTH].type, TOKEN_ERROR, "Nesting past the limit is an error");
+    ASSERT_STR_EQ(toks[LEXER_MAX_TEMPLATE_DEPTH].error_kind, "TemplateNestingTooDeep", "Nesting error kind");
+
+    Lexer lx;
+    lexer_init(&lx, "'plain' 'es\\c' `t` `\\n${x}`", 28);
+    ASSERT_EQ(lexer_next(&lx).escaped, 0, "Plain string is not escaped");
+    ASSERT_EQ(lexer_next(&lx).escaped, 1, "Backslash marks the string escaped");
+    ASSERT_EQ(lexer_next(&lx).escaped, 0, "Plain template");
+    ASSERT_EQ(lexer_next(&lx).escaped, 1, "Escaped template head");
+}
+
+static void test_cook_string(void) {
+    static const struct { const char *raw; const char *cooked; size_t len; } cases[] = {
+        {"plain", "plain", 5},
+        {"a\\nb\\t\\\\\\'", "a\nb\t\\'", 6},
+        {"\\x41\\u0042\\u{43}", "ABC", 3},
+        {"\\u00e9\\u{1F600}", "\xc3\xa9\xf0\x9f\x98\x80", 6},
+        {"\\uD83D\\uDE00", "\xf0\x9f\x98\x80", 4},
+        {"x\\\ny\\\r\nz", "xyz", 3},
+        {"\\0\\101\\7\\8", "\0A\a8", 4},
+        {"\\q\\$", "q$", 2},
+    };
+    char out[64];
+    int ok = 1;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        size_t n = lexer_cook_string(cases[i].raw, strlen(cases[i].raw), out);
+        if (n != cases[i].len || memcmp(out, cases[i].cooked, n) != 0) {
+            fprintf(stderr, "cooking '%s' failed\n", cases[i].raw);
+            ok = 0;
+        }
+    }
+    ASSERT_EQ(ok, 1, "Escapes cook to their values");
+    ASSERT_EQ(lexer_cook_string("\\x4", 3, out), LEXER_BAD_ESCAPE, "Short \\x escape is malformed");
+    ASSERT_EQ(lexer_cook_string("\\u{110000}", 10, out), LEXER_BAD_ESCAPE, "Code point past U+10FFFF");
+    ASSERT_EQ(lexer_cook_string("\\u{}", 4, out), LEXER_BAD_ESCAPE, "Empty \\u{}");
+    char inplace[] = "a\\x62c";
+    ASSERT_EQ(lexer_cook_string(inplace, 6, inplace), 3, "Cooking in place");
+    ASSERT_EQ(memcmp(inplace, "abc", 3), 0, "In-place result");
+}
+
+static void test_unicode_identifiers(void) {
+    // café π_1 日本語 \u0061b \u{1D49C}x a\u200Db if \u0069f
+    const char *src = "caf\xc3\xa9 \xcf\x80_1 \xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e \\u0061b "
+                      "\\u{1D49C}x a\\u200Db if \\u0069f";
+    Token toks[MAX_TOKENS];
+    size_t n = lex_all(src, strlen(src), toks);
+    ASSERT_EQ(n, 9, "Eight identifiers and EOF");
+    int all_ids = 1;
+    for (size_t i = 0; i + 1 < n; ++i) {
+        if (toks[i].type != TOKEN_IDENTIFIER) all_ids = 0;
+    }
+    ASSERT_EQ(all_ids, 1, "Non-ASCII letters and escapes form identifiers");
+    ASSERT_EQ(toks[0].length, 5, "UTF-8 letter continues an identifier");
+    ASSERT_EQ(toks[2].length, 9, "CJK identifier");
+    ASSERT_EQ(toks[0].escaped, 0, "Plain identifier is not escaped");
+    ASSERT_EQ(toks[3].escaped, 1, "Escaped identifier is flagged");
+    ASSERT_EQ(toks[6].kw, KW_IF, "Plain keyword");
+    ASSERT_EQ(toks[7].kw, KW_NONE, "Escaped keyword is an identifier");
+
+    // not identifier characters: NBSP, an emoji, a bad escape, a non-ID escape
+    n = lex_all("\xc2\xa0", 2, toks);
+    ASSERT_EQ(toks[0].type == TOKEN_IDENTIFIER, 0, "NBSP does not start an identifier");
+    n = lex_all("a\xf0\x9f\x98\x80", 5, toks);
+    ASSERT_EQ(toks[0].length, 1, "Emoji ends the identifier");
+    n = lex_all("a\\u00", 6, toks);
+    ASSERT_EQ(toks[0].type, TOKEN_ERROR, "Short \\u escape");
+    ASSERT_STR_EQ(toks[0].error_kind, "InvalidIdentifierEscape", "Escape error kind");
+    n = lex_all("\\u0031", 6, toks);
+    ASSERT_EQ(toks[0].type, TOKEN_ERROR, "Digit escape cannot start an identifier");
+    n = lex_all("3\xc3\xa9", 3, toks);
+    ASSERT_EQ(toks[0].type, TOKEN_ERROR, "Identifier directly after a number");
+    (void)n;
+
+    ASSERT_EQ(lexer_is_id_start(0x3B1), 1, "Greek alpha is ID_Start");
+    ASSERT_EQ(lexer_is_id_start(0x661), 0, "Arabic-Indic digit is not ID_Start");
+    ASSERT_EQ(lexer_is_id_continue(0x661), 1, "but is ID_Continue");
+    ASSERT_EQ(lexer_is_id_continue(0x300), 1, "Combining mark continues");
+    ASSERT_EQ(lexer_is_id_start(0x2E2F), 0, "Pattern_Syntax letter excluded");
+    ASSERT_EQ(lexer_is_id_start(0x1F600), 0, "Emoji is not ID_Start");
+    ASSERT_EQ(lexer_is_id_start('$'), 1, "$ starts identifiers");
+}
+
+static int same_double(double a, double b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// Decimal decoding must round exactly like strtod.
+static void test_decimal_decoding_matches_strtod(void) {
+    static const char *edge[] = {
+        "9007199254740993", "9007199254740992.5", "1e23", "5e-324", "2.4703282292062327e-324",
+        "1.7976931348623157e308", "1.7976931348623159e308", "2.2250738585072011e-308",
+        "2.2250738585072014e-308", "0.1", "0.30000000000000004", "123456789012345678901234567890",
+        "7.038531e-26", "1e-400", "1e400", "4.9406564584124654e-324", "18446744073709551615",
+        "1844674407370955161600000e-5", "0.000000000000000000000000000000000001"
+    };
+    int all_ok = 1;
+    for (size_t i = 0; i < sizeof(edge) / sizeof(edge[0]); ++i) {
+        if (!same_double(lexer_number_value(edge[i], strlen(edge[i])), strtod(edge[i], NULL))) {
+            fprintf(stderr, "decimal '%s' differs from strtod\n", edge[i]);
+            all_ok = 0;
+        }
+    }
+    unsigned r = 12345;
+    char buf[64];
+    for (int iter = 0; iter < 200000 && all_ok; ++iter) {
+        size_t n = 0;
+        r = r * 1103515245u + 12345u;
+        int digits = 1 + (int)((r >> 16) % 24);
+        int dot = (int)((r >> 8) % (unsigned)(digits + 1));
+        for (int k = 0; k < digits; ++k) {
+            if (k == dot && k > 0) buf[n++] = '.';
+            r = r * 1103515245u + 12345u;
+            // no leading zero: 0421 is a legacy octal literal
+            buf[n++] = (char)((k == 0 ? '1' : '0') + (r >> 16) % (k == 0 ? 9 : 10));
+        }
+        r = r * 1103515245u + 12345u;
+        if ((r >> 16) % 2) n += (size_t)sprintf(buf + n, "e%d", (int)((r >> 4) % 700) - 350);
+        buf[n] = '\0';
+        if (!same_double(lexer_number_value(buf, n), strtod(buf, NULL))) {
+            fprintf(stderr, "decimal '%s' differs from strtod\n", buf);
+            all_ok = 0;
+        }
+    }
+    ASSERT_EQ(all_ok, 1, "Decimal decoding rounds like strtod");
+
+    all_ok = 1;
+    for (int iter = 0; iter < 20000 && all_ok; ++iter) {
+        size_t n = (size_t)sprintf(buf, "0x");
+        r = r * 1103515245u + 12345u;
+        int digits = 1 + (int)((r >> 16) % 30);
+        for (int k = 0; k < digits; ++k) {
+            r = r * 1103515245u + 12345u;
+            buf[n++] = "0123456789abcdef"[(r >> 16) % 16];
+        }
+        buf[n] = '\0';
+        if (!same_double(lexer_number_value(buf, n), strtod(buf, NULL))) {
+            fprintf(stderr, "hex '%s' differs from strtod\n", buf);
+            all_ok = 0;
+        }
+    }
+    ASSERT_EQ(all_ok, 1, "Hex decoding rounds like strtod");
+}
+
+int main(void) {
+    test_backend_available();
+    test_backends_agree();
+    test_positions_after_long_runs();
+    test_line_index();
+    test_embedded_nul_stops_string();
+    test_keyword_ids();
+    test_punct_ids();
+    test_all_punctuators_single_token();
+    test_maximal_munch();
+    test_tokenize_all_matches_lexer_next();
+    test_tokenize_parallel_matches_sequential();
+    test_relex_matches_full_lex();
+    test_stream_lexer();
+    test_numeric_forms();
+    test_template_chunks();
+    test_cook_string();
+    test_unicode_identifiers();
+    test_decimal_decoding_matches_strtod();
+    TEST_SUMMARY();
+}
@@ -10,11 +10,9 @@ void test_lexer_simple(void) {
     
     Token t1 = lexer_next(&lx);
     ASSERT_EQ(t1.type, TOKEN_IDENTIFIER, "First token is identifier");
-    token_free(&t1);
     
     Token t2 = lexer_next(&lx);
     ASSERT_EQ(t2.type, TOKEN_IDENTIFIER, "Second token is identifier");
-    token_free(&t2);
 }
 
 int main(void) {
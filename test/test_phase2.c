@@ -185,8 +185,8 @@ int test_super_expression() {
 int test_ast_node_constructors() {
     TEST("Phase 2 AST node constructors");
     
-    Position s = {1, 1};
-    Position e = {1, 10};
+    SrcOffset s = 0;
+    SrcOffset e = 9;
     
     // Arrow function
     AstNode *arrow = ast_arrow_function_expression(0, s, e);
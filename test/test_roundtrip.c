@@ -62,26 +62,26 @@ static int ast_nodes_equal(const AstNode *a, const AstNode *b) {
             UpdateExpression *ua = (UpdateExpression *)a->data;
             UpdateExpression *ub = (UpdateExpression *)b->data;
             if (ua->prefix != ub->prefix) return 0;
-            if (!str_eq(ua->operator, ub->operator)) return 0;
+            if (ua->operator != ub->operator) return 0;
             return ast_nodes_equal(ua->argument, ub->argument);
         }
         case AST_UnaryExpression: {
             UnaryExpression *ua = (UnaryExpression *)a->data;
             UnaryExpression *ub = (UnaryExpression *)b->data;
             if (ua->prefix != ub->prefix) return 0;
-            if (!str_eq(ua->operator, ub->operator)) return 0;
+            if (ua->operator != ub->operator) return 0;
             return ast_nodes_equal(ua->argument, ub->argument);
         }
         case AST_BinaryExpression: {
             BinaryExpression *ba = (BinaryExpression *)a->data;
             BinaryExpression *bb = (BinaryExpression *)b->data;
-            if (!str_eq(ba->operator, bb->operator)) return 0;
+            if (ba->operator != bb->operator) return 0;
             return ast_nodes_equal(ba->left, bb->left) && ast_nodes_equal(ba->right, bb->right);
         }
         case AST_AssignmentExpression: {
             AssignmentExpression *aa = (AssignmentExpression *)a->data;
             AssignmentExpression *ab = (AssignmentExpression *)b->data;
-            if (!str_eq(aa->operator, ab->operator)) return 0;
+            if (aa->operator != ab->operator) return 0;
             return ast_nodes_equal(aa->left, ab->left) && ast_nodes_equal(aa->right, ab->right);
         }
         case AST_BlockStatement: {
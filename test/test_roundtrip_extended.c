@@ -460,8 +460,8 @@ char *ast_to_json(const AstNode *node) {
     }
     
     snprintf(buf, 512, 
-        "{\"type\": \"%s\", \"position\": {\"line\": %d, \"column\": %d}}",
-        type_name, node->start.line, node->start.column);
+        "{\"type\": \"%s\", \"position\": {\"start\": %u, \"end\": %u}}",
+        type_name, (unsigned)node->start, (unsigned)node->end);
     
     return buf;
 }
@@ -471,9 +471,9 @@ char *ast_to_string(const AstNode *node, int indent) {
     char *buf = malloc(4096);
     if (!buf) return NULL;
     
-    int written = snprintf(buf, 4096, "%*sNode(type=%d, pos=(%d,%d))\n",
+    int written = snprintf(buf, 4096, "%*sNode(type=%d, pos=(%u,%u))\n",
                           indent, "", node->type, 
-                          node->start.line, node->start.column);
+                          (unsigned)node->start, (unsigned)node->end);
     
     if (written >= 4096) {
         // Buffer too small
@@ -1,7 +1,9 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "quickjsflow/parser.h"
 #include "quickjsflow/scope.h"
+#include "quickjsflow/plugin.h"
 #include "test_framework.h"
 
 static AstNode *parse_source(const char *src) {
@@ -224,6 +226,120 @@ static void test_implicit_globals(void) {
     ast_free(root);
 }
 
+static void test_atom_table(void) {
+    AtomTable *t = atom_table_new();
+    Atom foo = atom_intern(t, "foo", 3);
+    ASSERT_EQ(foo != ATOM_NONE, 1, "interned");
+    ASSERT_EQ(atom_intern(t, "foobar", 3), foo, "same text, same atom");
+    ASSERT_EQ(atom_lookup(t, "bar", 3), ATOM_NONE, "lookup does not insert");
+    char name[16];
+    for (int i = 0; i < 5000; ++i) {
+        snprintf(name, sizeof(name), "n%d", i);
+        atom_intern(t, name, strlen(name));
+    }
+    ASSERT_EQ(atom_count(t), 5001, "table grows");
+    ASSERT_EQ(atom_lookup(t, "n4321", 5) != ATOM_NONE, 1, "found after rehash");
+    ASSERT_STR_EQ(atom_name(t, foo), "foo", "name stable across growth");
+    ASSERT_EQ(atom_length(t, foo), 3, "length");
+    atom_table_free(t);
+}
+
+static void test_names_are_atoms(void) {
+    AstNode *root = parse_source("let x = 1; function f(y) { return x + y; } f(x);");
+    ScopeManager sm;
+    scope_manager_init(&sm);
+    scope_analyze(&sm, root, 0);
+    ASSERT_EQ(sm.atoms == ast_arena_atoms(root->arena), 1, "analysis reuses the parse atoms");
+
+    Binding *x = find_binding(sm.root, "x");
+    Reference *ref = find_reference(sm.root, "x", 0);
+    ASSERT_EQ(ref->atom, x->atom, "reference and binding share an atom");
+    ASSERT_EQ(scope_resolve_atom(sm.root->children.items[0], x->atom) == x, 1, "resolve by atom");
+
+    // names point at the one interned copy
+    Program *pr = (Program *)root->data;
+    VariableDeclaration *vd = (VariableDeclaration *)pr->body.items[0]->data;
+    VariableDeclarator *decl = (VariableDeclarator *)vd->declarations.items[0]->data;
+    Identifier *id = (Identifier *)decl->id->data;
+    ASSERT_EQ(id->name == x->name, 1, "binding name not duplicated");
+    ASSERT_EQ(id->name == ref->name, 1, "reference name not duplicated");
+    scope_manager_free(&sm);
+
+    // heap trees get a private table
+    AstNode *heap = ast_clone(root);
+    scope_manager_init(&sm);
+    scope_analyze(&sm, heap, 0);
+    ASSERT_EQ(sm.owns_atoms, 1, "heap tree analyzed with its own atoms");
+    Binding *hx = find_binding(sm.root, "x");
+    ASSERT_NOT_NULL(hx, "heap binding found");
+    ASSERT_EQ(find_reference(sm.root, "x", 0)->resolved == hx, 1, "heap reference resolves");
+    scope_manager_free(&sm);
+    ast_free(heap);
+    ast_free(root);
+}
+
+static const char *if_test_name(AstNode *root, size_t i) {
+    Program *pr = (Program *)root->data;
+    IfStatement *st = (IfStatement *)pr->body.items[i]->data;
+    return ((Identifier *)st->test->data)->name;
+}
+
+static void test_rename_across_trees(void) {
+    Plugin *rename = plugin_rename_identifier("x", "renamed");
+    AstNode *first = parse_source("if (x) {}");
+    first = plugin_apply(rename, first, NULL);
+    ASSERT_STR_EQ(if_test_name(first, 0), "renamed", "first tree renamed");
+    ast_free(first);
+
+    // the next arena may reuse the freed one's address, with other atoms
+    AstNode *second = parse_source("if (zz) {} if (x) {}");
+    second = plugin_apply(rename, second, NULL);
+    ASSERT_STR_EQ(if_test_name(second, 0), "zz", "other name kept");
+    ASSERT_STR_EQ(if_test_name(second, 1), "renamed", "second tree renamed");
+    ast_free(second);
+}
+
+static char *scope_json(const Scope *scope) {
+    JsonWriter w;
+    json_writer_init_memory(&w);
+    scope_write_json(&w, scope);
+    return json_writer_take(&w, NULL);
+}
+
+// The analysis over compact records gives the pointer tree's scope tree,
+// positions included.
+static void test_compact_matches_tree(void) {
+    static const struct { const char *src; int is_module; } cases[] = {
+        { "var a = 1; let b = a + c; function f(p, q) { var r = p; return q + r + b; }", 0 },
+        { "x = 1; { y; let y = 2; const z = y; } ++w; o[k] = o.m;", 0 },
+        { "for (let i = 0; i < n; i++) { total = total + i; } while (i) { i--; }", 0 },
+        { "try { risky(); } catch (e) { log(e); } finally { done = 1; }", 0 },
+        { "switch (v) { case 1: let s = v; break; default: t = s; }", 0 },
+        { "var g = function h(a) { return h(a - 1); }; var o = { [key]: val, plain: g };", 0 },
+        { "import { a as b } from 'm'; export const c = b; export { c }; export default c;", 1 },
+        { "if (a) { b(); } else { do { c = [d, e]; } while (!f); }", 0 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        AstNode *root = parse_source(cases[i].src);
+        CompactAst *ca = compact_from_ast(root);
+        ASSERT_NOT_NULL(ca, "compact form built");
+        ScopeManager tree, recs;
+        scope_manager_init(&tree);
+        scope_manager_init(&recs);
+        ASSERT_EQ(scope_analyze(&tree, root, cases[i].is_module), 0, "tree analyzed");
+        ASSERT_EQ(scope_analyze_compact(&recs, ca, cases[i].is_module), 0, "records analyzed");
+        char *expected = scope_json(tree.root);
+        char *actual = scope_json(recs.root);
+        ASSERT_STR_EQ(actual, expected, cases[i].src);
+        free(expected);
+        free(actual);
+        scope_manager_free(&tree);
+        scope_manager_free(&recs);
+        compact_free(ca);
+        ast_free(root);
+    }
+}
+
 int main(void) {
     test_global_bindings();
     test_function_scopes();
@@ -232,5 +348,9 @@ int main(void) {
     test_for_scope_and_hoisting();
     test_shadowing_detection();
     test_implicit_globals();
+    test_atom_table();
+    test_names_are_atoms();
+    test_rename_across_trees();
+    test_compact_matches_tree();
     TEST_SUMMARY();
 }
@@ -1,7 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "quickjsflow/parser.h"
 #include "quickjsflow/ast.h"
+#include "quickjsflow/codegen.h"
+#include "quickjsflow/scope.h"
 #include "test_framework.h"
 
 static Program *parse_prog(const char *src, AstNode **out_root) {
@@ -65,10 +68,330 @@ static void test_return_break_continue(void) {
     ast_free(root);
 }
 
+static AstNode *parse_lazy(const char *src) {
+    Parser p; parser_init(&p, src, strlen(src));
+    p.lazy_functions = 1;
+    return parse_program(&p);
+}
+
+static BlockStatement *function_block(AstNode *fn) {
+    return (BlockStatement *)((FunctionBody *)fn->data)->body->data;
+}
+
+static void test_lazy_function_bodies(void) {
+    const char *src =
+        "function outer(a) {\n"
+        "  // inside\n"
+        "  var t = `x${ { k: a }.k }y`;\n"
+        "  function inner() { return { b: t }; }\n"
+        "  return inner;\n"
+        "}\n"
+        "var f = (x) => { return x + 1; };\n"
+        "outer(1);\n";
+    AstNode *eager = NULL;
+    parse_prog(src, &eager);
+    AstNode *lazy = parse_lazy(src);
+    Program *pr = (Program *)lazy->data;
+    ASSERT_EQ(pr->body.count, 3, "top level fully parsed");
+    AstNode *outer = pr->body.items[0];
+    BlockStatement *ob = function_block(outer);
+    ASSERT_EQ(ob->body.count, 0, "body left unparsed");
+    ASSERT_EQ(ob->lazy_source == src, 1, "body keeps its source");
+    ASSERT_EQ(((FunctionBody *)outer->data)->body->end, (SrcOffset)(strstr(src, "}\nvar") - src + 1), "body range recorded");
+    ASSERT_EQ(pr->comment_count, 1, "comments inside lazy bodies recorded");
+    ASSERT_EQ(ast_arena_bytes(lazy->arena) < ast_arena_bytes(eager->arena), 1, "lazy tree is smaller");
+
+    ASSERT_EQ(ast_materialize_body(outer), 1, "materialized on demand");
+    ASSERT_EQ(ast_materialize_body(outer), 0, "only once");
+    ASSERT_EQ(ob->body.count, 3, "statements parsed");
+    ASSERT_EQ(ob->lazy_source == NULL, 1, "no longer lazy");
+    ASSERT_EQ(function_block(ob->body.items[1])->lazy_source == src, 1, "nested function stays lazy");
+
+    // consumers materialize what they touch: codegen matches the eager tree
+    CodegenResult a = codegen_generate(eager, NULL);
+    CodegenResult b = codegen_generate(lazy, NULL);
+    ASSERT_STR_EQ(b.code, a.code, "codegen identical to eager parse");
+    codegen_result_free(&a);
+    codegen_result_free(&b);
+    ast_free(lazy);
+
+    lazy = parse_lazy(src);
+    ScopeManager sm;
+    scope_manager_init(&sm);
+    scope_analyze(&sm, lazy, 0);
+    ASSERT_EQ(sm.root->children.count, 1, "function scope found");
+    Scope *fs = sm.root->children.items[0];
+    ASSERT_EQ(fs->children.count, 1, "nested function scope found");
+    ASSERT_EQ(scope_lookup_local(fs, "t") != NULL, 1, "binding inside a lazy body");
+    scope_manager_free(&sm);
+    ast_free(lazy);
+    ast_free(eager);
+}
+
+static void test_lazy_body_errors(void) {
+    const char *src = "x = ;\nfunction f() { var = ; /* c */ }\ny = ;\n";
+    AstNode *eager = NULL;
+    Program *ep = parse_prog(src, &eager);
+    ASSERT_EQ(ep->diagnostic_count, 3, "eager parse reports the body's error");
+    AstNode *lazy = parse_lazy(src);
+    Program *pr = (Program *)lazy->data;
+    ASSERT_EQ(pr->diagnostic_count, 2, "skipped body not checked yet");
+    ASSERT_EQ(ast_materialize_body(pr->body.items[1]), 1, "materialized");
+    ASSERT_EQ(pr->diagnostic_count, ep->diagnostic_count, "body error joins the Program's");
+    for (size_t i = 0; i < pr->diagnostic_count && i < ep->diagnostic_count; ++i) {
+        ASSERT_STR_EQ(pr->diagnostics[i].kind, ep->diagnostics[i].kind, "same kind");
+        ASSERT_EQ(pr->diagnostics[i].start, ep->diagnostics[i].start, "in source order");
+    }
+    ASSERT_EQ(pr->comment_count, ep->comment_count, "comments recorded once");
+    ast_free(lazy);
+    ast_free(eager);
+
+    // the printer materializes the body itself; its error still shows
+    lazy = parse_lazy("function f() { x = p?.q; }");
+    ASSERT_EQ(((Program *)lazy->data)->diagnostic_count, 0, "nothing reported before printing");
+    JsonWriter w;
+    json_writer_init_memory(&w);
+    ast_write_json(&w, lazy);
+    char *json = json_writer_take(&w, NULL);
+    ASSERT_EQ(strstr(json, "\"diagnostics\":[{") != NULL, 1, "first dump lists the body's error");
+    free(json);
+    ast_free(lazy);
+
+    // an unterminated body ends at the end of the input either way
+    const char *open = "export default function () { return [1, , 3, ...xs]'?";
+    parse_prog(open, &eager);
+    lazy = parse_lazy(open);
+    AstNode *ef = ((ExportDefaultDeclaration *)((Program *)eager->data)->body.items[0]->data)->declaration;
+    AstNode *lf = ((ExportDefaultDeclaration *)((Program *)lazy->data)->body.items[0]->data)->declaration;
+    ASSERT_EQ(((FunctionBody *)ef->data)->body->end, (SrcOffset)strlen(open), "eager body runs to the end");
+    ASSERT_EQ(((FunctionBody *)lf->data)->body->end, (SrcOffset)strlen(open), "skipped body runs to the end");
+    ASSERT_EQ(ast_materialize_body(lf), 1, "materialized");
+    ASSERT_EQ(((FunctionBody *)lf->data)->body->end, ((FunctionBody *)ef->data)->body->end, "materialized body keeps it");
+    ASSERT_EQ(lf->end, ef->end, "same function range");
+    ast_free(lazy);
+    ast_free(eager);
+}
+
+// `open` n times, then `mid`, then `close` n times
+static char *nested(const char *open, size_t n, const char *mid, const char *close) {
+    size_t lo = strlen(open), lm = strlen(mid), lc = strlen(close);
+    char *src = (char *)malloc((lo + lc) * n + lm + 1);
+    char *q = src;
+    for (size_t i = 0; i < n; ++i) { memcpy(q, open, lo); q += lo; }
+    memcpy(q, mid, lm); q += lm;
+    for (size_t i = 0; i < n; ++i) { memcpy(q, close, lc); q += lc; }
+    *q = '\0';
+    return src;
+}
+
+// Parse `src` and return the first statement, counting how many times
+// `step` can descend from it.
+static size_t chain_depth(AstNode *n, AstNode *(*step)(AstNode *)) {
+    size_t depth = 0;
+    while ((n = step(n)) != NULL) depth++;
+    return depth;
+}
+
+static AstNode *into_operand(AstNode *n) {
+    if (n->type == AST_ExpressionStatement) return ((ExpressionStatement *)n->data)->expression;
+    if (n->type == AST_BinaryExpression) return ((BinaryExpression *)n->data)->right;
+    if (n->type == AST_UnaryExpression) return ((UnaryExpression *)n->data)->argument;
+    if (n->type == AST_AssignmentExpression) return ((AssignmentExpression *)n->data)->right;
+    return NULL;
+}
+
+static AstNode *into_callback(AstNode *n) {
+    if (n->type == AST_ExpressionStatement) n = ((ExpressionStatement *)n->data)->expression;
+    if (n->type != AST_CallExpression) return NULL;
+    AstNode *fn = ((CallExpression *)n->data)->arguments.items[0];
+    BlockStatement *body = (BlockStatement *)((FunctionBody *)fn->data)->body->data;
+    return body->body.count ? body->body.items[0] : NULL;
+}
+
+static AstNode *into_consequent(AstNode *n) {
+    return n->type == AST_IfStatement ? ((IfStatement *)n->data)->consequent : NULL;
+}
+
+static AstNode *into_block(AstNode *n) {
+    if (n->type != AST_BlockStatement) return NULL;
+    BlockStatement *bs = (BlockStatement *)n->data;
+    return bs->body.count ? bs->body.items[0] : NULL;
+}
+
+static AstNode *into_array_pattern(AstNode *n) {
+    if (n->type == AST_ExpressionStatement) {
+        AstNode *arrow = ((AssignmentExpression *)((ExpressionStatement *)n->data)->expression->data)->right;
+        return ((ArrowFunctionExpression *)arrow->data)->params.items[0];
+    }
+    if (n->type != AST_ArrayPattern) return NULL;
+    ArrayPattern *ap = (ArrayPattern *)n->data;
+    return ap->elements.items[0]->type == AST_ArrayPattern ? ap->elements.items[0] : NULL;
+}
+
+static void test_deep_nesting(void) {
+    // each of these overflows a plain recursive descent on an 8 MiB stack
+    const size_t n = 100000;
+    char *src = nested("(", n, "x", ")");
+    AstNode *root = NULL;
+    Program *pr = parse_prog(src, &root);
+    ASSERT_EQ(pr->body.count, 1, "deep parentheses parsed");
+    ASSERT_EQ(chain_depth(pr->body.items[0], into_operand), 1, "parentheses leave no nodes");
+    ast_free(root);
+    free(src);
+
+    src = nested("!", n, "x", "");
+    pr = parse_prog(src, &root);
+    ASSERT_EQ(chain_depth(pr->body.items[0], into_operand), n + 1, "long prefix chain");
+    ast_free(root);
+    free(src);
+
+    src = nested("a = ", n, "x", "");
+    pr = parse_prog(src, &root);
+    ASSERT_EQ(chain_depth(pr->body.items[0], into_operand), n + 1, "long assignment chain");
+    ast_free(root);
+    free(src);
+
+    src = nested("x ** ", n, "x", "");
+    pr = parse_prog(src, &root);
+    ASSERT_EQ(chain_depth(pr->body.items[0], into_operand), n + 1, "long right-associative chain");
+    ast_free(root);
+    free(src);
+
+    src = nested("if (x) ", n, "y;", "");
+    pr = parse_prog(src, &root);
+    ASSERT_EQ(pr->body.count, 1, "deep statements parsed");
+    ASSERT_EQ(chain_depth(pr->body.items[0], into_consequent), n, "statement nesting kept");
+    ast_free(root);
+    free(src);
+
+    src = nested("{", n, "", "}");
+    pr = parse_prog(src, &root);
+    ASSERT_EQ(pr->body.count, 1, "deep blocks parsed");
+    ASSERT_EQ(chain_depth(pr->body.items[0], into_block), n - 1, "block nesting kept");
+    ast_free(root);
+    free(src);
+
+    src = nested("f(function () { ", 20000, "", "});");
+    pr = parse_prog(src, &root);
+    ASSERT_EQ(pr->body.count, 1, "deep callbacks parsed");
+    ASSERT_EQ(chain_depth(pr->body.items[0], into_callback), 19999, "callback nesting kept");
+    ast_free(root);
+    free(src);
+
+    char *pattern = nested("[", n, "x", "]");
+    src = nested("f = (", 1, pattern, ") => x;");
+    pr = parse_prog(src, &root);
+    ASSERT_EQ(chain_depth(pr->body.items[0], into_array_pattern), n, "deep parameter pattern");
+    ast_free(root);
+    free(src);
+    free(pattern);
+}
+
+static void test_error_recovery(void) {
+    const char *src =
+        "let = 5;\n"
+        "foo(1, ;\n"
+        "if (x { y(); }\n"
+        "bar();\n"
+        "z = ) + 2;\n"
+        "function f(a, 1, b) { return [1 2, 3]; }\n"
+        "ok({a: 1, b 2, c: 3});\n";
+    AstNode *root = NULL;
+    Program *pr = parse_prog(src, &root);
+    const char *kinds[] = {"ExpectedIdentifier", "UnexpectedToken", "ExpectedCloseParen",
+                           "UnexpectedToken", "ExpectedParam", "ExpectedCommaOrCloseBracket", "ExpectedColon"};
+    size_t nkinds = sizeof(kinds) / sizeof(kinds[0]);
+    ASSERT_EQ(pr->diagnostic_count, nkinds, "every error reported once");
+    for (size_t i = 0; i < nkinds && i < pr->diagnostic_count; ++i) {
+        ASSERT_STR_EQ(pr->diagnostics[i].kind, kinds[i], kinds[i]);
+    }
+    ASSERT_EQ(ast_position(root, pr->diagnostics[2].start).line, 3, "missing paren on line 3");
+
+    // the statements between the errors survive
+    ASSERT_EQ(pr->body.count, 7, "one node per statement");
+    ASSERT_EQ(pr->body.items[3]->type, AST_ExpressionStatement, "bar() kept");
+    ASSERT_EQ(pr->body.items[5]->type, AST_FunctionDeclaration, "function kept");
+    FunctionBody *fb = (FunctionBody *)pr->body.items[5]->data;
+    ASSERT_EQ(fb->params.count, 3, "params around the bad one kept");
+    ASSERT_EQ(((BlockStatement *)fb->body->data)->body.count, 1, "function body parsed");
+    CallExpression *ok = (CallExpression *)((ExpressionStatement *)pr->body.items[6]->data)->expression->data;
+    ASSERT_EQ(ok->arguments.count, 1, "call recovered inside its object argument");
+    ast_free(root);
+
+    // unterminated constructs end at EOF instead of spinning on it
+    pr = parse_prog("class t{", &root);
+    ASSERT_EQ(pr->diagnostic_count, 1, "unterminated class reported");
+    ASSERT_STR_EQ(pr->diagnostics[0].kind, "ExpectedCloseBrace", "class body needs its brace");
+    ast_free(root);
+
+    pr = parse_prog("a = 1;\nb = [1, 2];\n", &root);
+    ASSERT_EQ(pr->diagnostic_count, 0, "valid source has no diagnostics");
+    ast_free(root);
+}
+
+static void test_parse_check(void) {
+    const char *bad =
+        "let = 5;\n"
+        "foo(1, ;\n"
+        "if (x { y(); }\n"
+        "bar();\n"
+        "z = ) + 2;\n"
+        "function f(a, 1, b) { return [1 2, 3]; }\n"
+        "ok({a: 1, b 2, c: 3});\n";
+    AstNode *root = NULL;
+    Program *pr = parse_prog(bad, &root);
+    Diagnostic diags[16];
+    Parser p;
+    parser_init(&p, bad, strlen(bad));
+    size_t n = parse_check(&p, diags, 16);
+    ASSERT_EQ(n, pr->diagnostic_count, "same errors as a full parse");
+    for (size_t i = 0; i < n && i < pr->diagnostic_count; ++i) {
+        ASSERT_STR_EQ(diags[i].kind, pr->diagnostics[i].kind, pr->diagnostics[i].kind);
+        ASSERT_EQ(diags[i].start, pr->diagnostics[i].start, "same position");
+    }
+    ast_free(root);
+
+    parser_init(&p, bad, strlen(bad));
+    ASSERT_EQ(parse_check(&p, diags, 2), n, "errors past the buffer are still counted");
+    parser_init(&p, bad, strlen(bad));
+    ASSERT_EQ(parse_check(&p, NULL, 0), n, "count without a buffer");
+
+    const char *good =
+        "// comment\n"
+        "const f = async (a, {b, c: [d] = []}, ...rest) => { await g(`t${a}`); return 'x\\n'; };\n"
+        "class C extends D { m() { return this.x + 1; } }\n"
+        "for (let i = 0; i < 10; i++) { switch (i) { case 1: break; default: continue; } }\n";
+    parser_init(&p, good, strlen(good));
+    ASSERT_EQ(parse_check(&p, diags, 16), 0, "valid source checks clean");
+
+    // deep enough to recycle the scratch memory and switch stack segments
+    char *src = nested("[", 100000, "x", "]");
+    parser_init(&p, src, strlen(src));
+    ASSERT_EQ(parse_check(&p, diags, 16), 0, "deep nesting checks clean");
+    free(src);
+    // a call whose arguments outgrow the scratch memory
+    const char *arg = "a + b, ";
+    size_t args = 100000, la = strlen(arg);
+    src = (char *)malloc(args * la + 16);
+    strcpy(src, "f(");
+    for (size_t i = 0; i < args; ++i) memcpy(src + 2 + i * la, arg, la);
+    strcpy(src + 2 + args * la, "x)++;");
+    pr = parse_prog(src, &root);
+    parser_init(&p, src, strlen(src));
+    ASSERT_EQ(parse_check(&p, NULL, 0), pr->diagnostic_count, "a long call is still not an update target");
+    ast_free(root);
+    free(src);
+}
+
 int main(void) {
     test_if_else();
     test_while_and_do_while();
     test_for_with_init_and_update();
     test_return_break_continue();
+    test_lazy_function_bodies();
+    test_lazy_body_errors();
+    test_deep_nesting();
+    test_error_recovery();
+    test_parse_check();
     TEST_SUMMARY();
 }